@@ -0,0 +1,67 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "Variants.glsl"
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) flat in uint inMaterialIndex;
+
+layout(location = 0) out vec4 outColor;
+
+const vec3 kLightDirections[kMaxLights] = vec3[](
+    vec3( 0.00,  0.80, -0.60),
+    vec3(-0.70,  0.20, -0.70),
+    vec3( 0.70,  0.20, -0.70),
+    vec3( 0.00, -0.60, -0.80)
+);
+const vec3 kLightColors[kMaxLights] = vec3[](
+    vec3(0.90, 0.85, 0.80),
+    vec3(0.25, 0.30, 0.40),
+    vec3(0.40, 0.30, 0.25),
+    vec3(0.15, 0.15, 0.15)
+);
+const vec3 kAmbient = vec3(0.05);
+
+// Must match MeshMaterial in Include/Mesh.hpp.
+struct Material
+{
+    vec4    baseColor;          // a = dissolve
+    vec4    emissive;
+    vec4    specular;           // w = shininess
+    uint    baseColorTexture;
+    uint    pad[3];
+};
+
+// Every material at once. Draws pick theirs by index, so switching materials
+// never switches descriptor sets.
+layout(set = 0, binding = 1, std430) readonly buffer Materials
+{
+    Material materials[];
+};
+
+void main()
+{
+    // We don't have normals yet, so use the face normal. Lighting is
+    // two-sided, since we don't know which way the faces are wound.
+    vec3 normal = normalize(cross(dFdx(inPosition), dFdy(inPosition)));
+
+    // kLightCount is a specialization constant, so this loop is unrolled
+    // and has no uniform branches left in it.
+    vec3 light = kAmbient;
+    for (uint i = 0; i < min(kLightCount, kMaxLights); i += 1) {
+        float nDotL = abs(dot(normal, normalize(kLightDirections[i])));
+        light += kLightColors[i] * nDotL;
+    }
+
+    // Dissolve isn't used. Everything is opaque, which the depth prepass
+    // relies on.
+    Material material = materials[inMaterialIndex];
+    vec3 rgb   = mesh.baseColor.rgb * material.baseColor.rgb * light +
+                 material.emissive.rgb;
+    vec4 color = vec4(rgb, mesh.baseColor.a);
+
+    if (color.a < 0.5) {
+        discard;
+    }
+    outColor = color;
+}
@@ -0,0 +1,32 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "Variants.glsl"
+
+layout(location = 0) in vec4 inPosition;
+
+// Per instance. Must match InstanceData in Include/Mesh.hpp. A mat4 takes up
+// four locations, one per column.
+layout(location = 1) in mat4 inTransform;
+layout(location = 5) in uint inMaterialIndex;
+
+layout(location = 0) out vec3 outPosition;
+layout(location = 1) flat out uint outMaterialIndex;
+
+// With a depth prepass, MeshDepth.vert has to land on exactly the same depth.
+invariant gl_Position;
+
+void main()
+{
+    vec4 position = inPosition;
+    if (kQuantizedPositions) {
+        // SNORM16 positions arrive in [-1, 1], relative to the mesh's extent.
+        position = vec4(inPosition.xyz * mesh.positionScale.xyz, 1.0);
+    }
+
+    position = inTransform * position;
+
+    outPosition      = position.xyz;
+    outMaterialIndex = inMaterialIndex;
+    gl_Position      = mesh.mvp * position;
+}
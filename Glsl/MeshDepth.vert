@@ -0,0 +1,23 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "Variants.glsl"
+
+// The depth prepass. Only the position, and the instance's transform, are
+// fetched. There's no fragment shader, so nothing is discarded here. That's
+// only right while everything Mesh.frag draws is opaque.
+layout(location = 0) in vec4 inPosition;
+layout(location = 1) in mat4 inTransform;
+
+// Mesh.vert has to land on exactly the same depth, for its EQUAL test.
+invariant gl_Position;
+
+void main()
+{
+    vec4 position = inPosition;
+    if (kQuantizedPositions) {
+        position = vec4(inPosition.xyz * mesh.positionScale.xyz, 1.0);
+    }
+
+    gl_Position = mesh.mvp * (inTransform * position);
+}
@@ -0,0 +1,127 @@
+// Shared by Glsl/Cull.comp, Glsl/CullEarly.comp, and Glsl/CullLate.comp.
+//
+// Each object that passes gets a VkDrawIndexedIndirectCommand. isVisible()
+// must behave exactly like its CPU reference, in Source/GpuCulling.cpp, which
+// validates it.
+
+// Must match kCullGroupSize in Source/GpuCulling.cpp.
+layout(local_size_x = 64) in;
+
+// Must match CullSpecConstantId in Source/GpuCulling.cpp.
+// With kCompact, survivors are packed at the front, and drawn with an indirect
+// count. Without it, every object keeps its slot, and culled ones draw no
+// instances.
+layout(constant_id = 0) const bool kCompact     = true;
+layout(constant_id = 1) const bool kConeCulling = false;
+
+// Must match MeshObject in Include/Mesh.hpp.
+struct MeshObject
+{
+    vec4    sphere;         // xyz = center, w = radius
+    vec4    cone;           // xyz = axis, w = cutoff
+    uint    firstIndex;
+    uint    indexCount;
+    int     vertexOffset;
+    uint    firstInstance;
+    uint    instanceCount;
+    uint    materialIndex;
+    uint    pad[2];
+};
+
+// VkDrawIndexedIndirectCommand. std430 packs it to 20 bytes, like the C one.
+struct DrawCommand
+{
+    uint    indexCount;
+    uint    instanceCount;
+    uint    firstIndex;
+    int     vertexOffset;
+    uint    firstInstance;
+};
+
+layout(set = 0, binding = 0, std430) readonly buffer Objects
+{
+    MeshObject objects[];
+};
+
+// Must match CullHeader in Include/GpuCulling.hpp. The commands start 16
+// bytes in.
+layout(set = 0, binding = 1, std430) buffer Draws
+{
+    uint        drawCount;
+    uint        triangleCount;
+    uint        pad0;
+    uint        pad1;
+    DrawCommand draws[];
+};
+
+// Must match CullParams in Include/GpuCulling.hpp.
+layout(push_constant) uniform CullParams
+{
+    mat4    viewProjection;
+    vec4    eye;
+    uint    objectCount;
+    uint    pad;
+    vec2    depthSize;      // Of the depth buffer the pyramid was built from
+} params;
+
+// Gribb & Hartmann. Each plane is the last row of the matrix, plus or minus
+// one of the others, normalized so distances are in world units.
+vec4 frustumPlane(int i)
+{
+    mat4 m   = params.viewProjection;
+    int  r   = i / 2;
+    vec4 row = vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+    vec4 w   = vec4(m[0][3], m[1][3], m[2][3], m[3][3]);
+    vec4 plane = (i % 2 == 0) ? w + row : w - row;
+    return plane / length(plane.xyz);
+}
+
+bool isVisible(MeshObject object)
+{
+    vec3  center = object.sphere.xyz;
+    float radius = object.sphere.w;
+
+    if (object.instanceCount == 0) {
+        return false;
+    }
+
+    for (int i = 0; i < 6; i += 1) {
+        vec4 plane = frustumPlane(i);
+        if (dot(plane.xyz, center) + plane.w < -radius) {
+            return false;
+        }
+    }
+
+    if (kConeCulling) {
+        // Culled if the eye sees the back of every triangle, from anywhere in
+        // the sphere.
+        vec3 toCenter = center - params.eye.xyz;
+        if (dot(toCenter, object.cone.xyz) >=
+                object.cone.w * length(toCenter) + radius) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void emitDraw(uint i, MeshObject object, bool draw)
+{
+    // The counts are kept either way, for stats and validation.
+    uint slot = i;
+    if (draw) {
+        uint compacted = atomicAdd(drawCount, 1);
+        atomicAdd(triangleCount, object.indexCount / 3 * object.instanceCount);
+        if (kCompact) {
+            slot = compacted;
+        }
+    } else if (kCompact) {
+        return;
+    }
+
+    draws[slot] = DrawCommand(object.indexCount,
+                              draw ? object.instanceCount : 0,
+                              object.firstIndex,
+                              object.vertexOffset,
+                              object.firstInstance);
+}
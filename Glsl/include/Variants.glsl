@@ -0,0 +1,19 @@
+// Specialization constants, shared by every stage.
+// The IDs must match SpecConstantId in Include/PipelineVariants.hpp.
+//
+// These are constants as far as the driver's compiler is concerned, so any
+// branch on them is compiled out when the pipeline is created.
+layout(constant_id = 0) const uint kLightCount         = 1;
+layout(constant_id = 1) const bool kQuantizedPositions = false;
+
+const uint kMaxLights = 4;
+
+// Must match MeshUniforms in Include/Mesh.hpp.
+// This is a dynamic uniform buffer, so every draw gets its own offset into the
+// same descriptor.
+layout(set = 0, binding = 0, std140) uniform MeshUniforms
+{
+    mat4 mvp;
+    vec4 baseColor;
+    vec4 positionScale;
+} mesh;
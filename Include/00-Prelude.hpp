@@ -36,6 +36,8 @@ static constexpr float PI = 3.14159265358979323846f;
 #include <vector>
 
 // ==== Math Includes ===========================================================
+// Vulkan's clip space depth is [0, 1], not OpenGL's [-1, 1].
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <glm/glm.hpp>
 #include <glm/vec3.hpp>
 #include <glm/mat4x4.hpp>
@@ -22,9 +22,22 @@ template<typename U, typename T>
 U* ptr_as(T* other) { return reinterpret_cast<U*>(other); }
 
 
+// 64-bit FNV-1a. Pass a previous result as 'seed' to hash several pieces.
+static constexpr uint64_t kHashSeed = 0xcbf29ce484222325ull;
+[[nodiscard]]
+uint64_t hashBytes(void const* pBytes, size_t size, uint64_t seed = kHashSeed);
+
+// Reads a whole file into a new buffer.
+// Prefer FileView (FileView.hpp) for anything large - it doesn't copy.
 [[nodiscard]]
 std::vector<uint8_t> loadBytesFrom(const char *const filename);
 
+// The running executable's directory, with a trailing separator, so files
+// copied next to it are found from any working directory. Empty if the OS
+// won't say, which leaves paths relative to the working directory.
+[[nodiscard]]
+std::string executableDir();
+
 // ==== ToCStr Overloads ========================================================
 // Leave this defined because MSVC's IntelliSense cannot handle re-used macros.
 #define TO_CSTR_CASE(VAL) case VAL: return #VAL;
@@ -55,6 +68,7 @@ constexpr const char* ToCStr(VkResult result)
         TO_CSTR_CASE(VK_ERROR_TOO_MANY_OBJECTS)
         TO_CSTR_CASE(VK_ERROR_FORMAT_NOT_SUPPORTED)
         TO_CSTR_CASE(VK_ERROR_FRAGMENTED_POOL)
+        TO_CSTR_CASE(VK_ERROR_OUT_OF_POOL_MEMORY_KHR)
         TO_CSTR_CASE(VK_ERROR_SURFACE_LOST_KHR)
         TO_CSTR_CASE(VK_ERROR_NATIVE_WINDOW_IN_USE_KHR)
         TO_CSTR_CASE(VK_SUBOPTIMAL_KHR)
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "00-Prelude.hpp"
+#include "FileView.hpp"
+
+#include <memory>
+
+// ==== On-disk Format ==========================================================
+// Everything is little-endian, and laid out like this:
+//
+//      ArchiveHeader
+//      ArchiveEntry[entryCount]            Sorted by 'nameHash'
+//      uint32_t[bucketCount + 1]           First entry of each hash bucket
+//      char[]                              Entry names, not NUL terminated
+//      <padding to kArchiveAlignment>
+//      Entry data, each starting on a kArchiveAlignment boundary
+//
+// Buckets are picked with the top bits of the name hash. Because the entries
+// are sorted by hash, each bucket is a contiguous run of entries, and a lookup
+// is one bucket index plus (on average) one compare.
+
+static constexpr uint32_t kArchiveMagic     = 0x4B50564B; // "KVPK"
+static constexpr uint32_t kArchiveVersion   = 1;
+static constexpr uint32_t kArchiveAlignment = 4096;
+
+enum class ArchiveCompression : uint32_t
+{
+    None = 0,
+    Lz   = 1,   // Small LZ77 variant, see AssetArchive.cpp
+};
+
+struct ArchiveHeader
+{
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    entryCount;
+    uint32_t    bucketBits;     // bucketCount == 1 << bucketBits
+    uint64_t    namesOffset;
+    uint64_t    namesSize;
+};
+
+struct ArchiveEntry
+{
+    uint64_t            nameHash;
+    uint64_t            offset;         // From the start of the archive
+    uint64_t            storedSize;     // Bytes in the archive
+    uint64_t            size;           // Bytes once decompressed
+    uint32_t            nameOffset;     // From 'namesOffset'
+    uint32_t            nameLength;
+    ArchiveCompression  compression;
+    uint32_t            reserved;
+};
+static_assert(sizeof(ArchiveHeader) == 32, "ArchiveHeader is on disk");
+static_assert(sizeof(ArchiveEntry)  == 48, "ArchiveEntry is on disk");
+
+// Names are hashed with 64-bit FNV-1a.
+[[nodiscard]]
+uint64_t hashAssetName(const char* pName, size_t length);
+
+// ==== Reading =================================================================
+
+// One asset's bytes.
+// Uncompressed assets point straight into the archive's mapping. Compressed
+// ones are decompressed into memory that this owns.
+struct AssetBlob
+{
+    const uint8_t*              pData   = nullptr;
+    size_t                      size    = 0;
+    std::unique_ptr<uint8_t[]>  pOwned;
+
+    bool valid() const { return pData != nullptr; }
+};
+
+// A read-only archive. The whole file is mapped once, and everything after that
+// is pointer math.
+class AssetArchive
+{
+    public:
+        AssetArchive() = default;
+
+        // Returns false if the file is missing or isn't a valid archive.
+        [[nodiscard]]
+        bool open(const char* pFilename);
+        void close();
+
+        bool isOpen() const { return m_pHeader != nullptr; }
+
+        // Returns nullptr if there's no such asset.
+        ArchiveEntry const* find(const char* pName) const;
+
+        // Returns an invalid blob if there's no such asset.
+        [[nodiscard]]
+        AssetBlob get(const char* pName) const;
+        [[nodiscard]]
+        AssetBlob get(ArchiveEntry const& entry) const;
+
+        uint32_t            entryCount() const;
+        ArchiveEntry const& entry(uint32_t index) const;
+        std::string         entryName(ArchiveEntry const& entry) const;
+
+    private:
+        FileView                m_file;
+        ArchiveHeader const*    m_pHeader   = nullptr;
+        ArchiveEntry  const*    m_pEntries  = nullptr;
+        uint32_t      const*    m_pBuckets  = nullptr;
+        const char*             m_pNames    = nullptr;
+};
+
+// ==== Writing =================================================================
+
+// Builds an archive in memory, then writes it out in one go.
+// Only the PackAssets tool should need this.
+class AssetArchiveWriter
+{
+    public:
+        // 'compress' is a request - entries that don't shrink are stored raw.
+        void add(std::string name, std::vector<uint8_t> bytes, bool compress);
+
+        [[nodiscard]]
+        bool write(const char* pFilename) const;
+
+    private:
+        struct PendingEntry
+        {
+            std::string             name;
+            std::vector<uint8_t>    bytes;      // As stored
+            uint64_t                size;       // Decompressed
+            ArchiveCompression      compression;
+        };
+        std::vector<PendingEntry>   m_entries;
+};
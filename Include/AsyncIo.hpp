@@ -0,0 +1,178 @@
+#pragma once
+
+#include "00-Prelude.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+
+class JobPool;
+
+// Heap memory with a guaranteed alignment. O_DIRECT reads need this for both
+// the destination address and the transfer size.
+class AlignedBuffer
+{
+    public:
+        AlignedBuffer() = default;
+        AlignedBuffer(size_t size, size_t alignment);
+        ~AlignedBuffer();
+
+        AlignedBuffer(AlignedBuffer&& other) noexcept;
+        AlignedBuffer& operator=(AlignedBuffer&& other) noexcept;
+
+        AlignedBuffer(AlignedBuffer const&)            = delete;
+        AlignedBuffer& operator=(AlignedBuffer const&) = delete;
+
+        uint8_t*       data()       { return m_pData; }
+        const uint8_t* data() const { return m_pData; }
+        size_t         size() const { return m_size;  }
+
+    private:
+        uint8_t*    m_pData = nullptr;
+        size_t      m_size  = 0;
+};
+
+// What a finished read hands back to its callback.
+struct AsyncReadResult
+{
+    std::string     filename;
+    void*           pDst        = nullptr;  // Where the bytes went
+    uint64_t        bytesRead   = 0;
+    int             error       = 0;        // 0 on success, errno otherwise
+
+    // Only used when the request didn't bring its own memory.
+    AlignedBuffer   ownedBuffer;
+};
+using AsyncReadCallback = std::function<void(AsyncReadResult& result)>;
+
+struct AsyncReadRequest
+{
+    std::string         filename;
+
+    // Caller owned memory (e.g. a mapped staging buffer). It must stay alive
+    // until the callback runs.
+    // Leave this null to have the reader allocate an AlignedBuffer that's big
+    // enough for the whole read, handed back in the result.
+    void*               pDst        = nullptr;
+    uint64_t            offset      = 0;
+    uint64_t            size        = 0;        // 0 -> until end of file
+
+    // Bypass the page cache (O_DIRECT). 'pDst', 'offset', and 'size' must all
+    // be multiples of AsyncFileReader::kDirectIoAlignment. This is a hint - it
+    // is quietly dropped where it isn't supported.
+    bool                direct      = false;
+
+    AsyncReadCallback   onComplete;
+};
+
+// Reads lots of files at once.
+//
+// On Linux this drives an io_uring directly, so one syscall submits a whole
+// batch and the kernel works through them in parallel. Elsewhere, or when the
+// kernel says no, each read becomes a blocking job on a JobPool instead.
+//
+// Either way, callbacks only ever run inside poll() or waitAll(), on the thread
+// that called them. This class is not thread-safe: give it one owner.
+class AsyncFileReader
+{
+    public:
+        static constexpr uint32_t kDirectIoAlignment = 4096;
+
+        AsyncFileReader() = default;
+        ~AsyncFileReader();
+
+        AsyncFileReader(AsyncFileReader const&)            = delete;
+        AsyncFileReader& operator=(AsyncFileReader const&) = delete;
+
+        // 'queueDepth' is how many reads may be in flight at once.
+        // 'pFallbackPool' is only used if we can't get an io_uring. If it's
+        // null too, reads happen synchronously inside submit().
+        void     init(uint32_t queueDepth, JobPool* pFallbackPool);
+        void     deInit();
+
+        // Queue up a read. Nothing happens until submit().
+        void     enqueue(AsyncReadRequest request);
+        // Same as above, but completion also fulfills the returned future.
+        [[nodiscard]]
+        std::future<AsyncReadResult> enqueueWithFuture(AsyncReadRequest request);
+
+        // Issue as many queued reads as there's room for. Returns that count.
+        uint32_t submit();
+        // Run callbacks for finished reads without blocking. Returns that count.
+        uint32_t poll();
+        // Submit everything and block until every read has completed.
+        void     waitAll();
+
+        bool     usingIoUring() const { return m_ring.fd >= 0; }
+        uint32_t pendingCount() const;
+
+        // Convenience for sizing caller-owned buffers. Returns 0 on failure.
+        static uint64_t fileSize(const char* pFilename);
+
+    private:
+        struct Slot
+        {
+            AsyncReadRequest    request;
+            AsyncReadResult     result;     // 'bytesRead' counts as we go
+            int                 fd          = -1;
+            uint8_t*            pDst        = nullptr;
+            uint64_t            wanted      = 0;        // What we report
+            uint64_t            transfer    = 0;        // What we ask for
+            // Storage for the readv the kernel is looking at. (A 'struct iovec')
+            struct { void* pBase; size_t length; } iov = {};
+        };
+
+        // Everything we need from the mapped io_uring.
+        struct Ring
+        {
+            int                 fd          = -1;
+            uint32_t            entries     = 0;
+            void*               pSqMap      = nullptr;
+            size_t              sqMapSize   = 0;
+            void*               pCqMap      = nullptr;
+            size_t              cqMapSize   = 0;
+            void*               pSqes       = nullptr;
+            size_t              sqesSize    = 0;
+
+            uint32_t*           pSqHead     = nullptr;
+            uint32_t*           pSqTail     = nullptr;
+            uint32_t*           pSqMask     = nullptr;
+            uint32_t*           pSqArray    = nullptr;
+            uint32_t*           pCqHead     = nullptr;
+            uint32_t*           pCqTail     = nullptr;
+            uint32_t*           pCqMask     = nullptr;
+            void*               pCqes       = nullptr;
+        };
+
+        bool     initRing(uint32_t queueDepth);
+        void     deInitRing();
+
+        // Opens the file and works out the destination. Returns false (with
+        // 'slot.result.error' set) if the read can't happen at all.
+        bool     prepareSlot(Slot& slot);
+        void     readBlocking(Slot& slot);
+        void     finishSlot(uint32_t slotIndex);
+
+        uint32_t submitRing();
+        uint32_t reapRing(bool wait);
+        uint32_t submitFallback();
+        uint32_t reapCompleted(bool wait);
+
+        Ring                            m_ring;
+        JobPool*                        m_pFallbackPool = nullptr;
+
+        std::vector<Slot>               m_slots;
+        std::vector<uint32_t>           m_freeSlots;
+        std::deque<AsyncReadRequest>    m_queued;
+        // Slots that need (re)submitting, e.g. after a short read.
+        std::deque<uint32_t>            m_ready;
+        uint32_t                        m_inFlight      = 0;
+
+        // Finished slots that didn't come through the ring: fallback reads
+        // (pushed from worker threads) and reads that failed to start.
+        std::mutex                      m_completedMutex;
+        std::condition_variable         m_completedCv;
+        std::vector<uint32_t>           m_completed;
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "00-Prelude.hpp"
+
+struct ComputeQueueInfo
+{
+    VkDevice                        device              = nullptr;
+    VkAllocationCallbacks const*    pAlloc              = nullptr;
+    VkQueue                         queue               = nullptr;
+    uint32_t                        queueFamily         = 0;
+    uint32_t                        graphicsQueueFamily = 0;
+    uint32_t                        frameCount          = 0;    // Frames in flight
+};
+
+// Compute work that runs alongside the frame's graphics work.
+//
+// Each frame, work is recorded into that frame's command buffer, submitted on
+// the compute queue, and signals a semaphore that the graphics submit waits
+// on. Graphics only waits at the stages that consume compute's results, so
+// everything before them (and the previous frame) can overlap.
+//
+// When compute has a queue family of its own, whatever it hands to graphics
+// needs an ownership transfer: a release on the compute queue, and a matching
+// acquire on the graphics queue. release*() records both halves.
+//
+// Compute is expected to overwrite what it hands over every frame, so nothing
+// is ever handed back.
+class ComputeQueue
+{
+    public:
+        ComputeQueue() = default;
+        ~ComputeQueue();
+
+        ComputeQueue(ComputeQueue const&)            = delete;
+        ComputeQueue& operator=(ComputeQueue const&) = delete;
+
+        VkResult init(ComputeQueueInfo const& info);
+        void     deInit();
+
+        // Only call once the frame's fence has signaled. The graphics submit
+        // waits on compute, so that covers compute's command buffer too.
+        void     beginFrame(uint32_t frameIndex);
+
+        // This frame's command buffer. Recording starts on the first call.
+        VkCommandBuffer commandBuffer();
+
+        // Hands a buffer, or image, written by compute shaders this frame to
+        // graphics, which will use it at 'dstStages' with 'dstAccess'.
+        void     releaseBuffer(VkBuffer             buffer,
+                               VkDeviceSize         offset,
+                               VkDeviceSize         size,
+                               VkPipelineStageFlags dstStages,
+                               VkAccessFlags        dstAccess);
+        void     releaseImage(VkImage                 image,
+                              VkImageSubresourceRange range,
+                              VkImageLayout           oldLayout,
+                              VkImageLayout           newLayout,
+                              VkPipelineStageFlags    dstStages,
+                              VkAccessFlags           dstAccess);
+
+        // Ends and submits this frame's compute work. Returns the semaphore
+        // graphics has to wait on, and the stages to wait at, or nullptr if
+        // nothing was recorded this frame.
+        VkSemaphore submit(VkPipelineStageFlags* pWaitStages);
+
+        // Records the acquiring half of this frame's transfers. Call at the
+        // start of the graphics command buffer that waits on submit().
+        void     acquire(VkCommandBuffer graphicsCmd);
+
+        // Whether compute runs on a queue family of its own.
+        bool     transfersOwnership() const;
+
+    private:
+        ComputeQueueInfo                    m_info;
+        VkCommandPool                       m_vkCommandPool     = nullptr;
+        std::vector<VkCommandBuffer>        m_vkCmdBuffers;
+        std::vector<VkSemaphore>            m_vkSemaphores;
+
+        uint32_t                            m_frameIndex        = 0;
+        bool                                m_recording         = false;
+        VkPipelineStageFlags                m_waitStages        = 0;
+        std::vector<VkBufferMemoryBarrier>  m_bufferTransfers;
+        std::vector<VkImageMemoryBarrier>   m_imageTransfers;
+};
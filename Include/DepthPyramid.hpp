@@ -0,0 +1,72 @@
+#pragma once
+
+#include "00-Prelude.hpp"
+
+class Descriptors;
+struct DescriptorLayout;
+
+struct DepthPyramidInfo
+{
+    VkDevice                            device          = nullptr;
+    VkAllocationCallbacks const*        pAlloc          = nullptr;
+    VkPhysicalDeviceMemoryProperties    memoryProperties = {};
+    VkPipelineCache                     cache           = nullptr;
+    Descriptors*                        pDescriptors    = nullptr;
+    VkShaderModule                      pyramidModule   = nullptr;
+    VkExtent2D                          depthExtent     = {};
+};
+
+// A mip chain of the farthest depth under each texel, for occlusion tests.
+//
+// Level 0 is half the depth buffer's size, rounded up, and each level after
+// that is half the last, down to 1x1. A texel in level l covers the
+// 2^(l+1) x 2^(l+1) depth pixels under it.
+//
+// The render graph doesn't do mips, so the pyramid lives outside it, in
+// VK_IMAGE_LAYOUT_GENERAL. It's rebuilt from scratch every frame.
+class DepthPyramid
+{
+    public:
+        DepthPyramid() = default;
+        ~DepthPyramid();
+
+        DepthPyramid(DepthPyramid const&)            = delete;
+        DepthPyramid& operator=(DepthPyramid const&) = delete;
+
+        VkResult init(DepthPyramidInfo const& info);
+        void     deInit();
+
+        // Rebuilds the levels for a new depth buffer size. The GPU must be
+        // done with the old ones.
+        VkResult resize(VkExtent2D depthExtent);
+
+        // Builds every level from 'depthView', which must be readable by
+        // compute shaders. Leaves the pyramid readable by compute shaders.
+        void     record(VkCommandBuffer cmd, VkImageView depthView);
+
+        // Every level, for sampling with texelFetch().
+        VkImageView view() const        { return m_vkView; }
+        VkSampler   sampler() const     { return m_vkSampler; }
+        uint32_t    levelCount() const  { return as<uint32_t>(m_levels.size()); }
+
+    private:
+        struct Level
+        {
+            VkImageView     view    = nullptr;
+            VkExtent2D      extent  = {};
+        };
+
+        VkResult createImages(VkExtent2D depthExtent);
+        void     destroyImages();
+
+        DepthPyramidInfo                m_info;
+        VkImage                         m_vkImage           = nullptr;
+        VkDeviceMemory                  m_vkMemory          = nullptr;
+        VkImageView                     m_vkView            = nullptr;
+        VkSampler                       m_vkSampler         = nullptr;
+        std::vector<Level>              m_levels;
+
+        DescriptorLayout const*         m_pSetLayout        = nullptr;
+        VkPipelineLayout                m_vkPipelineLayout  = nullptr;
+        VkPipeline                      m_vkPipeline        = nullptr;
+};
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "00-Prelude.hpp"
+
+#include <memory>
+#include <unordered_map>
+
+// ==== Layouts =================================================================
+
+// One binding in a set layout.
+//
+// 'offset' and 'stride' describe where this binding's VkDescriptorBufferInfo,
+// VkDescriptorImageInfo, or VkBufferView values live in the data passed to
+// Descriptors::write(). The same data drives update templates, and the plain
+// vkUpdateDescriptorSets fallback.
+struct DescriptorBinding
+{
+    uint32_t            binding     = 0;
+    VkDescriptorType    type        = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    uint32_t            count       = 1;
+    VkShaderStageFlags  stages      = 0;
+    size_t              offset      = 0;
+    size_t              stride      = 0;
+};
+
+// A cached set layout, plus everything we need to write sets of it.
+struct DescriptorLayout
+{
+    VkDescriptorSetLayout           vkLayout    = nullptr;
+    // Null without VK_KHR_descriptor_update_template.
+    VkDescriptorUpdateTemplateKHR   vkTemplate  = nullptr;
+    std::vector<DescriptorBinding>  bindings;
+    uint64_t                        hash        = 0;
+};
+
+// ==== DescriptorAllocator =====================================================
+
+// Allocates sets out of a chain of pools, and frees them all at once.
+//
+// Sets are never freed one by one. When a pool runs out, or is too fragmented,
+// we chain on another one and try again. reset() hands every set back with one
+// vkResetDescriptorPool per pool, and keeps the pools for next time.
+class DescriptorAllocator
+{
+    public:
+        DescriptorAllocator() = default;
+
+        // Without 'poolErrors' (VK_KHR_maintenance1), running out of memory
+        // is taken to mean the pool ran out.
+        void     init(VkDevice                     device,
+                      VkAllocationCallbacks const* pAlloc,
+                      bool                         poolErrors);
+        void     deInit();
+
+        VkResult allocate(VkDescriptorSetLayout layout, VkDescriptorSet* pSet);
+        void     reset();
+
+        uint32_t poolCount() const;
+
+    private:
+        VkResult grabPool(VkDescriptorPool* pPool);
+
+        VkDevice                        m_device        = nullptr;
+        VkAllocationCallbacks const*    m_pAlloc        = nullptr;
+        bool                            m_poolErrors    = false;
+        VkDescriptorPool                m_current       = nullptr;
+        std::vector<VkDescriptorPool>   m_usedPools;
+        std::vector<VkDescriptorPool>   m_freePools;
+};
+
+// ==== Descriptors =============================================================
+
+struct DescriptorsInfo
+{
+    VkDevice                        device          = nullptr;
+    VkAllocationCallbacks const*    pAlloc          = nullptr;
+    uint32_t                        frameCount      = 0;    // Frames in flight
+    bool                            updateTemplates = false;// Extension enabled
+    bool                            poolErrors      = false;// VK_KHR_maintenance1
+};
+
+// Everything descriptor related, in one place.
+//
+// - Layouts are created once per unique set of bindings, and cached by hash.
+// - Transient sets come from per-frame pools that are reset wholesale.
+// - Persistent sets are cached by their layout and the resources in them, so
+//   asking for the same set twice doesn't allocate or write anything.
+// - Writes go through update templates when the device has them.
+class Descriptors
+{
+    public:
+        Descriptors() = default;
+        ~Descriptors();
+
+        Descriptors(Descriptors const&)            = delete;
+        Descriptors& operator=(Descriptors const&) = delete;
+
+        void init(DescriptorsInfo const& info);
+        void deInit();
+
+        // Returns the cached layout for these bindings, creating it if needed.
+        DescriptorLayout const* getLayout(DescriptorBinding const* pBindings,
+                                          uint32_t                 count);
+
+        // Throws away the frame's transient sets. Only call once that frame's
+        // fence has signaled.
+        void beginFrame(uint32_t frameIndex);
+
+        // A set that's only valid until this frame slot comes around again.
+        VkDescriptorSet allocateFrameSet(DescriptorLayout const& layout,
+                                         void const*             pData);
+
+        // A set that lives until deInit(). Sets with the same layout and
+        // resources are shared.
+        VkDescriptorSet getPersistentSet(DescriptorLayout const& layout,
+                                         void const*             pData);
+
+        // Stops handing out the persistent set with these resources. Call it
+        // before destroying one of them, so a new resource that reuses its
+        // handle gets a new set. The old set is still freed by deInit().
+        void invalidatePersistentSet(DescriptorLayout const& layout,
+                                     void const*             pData);
+
+        // Writes every binding in 'layout' from 'pData'.
+        void write(DescriptorLayout const& layout,
+                   VkDescriptorSet         set,
+                   void const*             pData) const;
+
+        void logStats() const;
+
+    private:
+        uint64_t hashResources(DescriptorLayout const& layout,
+                               void const*             pData) const;
+        VkDescriptorUpdateTemplateKHR createTemplate(
+            DescriptorLayout const& layout) const;
+
+        DescriptorsInfo                 m_info;
+
+        std::unordered_map<uint64_t, std::unique_ptr<DescriptorLayout>>
+                                        m_layouts;
+        std::unordered_map<uint64_t, VkDescriptorSet>
+                                        m_persistentSets;
+
+        DescriptorAllocator             m_persistentAllocator;
+        std::vector<DescriptorAllocator> m_frameAllocators;
+        uint32_t                        m_frameIndex            = 0;
+
+        PFN_vkCreateDescriptorUpdateTemplateKHR  m_pfnCreateTemplate  = nullptr;
+        PFN_vkDestroyDescriptorUpdateTemplateKHR m_pfnDestroyTemplate = nullptr;
+        PFN_vkUpdateDescriptorSetWithTemplateKHR m_pfnUpdateTemplate  = nullptr;
+
+        // Stats
+        uint32_t                        m_frameSetCount         = 0;
+        uint32_t                        m_persistentHits        = 0;
+        uint32_t                        m_persistentMisses      = 0;
+};
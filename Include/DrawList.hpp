@@ -0,0 +1,114 @@
+#pragma once
+
+#include "00-Prelude.hpp"
+#include "RadixSort.hpp"
+
+#include <vector>
+
+class JobPool;
+
+// Draw sort keys, from the most significant field down. Sorting by key
+// groups draws by pass, then pipeline state, then material, and orders each
+// group by depth. The mesh breaks ties, so copies of one mesh end up next to
+// each other.
+//
+//   pass : 4 | pipeline : 12 | material : 16 | depth : 16 | mesh : 16
+//
+// Fields wider than that are truncated. That only costs grouping, not
+// correctness.
+uint64_t makeDrawKey(uint32_t pass,
+                     uint32_t pipeline,
+                     uint32_t material,
+                     uint32_t depth,
+                     uint32_t mesh);
+
+uint32_t drawKeyPass(uint64_t key);
+
+// Nearer is smaller. Logarithmic, so nearby draws still get told apart.
+uint32_t drawDepthBucket(float distance);
+
+// Everything a draw needs bound. Several draws share one.
+struct DrawBinds
+{
+    VkPipeline          pipeline        = nullptr;
+    VkPipelineLayout    layout          = nullptr;
+    VkDescriptorSet     set             = nullptr;
+    uint32_t            dynamicOffset   = 0;
+    VkBuffer            vertexBuffers[2] = {};
+    VkBuffer            indexBuffer     = nullptr;
+};
+
+// What the draws of the last frame, the one before clear(), cost.
+struct DrawListStats
+{
+    uint32_t    draws           = 0;
+    uint32_t    binds           = 0;    // Actually recorded
+    uint32_t    bindsAvoided    = 0;    // Already bound
+    double      sortMs          = 0.0;
+};
+
+struct DrawListInfo
+{
+    // Optional. Large lists are sorted across its threads.
+    JobPool*    pJobs       = nullptr;
+};
+
+// A frame's draws, sorted by key, then recorded pass by pass.
+//
+// add() only appends. sort() orders everything by key, with radixSort().
+// record() then walks one pass's run of draws, and only binds what differs
+// from the draw before.
+class DrawList
+{
+    public:
+        DrawList() = default;
+        ~DrawList();
+
+        DrawList(DrawList const&)            = delete;
+        DrawList& operator=(DrawList const&) = delete;
+
+        void     init(DrawListInfo const& info);
+        void     deInit();
+
+        // Starts the next frame. Totals the last one's stats.
+        void     clear();
+
+        // Returns what add() takes. Draws are keyed by it, so it has to fit
+        // the key's pipeline field.
+        uint32_t addBinds(DrawBinds const& binds);
+        void     add(uint64_t                            key,
+                     uint32_t                            binds,
+                     VkDrawIndexedIndirectCommand const& draw);
+
+        void     sort();
+        // Every draw whose key has 'pass' in it.
+        void     record(VkCommandBuffer cmd, uint32_t pass);
+
+        uint32_t drawCount() const { return as<uint32_t>(m_keys.size()); }
+        DrawListStats const& stats() const { return m_stats; }
+        void     logStats() const;
+
+    private:
+        struct Draw
+        {
+            VkDrawIndexedIndirectCommand    command;
+            uint32_t                        binds;
+        };
+
+        DrawListInfo                m_info;
+
+        std::vector<DrawBinds>      m_binds;
+        std::vector<Draw>           m_draws;
+        // Sorted together. The values index m_draws.
+        std::vector<uint64_t>       m_keys;
+        std::vector<uint32_t>       m_order;
+        RadixSortScratch            m_scratch;
+        bool                        m_sorted        = true;
+
+        DrawListStats               m_stats;
+        uint64_t                    m_frames        = 0;
+        uint64_t                    m_totalDraws    = 0;
+        uint64_t                    m_totalBinds    = 0;
+        uint64_t                    m_totalAvoided  = 0;
+        double                      m_totalSortMs   = 0.0;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "00-Prelude.hpp"
+
+#include <memory>
+#include <streambuf>
+
+// How we expect to walk through a file. This is only a hint for the OS.
+enum class FileAccess
+{
+    Sequential, // Front to back, once. (e.g. SPIR-V, .obj files)
+    Random,     // Jumping around. (e.g. archives)
+};
+
+// A read-only view of an entire file.
+//
+// When we can, the file is mapped into memory and nothing is copied - the pages
+// come straight out of the OS's page cache, and are shared with anyone else who
+// has the file open. If mapping isn't possible, we quietly fall back to reading
+// the file into a buffer we own. Callers can't tell the difference.
+//
+// The bytes stay valid until the view is closed or destroyed.
+class FileView
+{
+    public:
+        FileView() = default;
+        ~FileView();
+
+        FileView(FileView&& other) noexcept;
+        FileView& operator=(FileView&& other) noexcept;
+
+        FileView(FileView const&)            = delete;
+        FileView& operator=(FileView const&) = delete;
+
+        // Returns false if the file couldn't be opened or read.
+        [[nodiscard]]
+        bool open(const char* pFilename,
+                  FileAccess  access = FileAccess::Sequential);
+        void close();
+
+        const uint8_t* data()     const { return m_pData; }
+        size_t         size()     const { return m_size;  }
+        bool           empty()    const { return m_size == 0; }
+        bool           isMapped() const { return m_pMapping != nullptr; }
+
+        const uint8_t* begin()    const { return m_pData; }
+        const uint8_t* end()      const { return m_pData + m_size; }
+
+    private:
+        const uint8_t*              m_pData     = nullptr;
+        size_t                      m_size      = 0;
+
+        // Exactly one of these owns the bytes when the view isn't empty.
+        void*                       m_pMapping  = nullptr;
+        std::unique_ptr<uint8_t[]>  m_pFallback;
+};
+
+// Lets iostream based parsers (e.g. tinyobj) read directly out of memory we
+// already have, like a FileView or an archive entry. The bytes must outlive this.
+class ByteStreamBuf : public std::streambuf
+{
+    public:
+        ByteStreamBuf(const uint8_t* pData, size_t size)
+        {
+            // std::streambuf wants non-const pointers, but never writes
+            // through the get area.
+            char* pBegin = const_cast<char*>(ptr_as<const char>(pData));
+            setg(pBegin, pBegin, pBegin + size);
+        }
+
+        explicit ByteStreamBuf(FileView const& view)
+            : ByteStreamBuf(view.data(), view.size())
+        {
+        }
+};
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "00-Prelude.hpp"
+
+#include <chrono>
+
+struct FramePacerInfo
+{
+    double      targetHz        = 0.0;  // 0 doesn't limit anything
+    // Sleeps wake up late by a varying amount, so we wake up early, and spin
+    // the rest of the way. This is the least we spin for.
+    double      minSpinMs       = 0.5;
+};
+
+// Holds the main loop to a steady frame rate.
+//
+// wait() is meant to go right before input is polled. Time spent waiting there
+// is time input isn't getting older, unlike time spent blocked on a fence, or
+// on the swapchain, after input was polled.
+//
+// Sleeping alone overshoots by however long the OS takes to wake us up, and
+// spinning alone burns a core. So we sleep until a little before the
+// deadline, then spin. That little is learned from how late recent sleeps
+// woke up.
+class FramePacer
+{
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        FramePacer() = default;
+
+        void init(FramePacerInfo const& info);
+
+        // Returns once it's time to start the next frame.
+        void wait();
+
+        void logStats() const;
+
+    private:
+        FramePacerInfo      m_info;
+        Clock::duration     m_period        = {};
+        Clock::time_point   m_deadline      = {};
+        double              m_spinMs        = 0.0;
+        double              m_overshootMs   = 0.0;  // Decaying peak
+
+        // Stats
+        uint64_t            m_frameCount    = 0;
+        uint64_t            m_lateFrames    = 0;    // Missed the deadline
+        double              m_errorMsSum    = 0.0;  // How far past it we woke
+        double              m_spinMsSum     = 0.0;
+};
+
+// ==== Latency =================================================================
+
+// Points in a frame, from when its input was sampled to when it was handed to
+// the swapchain.
+enum class LatencyMarker : uint32_t
+{
+    Input,      // Input was sampled
+    Latch,      // The camera was written into the frame's uniforms
+    Submit,     // vkQueueSubmit() returned
+    Present,    // vkQueuePresentKHR() returned
+    Count,
+};
+
+// Times each marker relative to Input, frame by frame.
+//
+// Present is as far as the CPU can see. Scanout comes later, by however many
+// images the swapchain has queued up.
+class FrameLatency
+{
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        FrameLatency() = default;
+
+        void mark(LatencyMarker marker);
+        // For markers taken on another thread.
+        void mark(LatencyMarker marker, Clock::time_point time);
+
+        // Records the frame, if its input was marked, and starts a new one.
+        void endFrame();
+
+        void logStats() const;
+
+    private:
+        static constexpr uint32_t   kMarkerCount    = static_cast<uint32_t>(LatencyMarker::Count);
+        // Enough for a few minutes. After that, the oldest are overwritten.
+        static constexpr uint32_t   kMaxSamples     = 1u << 15;
+
+        Clock::time_point           m_marks[kMarkerCount]   = {};
+        bool                        m_marked[kMarkerCount]  = {};
+        // Milliseconds since Input, for each of the other markers.
+        std::vector<float>          m_samples[kMarkerCount];
+        uint64_t                    m_frameCount            = 0;
+};
@@ -0,0 +1,209 @@
+#pragma once
+
+#include "00-Prelude.hpp"
+#include "Mesh.hpp"
+
+class Descriptors;
+struct DescriptorLayout;
+
+// ==== Culling =================================================================
+
+// Push constants for Glsl/Cull*.comp.
+// Must match 'CullParams' in Glsl/include/Cull.glsl.
+struct CullParams
+{
+    Mat4        viewProjection  = {};
+    glm::vec4   eye             = {};
+    uint32_t    objectCount     = 0;
+    uint32_t    pad             = 0;
+    // Of the depth buffer the pyramid was built from. Only for the late phase.
+    float       depthWidth      = 0.f;
+    float       depthHeight     = 0.f;
+};
+static_assert(sizeof(CullParams) <= 128, "Every device has 128 bytes of push constants");
+
+// The start of each output buffer, followed by the commands.
+// Must match 'Draws' in Glsl/include/Cull.glsl.
+struct CullHeader
+{
+    uint32_t    drawCount       = 0;
+    uint32_t    triangleCount   = 0;
+    uint32_t    pad[2]          = {};
+};
+static_assert(sizeof(CullHeader) == 16, "CullHeader is a GPU format");
+
+CullParams makeCullParams(Mat4 const& viewProjection,
+                          Vec3 const& eye,
+                          uint32_t    objectCount);
+
+// The CPU reference for Glsl/Cull.comp. Writes one command per visible
+// object, in object order, and returns how many that was.
+// Optionally, objects with a 0 in 'pVisible' are skipped without testing,
+// and each command's object index is written to 'pOutObjects'.
+uint32_t cullObjects(MeshObject const*             pObjects,
+                     CullParams const&             params,
+                     bool                          coneCulling,
+                     VkDrawIndexedIndirectCommand* pOut,
+                     uint8_t const*                pVisible    = nullptr,
+                     uint32_t*                     pOutObjects = nullptr);
+
+// ==== GpuCulling ==============================================================
+
+// Which pass over the objects to cull, or draw.
+enum class CullPhase : uint8_t
+{
+    All,    // Frustum culling only, all in one go
+    Early,  // Whatever was visible last frame
+    Late,   // Whatever the early phase missed, tested against a depth pyramid
+
+    Count
+};
+
+struct GpuCullingInfo
+{
+    VkDevice                            device          = nullptr;
+    VkAllocationCallbacks const*        pAlloc          = nullptr;
+    VkPhysicalDeviceMemoryProperties    memoryProperties = {};
+    VkPipelineCache                     cache           = nullptr;
+    Descriptors*                        pDescriptors    = nullptr;
+    uint32_t                            frameCount      = 0;    // Frames in flight
+
+    // Glsl/Cull.comp, or with occlusion, Glsl/CullEarly.comp and
+    // Glsl/CullLate.comp.
+    VkShaderModule                      cullModule      = nullptr;
+    VkShaderModule                      earlyModule     = nullptr;
+    VkShaderModule                      lateModule      = nullptr;
+
+    // With it, survivors are compacted, and the GPU reads the count. Without
+    // it, every object gets a command, and culled ones draw zero instances.
+    PFN_vkCmdDrawIndexedIndirectCountKHR pfnDrawIndirectCount = nullptr;
+    // Without it, the commands are drawn one vkCmdDrawIndexedIndirect each.
+    bool                                multiDrawIndirect = false;
+
+    bool                                coneCulling     = false;
+    // Cull in two phases, with CullPhase::Early and CullPhase::Late, instead
+    // of CullPhase::All.
+    bool                                occlusion       = false;
+    // Read each frame's results back, and check them against cullObjects().
+    // Only CullPhase::All has a CPU reference.
+    bool                                validate        = false;
+};
+
+// Culls mesh objects on the GPU, and draws whatever survives.
+//
+// A compute shader tests each object's bounding sphere against the frustum,
+// and optionally its normal cone against the eye, then writes a
+// VkDrawIndexedIndirectCommand for each survivor. Drawing them is one
+// indirect draw, so the CPU's cost doesn't grow with the object count.
+//
+// With occlusion culling, that happens twice a frame:
+// - Early: draw what was visible last frame. That's most of this frame.
+// - Build a depth pyramid from what the early draws left in the depth buffer.
+// - Late: test every object against the pyramid, remember which ones are
+//   visible for next frame, and draw the ones the early phase didn't.
+// Both phases run on the graphics queue, between the draws.
+//
+// Each phase, of each frame in flight, has its own output buffer: a
+// CullHeader, followed by the commands.
+class GpuCulling
+{
+    public:
+        GpuCulling() = default;
+        ~GpuCulling();
+
+        GpuCulling(GpuCulling const&)            = delete;
+        GpuCulling& operator=(GpuCulling const&) = delete;
+
+        VkResult init(GpuCullingInfo const& info);
+        void     deInit();
+
+        // Replaces the objects. The GPU must be done with the old ones.
+        VkResult setObjects(MeshObject const* pObjects, uint32_t count);
+        // Changes this frame's copy of the objects, e.g. to pick other LODs.
+        // Call after beginFrame(). 'count' can't change.
+        void     updateObjects(MeshObject const* pObjects, uint32_t count);
+        uint32_t objectCount() const { return m_objectCount; }
+
+        // Only call once the frame's fence has signaled. Collects that
+        // frame's stats, and validates its results, if asked to.
+        void     beginFrame(uint32_t frameIndex);
+
+        // Records one phase's dispatch, and leaves its commands ready to
+        // draw. The late phase also needs the depth pyramid.
+        void     record(VkCommandBuffer              cmd,
+                        CullPhase                    phase,
+                        CullParams const&            params,
+                        VkDescriptorImageInfo const* pPyramid = nullptr);
+
+        // This frame's output for 'phase', for handing over to graphics.
+        VkBuffer     drawBuffer(CullPhase phase) const;
+        VkDeviceSize drawBufferSize() const { return m_drawBufferSize; }
+
+        // Records the draws. The index and vertex buffers must be bound.
+        void     draw(VkCommandBuffer cmd, CullPhase phase) const;
+
+        void     logStats() const;
+
+    private:
+        struct Output
+        {
+            VkBuffer        buffer          = nullptr;
+            VkDeviceMemory  memory          = nullptr;
+            void*           pMapped         = nullptr;  // Only when validating
+        };
+
+        struct Frame
+        {
+            VkBuffer        objectBuffer    = nullptr;
+            VkDeviceMemory  objectMemory    = nullptr;
+            MeshObject*     pObjects        = nullptr;
+            uint64_t        objectTriangles = 0;
+            Output          outputs[2];     // All or Early, then Late
+            // Each output's CullHeader is copied here, for the CPU to read.
+            VkBuffer        statsBuffer     = nullptr;
+            VkDeviceMemory  statsMemory     = nullptr;
+            CullHeader*     pStats          = nullptr;
+            CullParams      params;
+            uint32_t        recordedPhases  = 0;    // Bit per CullPhase
+        };
+
+        // The phase's shader uses the first 'bindingCount' bindings.
+        VkResult createPipeline(CullPhase      phase,
+                                VkShaderModule module,
+                                uint32_t       bindingCount);
+        void     destroyBuffers();
+        Output const& output(CullPhase phase) const;
+        void     validate(Frame const& frame);
+
+        // Where the commands start in each output buffer.
+        static constexpr VkDeviceSize kDrawsOffset = sizeof(CullHeader);
+
+        struct Pipeline
+        {
+            DescriptorLayout const*     pSetLayout  = nullptr;
+            VkPipelineLayout            vkLayout    = nullptr;
+            VkPipeline                  vkPipeline  = nullptr;
+        };
+
+        GpuCullingInfo                  m_info;
+        Pipeline                        m_pipelines[static_cast<size_t>(CullPhase::Count)];
+
+        uint32_t                        m_objectCount       = 0;
+        // Which objects were visible last frame. Only with occlusion.
+        VkBuffer                        m_vkVisibilityBuffer = nullptr;
+        VkDeviceMemory                  m_vkVisibilityMemory = nullptr;
+        bool                            m_visibilityCleared = false;
+        std::vector<Frame>              m_frames;
+        VkDeviceSize                    m_drawBufferSize    = 0;
+        uint32_t                        m_frameIndex        = 0;
+
+        // Stats
+        uint64_t                        m_frameCount        = 0;
+        uint64_t                        m_testedObjects     = 0;
+        uint64_t                        m_testedTriangles   = 0;
+        uint64_t                        m_drawnObjects      = 0;
+        uint64_t                        m_drawnTriangles    = 0;
+        uint64_t                        m_lateTriangles     = 0;
+        uint64_t                        m_validatedFrames   = 0;
+        uint64_t                        m_mismatchedFrames  = 0;
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "00-Prelude.hpp"
+#include "Mesh.hpp"
+
+struct InstanceBufferInfo
+{
+    VkDevice                            device          = nullptr;
+    VkAllocationCallbacks const*        pAlloc          = nullptr;
+    VkPhysicalDeviceMemoryProperties    memoryProperties = {};
+    uint32_t                            frameCount      = 0;    // Frames in flight
+};
+
+// The per-instance vertex stream that Glsl/Mesh.vert reads at binding 1.
+//
+// Each frame in flight has its own persistently mapped copy, so the CPU never
+// writes one the GPU is reading. setInstance() only changes the CPU's copy,
+// and remembers which frames haven't seen it yet. Each frame's copy catches
+// up in beginFrame(), with just the instances that changed since it was last
+// used, instead of the whole stream.
+class InstanceBuffer
+{
+    public:
+        InstanceBuffer() = default;
+        ~InstanceBuffer();
+
+        InstanceBuffer(InstanceBuffer const&)            = delete;
+        InstanceBuffer& operator=(InstanceBuffer const&) = delete;
+
+        VkResult init(InstanceBufferInfo const& info);
+        void     deInit();
+
+        // Replaces every instance. The GPU must be done with the old ones.
+        VkResult setInstances(InstanceData const* pInstances, uint32_t count);
+        void     setInstance(uint32_t index, InstanceData const& instance);
+
+        uint32_t instanceCount() const { return as<uint32_t>(m_instances.size()); }
+        InstanceData const& instance(uint32_t index) const { return m_instances[index]; }
+
+        // Only call once the frame's fence has signaled. Writes whatever
+        // changed since that frame's copy was last written.
+        void     beginFrame(uint32_t frameIndex);
+
+        // This frame's copy.
+        VkBuffer buffer() const;
+
+        void     logStats() const;
+
+    private:
+        struct Frame
+        {
+            VkBuffer                buffer      = nullptr;
+            VkDeviceMemory          memory      = nullptr;
+            InstanceData*           pMapped     = nullptr;
+            std::vector<uint32_t>   dirty;      // Instances it hasn't seen
+        };
+
+        void     destroyBuffers();
+
+        InstanceBufferInfo          m_info;
+        std::vector<InstanceData>   m_instances;
+        // A bit per frame, set while that frame's copy is out of date.
+        std::vector<uint8_t>        m_staleFrames;
+        std::vector<Frame>          m_frames;
+        uint32_t                    m_frameIndex        = 0;
+
+        // Stats
+        uint64_t                    m_frameCount        = 0;
+        uint64_t                    m_writtenInstances  = 0;
+};
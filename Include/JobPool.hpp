@@ -0,0 +1,55 @@
+#pragma once
+
+#include "00-Prelude.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// A fixed set of worker threads pulling from one shared queue.
+//
+// This is deliberately simple - one lock, one queue. Jobs are expected to be
+// chunky (file reads, pipeline compiles, a slice of a parallelFor), not tiny.
+class JobPool
+{
+    public:
+        using Job      = std::function<void()>;
+        // Called with a half-open range [begin, end) of indices.
+        using RangeJob = std::function<void(uint32_t begin, uint32_t end)>;
+
+        JobPool() = default;
+        ~JobPool();
+
+        JobPool(JobPool const&)            = delete;
+        JobPool& operator=(JobPool const&) = delete;
+
+        // 'threadCount' of 0 picks one thread per core, minus the caller's.
+        void     init(uint32_t threadCount = 0);
+        void     deInit();
+
+        // Queues a job. It runs on some worker thread, eventually.
+        void     push(Job job);
+
+        // Splits [0, count) into chunks of 'grainSize' and runs 'fn' on them,
+        // across the workers and the calling thread. Blocks until all of them
+        // are done.
+        // This is safe to call from inside a job: the caller always makes
+        // progress on its own, even if every worker is busy.
+        void     parallelFor(uint32_t        count,
+                             uint32_t        grainSize,
+                             RangeJob const& fn);
+
+        uint32_t threadCount() const { return as<uint32_t>(m_threads.size()); }
+
+    private:
+        void     workerMain();
+
+        std::vector<std::thread>    m_threads;
+        std::deque<Job>             m_jobs;
+        std::mutex                  m_mutex;
+        std::condition_variable     m_wakeup;
+        bool                        m_quitting  = false;
+};
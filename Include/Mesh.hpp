@@ -0,0 +1,144 @@
+#pragma once
+
+#include "00-Prelude.hpp"
+
+#include <string>
+
+struct Vertex
+{
+    float x = 0.f;
+    float y = 0.f;
+    float z = 0.f;
+    float w = 1.f;
+
+    Vertex() = default;
+    Vertex(float x, float y, float z, float w = 1.f)
+            : x(x), y(y), z(z), w(w) {}
+};
+
+// Half the size of a Vertex. Positions are SNORM16, relative to the mesh's
+// extent, which the vertex shader scales back out.
+struct QuantizedVertex
+{
+    int16_t x = 0;
+    int16_t y = 0;
+    int16_t z = 0;
+    int16_t w = INT16_MAX;
+};
+static_assert(sizeof(Vertex)          == 16, "Vertex is a GPU format");
+static_assert(sizeof(QuantizedVertex) == 8,  "QuantizedVertex is a GPU format");
+
+// Per-draw uniforms for Glsl/Mesh.vert and Glsl/Mesh.frag.
+// Must match 'MeshUniforms' in Glsl/include/Variants.glsl, with std140 layout.
+struct MeshUniforms
+{
+    Mat4        mvp;
+    glm::vec4   baseColor;
+    glm::vec4   positionScale;  // Only used with quantized positions
+};
+static_assert(sizeof(MeshUniforms) % 16 == 0, "std140 rounds up to a vec4");
+
+// A piece of a mesh that's culled, and drawn, on its own.
+// Must match 'MeshObject' in Glsl/include/Cull.glsl, with std430 layout.
+struct MeshObject
+{
+    glm::vec4   sphere          = {};   // xyz = center, w = radius
+    // Every triangle faces away from cameras that look down this cone.
+    // xyz = axis, w = cutoff. A cutoff of 1 never culls.
+    glm::vec4   cone            = { 0.f, 0.f, 0.f, 1.f };
+    uint32_t    firstIndex      = 0;
+    uint32_t    indexCount      = 0;
+    int32_t     vertexOffset    = 0;
+    // Every copy of the object is drawn at once, with these instances.
+    uint32_t    firstInstance   = 0;
+    uint32_t    instanceCount   = 1;
+    // What copies get, without instances of their own.
+    uint32_t    materialIndex   = 0;
+    uint32_t    pad[2]          = {};
+};
+static_assert(sizeof(MeshObject) == 64, "MeshObject is a GPU format");
+
+static constexpr uint32_t kNoTexture = UINT32_MAX;
+
+// One entry of the material table, which Glsl/Mesh.frag indexes with the
+// instance's material. Must match 'Material' in Glsl/Mesh.frag, with std430
+// layout.
+struct MeshMaterial
+{
+    glm::vec4   baseColor       = { 1.f, 1.f, 1.f, 1.f };  // a = dissolve
+    glm::vec4   emissive        = { 0.f, 0.f, 0.f, 0.f };
+    glm::vec4   specular        = { 0.f, 0.f, 0.f, 0.f };  // w = shininess
+    // Into MeshData::textures, or kNoTexture.
+    uint32_t    baseColorTexture = kNoTexture;
+    uint32_t    pad[3]          = {};
+};
+static_assert(sizeof(MeshMaterial) == 64, "MeshMaterial is a GPU format");
+
+// Per-instance vertex attributes for Glsl/Mesh.vert, at binding 1.
+struct InstanceData
+{
+    Mat4        transform       = Mat4(1.f);
+    uint32_t    materialIndex   = 0;
+    uint32_t    pad[3]          = {};
+};
+static_assert(sizeof(InstanceData) == 80, "InstanceData is a GPU format");
+
+// One copy of an object, somewhere in the world.
+struct MeshInstance
+{
+    uint32_t        object      = 0;
+    InstanceData    data;
+};
+
+// One level of detail of an object. Its indices live in the same index
+// buffer, and use the same vertices, as full detail.
+struct MeshLod
+{
+    uint32_t    firstIndex      = 0;
+    uint32_t    indexCount      = 0;
+    float       error           = 0.f;  // How far it strays from LOD 0
+};
+
+static constexpr uint32_t kMaxMeshLods = 4;
+
+// LOD 0 is the object itself, then coarser and coarser.
+struct MeshObjectLods
+{
+    uint32_t    count           = 1;
+    MeshLod     lods[kMaxMeshLods];
+};
+
+// An indexed mesh, split into objects. Everything uploadMesh() needs.
+struct MeshData
+{
+    std::vector<Vertex>         vertices;
+    std::vector<uint32_t>       indices;
+    std::vector<MeshObject>     objects;
+    // Optional. One chain per object.
+    std::vector<MeshObjectLods> lods;
+    // Optional. Without any, each object is drawn once, where it is.
+    std::vector<MeshInstance>   instances;
+    // Optional. Without any, the renderer has a few plain ones.
+    std::vector<MeshMaterial>   materials;
+    // The files materials name, for when there are texture coordinates to
+    // use them with.
+    std::vector<std::string>    textures;
+};
+
+// Bounding sphere, and normal cone, of the triangles in
+// 'indices[firstIndex, firstIndex + indexCount)'.
+MeshObject makeMeshObject(MeshData const& mesh,
+                          uint32_t        firstIndex,
+                          uint32_t        indexCount);
+
+// The bounding sphere of 'sphere', after it's moved by 'transform'.
+glm::vec4 transformSphere(Mat4 const& transform, glm::vec4 const& sphere);
+
+// The smallest sphere around both.
+glm::vec4 mergeSpheres(glm::vec4 const& a, glm::vec4 const& b);
+
+// Quantizes 'count' vertices into 'pOut'.
+// Returns the scale the shader needs to undo the quantization.
+glm::vec4 quantizePositions(Vertex const*                 pVerts,
+                            uint32_t                      count,
+                            std::vector<QuantizedVertex>* pOut);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "00-Prelude.hpp"
+#include "Mesh.hpp"
+
+// Simplifies the triangles in 'pIndices' down to about 'targetIndexCount'
+// indices, with quadric error metrics. Vertices are only ever removed, never
+// moved, so the result indexes the same vertices. Vertices on open edges
+// never move, so holes and outlines keep their shape.
+//
+// Writes the result to 'pOut', and returns the largest distance a collapse
+// moved the surface, in the vertices' units.
+float simplifyMesh(Vertex const*          pVerts,
+                   uint32_t const*        pIndices,
+                   uint32_t               indexCount,
+                   uint32_t               targetIndexCount,
+                   std::vector<uint32_t>* pOut);
+
+// Builds a chain of LODs for every object, each about half the triangles of
+// the last, and appends their indices to 'pMesh->indices'. LODs that barely
+// simplify anything aren't kept.
+void buildMeshLods(MeshData* pMesh);
+
+struct LodSelectParams
+{
+    Vec3    eye             = {};
+    // Pixels per world unit, at a distance of 1.
+    float   pixelsPerUnit   = 0.f;
+    // How far a LOD may stray from full detail, on screen.
+    float   maxErrorPixels  = 1.f;
+    // A coarser LOD has to be this much under the limit before we switch to
+    // it, so objects sitting at the limit don't flicker between two.
+    float   hysteresis      = 0.25f;
+};
+
+// Picks the coarsest LOD whose error, projected to the screen, is under the
+// limit. 'current' is what the object drew last frame.
+uint32_t selectLod(MeshObjectLods const&  lods,
+                   glm::vec4 const&       sphere,
+                   uint32_t               current,
+                   LodSelectParams const& params);
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "00-Prelude.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <unordered_map>
+
+class JobPool;
+
+// ==== Specialization Constants ================================================
+// Instead of branching on uniforms, shaders read these as constants, and the
+// driver compiles the dead paths out when the pipeline is created.
+//
+// The IDs must match the constant_ids in Glsl/include/Variants.glsl.
+enum SpecConstantId : uint32_t
+{
+    SpecConstantId_LightCount         = 0,
+    SpecConstantId_QuantizedPositions = 1,
+};
+
+static constexpr uint32_t kMaxLights = 4;
+
+// Everything that makes one variant different from another.
+struct PipelineVariantKey
+{
+    uint32_t                lightCount          = 1;
+    bool                    quantizedPositions  = false;
+    // A depth prepass already wrote the final depth. Test for EQUAL, and
+    // don't write, so only the visible fragment of each pixel is shaded.
+    bool                    depthEqual          = false;
+};
+
+// Everything that the variants have in common.
+struct PipelineVariantsInfo
+{
+    VkDevice                        device          = nullptr;
+    VkAllocationCallbacks const*    pAlloc          = nullptr;
+    VkPipelineCache                 cache           = nullptr;
+    VkRenderPass                    renderPass      = nullptr;
+    // Identifies the render passes 'renderPass' is compatible with, e.g.
+    // RenderGraph::renderPassClass(). Variants are only shared within one.
+    uint64_t                        renderPassClass = 0;
+    uint32_t                        subpass         = 0;
+    VkPipelineLayout                layout          = nullptr;
+    VkShaderModule                  vertModule      = nullptr;
+    // Optional. Without it, the variants only write depth. They have no
+    // color attachments, and don't fetch the instance's material.
+    VkShaderModule                  fragModule      = nullptr;
+
+    // Optional. Without it, request() compiles on the calling thread.
+    JobPool*                        pJobs           = nullptr;
+
+    // Compiles slower than this are reported as hitches.
+    float                           hitchMs         = 4.f;
+};
+
+// Owns every variant of one graphics pipeline.
+//
+// Variants are looked up by a hash of the full state description, including
+// the render pass's compatibility class, and then compared field by field.
+// Two keys that produce the same pipeline share it. They are compiled on worker threads
+// against one shared VkPipelineCache, so the render thread never has to wait
+// on the driver's compiler.
+class PipelineVariants
+{
+    public:
+        PipelineVariants() = default;
+        ~PipelineVariants();
+
+        PipelineVariants(PipelineVariants const&)            = delete;
+        PipelineVariants& operator=(PipelineVariants const&) = delete;
+
+        void init(PipelineVariantsInfo const& info);
+        // Waits for any compiles that are still running.
+        void deInit();
+
+        // Compiles from now on use 'renderPass', e.g. after a resize
+        // recreates the render passes. Variants compiled for the same
+        // 'renderPassClass' keep being used. Others are compiled again.
+        void setRenderPass(VkRenderPass renderPass, uint64_t renderPassClass);
+
+        // Never blocks. Returns nullptr until the variant has been compiled,
+        // and starts compiling it the first time it's asked for.
+        VkPipeline request(PipelineVariantKey const& key);
+
+        // Blocks until the variant is ready. Returns nullptr if the driver
+        // couldn't create it. Use this at load time, not mid-frame.
+        VkPipeline get(PipelineVariantKey const& key);
+
+        uint32_t   variantCount() const;
+        void       logStats() const;
+
+    private:
+        enum class State
+        {
+            Compiling,
+            Ready,
+            Failed,
+        };
+        struct Variant
+        {
+            // What it was compiled from, to tell apart hashes that collide.
+            PipelineVariantKey  key;
+            uint64_t            renderPassClass = 0;
+
+            State               state           = State::Compiling;
+            VkPipeline          pipeline        = nullptr;
+        };
+
+        uint64_t hashState(PipelineVariantKey const& key) const;
+        // Requires m_mutex. Returns the variant, adding it if it's new.
+        // Variants are never removed before deInit(), so it stays valid.
+        Variant& findOrStart(PipelineVariantKey const& key,
+                             uint64_t                  hash,
+                             bool*                     pStarted);
+        void     compile(Variant& variant, uint64_t hash);
+        VkResult createVariant(PipelineVariantKey const& key,
+                               VkPipeline*               pPipeline) const;
+
+        PipelineVariantsInfo                        m_info;
+
+        mutable std::mutex                          m_mutex;
+        std::condition_variable                     m_compiled;
+        std::unordered_multimap<uint64_t, Variant>  m_variants;
+        uint32_t                                    m_compilingCount = 0;
+
+        // Stats, guarded by m_mutex.
+        uint32_t                                    m_compiledCount  = 0;
+        uint32_t                                    m_hitchCount     = 0;
+        uint32_t                                    m_blockingCount  = 0;
+        double                                      m_totalMs        = 0.0;
+        double                                      m_maxMs          = 0.0;
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "00-Prelude.hpp"
+
+#include <vector>
+
+class JobPool;
+
+// Reused between sorts, so they don't allocate once it's grown.
+struct RadixSortScratch
+{
+    std::vector<uint64_t>   keys;
+    std::vector<uint32_t>   values;
+    std::vector<uint32_t>   counts;     // 256 per chunk
+};
+
+// Sorts 'pKeys' ascending, and moves 'pValues' along with them. Stable.
+//
+// Least significant digit first, 8 bits at a time. Digits that every key
+// has in common are skipped, so keys that only use their low bits, or only
+// a few fields, take fewer passes. Each pass is split into chunks: each
+// chunk counts its digits, then scatters them to where the counts say. With
+// 'pJobs', the chunks run across its threads.
+void radixSort(uint64_t*         pKeys,
+               uint32_t*         pValues,
+               uint32_t          count,
+               RadixSortScratch* pScratch,
+               JobPool*          pJobs = nullptr);
@@ -0,0 +1,289 @@
+#pragma once
+
+#include "00-Prelude.hpp"
+
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+class RenderGraph;
+
+// ==== Resources ===============================================================
+
+// A handle to an image owned, or imported, by a RenderGraph.
+struct RgImage
+{
+    uint32_t    index   = UINT32_MAX;
+
+    bool valid() const { return index != UINT32_MAX; }
+};
+
+struct RgImageDesc
+{
+    VkFormat                format  = VK_FORMAT_UNDEFINED;
+    VkExtent2D              extent  = {};
+    VkSampleCountFlagBits   samples = VK_SAMPLE_COUNT_1_BIT;
+};
+
+// Where an imported image is when the graph starts, and where it has to be
+// when the graph is done with it.
+struct RgImportInfo
+{
+    VkImageLayout           initialLayout   = VK_IMAGE_LAYOUT_UNDEFINED;
+    // Whatever last touched the image, e.g. the stage the acquire semaphore
+    // was waited on for swapchain images.
+    VkPipelineStageFlags    initialStages   = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    VkAccessFlags           initialAccess   = 0;
+
+    VkImageLayout           finalLayout     = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkPipelineStageFlags    finalStages     = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+    VkAccessFlags           finalAccess     = 0;
+};
+
+// How a pass uses an image. Each one maps to a layout, stages, and access
+// mask, so passes never spell out barriers themselves.
+enum class RgUsage : uint8_t
+{
+    ColorAttachment,        // Written as a color attachment
+    DepthAttachment,        // Depth tested and written
+    DepthAttachmentRead,    // Depth tested, never written
+    SampledFragment,        // Sampled in a fragment shader
+    SampledCompute,         // Sampled in a compute shader
+    StorageReadCompute,     // imageLoad() in a compute shader
+    StorageWriteCompute,    // imageStore() in a compute shader
+    TransferSrc,
+    TransferDst,
+
+    Count
+};
+
+enum class RgLoadOp : uint8_t
+{
+    Load,       // Keep what's there
+    Clear,      // Clear it first
+    DontCare,   // Every pixel gets overwritten
+};
+
+// ==== Formats =================================================================
+
+// What matters most in a depth format.
+enum class DepthPrecision : uint8_t
+{
+    Bandwidth,  // D16 first. Half the traffic, fine for short depth ranges.
+    Balanced,   // D24 first.
+    Precision,  // D32 first.
+};
+
+// Returns the first depth format, in 'precision's order of preference, that
+// the device can use as an optimally tiled depth attachment.
+VkFormat chooseDepthFormat(VkPhysicalDevice physicalDevice,
+                           DepthPrecision   precision);
+
+// ==== Passes ==================================================================
+
+// What a pass's execute function gets to work with.
+struct RgPassContext
+{
+    VkCommandBuffer     cmd         = nullptr;
+    VkRenderPass        renderPass  = nullptr;  // Null for non-graphics passes
+    VkExtent2D          extent      = {};
+    RenderGraph const*  pGraph      = nullptr;
+};
+
+using RgExecuteFn = std::function<void(RgPassContext const&)>;
+
+// A pass declares every image it touches, and how. Declaration order is
+// execution order.
+//
+// Passes with color or depth attachments get a render pass of their own, and
+// run inside it.
+class RgPass
+{
+    public:
+        RgPass& color(RgImage           image,
+                      RgLoadOp          loadOp      = RgLoadOp::Clear,
+                      VkClearColorValue clearValue  = {});
+        RgPass& depth(RgImage                  image,
+                      RgLoadOp                 loadOp      = RgLoadOp::Clear,
+                      VkClearDepthStencilValue clearValue  = { 1.f, 0 },
+                      bool                     write       = true);
+        RgPass& read(RgImage image, RgUsage usage);
+        // With RgLoadOp::Load, the pass also depends on what was there before.
+        // Anything else means every pixel gets overwritten.
+        RgPass& write(RgImage  image,
+                      RgUsage  usage,
+                      RgLoadOp loadOp = RgLoadOp::Load);
+
+        // Never cull this pass, even if nothing reads what it writes.
+        RgPass& sideEffects();
+
+        RgPass& execute(RgExecuteFn fn);
+
+    private:
+        friend class RenderGraph;
+
+        struct Access
+        {
+            RgImage     image;
+            RgUsage     usage       = RgUsage::Count;
+            RgLoadOp    loadOp      = RgLoadOp::Load;
+            VkClearValue clearValue = {};
+        };
+
+        // Resolved by RenderGraph::compile().
+        struct Barrier
+        {
+            uint32_t        image       = 0;
+            VkImageLayout   oldLayout   = VK_IMAGE_LAYOUT_UNDEFINED;
+            VkImageLayout   newLayout   = VK_IMAGE_LAYOUT_UNDEFINED;
+            VkAccessFlags   srcAccess   = 0;
+            VkAccessFlags   dstAccess   = 0;
+        };
+
+        std::string                 m_name;
+        std::vector<Access>         m_accesses;
+        RgExecuteFn                 m_execute;
+        bool                        m_sideEffects   = false;
+
+        bool                        m_live          = false;
+        std::vector<Barrier>        m_barriers;
+        VkPipelineStageFlags        m_srcStages     = 0;
+        VkPipelineStageFlags        m_dstStages     = 0;
+        VkRenderPass                m_vkRenderPass  = nullptr;
+        uint64_t                    m_renderPassClass = 0;
+        std::vector<uint32_t>       m_attachments;  // Image indices, in order
+        std::vector<VkClearValue>   m_clearValues;
+        VkExtent2D                  m_extent        = {};
+};
+
+// ==== RenderGraph =============================================================
+
+struct RenderGraphInfo
+{
+    VkDevice                            device      = nullptr;
+    VkAllocationCallbacks const*        pAlloc      = nullptr;
+    VkPhysicalDeviceMemoryProperties    memoryProperties = {};
+};
+
+// A frame described as passes, and the images they read and write.
+//
+// compile() turns that into:
+// - Culling. Passes whose results nothing uses are dropped, walking back from
+//   the imported images (our outputs) and passes with side effects.
+// - One VkRenderPass per graphics pass. Stores of attachments that nothing
+//   reads afterward become DONT_CARE.
+// - The minimal set of barriers and layout transitions between passes,
+//   batched to one vkCmdPipelineBarrier per pass. Reads after reads in the
+//   same layout don't get one at all.
+// - Transient images whose lifetimes don't overlap share memory.
+// - Attachments that live and die inside one pass are never loaded or stored,
+//   so they get TRANSIENT_ATTACHMENT usage, and LAZILY_ALLOCATED memory when
+//   the device has it. On tiled GPUs, they never leave tile memory.
+//
+// Build and compile the graph once. Each frame, point the imported images at
+// this frame's VkImages, and execute() it.
+class RenderGraph
+{
+    public:
+        RenderGraph() = default;
+        ~RenderGraph();
+
+        RenderGraph(RenderGraph const&)            = delete;
+        RenderGraph& operator=(RenderGraph const&) = delete;
+
+        void     init(RenderGraphInfo const& info);
+        // Destroys everything, including passes. Build it again to re-use it.
+        void     deInit();
+
+        // An image the graph creates, and owns the memory for.
+        RgImage  createImage(const char* pName, RgImageDesc const& desc);
+        // An image someone else owns, like a swapchain image.
+        RgImage  importImage(const char*         pName,
+                             RgImageDesc const&  desc,
+                             RgImportInfo const& importInfo);
+
+        RgPass&  addPass(const char* pName);
+
+        VkResult compile();
+
+        // Points an imported image at this frame's image. Framebuffers that
+        // use it are cached by view.
+        void     setImportedImage(RgImage image, VkImage vkImage,
+                                  VkImageView vkView);
+
+        void     execute(VkCommandBuffer cmd);
+
+        // Valid after compile(). Null if the pass was culled, or isn't a
+        // graphics pass.
+        VkRenderPass renderPass(RgPass const& pass) const;
+        // Equal for render passes that are compatible, so a pipeline made
+        // for one works with the other, e.g. after a resize.
+        uint64_t     renderPassClass(RgPass const& pass) const;
+        VkImageView  imageView(RgImage image) const;
+        // The view shaders read. Only the depth aspect, for depth/stencil
+        // images.
+        VkImageView  sampledView(RgImage image) const;
+        VkImage      image(RgImage image) const;
+
+        // Lazily allocated memory is only committed once it's used, so this
+        // is most interesting after a few frames.
+        void     logStats() const;
+
+    private:
+        struct Image
+        {
+            std::string             name;
+            RgImageDesc             desc;
+            bool                    imported        = false;
+            RgImportInfo            importInfo;
+
+            VkImage                 vkImage         = nullptr;
+            VkImageView             vkView          = nullptr;
+            VkImageView             vkSampledView   = nullptr;
+            VkImageUsageFlags       usage           = 0;
+            uint32_t                firstPass       = UINT32_MAX;
+            uint32_t                lastPass        = 0;
+            uint32_t                memoryBlock     = UINT32_MAX;
+            VkMemoryRequirements    memReq          = {};
+            bool                    attachmentOnly  = true;
+            bool                    lazy            = false;
+        };
+
+        struct MemoryBlock
+        {
+            VkDeviceMemory          memory          = nullptr;
+            VkDeviceSize            size            = 0;
+            uint32_t                memoryTypeBits  = 0;
+            bool                    lazy            = false;
+            std::vector<uint32_t>   images;
+
+            // Everything any image in this block was last used with. The
+            // next image to use this memory waits on all of it.
+            VkPipelineStageFlags    lastStages      = 0;
+            VkAccessFlags           lastAccess      = 0;
+        };
+
+        void     cullPasses();
+        VkResult createTransientImages();
+        void     computeBarriers();
+        VkResult createRenderPass(RgPass* pPass);
+        VkFramebuffer getFramebuffer(RgPass const& pass);
+
+        RenderGraphInfo                         m_info;
+        std::vector<Image>                      m_images;
+        std::vector<std::unique_ptr<RgPass>>    m_passes;
+        std::vector<MemoryBlock>                m_blocks;
+
+        // Barriers into each imported image's final layout.
+        std::vector<RgPass::Barrier>            m_finalBarriers;
+        VkPipelineStageFlags                    m_finalSrcStages    = 0;
+        VkPipelineStageFlags                    m_finalDstStages    = 0;
+
+        std::unordered_map<uint64_t, VkFramebuffer> m_framebuffers;
+
+        // Stats
+        uint32_t                                m_culledPasses      = 0;
+        VkDeviceSize                            m_unaliasedBytes    = 0;
+        VkDeviceSize                            m_aliasedBytes      = 0;
+        VkDeviceSize                            m_lazyBytes         = 0;
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "00-Prelude.hpp"
+#include "FramePacer.hpp"
+#include "Mesh.hpp"
+#include "PipelineVariants.hpp"
+#include "SpscQueue.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+class Renderer;
+class Simulation;
+
+// Everything a frame needs from the main thread, copied, so neither side
+// touches the other's copy once it's submitted.
+struct FrameSnapshot
+{
+    uint64_t                            frame           = 0;
+    Vec3                                eye             = {};
+    Vec3                                target          = {};
+    PipelineVariantKey                  meshVariant;
+    bool                                depthPrepass    = false;
+    FrameLatency::Clock::time_point     inputTime       = {};
+};
+
+struct RenderThreadInfo
+{
+    // Already initialized. Only the render thread touches it from init() to
+    // deInit().
+    Renderer*   pRenderer   = nullptr;
+    // Optional. Each frame draws its instances, interpolated to when the
+    // frame starts.
+    Simulation* pSimulation = nullptr;
+};
+
+// Runs the renderer on its own thread, so a slow frame doesn't hold up
+// glfwPollEvents(), and the other way around.
+//
+// The main thread submits snapshots, and the render thread draws them, in
+// order. The queue between them is short, so a main thread that gets ahead
+// finds it full, and waits on events instead of piling up stale frames.
+//
+// GLFW's input functions are main thread only, so late latching can't read
+// the mouse from here. Instead, the main thread keeps publishing the newest
+// camera while it waits, and latchCamera() picks up whatever's newest.
+class RenderThread
+{
+    public:
+        RenderThread() = default;
+        ~RenderThread();
+
+        RenderThread(RenderThread const&)            = delete;
+        RenderThread& operator=(RenderThread const&) = delete;
+
+        void     init(RenderThreadInfo const& info);
+        // Finishes the frames already submitted, then joins the thread.
+        void     deInit();
+
+        // Main thread only. Returns false, without waiting, when the queue is
+        // full.
+        bool     submit(FrameSnapshot const& snapshot);
+        bool     full() const { return m_snapshots.full(); }
+
+        // Safe from any thread, e.g. from GLFW's framebuffer size callback.
+        // Only the newest size is applied, before the next frame.
+        void     resize(uint32_t width, uint32_t height);
+
+        // Main thread. The camera latchCamera() will pick up.
+        void     setLatestCamera(Vec3 const&                     eye,
+                                 Vec3 const&                     target,
+                                 FrameLatency::Clock::time_point inputTime);
+        // Render thread, from RendererInfo::latchInput.
+        void     latchCamera();
+
+    private:
+        static constexpr uint32_t   kQueueDepth = 2;
+        static constexpr uint64_t   kNoResize   = UINT64_MAX;
+
+        void     threadMain();
+        void     wake();
+        // Render thread. Applies a pending resize, if there is one.
+        bool     applyResize();
+        void     drawFrame();
+
+        RenderThreadInfo                            m_info;
+        std::thread                                 m_thread;
+        SpscQueue<FrameSnapshot, kQueueDepth>       m_snapshots;
+
+        // Width in the top half, height in the bottom, or kNoResize.
+        std::atomic<uint64_t>                       m_pendingSize   = { kNoResize };
+        std::atomic<bool>                           m_quitting      = { false };
+
+        // Only locked to go to sleep, or to wake the thread while it's asleep.
+        std::atomic<bool>                           m_sleeping      = { false };
+        std::mutex                                  m_sleepMutex;
+        std::condition_variable                     m_wakeup;
+
+        // Late latching
+        std::mutex                                  m_latestMutex;
+        Vec3                                        m_latestEye     = {};
+        Vec3                                        m_latestTarget  = {};
+        FrameLatency::Clock::time_point             m_latestTime    = {};
+        bool                                        m_hasLatest     = false;
+
+        std::vector<InstanceData>                   m_instances;    // Simulated
+
+        // Stats
+        uint64_t                                    m_framesDrawn   = 0;
+        uint64_t                                    m_queueFull     = 0;    // Main thread
+};
@@ -1,6 +1,25 @@
 #pragma once
 
 #include "00-Prelude.hpp"
+#include "AsyncIo.hpp"
+#include "ComputeQueue.hpp"
+#include "DepthPyramid.hpp"
+#include "Descriptors.hpp"
+#include "DrawList.hpp"
+#include "FramePacer.hpp"
+#include "GpuCulling.hpp"
+#include "InstanceBuffer.hpp"
+#include "Mesh.hpp"
+#include "PipelineVariants.hpp"
+#include "RenderGraph.hpp"
+#include "SoftwareOcclusion.hpp"
+#include "UniformRing.hpp"
+
+#include <functional>
+#include <unordered_map>
+
+class AssetArchive;
+class JobPool;
 
 // Information that the graphic system needs to know from other systems
 // e.g. Anything from GLFW
@@ -11,6 +30,74 @@ struct RendererInfo
     GLFWwindow* pWindow             = nullptr;
     int         framebufferWidth    = 0;
     int         framebufferHeight   = 0;
+
+    // Render into offscreen images, framebufferWidth x framebufferHeight,
+    // instead of presenting to pWindow. Nothing needs a window, or a display.
+    bool        headless            = false;
+
+    // Optional. Shaders are looked up here before falling back to loose files.
+    AssetArchive const* pAssets     = nullptr;
+
+    // Optional. Pipelines are compiled here instead of on the render thread.
+    JobPool*            pJobs       = nullptr;
+
+    // Which variant of the mesh pipeline to draw with.
+    PipelineVariantKey  meshVariant;
+
+    // How the depth buffer's format is picked.
+    DepthPrecision      depthPrecision = DepthPrecision::Balanced;
+
+    // Optional. A device index, or part of a device name, to use instead of
+    // the best scoring one.
+    const char*         pPhysicalDevice = nullptr;
+
+    // Run compute on its own queue when the device has one.
+    bool                asyncCompute    = true;
+
+    // Cull mesh objects in a compute shader, and draw them indirectly.
+    // Otherwise the CPU culls them, and draws them one by one.
+    bool                gpuCulling      = true;
+    // Also cull objects that face away from the camera. Only worth it when
+    // back faces are culled too.
+    bool                coneCulling     = false;
+    // Check every frame's GPU culling results against the CPU's.
+    bool                validateCulling = false;
+    // Also cull objects hidden behind others, in two phases, with a depth
+    // pyramid. Needs GPU culling, and a depth format shaders can sample.
+    bool                occlusionCulling = true;
+    // Without GPU culling, cull hidden objects with a software rasterizer
+    // instead, on the job threads.
+    bool                softwareOcclusion = false;
+
+    // How far, in pixels, an object's LOD may stray from full detail. 0
+    // always draws full detail.
+    float               lodErrorPixels  = 1.f;
+
+    // Late latching. Once the frame is recorded, right before it's submitted,
+    // latchInput() is called to sample input and setCamera() with it. The
+    // camera is then written over the frame's uniforms, which the GPU hasn't
+    // seen yet. Culling still uses the camera from the start of the frame, so
+    // this is off with occlusion culling, which needs the two to match.
+    bool                    lateLatch   = false;
+    std::function<void()>   latchInput;
+
+    // Lay down depth first, with a position-only pass, then shade with an
+    // EQUAL depth test, so every pixel is shaded once. Worth it when shading
+    // costs more than drawing the geometry twice.
+    bool                    depthPrepass = false;
+};
+
+// How suitable a physical device is. Compared field by field, in order, so a
+// discrete GPU always beats an integrated one, whatever its heap size.
+struct PhysicalDeviceScore
+{
+    bool            usable              = false;
+    uint32_t        typeRank            = 0;    // Discrete > integrated > virtual > CPU
+    VkDeviceSize    deviceLocalBytes    = 0;
+    uint32_t        extras              = 0;    // Nice-to-haves, one point each
+    std::string     reason;                     // Why it isn't usable
+
+    bool operator>(PhysicalDeviceScore const& other) const;
 };
 
 // Information queried from Vulkan about devices, capabilities, formats. etc.
@@ -33,6 +120,8 @@ struct QueriedVulkanInfo
         VkPhysicalDeviceFeatures            features                = {};
         VkPhysicalDeviceMemoryProperties    memoryProperties        = {};
         std::vector<VkExtensionProperties>  availableDeviceExts;
+        std::vector<VkQueueFamilyProperties> queueFamilies;
+        PhysicalDeviceScore                 score;
     };
     std::vector<PhysicalDeviceInfo>         physicalDeviceInfos;
     size_t                                  physicalDeviceIndex     = 0;
@@ -56,6 +145,49 @@ class Renderer
 
         void     doOneFrame();
 
+        // Recreates everything sized by the framebuffer. A size of 0 (e.g.
+        // minimized) skips frames until the next resize.
+        VkResult resize(uint32_t width, uint32_t height);
+
+        // Copies the mesh to the GPU. Replaces any previously uploaded mesh.
+        VkResult uploadMesh(MeshData const& mesh);
+
+        // Where the camera is, and what it looks at, from the next frame on.
+        // With late latching, from inside latchInput(), for this frame.
+        void     setCamera(Vec3 const& eye, Vec3 const& target);
+        Vec3 const& eye()          const { return m_eye; }
+        Vec3 const& cameraTarget() const { return m_cameraTarget; }
+
+        // Call right after input is polled, so the frame's latency can be
+        // measured from there. Late latching does this itself.
+        void     markInput() { m_latency.mark(LatencyMarker::Input); }
+        // When input was polled on another thread.
+        void     markInput(FrameLatency::Clock::time_point time)
+        {
+            m_latency.mark(LatencyMarker::Input, time);
+        }
+
+        // How long the GPU spent on the newest frame that's finished, or a
+        // negative value if the device can't time it.
+        double       lastGpuFrameMs() const { return m_lastGpuFrameMs; }
+        // Device memory in use by this process, or 0 if the device can't say.
+        VkDeviceSize deviceMemoryUsage() const;
+        char const*  deviceName() const;
+
+        // Changes one of MeshData::instances, or without any, the one copy of
+        // each object. Only the instances that changed are written to the GPU.
+        void     setInstance(uint32_t instance, InstanceData const& data);
+
+        // New variants are compiled in the background. Until they're ready,
+        // we keep drawing with the last one that was.
+        PipelineVariantKey const& meshVariant() const { return m_meshVariant; }
+        void setMeshVariant(PipelineVariantKey const& key) { m_meshVariant = key; }
+
+        // Changes the render graph, so it waits for the GPU to go idle, at
+        // the start of the next frame.
+        bool depthPrepass() const { return m_wantDepthPrepass; }
+        void setDepthPrepass(bool enabled) { m_wantDepthPrepass = enabled; }
+
         #define USE_CUSTOM_VK_ALLOC 0
         #if USE_CUSTOM_VK_ALLOC
         VkAllocationCallbacks const* getVkAlloc() const { return &m_vkAlloc; }
@@ -67,6 +199,15 @@ class Renderer
 
         // Windowing object
         GLFWwindow*                 m_pGlfwWindow               = nullptr;
+        bool                        m_headless                  = false;
+        AssetArchive const*         m_pAssets                   = nullptr;
+        JobPool*                    m_pJobs                     = nullptr;
+        std::string                 m_physicalDeviceOverride;
+
+        // Loose files init() needs, read in one batch while the device is
+        // created. Both are empty once init() returns.
+        AsyncFileReader             m_startupReader;
+        std::unordered_map<std::string, AsyncReadResult> m_startupFiles;
 
         // ---- Vulkan objects --------------------------------------------------
 
@@ -77,6 +218,10 @@ class Renderer
         VkAllocationCallbacks       m_vkAlloc                   = {}; // TODO
         VkQueue                     m_vkGraphicsQueue           = nullptr;
         uint32_t                    m_vkGraphicsQueueIndex      = -1;
+        VkQueue                     m_vkComputeQueue            = nullptr;
+        uint32_t                    m_vkComputeQueueIndex       = -1;
+        bool                        m_asyncCompute              = true;
+        ComputeQueue                m_computeQueue;
 
         // Presentation objects
         static constexpr uint32_t   N                           = 3;
@@ -84,33 +229,143 @@ class Renderer
         VkSwapchainKHR              m_vkSwapchain               = nullptr;
         VkImage                     m_vkPresentImages[N]        = {};
         VkImageView                 m_vkPresentImageViews[N]    = {};
-        VkFramebuffer               m_vkFramebuffers[N]         = {};
-        VkFence                     m_vkAcquireFence            = nullptr;
-        VkSemaphore                 m_vkRenderSemaphore         = nullptr;
+        VkDeviceMemory              m_vkOffscreenMemory[N]      = {};   // Headless only
+        bool                        m_swapchainOutOfDate        = false;
+
+        // Frame objects
+        // The CPU records one frame while the GPU works on the one before it.
+        static constexpr uint32_t   kFramesInFlight             = 2;
+        uint32_t                    m_frameIndex                = 0;
+        VkCommandBuffer             m_vkFrameCmdBuffers[kFramesInFlight]    = {};
+        VkFence                     m_vkFrameFences[kFramesInFlight]        = {};
+        VkSemaphore                 m_vkAcquireSemaphores[kFramesInFlight]  = {};
+        VkSemaphore                 m_vkRenderSemaphores[kFramesInFlight]   = {};
+
+        // GPU frame times, from a timestamp at each end of a frame's commands.
+        VkQueryPool                 m_vkTimestampPool           = nullptr;
+        uint64_t                    m_timestampMask             = 0;    // The valid bits
+        double                      m_timestampPeriodNs         = 0.0;
+        bool                        m_timestampsWritten[kFramesInFlight] = {};
+        double                      m_lastGpuFrameMs            = -1.0;
+        // Only with VK_EXT_memory_budget.
+        PFN_vkGetPhysicalDeviceMemoryProperties2KHR m_pfnGetMemoryProperties2 = nullptr;
 
         // Rendering objects
+        // The graph owns the render passes, framebuffers, and depth buffer.
+        RenderGraph                 m_renderGraph;
+        RgImage                     m_rgBackbuffer;
+        RgImage                     m_rgDepth;
+        RgPass*                     m_pMeshPass                 = nullptr;
+        DepthPrecision              m_depthPrecision            = DepthPrecision::Balanced;
         VkRenderPass                m_vkRenderPass              = nullptr;
+        uint64_t                    m_meshPassClass             = 0;
+        // With a depth prepass, the first one's render pass. The others are
+        // compatible with it.
+        VkRenderPass                m_vkDepthRenderPass         = nullptr;
+        uint64_t                    m_depthPassClass            = 0;
+        bool                        m_depthPrepass              = false;
+        bool                        m_wantDepthPrepass          = false;
 
         // Pools
         VkCommandPool               m_vkCommandPool             = nullptr;
-        VkDescriptorPool            m_vkDescriptorPool          = nullptr;
+        Descriptors                 m_descriptors;
+        bool                        m_hasUpdateTemplates        = false;
+        bool                        m_hasMaintenance1           = false;
+
+        // Culling
+        GpuCulling                  m_gpuCulling;
+        bool                        m_useGpuCulling             = true;
+        bool                        m_coneCulling               = false;
+        bool                        m_validateCulling           = false;
+        bool                        m_occlusionCulling          = false;
+        DepthPyramid                m_depthPyramid;
+        bool                        m_hasDrawIndirectCount      = false;
+        PFN_vkCmdDrawIndexedIndirectCountKHR m_pfnDrawIndirectCount = nullptr;
+        std::vector<VkDrawIndexedIndirectCommand> m_cpuDraws;
+        std::vector<uint32_t>       m_cpuDrawObjects;
+        DrawList                    m_drawList;
+        SoftwareOcclusion           m_softwareOcclusion;
+        bool                        m_useSoftwareOcclusion      = false;
+        std::vector<uint8_t>        m_cpuVisible;
+
+        // Camera, updated at the start of each frame.
+        VkExtent2D                  m_framebufferExtent         = {};
+        Vec3                        m_eye                       = Vec3(0.f, 0.f, -4.5f);
+        Vec3                        m_cameraTarget              = Vec3(0.f, 0.f,  1.5f);
+        Mat4                        m_viewProjection            = {};
+        float                       m_pixelsPerUnit             = 0.f;  // At a distance of 1
 
-        // Depth Buffer objects
-        VkImage                     m_vkDepthImage              = nullptr;
-        VkImageView                 m_vkDepthImageView          = nullptr;
-        VkDeviceMemory              m_vkDepthDeviceMemory       = nullptr;
+        // Late latching. The mapped uniforms this frame's camera goes into.
+        bool                        m_lateLatch                 = false;
+        std::function<void()>       m_latchInput;
+        std::vector<MeshUniforms*>  m_latchedUniforms;
+        FrameLatency                m_latency;
+
+        // LODs, picked for each object at the start of each frame.
+        std::vector<MeshObjectLods> m_meshLods;
+        std::vector<uint8_t>        m_objectLods;               // Last frame's picks
+        float                       m_lodErrorPixels            = 1.f;
+        uint64_t                    m_fullDetailTriangles       = 0;
+        uint64_t                    m_lodTriangles              = 0;
+
+        // Instances, grouped by object, so each object draws every copy of
+        // itself at once. m_meshObjects' spheres hold all of those copies.
+        InstanceBuffer              m_instanceBuffer;
+        std::vector<MeshObject>     m_baseObjects;              // Before instancing
+        std::vector<uint32_t>       m_instanceSlots;            // Where each is in the stream
+        std::vector<uint32_t>       m_instanceObjects;          // What each is a copy of
+        std::vector<uint8_t>        m_movedObjects;             // Need new spheres
+        bool                        m_instancesMoved            = false;
+        bool                        m_identityInstances         = true; // Each object once, where it is
+        // How many of GPU culling's copies of the objects are out of date.
+        uint32_t                    m_staleObjectFrames         = 0;
 
         // Pipeline objects
-        VkShaderModule              m_vkShaderModule            = nullptr;
+        VkShaderModule              m_vkMeshVertModule          = nullptr;
+        VkShaderModule              m_vkMeshFragModule          = nullptr;
+        VkShaderModule              m_vkMeshDepthVertModule     = nullptr;
         VkDescriptorSet             m_vkDescriptorSet           = nullptr;
         VkDescriptorSetLayout       m_vkDescriptorSetLayout     = nullptr;
+        DescriptorLayout const*     m_pMeshSetLayout            = nullptr;
 
-        VkPipeline                  m_vkPipeline                = nullptr;
         VkPipelineLayout            m_vkPipelineLayout          = nullptr;
+        VkPipelineCache             m_vkPipelineCache           = nullptr;
+        PipelineVariants            m_meshPipelines;
+        PipelineVariantKey          m_meshVariant;
+        PipelineVariantKey          m_meshReadyVariant;
+        uint32_t                    m_meshSubstitutedFrames     = 0;
+        // Depth prepass variants. Only their quantization, and sample count,
+        // matter. Initialized with the first depth prepass.
+        PipelineVariants            m_depthPipelines;
+        bool                        m_hasDepthPipelines         = false;
+        // Picked at the start of each frame, so every pass draws the same
+        // positions, even if a variant finishes compiling mid-frame.
+        PipelineVariantKey          m_frameVariant;
+        VkPipeline                  m_frameMeshPipeline         = nullptr;
+        VkPipeline                  m_frameDepthPipeline        = nullptr;
+
+        // Mesh objects
+        // Both vertex formats are kept, so switching variants is free.
+        VkBuffer                    m_vkVertexBuffer            = nullptr;
+        VkDeviceMemory              m_vkVertexDeviceMemory      = nullptr;
+        VkBuffer                    m_vkQuantizedBuffer         = nullptr;
+        VkDeviceMemory              m_vkQuantizedDeviceMemory   = nullptr;
+        VkBuffer                    m_vkIndexBuffer             = nullptr;
+        VkDeviceMemory              m_vkIndexDeviceMemory       = nullptr;
+        uint32_t                    m_vertexCount               = 0;
+        std::vector<MeshObject>     m_meshObjects;
+        glm::vec4                   m_positionScale             = {};
+        // Every material, in one storage buffer that draws index into.
+        VkBuffer                    m_vkMaterialBuffer          = nullptr;
+        VkDeviceMemory              m_vkMaterialDeviceMemory    = nullptr;
+        uint32_t                    m_materialCount             = 0;
 
         // Shader Uniforms
+        // Persistently mapped, and split between the frames in flight.
+        static constexpr VkDeviceSize kUniformBytesPerFrame     = 256 * 1024;
         VkBuffer                    m_vkUniformBuffer           = nullptr;
         VkDeviceMemory              m_vkUniformDeviceMemory     = nullptr;
+        UniformRing                 m_uniformRing;
 
         QueriedVulkanInfo           m_queriedInfo;
 
@@ -120,11 +375,74 @@ class Renderer
         VkResult createLayers();
         VkResult createInstance();
         VkResult createPhysicalDevice();
+        PhysicalDeviceScore scorePhysicalDevice(
+            QueriedVulkanInfo::PhysicalDeviceInfo const& deviceInfo) const;
         VkResult createDevice();
         VkResult createFencesAndSemaphores();
+        VkResult createTimestampQueries();
         VkResult createSwapChain();
         VkResult createPresentImages();
+        VkResult createOffscreenImages();
+        void     destroyPresentImages();
         VkResult createCommandPool();
-        VkResult createDepthBuffer(VkExtent3D const& extent);
-        VkResult createRenderPassAndFramebuffer(VkExtent3D const& extent);
+        VkResult createRenderGraph(VkExtent2D const& extent);
+        // For a new size, or a new set of passes. The pipelines are pointed
+        // at the new render passes, which are compatible with the old ones.
+        VkResult rebuildRenderGraph();
+        VkResult createUniformBuffer();
+        VkResult createDescriptorSet();
+        // Replaces the material table, and points the mesh set at it. The
+        // GPU can't be using the old one.
+        VkResult uploadMaterials(MeshMaterial const* pMaterials, uint32_t count);
+        VkResult createPipelineCache();
+        void     savePipelineCache();
+        VkResult createMeshPipelines();
+        VkResult createDepthPipelines();
+        void     applyDepthPrepass();
+        VkResult createGpuCulling();
+
+        void     updateCamera();
+        void     selectLods();
+        void     updateInstances();
+        void     updateObjectSphere(uint32_t object);
+
+        // Picks this frame's mesh variant, and its depth prepass variant.
+        void     selectMeshVariant();
+        // Culls on the CPU, and sorts what's left into m_drawList. With GPU
+        // culling, it stays empty.
+        void     buildDrawList();
+        UniformAllocation pushMeshUniforms();
+
+        // Draws whatever 'phase' of GPU culling left, or everything the CPU
+        // doesn't cull, for CullPhase::All. 'depthOnly' is the depth prepass.
+        void     recordMeshPass(RgPassContext const& context,
+                                CullPhase            phase,
+                                bool                 depthOnly = false);
+
+        // Returns VK_MAX_MEMORY_TYPES if no memory type fits.
+        uint32_t findMemoryType(uint32_t              memoryTypeBits,
+                                VkMemoryPropertyFlags properties) const;
+        VkResult createBuffer(VkDeviceSize          size,
+                              VkBufferUsageFlags    usage,
+                              VkMemoryPropertyFlags properties,
+                              VkBuffer*             pBuffer,
+                              VkDeviceMemory*       pMemory);
+        void     destroyBuffer(VkBuffer* pBuffer, VkDeviceMemory* pMemory);
+        // Creates a device local buffer holding a copy of 'pSrc'. Waits for
+        // the copy, so only use it while loading.
+        VkResult uploadBuffer(void const*        pSrc,
+                              VkDeviceSize       size,
+                              VkBufferUsageFlags usage,
+                              VkBuffer*          pBuffer,
+                              VkDeviceMemory*    pMemory);
+
+        // Queues every loose file init() reads, and submits them at once.
+        // finishStartupReads() waits for all of them.
+        void     beginStartupReads();
+        void     finishStartupReads();
+        // Returns nullptr if 'pFilename' wasn't read, or couldn't be.
+        AsyncReadResult const* startupFile(const char* pFilename) const;
+
+        VkResult createShaderModule(const char*     pFilename,
+                                    VkShaderModule* pShaderModule);
 };
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "00-Prelude.hpp"
+#include "Mesh.hpp"
+
+class AssetArchive;
+
+// Loads a wavefront model, e.g. "cornell_box.obj", into 'pMesh', replacing
+// whatever was there. It's looked up under "models/" in 'pAssets', if there
+// is one, or in tinyobjloader's models directory otherwise. Each shape
+// becomes an object, and everything is scaled to fit a 3 unit box.
+// Returns false if it couldn't be loaded.
+bool loadObjMesh(AssetArchive const* pAssets,
+                 char const*         pName,
+                 MeshData*           pMesh);
+
+// ==== Synthetic scenes ========================================================
+
+struct SceneDesc
+{
+    uint32_t    seed            = 1;
+    uint32_t    instanceCount   = 1000; // Copies of the unique meshes, in all
+    uint32_t    meshCount       = 8;    // Unique meshes, made from the models
+    uint32_t    materialCount   = 4;
+    float       spacing         = 6.f;  // Roughly, between instances
+};
+
+// Generates a scene, the same one every time for the same 'desc' and models.
+//
+// Each unique mesh is one of 'models', in turn, stretched and sheared by its
+// own random amounts, so no two share vertices. Instances are scattered over
+// a square on the XZ plane, with a random mesh, yaw, scale, and material.
+void generateScene(std::vector<MeshData> const& models,
+                   SceneDesc const&             desc,
+                   MeshData*                    pOut);
+
+// How wide the square that generateScene() scatters instances over is.
+float sceneWidth(SceneDesc const& desc);
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "00-Prelude.hpp"
+#include "Mesh.hpp"
+#include "TripleBuffer.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+struct SimulationInfo
+{
+    double                      stepHz      = 60.0;
+    // How fast instances spin about their own origin, in radians per second.
+    // Each one's rate is scaled a little by where it is.
+    float                       spinRate    = 0.f;
+    // Where every instance starts.
+    std::vector<InstanceData>   instances;
+};
+
+// One step of the simulation, as the renderer sees it. It carries the step
+// before it too, so the renderer can draw anywhere in between.
+struct SimState
+{
+    using Clock = std::chrono::steady_clock;
+
+    uint64_t            step        = 0;
+    Clock::time_point   time        = {};   // When the step is for
+    std::vector<float>  prevYaw;
+    std::vector<float>  yaw;
+};
+
+// Steps the world at a fixed rate on its own thread, whatever rate frames are
+// drawn at.
+//
+// Each step writes a SimState into a triple buffer, so the render thread
+// always has a whole, stable one to read, and neither thread takes a lock to
+// hand it over. Frames are drawn one step behind, interpolated between the
+// newest step and the one before it, so motion is smooth at any frame rate.
+//
+// When steps fall behind (e.g. the machine is busy), a few are run back to
+// back to catch up. Past that, the time is dropped, rather than spiralling.
+class Simulation
+{
+    public:
+        using Clock = SimState::Clock;
+
+        Simulation() = default;
+        ~Simulation();
+
+        Simulation(Simulation const&)            = delete;
+        Simulation& operator=(Simulation const&) = delete;
+
+        void     init(SimulationInfo const& info);
+        void     deInit();
+
+        uint32_t instanceCount() const { return as<uint32_t>(m_info.instances.size()); }
+
+        // Render thread only. The instances at 'now', less one step. Returns
+        // false if there hasn't been a step yet.
+        bool     sample(Clock::time_point now, std::vector<InstanceData>* pOut);
+
+    private:
+        static constexpr uint32_t   kMaxCatchUpSteps = 5;
+
+        void     threadMain();
+        void     step();
+
+        SimulationInfo              m_info;
+        Clock::duration             m_step          = {};
+        float                       m_stepSeconds   = 0.f;
+        std::vector<float>          m_spinRates;    // Radians per step
+        std::vector<float>          m_yaw;          // Simulation thread only
+
+        TripleBuffer<SimState>      m_states;
+
+        std::thread                 m_thread;
+        std::mutex                  m_mutex;        // Only to sleep on
+        std::condition_variable     m_wakeup;
+        bool                        m_quitting      = false;
+
+        // Stats
+        uint64_t                    m_stepCount     = 0;
+        uint64_t                    m_droppedSteps  = 0;
+        double                      m_stepMsSum     = 0.0;
+};
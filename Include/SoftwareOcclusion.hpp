@@ -0,0 +1,121 @@
+#pragma once
+
+#include "00-Prelude.hpp"
+#include "Mesh.hpp"
+
+class JobPool;
+
+struct SoftwareOcclusionInfo
+{
+    // Optional. Rasterizing and testing are split across its threads.
+    JobPool*    pJobs                   = nullptr;
+
+    // Of the depth buffer. Both must be multiples of 8.
+    uint32_t    width                   = 320;
+    uint32_t    height                  = 192;
+
+    // Occluders are the biggest objects, by bounding sphere, up to this many
+    // of them, with up to this many triangles between them.
+    uint32_t    maxOccluders            = 16;
+    uint32_t    maxOccluderTriangles    = 16 * 1024;
+};
+
+// What one frame cost, and what it got for it.
+struct SoftwareOcclusionStats
+{
+    double      rasterMs            = 0.0;
+    double      testMs              = 0.0;
+    uint32_t    occluderTriangles   = 0;    // Rasterized, after clipping
+    uint32_t    testedObjects       = 0;
+    uint32_t    occludedObjects     = 0;
+};
+
+// Occlusion culling on the CPU, for devices without good compute.
+//
+// A few of the biggest objects are picked as occluders. Each frame, their
+// triangles are rasterized into a small depth buffer, and every object's
+// bounds are tested against it. An object is occluded when the nearest point
+// of its bounds is behind everything the occluders left under it.
+//
+// Every 8x8 tile also keeps its farthest depth, so most tests never look at
+// a single pixel. Rows of tiles are rasterized, and objects tested, in
+// parallel on the job threads.
+//
+// Pixels are done 8 at a time with AVX2, when the build enables it, 4 with
+// SSE2, or one at a time otherwise.
+class SoftwareOcclusion
+{
+    public:
+        SoftwareOcclusion() = default;
+        ~SoftwareOcclusion();
+
+        SoftwareOcclusion(SoftwareOcclusion const&)            = delete;
+        SoftwareOcclusion& operator=(SoftwareOcclusion const&) = delete;
+
+        void     init(SoftwareOcclusionInfo const& info);
+        void     deInit();
+
+        // Picks the occluders, and keeps a copy of their triangles. Every
+        // object in 'mesh' is tested by cull().
+        void     setMesh(MeshData const& mesh);
+        uint32_t objectCount() const { return as<uint32_t>(m_spheres.size()); }
+
+        // Rasterizes the occluders, then writes 0 to 'pVisible' for each
+        // object they hide, and 1 for the rest.
+        void     cull(Mat4 const& viewProjection, uint8_t* pVisible);
+
+        SoftwareOcclusionStats const& lastFrame() const { return m_lastFrame; }
+        void     logStats() const;
+
+        // Which instruction set the rasterizer was built for.
+        static const char* simdName();
+
+    private:
+        // Screen space edge equations, and depth plane, of one triangle.
+        struct Triangle
+        {
+            // Inside when A x + B y + C >= 0, for all three edges.
+            float       edgeA[3]    = {};
+            float       edgeB[3]    = {};
+            float       edgeC[3]    = {};
+            // z = zA x + zB y + zC
+            float       zA          = 0.f;
+            float       zB          = 0.f;
+            float       zC          = 0.f;
+            // Pixels, inclusive.
+            int32_t     minX        = 0;
+            int32_t     maxX        = 0;
+            int32_t     minY        = 0;
+            int32_t     maxY        = 0;
+        };
+
+        void     setupTriangles(Mat4 const& viewProjection);
+        // Rasterizes every triangle into one row of tiles, then updates the
+        // row's tile maximums.
+        void     rasterizeTileRow(uint32_t tileY);
+        bool     isOccluded(glm::vec4 const& sphere,
+                            Mat4 const&      viewProjection) const;
+
+        static constexpr uint32_t       kTileSize           = 8;
+
+        SoftwareOcclusionInfo           m_info;
+        uint32_t                        m_tilesX            = 0;
+        uint32_t                        m_tilesY            = 0;
+        std::vector<float>              m_depth;
+        std::vector<float>              m_tileMax;
+
+        std::vector<glm::vec4>          m_spheres;
+        // Three world space positions per triangle.
+        std::vector<Vec3>               m_occluderVerts;
+        uint32_t                        m_occluderCount     = 0;
+        std::vector<Triangle>           m_triangles;
+
+        // Stats
+        SoftwareOcclusionStats          m_lastFrame;
+        uint64_t                        m_frameCount        = 0;
+        double                          m_totalRasterMs     = 0.0;
+        double                          m_totalTestMs       = 0.0;
+        double                          m_worstMs           = 0.0;
+        uint64_t                        m_testedObjects     = 0;
+        uint64_t                        m_occludedObjects   = 0;
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "00-Prelude.hpp"
+
+#include <atomic>
+
+// A bounded queue between exactly one producer thread and one consumer thread.
+//
+// Neither side ever blocks, or takes a lock. Each index is only written by
+// one side, so pushing and popping are a load, a copy, and a store each. The
+// indices are on their own cache lines, so the two sides don't keep stealing
+// them from each other.
+//
+// One slot is always left empty, to tell a full queue from an empty one.
+template <typename T, uint32_t Capacity>
+class SpscQueue
+{
+    static_assert(Capacity >= 1, "SpscQueue needs room for something");
+
+    public:
+        SpscQueue() = default;
+
+        SpscQueue(SpscQueue const&)            = delete;
+        SpscQueue& operator=(SpscQueue const&) = delete;
+
+        // Producer only. Returns false, and leaves 'item' alone, when full.
+        bool tryPush(T const& item)
+        {
+            uint32_t tail = m_tail.load(std::memory_order_relaxed);
+            uint32_t next = (tail + 1) % kSlotCount;
+            if (next == m_head.load(std::memory_order_acquire)) {
+                return false;
+            }
+            m_slots[tail] = item;
+            m_tail.store(next, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer only. Returns false when empty.
+        bool tryPop(T* pItem)
+        {
+            uint32_t head = m_head.load(std::memory_order_relaxed);
+            if (head == m_tail.load(std::memory_order_acquire)) {
+                return false;
+            }
+            *pItem = m_slots[head];
+            m_head.store((head + 1) % kSlotCount, std::memory_order_release);
+            return true;
+        }
+
+        // Either side. Only a hint, since the other side keeps going.
+        bool full() const
+        {
+            uint32_t tail = m_tail.load(std::memory_order_acquire);
+            return (tail + 1) % kSlotCount == m_head.load(std::memory_order_acquire);
+        }
+        bool empty() const
+        {
+            return m_head.load(std::memory_order_acquire) ==
+                   m_tail.load(std::memory_order_acquire);
+        }
+
+    private:
+        static constexpr uint32_t kSlotCount = Capacity + 1;
+
+        alignas(64) std::atomic<uint32_t>   m_head  = { 0 };    // Next to pop
+        alignas(64) std::atomic<uint32_t>   m_tail  = { 0 };    // Next to push
+        alignas(64) T                       m_slots[kSlotCount] = {};
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "00-Prelude.hpp"
+
+#include <vector>
+
+class JobPool;
+
+using TransformId = uint32_t;
+static constexpr TransformId kNoTransform = UINT32_MAX;
+
+struct TransformHierarchyInfo
+{
+    // Optional. Each depth's nodes are split across its threads.
+    JobPool*    pJobs       = nullptr;
+    // Nodes per job. Levels smaller than this stay on the calling thread.
+    uint32_t    grainSize   = 2048;
+};
+
+// What the last update() cost, and how much of the hierarchy it touched.
+struct TransformHierarchyStats
+{
+    double      updateMs        = 0.0;
+    uint32_t    updatedNodes    = 0;    // World matrices recomputed
+    uint32_t    levels          = 0;
+};
+
+// Local and world matrices for a tree of nodes, e.g. scene objects and the
+// parts attached to them.
+//
+// Everything is kept in flat arrays, one per field, sorted by depth in the
+// tree. So every parent comes before its children, and one pass from front
+// to back computes every world matrix from one that's already done. Each
+// depth's nodes only read the depth above, so a depth can be split across
+// the job threads, with a barrier between depths.
+//
+// setLocal() only marks the node. update() recomputes the marked nodes, and
+// everything under them, starting from the shallowest marked depth. Nothing
+// else is touched. The multiplies are done 4 floats at a time with SSE, when
+// the build has it.
+//
+// Ids are stable. Adding a node shallower than the deepest one re-sorts the
+// arrays on the next update(), so add in bulk, before updating.
+class TransformHierarchy
+{
+    public:
+        TransformHierarchy() = default;
+        ~TransformHierarchy();
+
+        TransformHierarchy(TransformHierarchy const&)            = delete;
+        TransformHierarchy& operator=(TransformHierarchy const&) = delete;
+
+        void        init(TransformHierarchyInfo const& info);
+        void        deInit();
+
+        // 'parent' must already have been added, or be kNoTransform.
+        TransformId add(Mat4 const& local, TransformId parent = kNoTransform);
+
+        void        setLocal(TransformId id, Mat4 const& local);
+        Mat4 const& local(TransformId id) const { return m_locals[m_slots[id]]; }
+        // As of the last update().
+        Mat4 const& world(TransformId id) const { return m_worlds[m_slots[id]]; }
+
+        uint32_t    count() const { return as<uint32_t>(m_slots.size()); }
+
+        // Brings the world matrices up to date.
+        void        update();
+
+        TransformHierarchyStats const& stats() const { return m_stats; }
+
+    private:
+        void        sortByDepth();
+        void        updateRange(uint32_t begin, uint32_t end, uint32_t* pUpdated);
+
+        TransformHierarchyInfo  m_info;
+
+        // By slot, sorted by depth.
+        std::vector<Mat4>       m_locals;
+        std::vector<Mat4>       m_worlds;
+        std::vector<uint32_t>   m_parents;      // Slots, or kNoTransform
+        std::vector<uint32_t>   m_depths;
+        std::vector<uint8_t>    m_dirty;
+        std::vector<TransformId> m_ids;
+
+        std::vector<uint32_t>   m_slots;        // By id
+        // Where each depth's slots start, and one past the last depth's.
+        std::vector<uint32_t>   m_levelStarts;
+
+        bool                    m_unsorted      = false;
+        uint32_t                m_minDirtyDepth = UINT32_MAX;
+
+        TransformHierarchyStats m_stats;
+};
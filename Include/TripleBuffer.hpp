@@ -0,0 +1,54 @@
+#pragma once
+
+#include "00-Prelude.hpp"
+
+#include <atomic>
+
+// Hands the newest copy of some state from one writer thread to one reader
+// thread, without either ever waiting on the other.
+//
+// There are three copies. The writer owns one, the reader owns one, and the
+// third sits in the middle. publish() swaps the writer's copy with the middle
+// one, and update() swaps the middle one with the reader's, if it's newer.
+// Either way, that's one atomic exchange of a byte. The reader's copy stays
+// put until it asks for a newer one, however far ahead the writer gets.
+template <typename T>
+class TripleBuffer
+{
+    public:
+        TripleBuffer() = default;
+
+        TripleBuffer(TripleBuffer const&)            = delete;
+        TripleBuffer& operator=(TripleBuffer const&) = delete;
+
+        // Writer only. What it left here two publishes ago, so it has to
+        // write every field again.
+        T&       writeBuffer()      { return m_buffers[m_write]; }
+        void     publish()
+        {
+            uint8_t old = m_middle.exchange(m_write | kFresh,
+                                            std::memory_order_acq_rel);
+            m_write = old & kIndexMask;
+        }
+
+        // Reader only. Takes the newest copy, if there's one it hasn't seen.
+        bool     update()
+        {
+            if ((m_middle.load(std::memory_order_relaxed) & kFresh) == 0) {
+                return false;
+            }
+            uint8_t old = m_middle.exchange(m_read, std::memory_order_acq_rel);
+            m_read = old & kIndexMask;
+            return true;
+        }
+        T const& readBuffer() const { return m_buffers[m_read]; }
+
+    private:
+        static constexpr uint8_t kIndexMask = 0x3;
+        static constexpr uint8_t kFresh     = 0x4;   // Published, not yet read
+
+        T                                   m_buffers[3]    = {};
+        alignas(64) std::atomic<uint8_t>    m_middle        = { 1 };
+        alignas(64) uint8_t                 m_write         = 0;    // Writer only
+        alignas(64) uint8_t                 m_read          = 2;    // Reader only
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "00-Prelude.hpp"
+
+// One sub-allocation out of a UniformRing.
+struct UniformAllocation
+{
+    void*       pData   = nullptr;  // Write the uniforms here
+    uint32_t    offset  = 0;        // Pass this as the dynamic offset
+};
+
+struct UniformRingInfo
+{
+    VkDevice        device          = nullptr;
+    VkDeviceMemory  memory          = nullptr;  // Backs the whole buffer
+    void*           pMapped         = nullptr;  // Persistently mapped memory
+    bool            coherent        = true;     // Otherwise, we flush
+
+    uint32_t        frameCount      = 0;        // Frames in flight
+    VkDeviceSize    bytesPerFrame   = 0;        // From frameSize()
+
+    // minUniformBufferOffsetAlignment, and nonCoherentAtomSize if we flush.
+    VkDeviceSize    alignment       = 0;
+};
+
+// A persistently mapped uniform buffer, split into one slice per frame in
+// flight.
+//
+// Each frame bump allocates out of its own slice, which the GPU can't still
+// be reading from once that frame's fence has signaled. Every allocation is
+// bound through the same UNIFORM_BUFFER_DYNAMIC descriptor, with its offset
+// passed to vkCmdBindDescriptorSets.
+//
+// Per-draw uniforms become a pointer bump and a memcpy.
+class UniformRing
+{
+    public:
+        UniformRing() = default;
+
+        // Rounds a slice up so every frame starts aligned.
+        static VkDeviceSize frameSize(VkDeviceSize bytesPerFrame,
+                                      VkDeviceSize alignment);
+
+        void init(UniformRingInfo const& info);
+        void deInit();
+
+        // Starts allocating from 'frameIndex's slice, throwing away whatever
+        // was in it. Only call once that frame's fence has signaled.
+        void beginFrame(uint32_t frameIndex);
+
+        // Returns an allocation with a null pData if the slice is full.
+        UniformAllocation allocate(VkDeviceSize size);
+
+        template<typename T>
+        UniformAllocation push(T const& uniforms)
+        {
+            UniformAllocation allocation = allocate(sizeof(T));
+            if (allocation.pData != nullptr) {
+                memcpy(allocation.pData, &uniforms, sizeof(T));
+            }
+            return allocation;
+        }
+
+        // Makes this frame's writes visible to the GPU. Call before submitting.
+        // This is free when the memory is coherent.
+        void flush();
+
+        // How much of the current slice is in use.
+        VkDeviceSize usedBytes() const { return m_head - m_frameBegin; }
+
+    private:
+        UniformRingInfo     m_info;
+        VkDeviceSize        m_frameBegin    = 0;
+        VkDeviceSize        m_frameEnd      = 0;
+        VkDeviceSize        m_head          = 0;
+        VkDeviceSize        m_flushed       = 0;
+};
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "00-Prelude.hpp"
+
+// The first of 'memoryTypeBits' that has all of 'flags'. Returns
+// VK_MAX_MEMORY_TYPES if no memory type fits.
+[[nodiscard]]
+uint32_t findMemoryType(VkPhysicalDeviceMemoryProperties const& properties,
+                        uint32_t                                memoryTypeBits,
+                        VkMemoryPropertyFlags                   flags);
+
+// Creates a buffer with its own allocation of 'flags' memory, bound at 0.
+VkResult createBuffer(VkDevice                                device,
+                      VkAllocationCallbacks const*            pAlloc,
+                      VkPhysicalDeviceMemoryProperties const& properties,
+                      VkDeviceSize                            size,
+                      VkBufferUsageFlags                      usage,
+                      VkMemoryPropertyFlags                   flags,
+                      VkBuffer*                               pBuffer,
+                      VkDeviceMemory*                         pMemory);
@@ -0,0 +1,487 @@
+#include "AssetArchive.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+uint64_t hashAssetName(const char* pName, size_t length)
+{
+    return hashBytes(pName, length);
+}
+
+static uint32_t bucketOf(uint64_t hash, uint32_t bucketBits)
+{
+    return as<uint32_t>(hash >> (64 - bucketBits));
+}
+
+// ==== Lz ======================================================================
+// A byte-oriented LZ77, in the spirit of LZ4's block format:
+//
+//      token     - high nibble: literal count, low nibble: match length - 4
+//      [length]  - extra literal count bytes, if the nibble was 15
+//      literals
+//      offset    - 2 bytes, little-endian          (absent on the last token)
+//      [length]  - extra match length bytes, if the nibble was 15
+//
+// Extra length bytes are added up, and stop at the first byte that isn't 255.
+// It's not meant to compete with real compressors - it's here so text-heavy
+// assets (.obj, .mtl) don't bloat the archive, and it decodes very quickly.
+
+static constexpr uint32_t kLzMinMatch  = 4;
+static constexpr uint32_t kLzMaxOffset = 65535;
+static constexpr uint32_t kLzHashBits  = 14;
+
+static void lzWriteLength(std::vector<uint8_t>& out, size_t length)
+{
+    while (length >= 255) {
+        out.push_back(255);
+        length -= 255;
+    }
+    out.push_back(as<uint8_t>(length));
+}
+
+static void lzWriteSequence(std::vector<uint8_t>& out,
+                            const uint8_t*        pLiterals,
+                            size_t                literalCount,
+                            uint32_t              offset,
+                            size_t                matchLength)
+{
+    size_t matchExtra = (matchLength != 0) ? matchLength - kLzMinMatch : 0;
+
+    uint8_t token = as<uint8_t>((std::min<size_t>(literalCount, 15) << 4) |
+                                 std::min<size_t>(matchExtra,   15));
+    out.push_back(token);
+    if (literalCount >= 15) {
+        lzWriteLength(out, literalCount - 15);
+    }
+    out.insert(out.end(), pLiterals, pLiterals + literalCount);
+
+    if (matchLength != 0) {
+        out.push_back(as<uint8_t>(offset & 0xFF));
+        out.push_back(as<uint8_t>(offset >> 8));
+        if (matchExtra >= 15) {
+            lzWriteLength(out, matchExtra - 15);
+        }
+    }
+}
+
+static std::vector<uint8_t> lzCompress(std::vector<uint8_t> const& in)
+{
+    std::vector<uint8_t> out;
+    out.reserve(in.size() / 2);
+
+    const uint8_t* pSrc = in.data();
+    size_t         size = in.size();
+
+    auto read32 = [pSrc](size_t i) {
+        uint32_t value;
+        memcpy(&value, &pSrc[i], sizeof(value));
+        return value;
+    };
+
+    // Most recent position of each hashed 4-byte sequence.
+    std::vector<int64_t> table(1u << kLzHashBits, -1);
+
+    size_t anchor = 0;
+    size_t i      = 0;
+    while (i + kLzMinMatch <= size) {
+        uint32_t sequence = read32(i);
+        uint32_t hash     = (sequence * 2654435761u) >> (32 - kLzHashBits);
+        int64_t  candidate = table[hash];
+        table[hash] = as<int64_t>(i);
+
+        if (candidate >= 0 &&
+            i - as<size_t>(candidate) <= kLzMaxOffset &&
+            read32(as<size_t>(candidate)) == sequence)
+        {
+            size_t match  = as<size_t>(candidate);
+            size_t length = kLzMinMatch;
+            while (i + length < size && pSrc[match + length] == pSrc[i + length]) {
+                length += 1;
+            }
+
+            lzWriteSequence(out, &pSrc[anchor], i - anchor,
+                            as<uint32_t>(i - match), length);
+            i     += length;
+            anchor = i;
+        } else {
+            i += 1;
+        }
+    }
+
+    // Whatever's left is literals, with no match after them.
+    lzWriteSequence(out, &pSrc[anchor], size - anchor, 0, 0);
+
+    return out;
+}
+
+// Returns false if 'pSrc' is malformed or doesn't decode to exactly 'dstSize'.
+static bool lzDecompress(const uint8_t* pSrc,
+                         size_t         srcSize,
+                         uint8_t*       pDst,
+                         size_t         dstSize)
+{
+    const uint8_t* pSrcEnd = pSrc + srcSize;
+    uint8_t*       pOut    = pDst;
+    uint8_t*       pOutEnd = pDst + dstSize;
+
+    auto readLength = [&pSrc, pSrcEnd](size_t& length) -> bool {
+        for (;;) {
+            if (pSrc >= pSrcEnd) {
+                return false;
+            }
+            uint8_t byte = *pSrc++;
+            length += byte;
+            if (byte != 255) {
+                return true;
+            }
+        }
+    };
+
+    while (pSrc < pSrcEnd) {
+        uint8_t token = *pSrc++;
+
+        size_t literalCount = token >> 4;
+        if (literalCount == 15 && !readLength(literalCount)) {
+            return false;
+        }
+        if (literalCount > as<size_t>(pSrcEnd - pSrc) ||
+            literalCount > as<size_t>(pOutEnd - pOut))
+        {
+            return false;
+        }
+        memcpy(pOut, pSrc, literalCount);
+        pSrc += literalCount;
+        pOut += literalCount;
+
+        // The last token has no match.
+        if (pSrc == pSrcEnd) {
+            break;
+        }
+
+        if (pSrcEnd - pSrc < 2) {
+            return false;
+        }
+        size_t offset = pSrc[0] | (pSrc[1] << 8);
+        pSrc += 2;
+
+        size_t matchLength = token & 0xF;
+        if (matchLength == 15 && !readLength(matchLength)) {
+            return false;
+        }
+        matchLength += kLzMinMatch;
+
+        if (offset == 0 ||
+            offset > as<size_t>(pOut - pDst) ||
+            matchLength > as<size_t>(pOutEnd - pOut))
+        {
+            return false;
+        }
+        // Matches can overlap what they're writing, so go byte by byte.
+        const uint8_t* pMatch = pOut - offset;
+        for (size_t i = 0; i < matchLength; i += 1) {
+            pOut[i] = pMatch[i];
+        }
+        pOut += matchLength;
+    }
+
+    return pOut == pOutEnd;
+}
+
+// ==== AssetArchive ============================================================
+
+bool AssetArchive::open(const char* pFilename)
+{
+    close();
+
+    // Lookups jump all over the file.
+    if (!m_file.open(pFilename, FileAccess::Random)) {
+        return false;
+    }
+
+    const uint8_t* pBase = m_file.data();
+    size_t         size  = m_file.size();
+
+    auto fail = [this, pFilename](const char* pWhy) {
+        Bug("'%s' is not a valid archive: %s", pFilename, pWhy);
+        close();
+        return false;
+    };
+
+    if (size < sizeof(ArchiveHeader)) {
+        return fail("Too small");
+    }
+    auto const* pHeader = ptr_as<const ArchiveHeader>(pBase);
+    if (pHeader->magic != kArchiveMagic) {
+        return fail("Bad magic");
+    }
+    if (pHeader->version != kArchiveVersion) {
+        return fail("Unsupported version");
+    }
+    if (pHeader->bucketBits == 0 || pHeader->bucketBits > 31) {
+        return fail("Bad bucket count");
+    }
+
+    uint64_t bucketCount = 1ull << pHeader->bucketBits;
+    uint64_t tocEnd = sizeof(ArchiveHeader)
+                    + pHeader->entryCount * sizeof(ArchiveEntry)
+                    + (bucketCount + 1) * sizeof(uint32_t);
+    if (tocEnd > size ||
+        pHeader->namesOffset < tocEnd ||
+        pHeader->namesOffset + pHeader->namesSize > size)
+    {
+        return fail("Truncated table of contents");
+    }
+
+    m_pHeader  = pHeader;
+    m_pEntries = ptr_as<const ArchiveEntry>(pBase + sizeof(ArchiveHeader));
+    m_pBuckets = ptr_as<const uint32_t>(m_pEntries + pHeader->entryCount);
+    m_pNames   = ptr_as<const char>(pBase + pHeader->namesOffset);
+
+    for (uint32_t i = 0; i < pHeader->entryCount; i += 1) {
+        ArchiveEntry const& entry = m_pEntries[i];
+        if (entry.offset + entry.storedSize > size ||
+            entry.nameOffset + entry.nameLength > pHeader->namesSize)
+        {
+            return fail("Entry out of bounds");
+        }
+    }
+
+    Info("Opened archive '%s' with %u entries", pFilename, pHeader->entryCount);
+    return true;
+}
+
+void AssetArchive::close()
+{
+    m_file.close();
+    m_pHeader  = nullptr;
+    m_pEntries = nullptr;
+    m_pBuckets = nullptr;
+    m_pNames   = nullptr;
+}
+
+ArchiveEntry const* AssetArchive::find(const char* pName) const
+{
+    if (!isOpen()) {
+        return nullptr;
+    }
+
+    size_t   length = strlen(pName);
+    uint64_t hash   = hashAssetName(pName, length);
+    uint32_t bucket = bucketOf(hash, m_pHeader->bucketBits);
+
+    uint32_t end = std::min(m_pBuckets[bucket + 1], m_pHeader->entryCount);
+    for (uint32_t i = m_pBuckets[bucket]; i < end; i += 1) {
+        ArchiveEntry const& entry = m_pEntries[i];
+        if (entry.nameHash   == hash &&
+            entry.nameLength == length &&
+            memcmp(&m_pNames[entry.nameOffset], pName, length) == 0)
+        {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+AssetBlob AssetArchive::get(const char* pName) const
+{
+    ArchiveEntry const* pEntry = find(pName);
+    if (pEntry == nullptr) {
+        Info("Archive has no asset named '%s'", pName);
+        return AssetBlob();
+    }
+    return get(*pEntry);
+}
+
+AssetBlob AssetArchive::get(ArchiveEntry const& entry) const
+{
+    AssetBlob blob;
+    const uint8_t* pStored = m_file.data() + entry.offset;
+
+    switch (entry.compression) {
+        case ArchiveCompression::None:
+            blob.pData = pStored;
+            blob.size  = as<size_t>(entry.size);
+            break;
+
+        case ArchiveCompression::Lz: {
+            blob.size = as<size_t>(entry.size);
+            blob.pOwned.reset(new uint8_t[std::max<size_t>(blob.size, 1)]);
+            bool okay = lzDecompress(pStored, as<size_t>(entry.storedSize),
+                                     blob.pOwned.get(), blob.size);
+            if (!okay) {
+                Bug("Corrupt archive entry '%s'", entryName(entry).c_str());
+                return AssetBlob();
+            }
+            blob.pData = blob.pOwned.get();
+            break;
+        }
+
+        default:
+            Bug("Unknown compression %u on '%s'",
+                as<uint32_t>(entry.compression), entryName(entry).c_str());
+            break;
+    }
+    return blob;
+}
+
+uint32_t AssetArchive::entryCount() const
+{
+    return isOpen() ? m_pHeader->entryCount : 0;
+}
+
+ArchiveEntry const& AssetArchive::entry(uint32_t index) const
+{
+    Assert(index < entryCount());
+    return m_pEntries[index];
+}
+
+std::string AssetArchive::entryName(ArchiveEntry const& entry) const
+{
+    return std::string(&m_pNames[entry.nameOffset], entry.nameLength);
+}
+
+// ==== AssetArchiveWriter ======================================================
+
+void AssetArchiveWriter::add(std::string          name,
+                             std::vector<uint8_t> bytes,
+                             bool                 compress)
+{
+    // Archive names always use forward slashes.
+    std::replace(name.begin(), name.end(), '\\', '/');
+
+    PendingEntry entry;
+    entry.name        = std::move(name);
+    entry.size        = bytes.size();
+    entry.compression = ArchiveCompression::None;
+
+    if (compress && !bytes.empty()) {
+        std::vector<uint8_t> packed = lzCompress(bytes);
+        if (packed.size() < bytes.size()) {
+            bytes             = std::move(packed);
+            entry.compression = ArchiveCompression::Lz;
+        }
+    }
+    entry.bytes = std::move(bytes);
+
+    m_entries.push_back(std::move(entry));
+}
+
+bool AssetArchiveWriter::write(const char* pFilename) const
+{
+    uint32_t entryCount = as<uint32_t>(m_entries.size());
+
+    // At least as many buckets as entries, so most buckets hold 0 or 1.
+    uint32_t bucketBits = 1;
+    while ((1u << bucketBits) < entryCount) {
+        bucketBits += 1;
+    }
+    uint32_t bucketCount = 1u << bucketBits;
+
+    // Sort by hash. Buckets then fall out as contiguous runs.
+    std::vector<uint64_t> hashes(entryCount);
+    std::vector<uint32_t> order(entryCount);
+    for (uint32_t i = 0; i < entryCount; i += 1) {
+        std::string const& name = m_entries[i].name;
+        hashes[i] = hashAssetName(name.data(), name.size());
+        order[i]  = i;
+    }
+    std::sort(order.begin(), order.end(), [&hashes](uint32_t lhs, uint32_t rhs) {
+        return hashes[lhs] < hashes[rhs];
+    });
+    for (uint32_t i = 1; i < entryCount; i += 1) {
+        if (m_entries[order[i]].name == m_entries[order[i - 1]].name) {
+            Bug("Duplicate archive entry '%s'", m_entries[order[i]].name.c_str());
+            return false;
+        }
+    }
+
+    std::string names;
+    std::vector<ArchiveEntry> toc(entryCount);
+    std::vector<uint32_t>     buckets(bucketCount + 1, entryCount);
+    for (uint32_t i = 0; i < entryCount; i += 1) {
+        PendingEntry const& pending = m_entries[order[i]];
+        ArchiveEntry&       entry   = toc[i];
+        entry.nameHash    = hashes[order[i]];
+        entry.storedSize  = pending.bytes.size();
+        entry.size        = pending.size;
+        entry.nameOffset  = as<uint32_t>(names.size());
+        entry.nameLength  = as<uint32_t>(pending.name.size());
+        entry.compression = pending.compression;
+        entry.reserved    = 0;
+        names += pending.name;
+
+        // Entries are sorted, so the first one we see in a bucket starts it.
+        uint32_t bucket = bucketOf(entry.nameHash, bucketBits);
+        if (buckets[bucket] == entryCount) {
+            buckets[bucket] = i;
+        }
+    }
+    // Empty buckets start where the next non-empty one does.
+    for (uint32_t b = bucketCount; b > 0; b -= 1) {
+        buckets[b - 1] = std::min(buckets[b - 1], buckets[b]);
+    }
+
+    auto alignUp = [](uint64_t value) {
+        return (value + kArchiveAlignment - 1) / kArchiveAlignment
+                                               * kArchiveAlignment;
+    };
+
+    ArchiveHeader header = {};
+    header.magic       = kArchiveMagic;
+    header.version     = kArchiveVersion;
+    header.entryCount  = entryCount;
+    header.bucketBits  = bucketBits;
+    header.namesOffset = sizeof(ArchiveHeader)
+                       + toc.size()     * sizeof(ArchiveEntry)
+                       + buckets.size() * sizeof(uint32_t);
+    header.namesSize   = names.size();
+
+    uint64_t offset = alignUp(header.namesOffset + header.namesSize);
+    for (ArchiveEntry& entry : toc) {
+        entry.offset = offset;
+        offset       = alignUp(offset + entry.storedSize);
+    }
+
+    FILE* pFile = fopen(pFilename, "wb");
+    if (pFile == nullptr) {
+        Bug("Unable to open '%s' for writing", pFilename);
+        return false;
+    }
+
+    uint64_t written = 0;
+    auto writeBytes = [pFile, &written](const void* pData, size_t size) {
+        if (size != 0) {
+            fwrite(pData, 1, size, pFile);
+        }
+        written += size;
+    };
+    auto padTo = [&writeBytes, &written](uint64_t target) {
+        static const uint8_t zeros[kArchiveAlignment] = {};
+        while (written < target) {
+            writeBytes(zeros, as<size_t>(std::min<uint64_t>(target - written,
+                                                           sizeof(zeros))));
+        }
+    };
+
+    writeBytes(&header,        sizeof(header));
+    writeBytes(toc.data(),     toc.size()     * sizeof(ArchiveEntry));
+    writeBytes(buckets.data(), buckets.size() * sizeof(uint32_t));
+    writeBytes(names.data(),   names.size());
+    for (uint32_t i = 0; i < entryCount; i += 1) {
+        std::vector<uint8_t> const& bytes = m_entries[order[i]].bytes;
+        padTo(toc[i].offset);
+        writeBytes(bytes.data(), bytes.size());
+    }
+
+    bool okay = (ferror(pFile) == 0);
+    okay = (fclose(pFile) == 0) && okay;
+    if (!okay) {
+        Bug("Failed writing '%s'", pFilename);
+        return false;
+    }
+
+    Info("Wrote %u entries (%llu bytes) to '%s'", entryCount,
+         as<unsigned long long>(written), pFilename);
+    return true;
+}
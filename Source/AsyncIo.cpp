@@ -0,0 +1,647 @@
+#include "AsyncIo.hpp"
+#include "JobPool.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#if OS_WINDOWS
+    #include <fcntl.h>
+    #include <io.h>
+    #include <malloc.h>
+    #include <sys/stat.h>
+#else
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <sys/uio.h>
+#endif
+
+#if OS_LINUX
+    #include <linux/io_uring.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+
+    // Older libc headers may not know about these yet.
+    #ifndef __NR_io_uring_setup
+        #define __NR_io_uring_setup 425
+    #endif
+    #ifndef __NR_io_uring_enter
+        #define __NR_io_uring_enter 426
+    #endif
+#endif
+
+// ==== OS Shims ================================================================
+// Windows has all of the same calls, just with different names.
+
+static int osOpen(const char* pFilename, bool direct)
+{
+    #if OS_WINDOWS
+    UNUSED(direct);
+    return _open(pFilename, _O_RDONLY | _O_BINARY);
+    #else
+    int flags = O_RDONLY | O_CLOEXEC;
+    #if OS_LINUX
+    if (direct) {
+        int fd = open(pFilename, flags | O_DIRECT);
+        // EINVAL means this filesystem (e.g. tmpfs) can't do O_DIRECT.
+        if (fd >= 0 || errno != EINVAL) {
+            return fd;
+        }
+    }
+    #endif
+    int fd = open(pFilename, flags);
+    #if OS_MACOS
+    if (fd >= 0 && direct) {
+        fcntl(fd, F_NOCACHE, 1);
+    }
+    #endif
+    return fd;
+    #endif
+}
+
+static void osClose(int fd)
+{
+    #if OS_WINDOWS
+    _close(fd);
+    #else
+    close(fd);
+    #endif
+}
+
+static int64_t osFileSize(int fd)
+{
+    #if OS_WINDOWS
+    struct _stat64 fileStat = {};
+    return (_fstat64(fd, &fileStat) == 0) ? fileStat.st_size : -1;
+    #else
+    struct stat fileStat = {};
+    return (fstat(fd, &fileStat) == 0) ? fileStat.st_size : -1;
+    #endif
+}
+
+static int64_t osReadAt(int fd, void* pDst, uint64_t size, uint64_t offset)
+{
+    #if OS_WINDOWS
+    if (_lseeki64(fd, as<int64_t>(offset), SEEK_SET) < 0) {
+        return -1;
+    }
+    return _read(fd, pDst, as<unsigned>(std::min<uint64_t>(size, 1u << 30)));
+    #else
+    return pread(fd, pDst, size, as<off_t>(offset));
+    #endif
+}
+
+static uint64_t roundUp(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// ==== AlignedBuffer ===========================================================
+
+AlignedBuffer::AlignedBuffer(size_t size, size_t alignment)
+    : m_size(size)
+{
+    #if OS_WINDOWS
+    m_pData = ptr_as<uint8_t>(_aligned_malloc(size, alignment));
+    #else
+    void* pMemory = nullptr;
+    if (posix_memalign(&pMemory, alignment, size) == 0) {
+        m_pData = ptr_as<uint8_t>(pMemory);
+    }
+    #endif
+    AssertMsg(m_pData != nullptr, "Unable to allocate %zu bytes", size);
+}
+
+AlignedBuffer::~AlignedBuffer()
+{
+    #if OS_WINDOWS
+    _aligned_free(m_pData);
+    #else
+    free(m_pData);
+    #endif
+}
+
+AlignedBuffer::AlignedBuffer(AlignedBuffer&& other) noexcept
+    : m_pData(std::exchange(other.m_pData, nullptr)),
+      m_size(std::exchange(other.m_size, 0))
+{
+}
+
+AlignedBuffer& AlignedBuffer::operator=(AlignedBuffer&& other) noexcept
+{
+    std::swap(m_pData, other.m_pData);
+    std::swap(m_size,  other.m_size);
+    return *this;
+}
+
+// ==== AsyncFileReader =========================================================
+
+AsyncFileReader::~AsyncFileReader()
+{
+    deInit();
+}
+
+void AsyncFileReader::init(uint32_t queueDepth, JobPool* pFallbackPool)
+{
+    Assert(m_slots.empty());
+
+    queueDepth      = std::max(queueDepth, 1u);
+    m_pFallbackPool = pFallbackPool;
+
+    m_slots.resize(queueDepth);
+    m_freeSlots.reserve(queueDepth);
+    for (uint32_t i = queueDepth; i > 0; i -= 1) {
+        m_freeSlots.push_back(i - 1);
+    }
+
+    if (initRing(queueDepth)) {
+        Info("AsyncFileReader: Using io_uring (%u entries)", m_ring.entries);
+    } else {
+        Info("AsyncFileReader: io_uring unavailable, using %s",
+             m_pFallbackPool ? "the job pool" : "blocking reads");
+    }
+}
+
+void AsyncFileReader::deInit()
+{
+    if (m_slots.empty()) {
+        return;
+    }
+
+    // The kernel (or a worker) may still be writing into these slots.
+    waitAll();
+    deInitRing();
+
+    m_slots.clear();
+    m_freeSlots.clear();
+    m_pFallbackPool = nullptr;
+}
+
+void AsyncFileReader::enqueue(AsyncReadRequest request)
+{
+    m_queued.push_back(std::move(request));
+}
+
+std::future<AsyncReadResult>
+AsyncFileReader::enqueueWithFuture(AsyncReadRequest request)
+{
+    auto pPromise = std::make_shared<std::promise<AsyncReadResult>>();
+    std::future<AsyncReadResult> future = pPromise->get_future();
+
+    AsyncReadCallback userCallback = std::move(request.onComplete);
+    request.onComplete = [pPromise, userCallback](AsyncReadResult& result) {
+        if (userCallback) {
+            userCallback(result);
+        }
+        pPromise->set_value(std::move(result));
+    };
+    enqueue(std::move(request));
+
+    return future;
+}
+
+uint32_t AsyncFileReader::pendingCount() const
+{
+    return as<uint32_t>(m_queued.size()) + m_inFlight;
+}
+
+uint64_t AsyncFileReader::fileSize(const char* pFilename)
+{
+    int fd = osOpen(pFilename, false);
+    if (fd < 0) {
+        return 0;
+    }
+    int64_t size = osFileSize(fd);
+    osClose(fd);
+
+    return (size < 0) ? 0 : as<uint64_t>(size);
+}
+
+uint32_t AsyncFileReader::submit()
+{
+    // Hand queued requests out to free slots.
+    while (!m_queued.empty() && !m_freeSlots.empty()) {
+        uint32_t index = m_freeSlots.back();
+        m_freeSlots.pop_back();
+        m_inFlight += 1;
+
+        Slot& slot = m_slots[index];
+        slot.request = std::move(m_queued.front());
+        m_queued.pop_front();
+
+        if (prepareSlot(slot)) {
+            m_ready.push_back(index);
+        } else {
+            // Report it from poll(), like everything else.
+            std::lock_guard<std::mutex> lock(m_completedMutex);
+            m_completed.push_back(index);
+        }
+    }
+
+    return usingIoUring() ? submitRing() : submitFallback();
+}
+
+uint32_t AsyncFileReader::poll()
+{
+    submit();
+
+    if (usingIoUring()) {
+        return reapRing(false);
+    }
+    return reapCompleted(false);
+}
+
+void AsyncFileReader::waitAll()
+{
+    while (pendingCount() != 0) {
+        submit();
+
+        if (usingIoUring()) {
+            reapRing(true);
+        } else {
+            reapCompleted(true);
+        }
+    }
+}
+
+bool AsyncFileReader::prepareSlot(Slot& slot)
+{
+    AsyncReadRequest const& request = slot.request;
+
+    slot.result          = AsyncReadResult();
+    slot.result.filename = request.filename;
+
+    // O_DIRECT has strict rules. If they aren't met, just read normally.
+    bool direct = request.direct;
+    if (direct) {
+        uint64_t alignment = kDirectIoAlignment;
+        bool aligned = (request.offset % alignment) == 0;
+        if (request.pDst != nullptr) {
+            aligned = aligned &&
+                      request.size != 0 &&
+                      (request.size % alignment) == 0 &&
+                      (reinterpret_cast<uintptr_t>(request.pDst) % alignment) == 0;
+        }
+        if (!aligned) {
+            Bug("Unaligned direct read of '%s', using buffered reads instead",
+                request.filename.c_str());
+            direct = false;
+        }
+    }
+
+    slot.fd = osOpen(request.filename.c_str(), direct);
+    if (slot.fd < 0) {
+        slot.result.error = errno;
+        Info("Unable to open file '%s'", request.filename.c_str());
+        return false;
+    }
+
+    slot.wanted = request.size;
+    if (slot.wanted == 0) {
+        int64_t fileSize = osFileSize(slot.fd);
+        if (fileSize < 0) {
+            slot.result.error = errno;
+            return false;
+        }
+        uint64_t size = as<uint64_t>(fileSize);
+        slot.wanted = (size > request.offset) ? (size - request.offset) : 0;
+    }
+
+    // Direct reads have to ask for whole blocks, even past the end of the file.
+    slot.transfer = direct ? roundUp(slot.wanted, kDirectIoAlignment)
+                           : slot.wanted;
+
+    if (request.pDst != nullptr) {
+        slot.pDst = ptr_as<uint8_t>(request.pDst);
+    } else {
+        size_t bytes = as<size_t>(std::max<uint64_t>(slot.transfer, 1));
+        slot.result.ownedBuffer = AlignedBuffer(bytes, kDirectIoAlignment);
+        slot.pDst = slot.result.ownedBuffer.data();
+    }
+    slot.result.pDst = slot.pDst;
+
+    return true;
+}
+
+void AsyncFileReader::readBlocking(Slot& slot)
+{
+    uint64_t& done = slot.result.bytesRead;
+    while (done < slot.transfer) {
+        int64_t got = osReadAt(slot.fd,
+                               slot.pDst + done,
+                               slot.transfer - done,
+                               slot.request.offset + done);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0) {
+            slot.result.error = errno;
+            break;
+        }
+        if (got == 0) {
+            break; // EOF
+        }
+        done += as<uint64_t>(got);
+    }
+}
+
+void AsyncFileReader::finishSlot(uint32_t slotIndex)
+{
+    Slot& slot = m_slots[slotIndex];
+
+    if (slot.fd >= 0) {
+        osClose(slot.fd);
+        slot.fd = -1;
+    }
+
+    // Direct reads may have run past what was asked for.
+    AsyncReadResult result = std::move(slot.result);
+    result.bytesRead = std::min(result.bytesRead, slot.wanted);
+    if (result.error != 0) {
+        Bug("Async read of '%s' failed: %s", result.filename.c_str(),
+                                             strerror(result.error));
+    }
+
+    AsyncReadCallback callback = std::move(slot.request.onComplete);
+    slot = Slot();
+    m_freeSlots.push_back(slotIndex);
+    m_inFlight -= 1;
+
+    // This may enqueue more reads, so the slot needs to be free already.
+    if (callback) {
+        callback(result);
+    }
+}
+
+uint32_t AsyncFileReader::submitFallback()
+{
+    uint32_t count = 0;
+    while (!m_ready.empty()) {
+        uint32_t index = m_ready.front();
+        m_ready.pop_front();
+        count += 1;
+
+        // 'm_slots' never resizes while reads are in flight, so handing
+        // workers a reference to one of its elements is safe.
+        auto job = [this, index]() {
+            readBlocking(m_slots[index]);
+            {
+                std::lock_guard<std::mutex> lock(m_completedMutex);
+                m_completed.push_back(index);
+            }
+            m_completedCv.notify_one();
+        };
+
+        if (m_pFallbackPool != nullptr) {
+            m_pFallbackPool->push(std::move(job));
+        } else {
+            job();
+        }
+    }
+    return count;
+}
+
+uint32_t AsyncFileReader::reapCompleted(bool wait)
+{
+    std::vector<uint32_t> completed;
+    {
+        std::unique_lock<std::mutex> lock(m_completedMutex);
+        if (wait) {
+            m_completedCv.wait(lock, [this]() { return !m_completed.empty(); });
+        }
+        completed.swap(m_completed);
+    }
+
+    for (uint32_t index : completed) {
+        finishSlot(index);
+    }
+    return as<uint32_t>(completed.size());
+}
+
+#if OS_LINUX
+
+static int ioUringEnter(int      fd,
+                        uint32_t toSubmit,
+                        uint32_t minComplete,
+                        uint32_t flags)
+{
+    return as<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete,
+                           flags, nullptr, 0));
+}
+
+bool AsyncFileReader::initRing(uint32_t queueDepth)
+{
+    // Opt-out for debugging, or for kernels where io_uring is locked down.
+    const char* pDisable = getenv("DISABLE_IO_URING");
+    if (pDisable != nullptr && strcmp(pDisable, "1") == 0) {
+        return false;
+    }
+
+    io_uring_params params = {};
+    int fd = as<int>(syscall(__NR_io_uring_setup, queueDepth, &params));
+    if (fd < 0) {
+        Verbose("io_uring_setup() failed: %s", strerror(errno));
+        return false;
+    }
+    m_ring.fd      = fd;
+    m_ring.entries = params.sq_entries;
+
+    m_ring.sqMapSize = params.sq_off.array
+                     + params.sq_entries * sizeof(uint32_t);
+    m_ring.cqMapSize = params.cq_off.cqes
+                     + params.cq_entries * sizeof(io_uring_cqe);
+    m_ring.sqesSize  = params.sq_entries * sizeof(io_uring_sqe);
+
+    // Newer kernels let both rings share one mapping.
+    bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap) {
+        m_ring.sqMapSize = std::max(m_ring.sqMapSize, m_ring.cqMapSize);
+        m_ring.cqMapSize = m_ring.sqMapSize;
+    }
+
+    auto mapRing = [fd](size_t size, uint64_t offset) -> void* {
+        void* pMap = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd, as<off_t>(offset));
+        return (pMap == MAP_FAILED) ? nullptr : pMap;
+    };
+
+    m_ring.pSqMap = mapRing(m_ring.sqMapSize, IORING_OFF_SQ_RING);
+    m_ring.pCqMap = singleMap ? m_ring.pSqMap
+                              : mapRing(m_ring.cqMapSize, IORING_OFF_CQ_RING);
+    m_ring.pSqes  = mapRing(m_ring.sqesSize, IORING_OFF_SQES);
+    if (m_ring.pSqMap == nullptr ||
+        m_ring.pCqMap == nullptr ||
+        m_ring.pSqes  == nullptr)
+    {
+        Bug("Unable to map io_uring: %s", strerror(errno));
+        deInitRing();
+        return false;
+    }
+
+    uint8_t* pSq = ptr_as<uint8_t>(m_ring.pSqMap);
+    m_ring.pSqHead  = ptr_as<uint32_t>(pSq + params.sq_off.head);
+    m_ring.pSqTail  = ptr_as<uint32_t>(pSq + params.sq_off.tail);
+    m_ring.pSqMask  = ptr_as<uint32_t>(pSq + params.sq_off.ring_mask);
+    m_ring.pSqArray = ptr_as<uint32_t>(pSq + params.sq_off.array);
+
+    uint8_t* pCq = ptr_as<uint8_t>(m_ring.pCqMap);
+    m_ring.pCqHead  = ptr_as<uint32_t>(pCq + params.cq_off.head);
+    m_ring.pCqTail  = ptr_as<uint32_t>(pCq + params.cq_off.tail);
+    m_ring.pCqMask  = ptr_as<uint32_t>(pCq + params.cq_off.ring_mask);
+    m_ring.pCqes    = pCq + params.cq_off.cqes;
+
+    return true;
+}
+
+void AsyncFileReader::deInitRing()
+{
+    if (m_ring.pSqes != nullptr) {
+        munmap(m_ring.pSqes, m_ring.sqesSize);
+    }
+    if (m_ring.pCqMap != nullptr && m_ring.pCqMap != m_ring.pSqMap) {
+        munmap(m_ring.pCqMap, m_ring.cqMapSize);
+    }
+    if (m_ring.pSqMap != nullptr) {
+        munmap(m_ring.pSqMap, m_ring.sqMapSize);
+    }
+    if (m_ring.fd >= 0) {
+        close(m_ring.fd);
+    }
+    m_ring = Ring();
+}
+
+uint32_t AsyncFileReader::submitRing()
+{
+    static_assert(sizeof(Slot::iov) == sizeof(iovec),
+                  "Slot::iov must match struct iovec");
+
+    // We're the only producer, so the tail is ours to read without atomics.
+    uint32_t tail  = *m_ring.pSqTail;
+    uint32_t mask  = *m_ring.pSqMask;
+    uint32_t count = 0;
+
+    auto* pSqes = ptr_as<io_uring_sqe>(m_ring.pSqes);
+    while (!m_ready.empty()) {
+        uint32_t head = __atomic_load_n(m_ring.pSqHead, __ATOMIC_ACQUIRE);
+        if (tail - head >= m_ring.entries) {
+            break; // Full. The rest go next time.
+        }
+
+        uint32_t index = m_ready.front();
+        m_ready.pop_front();
+
+        // Short reads come back through here for the remainder.
+        Slot&    slot = m_slots[index];
+        uint64_t done = slot.result.bytesRead;
+        slot.iov.pBase  = slot.pDst + done;
+        slot.iov.length = as<size_t>(slot.transfer - done);
+
+        io_uring_sqe& sqe = pSqes[tail & mask];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode    = IORING_OP_READV;
+        sqe.fd        = slot.fd;
+        sqe.addr      = reinterpret_cast<uint64_t>(&slot.iov);
+        sqe.len       = 1;
+        sqe.off       = slot.request.offset + done;
+        sqe.user_data = index;
+
+        m_ring.pSqArray[tail & mask] = tail & mask;
+        tail  += 1;
+        count += 1;
+    }
+
+    if (count == 0) {
+        return 0;
+    }
+
+    __atomic_store_n(m_ring.pSqTail, tail, __ATOMIC_RELEASE);
+
+    // Anything the kernel doesn't consume now stays in the ring, and goes out
+    // with the next io_uring_enter().
+    int submitted = ioUringEnter(m_ring.fd, count, 0, 0);
+    if (submitted < 0 && errno != EINTR && errno != EAGAIN) {
+        Bug("io_uring_enter() failed: %s", strerror(errno));
+    }
+
+    return count;
+}
+
+uint32_t AsyncFileReader::reapRing(bool wait)
+{
+    // Reads that never made it to the ring.
+    uint32_t count = reapCompleted(false);
+
+    if (wait && count == 0 && m_inFlight != 0) {
+        // Also push out anything a failed io_uring_enter() left behind.
+        uint32_t unsubmitted = *m_ring.pSqTail
+                             - __atomic_load_n(m_ring.pSqHead, __ATOMIC_ACQUIRE);
+        ioUringEnter(m_ring.fd, unsubmitted, 1, IORING_ENTER_GETEVENTS);
+    }
+
+    uint32_t head = *m_ring.pCqHead;
+    uint32_t tail = __atomic_load_n(m_ring.pCqTail, __ATOMIC_ACQUIRE);
+    uint32_t mask = *m_ring.pCqMask;
+
+    // Don't run callbacks until the kernel has its CQ entries back.
+    std::vector<uint32_t> finished;
+
+    auto* pCqes = ptr_as<io_uring_cqe>(m_ring.pCqes);
+    for (; head != tail; head += 1) {
+        io_uring_cqe const& cqe = pCqes[head & mask];
+        uint32_t index = as<uint32_t>(cqe.user_data);
+        Slot&    slot  = m_slots[index];
+
+        if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+            m_ready.push_back(index);
+        } else if (cqe.res < 0) {
+            slot.result.error = -cqe.res;
+            finished.push_back(index);
+        } else {
+            slot.result.bytesRead += as<uint64_t>(cqe.res);
+            bool eof = (cqe.res == 0);
+            if (eof || slot.result.bytesRead >= slot.transfer) {
+                finished.push_back(index);
+            } else {
+                m_ready.push_back(index);
+            }
+        }
+    }
+    __atomic_store_n(m_ring.pCqHead, head, __ATOMIC_RELEASE);
+
+    for (uint32_t index : finished) {
+        finishSlot(index);
+    }
+    count += as<uint32_t>(finished.size());
+
+    // Short reads, and anything the callbacks just queued.
+    submit();
+
+    return count;
+}
+
+#else
+
+bool AsyncFileReader::initRing(uint32_t queueDepth)
+{
+    UNUSED(queueDepth);
+    return false;
+}
+
+void AsyncFileReader::deInitRing()
+{
+}
+
+uint32_t AsyncFileReader::submitRing()
+{
+    return 0;
+}
+
+uint32_t AsyncFileReader::reapRing(bool wait)
+{
+    UNUSED(wait);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,493 @@
+#include "00-Prelude.hpp"
+
+#include "AssetArchive.hpp"
+#include "FileView.hpp"
+#include "JobPool.hpp"
+#include "MeshLod.hpp"
+#include "Renderer.hpp"
+#include "Scene.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#if OS_WINDOWS
+    #include <psapi.h>
+#else
+    #include <sys/resource.h>
+#endif
+
+// Demo-Bench renders a generated scene offscreen, along a fixed camera path,
+// and writes how long each frame took to a JSON file. Given a baseline from
+// an earlier run, it fails if anything got slower by more than a threshold.
+//
+//   Demo-Bench [--instances=1000] [--meshes=8] [--materials=4] [--seed=1]
+//              [--warmup=60] [--frames=600] [--width=1280] [--height=720]
+//              [--gpu=<index or name>] [--depth-prepass=0]
+//              [--out=bench.json]
+//              [--baseline=<file>] [--threshold=<percent>]
+//              [--results=<file>]   Compare these instead of running
+//
+// Exits with 1 on a regression, or 2 if it couldn't run at all. Refuses to
+// compare against a baseline of a different scene, or from another device.
+
+struct BenchArgs
+{
+    SceneDesc   scene;
+    uint32_t    warmupFrames    = 60;
+    uint32_t    frames          = 600;
+    uint32_t    width           = 1280;
+    uint32_t    height          = 720;
+    char const* pGpu            = nullptr;
+    bool        depthPrepass    = false;
+    char const* pOut            = "bench.json";
+    char const* pBaseline       = nullptr;
+    char const* pResults        = nullptr;
+    double      threshold       = 10.0; // Percent
+};
+
+// ==== Results =================================================================
+
+// Every metric is something we want less of.
+struct Metric
+{
+    char const* pName;
+    double      value;
+    bool        compared;   // Max frame times are too noisy to fail on
+};
+
+static std::vector<Metric> makeMetrics()
+{
+    return {
+        { "cpu_ms_mean",        -1.0, true  },
+        { "cpu_ms_p50",         -1.0, true  },
+        { "cpu_ms_p90",         -1.0, true  },
+        { "cpu_ms_p99",         -1.0, true  },
+        { "cpu_ms_max",         -1.0, false },
+        { "gpu_ms_mean",        -1.0, true  },
+        { "gpu_ms_p50",         -1.0, true  },
+        { "gpu_ms_p90",         -1.0, true  },
+        { "gpu_ms_p99",         -1.0, true  },
+        { "gpu_ms_max",         -1.0, false },
+        { "peak_rss_mib",       -1.0, true  },
+        { "device_memory_mib",  -1.0, true  },
+    };
+}
+
+static Metric* findMetric(std::vector<Metric>& metrics, char const* pName)
+{
+    for (Metric& metric : metrics) {
+        if (strcmp(metric.pName, pName) == 0) {
+            return &metric;
+        }
+    }
+    return nullptr;
+}
+
+// Nearest rank. Leaves the metrics at -1 without any samples.
+static void setFrameStats(std::vector<Metric>& metrics,
+                          char const*          pPrefix,
+                          std::vector<double>  samples)
+{
+    if (samples.empty()) {
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+
+    auto percentile = [&samples](double p) {
+        size_t rank = as<size_t>(std::ceil(p / 100.0 * samples.size()));
+        return samples[std::max(rank, size_t(1)) - 1];
+    };
+    double sum = 0.0;
+    for (double sample : samples) {
+        sum += sample;
+    }
+
+    std::string prefix = pPrefix;
+    findMetric(metrics, (prefix + "_mean").c_str())->value = sum / samples.size();
+    findMetric(metrics, (prefix + "_p50").c_str())->value  = percentile(50.0);
+    findMetric(metrics, (prefix + "_p90").c_str())->value  = percentile(90.0);
+    findMetric(metrics, (prefix + "_p99").c_str())->value  = percentile(99.0);
+    findMetric(metrics, (prefix + "_max").c_str())->value  = samples.back();
+}
+
+static double peakRssMib()
+{
+    #if OS_WINDOWS
+    PROCESS_MEMORY_COUNTERS counters = {};
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return as<double>(counters.PeakWorkingSetSize) / (1024.0 * 1024.0);
+    #else
+    rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+    #if OS_MACOS
+    return as<double>(usage.ru_maxrss) / (1024.0 * 1024.0); // Bytes
+    #else
+    return as<double>(usage.ru_maxrss) / 1024.0;            // KiB
+    #endif
+    #endif
+}
+
+static bool writeResults(char const*                pFilename,
+                         BenchArgs const&           args,
+                         char const*                pDeviceName,
+                         std::vector<Metric> const& metrics)
+{
+    FILE* pFile = fopen(pFilename, "w");
+    if (pFile == nullptr) {
+        Bug("Unable to write \"%s\"", pFilename);
+        return false;
+    }
+
+    fprintf(pFile, "{\n");
+    fprintf(pFile, "  \"device\": \"%s\",\n", pDeviceName);
+    fprintf(pFile, "  \"scene\": {\n");
+    fprintf(pFile, "    \"seed\": %u,\n",          args.scene.seed);
+    fprintf(pFile, "    \"instances\": %u,\n",     args.scene.instanceCount);
+    fprintf(pFile, "    \"meshes\": %u,\n",        args.scene.meshCount);
+    fprintf(pFile, "    \"materials\": %u,\n",     args.scene.materialCount);
+    fprintf(pFile, "    \"width\": %u,\n",         args.width);
+    fprintf(pFile, "    \"height\": %u,\n",        args.height);
+    fprintf(pFile, "    \"depth_prepass\": %s,\n",
+            args.depthPrepass ? "true" : "false");
+    fprintf(pFile, "    \"warmup_frames\": %u,\n", args.warmupFrames);
+    fprintf(pFile, "    \"frames\": %u\n",         args.frames);
+    fprintf(pFile, "  },\n");
+    fprintf(pFile, "  \"metrics\": {\n");
+    for (size_t i = 0; i < metrics.size(); i += 1) {
+        fprintf(pFile, "    \"%s\": %.4f%s\n",
+                metrics[i].pName,
+                metrics[i].value,
+                i + 1 < metrics.size() ? "," : "");
+    }
+    fprintf(pFile, "  }\n");
+    fprintf(pFile, "}\n");
+
+    fclose(pFile);
+    return true;
+}
+
+// The parts of "scene" that change what's measured. Two runs are only
+// compared if they match, and ran on the same device.
+static char const* const kSceneKeys[] = {
+    "seed", "instances", "meshes", "materials", "width", "height",
+    "depth_prepass",
+};
+
+struct Results
+{
+    std::string                 device;
+    std::string                 scene[array_size(kSceneKeys)];
+    std::vector<Metric>         metrics = makeMetrics();
+};
+
+// The text of the value after '"key":', up to the next ',' or the end of the
+// line. Empty if there's no such key.
+static std::string readValue(std::string const& text, char const* pKey)
+{
+    std::string key = std::string("\"") + pKey + "\":";
+    size_t      at  = text.find(key);
+    if (at == std::string::npos) {
+        return "";
+    }
+    at = text.find_first_not_of(' ', at + key.size());
+    if (at == std::string::npos) {
+        return "";
+    }
+    size_t end = text.find_first_of(",\r\n", at);
+    return text.substr(at, end - at);
+}
+
+// Only reads back what writeResults() wrote, so there's no need for a real
+// JSON parser. Metrics it can't find stay at -1.
+static bool readResults(char const* pFilename, Results* pResults)
+{
+    FileView view;
+    if (!view.open(pFilename)) {
+        Bug("Unable to open \"%s\"", pFilename);
+        return false;
+    }
+    std::string text(ptr_as<const char>(view.data()), view.size());
+
+    pResults->device = readValue(text, "device");
+    for (uint32_t i = 0; i < array_size(kSceneKeys); i += 1) {
+        pResults->scene[i] = readValue(text, kSceneKeys[i]);
+    }
+    for (Metric& metric : pResults->metrics) {
+        std::string value = readValue(text, metric.pName);
+        if (!value.empty()) {
+            metric.value = strtod(value.c_str(), nullptr);
+        }
+    }
+    return true;
+}
+
+// Frame times from another scene, or another device, don't say anything
+// about a regression.
+static bool sameRun(Results const& baseline, Results const& results)
+{
+    bool same = true;
+    if (baseline.device != results.device) {
+        Bug("The baseline ran on %s, not %s",
+            baseline.device.c_str(), results.device.c_str());
+        same = false;
+    }
+    for (uint32_t i = 0; i < array_size(kSceneKeys); i += 1) {
+        if (baseline.scene[i] != results.scene[i]) {
+            Bug("The baseline's %s is '%s', not '%s'", kSceneKeys[i],
+                baseline.scene[i].c_str(), results.scene[i].c_str());
+            same = false;
+        }
+    }
+    return same;
+}
+
+// Returns how many metrics regressed.
+static uint32_t compareResults(Results const& baseline,
+                               Results const& results,
+                               double         threshold)
+{
+    uint32_t regressions = 0;
+
+    printf("%-20s %12s %12s %9s\n", "metric", "baseline", "result", "change");
+    for (size_t i = 0; i < results.metrics.size(); i += 1) {
+        Metric const& before = baseline.metrics[i];
+        Metric const& after  = results.metrics[i];
+
+        // Unknown on either side, e.g. a device without timestamps.
+        if (before.value <= 0.0 || after.value < 0.0) {
+            printf("%-20s %12s %12s %9s\n", after.pName, "-", "-", "-");
+            continue;
+        }
+
+        double change    = 100.0 * (after.value - before.value) / before.value;
+        bool   regressed = after.compared && change > threshold;
+        printf("%-20s %12.3f %12.3f %+8.1f%%%s\n",
+               after.pName, before.value, after.value, change,
+               regressed ? "  REGRESSED" : "");
+        if (regressed) {
+            regressions += 1;
+        }
+    }
+
+    return regressions;
+}
+
+// ==== Running =================================================================
+
+// A slow circle through the middle of the scene, looking a little ahead, so
+// each frame sees a different mix of near, far, and hidden instances. Frame
+// 'i' is always in the same place.
+static void placeCamera(Renderer*        pRenderer,
+                        SceneDesc const& scene,
+                        uint32_t         frame,
+                        uint32_t         frameCount)
+{
+    float radius = 0.3f * sceneWidth(scene);
+    float angle  = 2.f * PI * as<float>(frame) / as<float>(std::max(frameCount, 1u));
+    float ahead  = angle + 0.35f;
+
+    Vec3 eye   (radius * std::cos(angle), 4.f, radius * std::sin(angle));
+    Vec3 target(radius * std::cos(ahead), 1.f, radius * std::sin(ahead));
+    pRenderer->setCamera(eye, target);
+}
+
+static bool runBench(BenchArgs const& args)
+{
+    JobPool jobs;
+    jobs.init();
+
+    // Copied next to the executable, like Demo's.
+    AssetArchive assets;
+    std::string  archivePath = executableDir() + "assets.pak";
+    if (!assets.open(archivePath.c_str())) {
+        Info("No asset archive at '%s', loading loose files",
+             archivePath.c_str());
+    }
+    AssetArchive const* pAssets = assets.isOpen() ? &assets : nullptr;
+
+    RendererInfo rendererInfo;
+    rendererInfo.headless          = true;
+    rendererInfo.framebufferWidth  = as<int>(args.width);
+    rendererInfo.framebufferHeight = as<int>(args.height);
+    rendererInfo.pAssets           = pAssets;
+    rendererInfo.pJobs             = &jobs;
+    rendererInfo.pPhysicalDevice   = args.pGpu;
+    rendererInfo.depthPrepass      = args.depthPrepass;
+
+    Renderer renderer;
+    VkResult result = renderer.init(rendererInfo);
+    if (result != VK_SUCCESS) {
+        Bug("Unable to start the renderer: %s", ToCStr(result));
+        return false;
+    }
+
+    // The scene. Built the same way each run, so runs can be compared.
+    {
+        std::vector<MeshData> models(2);
+        if (!loadObjMesh(pAssets, "cornell_box.obj", &models[0]) ||
+            !loadObjMesh(pAssets, "cube.obj",        &models[1])) {
+            return false;
+        }
+
+        MeshData scene;
+        generateScene(models, args.scene, &scene);
+        buildMeshLods(&scene);
+
+        result = renderer.uploadMesh(scene);
+        if (result != VK_SUCCESS) {
+            Bug("Unable to upload the scene: %s", ToCStr(result));
+            return false;
+        }
+    }
+
+    // Warm-up fills caches, and compiles anything compiled lazily.
+    for (uint32_t i = 0; i < args.warmupFrames; i += 1) {
+        placeCamera(&renderer, args.scene, i, args.frames);
+        renderer.doOneFrame();
+    }
+
+    // Only the renderer's own frame is timed. The GPU's time for a frame
+    // comes back a few frames later, which doesn't matter for the stats.
+    std::vector<double> cpuMs;
+    std::vector<double> gpuMs;
+    cpuMs.reserve(args.frames);
+    gpuMs.reserve(args.frames);
+    for (uint32_t i = 0; i < args.frames; i += 1) {
+        placeCamera(&renderer, args.scene, i, args.frames);
+
+        auto start = std::chrono::steady_clock::now();
+        renderer.doOneFrame();
+        auto end   = std::chrono::steady_clock::now();
+
+        cpuMs.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+        if (renderer.lastGpuFrameMs() >= 0.0) {
+            gpuMs.push_back(renderer.lastGpuFrameMs());
+        }
+    }
+    if (gpuMs.empty()) {
+        Info("The device can't time frames, so there are no GPU times");
+    }
+
+    std::vector<Metric> metrics = makeMetrics();
+    setFrameStats(metrics, "cpu_ms", cpuMs);
+    setFrameStats(metrics, "gpu_ms", gpuMs);
+    findMetric(metrics, "peak_rss_mib")->value = peakRssMib();
+    VkDeviceSize deviceMemory = renderer.deviceMemoryUsage();
+    if (deviceMemory != 0) {
+        findMetric(metrics, "device_memory_mib")->value =
+            as<double>(deviceMemory) / (1024.0 * 1024.0);
+    }
+
+    return writeResults(args.pOut, args, renderer.deviceName(), metrics);
+}
+
+// ==== Arguments ===============================================================
+
+static bool matchArg(char const* pArg, char const* pName, char const** ppValue)
+{
+    size_t length = strlen(pName);
+    if (strncmp(pArg, pName, length) != 0) {
+        return false;
+    }
+    *ppValue = pArg + length;
+    return true;
+}
+
+static bool parseArgs(int argc, char** argv, BenchArgs* pArgs)
+{
+    BenchArgs& args = *pArgs;
+
+    for (int i = 1; i < argc; i += 1) {
+        char const* pValue = nullptr;
+        if (matchArg(argv[i], "--instances=", &pValue)) {
+            args.scene.instanceCount = as<uint32_t>(strtoul(pValue, nullptr, 10));
+        } else if (matchArg(argv[i], "--meshes=", &pValue)) {
+            args.scene.meshCount = as<uint32_t>(strtoul(pValue, nullptr, 10));
+        } else if (matchArg(argv[i], "--materials=", &pValue)) {
+            args.scene.materialCount = as<uint32_t>(strtoul(pValue, nullptr, 10));
+        } else if (matchArg(argv[i], "--seed=", &pValue)) {
+            args.scene.seed = as<uint32_t>(strtoul(pValue, nullptr, 10));
+        } else if (matchArg(argv[i], "--warmup=", &pValue)) {
+            args.warmupFrames = as<uint32_t>(strtoul(pValue, nullptr, 10));
+        } else if (matchArg(argv[i], "--frames=", &pValue)) {
+            args.frames = as<uint32_t>(strtoul(pValue, nullptr, 10));
+        } else if (matchArg(argv[i], "--width=", &pValue)) {
+            args.width = as<uint32_t>(strtoul(pValue, nullptr, 10));
+        } else if (matchArg(argv[i], "--height=", &pValue)) {
+            args.height = as<uint32_t>(strtoul(pValue, nullptr, 10));
+        } else if (matchArg(argv[i], "--gpu=", &pValue)) {
+            args.pGpu = pValue;
+        } else if (matchArg(argv[i], "--depth-prepass=", &pValue)) {
+            args.depthPrepass = (strcmp(pValue, "0") != 0);
+        } else if (matchArg(argv[i], "--out=", &pValue)) {
+            args.pOut = pValue;
+        } else if (matchArg(argv[i], "--baseline=", &pValue)) {
+            args.pBaseline = pValue;
+        } else if (matchArg(argv[i], "--threshold=", &pValue)) {
+            args.threshold = strtod(pValue, nullptr);
+        } else if (matchArg(argv[i], "--results=", &pValue)) {
+            args.pResults = pValue;
+        } else {
+            Bug("Unknown argument \"%s\"", argv[i]);
+            return false;
+        }
+    }
+
+    if (args.scene.meshCount == 0 || args.frames == 0 ||
+        args.width == 0 || args.height == 0) {
+        Bug("--meshes, --frames, --width, and --height can't be 0");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    BenchArgs args;
+    if (!parseArgs(argc, argv, &args)) {
+        return 2;
+    }
+
+    // A fresh run is read back from its file too, so both sides of the
+    // comparison are written, and read, the same way.
+    char const* pResults = args.pResults;
+    if (pResults == nullptr) {
+        if (!runBench(args)) {
+            return 2;
+        }
+        Info("Wrote \"%s\"", args.pOut);
+        pResults = args.pOut;
+    }
+
+    Results results;
+    if (!readResults(pResults, &results)) {
+        return 2;
+    }
+
+    if (args.pBaseline == nullptr) {
+        for (Metric const& metric : results.metrics) {
+            printf("%-20s %12.3f\n", metric.pName, metric.value);
+        }
+        return 0;
+    }
+
+    Results baseline;
+    if (!readResults(args.pBaseline, &baseline)) {
+        return 2;
+    }
+    if (!sameRun(baseline, results)) {
+        printf("Not comparing against \"%s\", it's from a different run\n",
+               args.pBaseline);
+        return 2;
+    }
+    uint32_t regressions = compareResults(baseline, results, args.threshold);
+    if (regressions != 0) {
+        printf("%u metric(s) regressed by more than %.1f%%\n",
+               regressions, args.threshold);
+        return 1;
+    }
+    return 0;
+}
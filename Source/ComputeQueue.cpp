@@ -0,0 +1,254 @@
+#include "ComputeQueue.hpp"
+
+ComputeQueue::~ComputeQueue()
+{
+    deInit();
+}
+
+VkResult ComputeQueue::init(ComputeQueueInfo const& info)
+{
+    VkResult result;
+
+    Assert(info.device     != nullptr);
+    Assert(info.queue      != nullptr);
+    Assert(info.frameCount != 0);
+    m_info = info;
+
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT |
+                     VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = info.queueFamily;
+
+    result = vkCreateCommandPool(info.device, &poolInfo, info.pAlloc,
+                                 &m_vkCommandPool);
+    AssertVk(result);
+
+    m_vkCmdBuffers.resize(info.frameCount);
+
+    VkCommandBufferAllocateInfo cmdBufAllocInfo = {};
+    cmdBufAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    cmdBufAllocInfo.commandPool        = m_vkCommandPool;
+    cmdBufAllocInfo.level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    cmdBufAllocInfo.commandBufferCount = info.frameCount;
+
+    result = vkAllocateCommandBuffers(info.device, &cmdBufAllocInfo,
+                                      m_vkCmdBuffers.data());
+    AssertVk(result);
+
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    m_vkSemaphores.resize(info.frameCount);
+    for (VkSemaphore& semaphore : m_vkSemaphores) {
+        result = vkCreateSemaphore(info.device, &semaphoreInfo, info.pAlloc,
+                                   &semaphore);
+        AssertVk(result);
+    }
+
+    Info("Compute runs on queue family #%u%s",
+         info.queueFamily,
+         transfersOwnership() ? ", with ownership transfers" : "");
+
+    return result;
+}
+
+void ComputeQueue::deInit()
+{
+    if (m_info.device == nullptr) {
+        return;
+    }
+
+    for (VkSemaphore semaphore : m_vkSemaphores) {
+        vkDestroySemaphore(m_info.device, semaphore, m_info.pAlloc);
+    }
+    m_vkSemaphores.clear();
+
+    // Destroying the pool frees its command buffers.
+    vkDestroyCommandPool(m_info.device, m_vkCommandPool, m_info.pAlloc);
+    m_vkCommandPool = nullptr;
+    m_vkCmdBuffers.clear();
+
+    m_info = {};
+}
+
+void ComputeQueue::beginFrame(uint32_t frameIndex)
+{
+    Assert(frameIndex < m_info.frameCount);
+    AssertMsg(!m_recording, "Last frame's compute work was never submitted");
+
+    m_frameIndex = frameIndex;
+    m_waitStages = 0;
+    m_bufferTransfers.clear();
+    m_imageTransfers.clear();
+}
+
+VkCommandBuffer ComputeQueue::commandBuffer()
+{
+    VkCommandBuffer cmd = m_vkCmdBuffers[m_frameIndex];
+    if (m_recording) {
+        return cmd;
+    }
+
+    VkResult result = vkResetCommandBuffer(cmd, 0);
+    AssertVk(result);
+
+    VkCommandBufferBeginInfo cmdInfo = {};
+    cmdInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    cmdInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    result = vkBeginCommandBuffer(cmd, &cmdInfo);
+    AssertVk(result);
+
+    m_recording = true;
+    return cmd;
+}
+
+void ComputeQueue::releaseBuffer(VkBuffer             buffer,
+                                 VkDeviceSize         offset,
+                                 VkDeviceSize         size,
+                                 VkPipelineStageFlags dstStages,
+                                 VkAccessFlags        dstAccess)
+{
+    m_waitStages |= dstStages;
+    if (!transfersOwnership()) {
+        return;
+    }
+
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask       = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask       = dstAccess;
+    barrier.srcQueueFamilyIndex = m_info.queueFamily;
+    barrier.dstQueueFamilyIndex = m_info.graphicsQueueFamily;
+    barrier.buffer              = buffer;
+    barrier.offset              = offset;
+    barrier.size                = size;
+    m_bufferTransfers.push_back(barrier);
+}
+
+void ComputeQueue::releaseImage(VkImage                 image,
+                                VkImageSubresourceRange range,
+                                VkImageLayout           oldLayout,
+                                VkImageLayout           newLayout,
+                                VkPipelineStageFlags    dstStages,
+                                VkAccessFlags           dstAccess)
+{
+    m_waitStages |= dstStages;
+
+    // Without a transfer, a layout change still needs a barrier. The
+    // semaphore takes care of the rest.
+    if (!transfersOwnership() && oldLayout == newLayout) {
+        return;
+    }
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask       = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask       = dstAccess;
+    barrier.oldLayout           = oldLayout;
+    barrier.newLayout           = newLayout;
+    barrier.srcQueueFamilyIndex = transfersOwnership() ? m_info.queueFamily
+                                                       : VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = transfersOwnership() ? m_info.graphicsQueueFamily
+                                                       : VK_QUEUE_FAMILY_IGNORED;
+    barrier.image               = image;
+    barrier.subresourceRange    = range;
+    m_imageTransfers.push_back(barrier);
+}
+
+VkSemaphore ComputeQueue::submit(VkPipelineStageFlags* pWaitStages)
+{
+    VkResult result;
+
+    *pWaitStages = 0;
+    if (!m_recording) {
+        return nullptr;
+    }
+    VkCommandBuffer cmd = m_vkCmdBuffers[m_frameIndex];
+
+    // The releasing half. Its destination is on another queue, so there's
+    // nothing to wait for here - the semaphore does that.
+    if (!m_bufferTransfers.empty() || !m_imageTransfers.empty()) {
+        if (transfersOwnership()) {
+            vkCmdPipelineBarrier(cmd,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                                 0,
+                                 0, nullptr,
+                                 as<uint32_t>(m_bufferTransfers.size()),
+                                 m_bufferTransfers.data(),
+                                 as<uint32_t>(m_imageTransfers.size()),
+                                 m_imageTransfers.data());
+        } else {
+            // Layout changes only. Nothing after BOTTOM_OF_PIPE can access
+            // anything, and the semaphore makes the writes visible anyway.
+            for (VkImageMemoryBarrier& barrier : m_imageTransfers) {
+                barrier.dstAccessMask = 0;
+            }
+            vkCmdPipelineBarrier(cmd,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                                 0,
+                                 0, nullptr,
+                                 0, nullptr,
+                                 as<uint32_t>(m_imageTransfers.size()),
+                                 m_imageTransfers.data());
+            m_imageTransfers.clear();
+        }
+    }
+
+    result = vkEndCommandBuffer(cmd);
+    AssertVk(result);
+    m_recording = false;
+
+    VkSemaphore semaphore = m_vkSemaphores[m_frameIndex];
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount   = 1;
+    submitInfo.pCommandBuffers      = &cmd;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores    = &semaphore;
+    result = vkQueueSubmit(m_info.queue, 1, &submitInfo, nullptr);
+    AssertVk(result);
+
+    // Without any hand-offs, graphics still shouldn't start anything that
+    // might depend on compute.
+    *pWaitStages = m_waitStages != 0 ? m_waitStages
+                                     : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    return semaphore;
+}
+
+void ComputeQueue::acquire(VkCommandBuffer graphicsCmd)
+{
+    if (m_bufferTransfers.empty() && m_imageTransfers.empty()) {
+        return;
+    }
+
+    // The acquiring half repeats the release's transfer and layout change.
+    // Its source scope is empty - the semaphore already waited for compute.
+    for (VkBufferMemoryBarrier& barrier : m_bufferTransfers) {
+        barrier.srcAccessMask = 0;
+    }
+    for (VkImageMemoryBarrier& barrier : m_imageTransfers) {
+        barrier.srcAccessMask = 0;
+    }
+
+    vkCmdPipelineBarrier(graphicsCmd,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         m_waitStages,
+                         0,
+                         0, nullptr,
+                         as<uint32_t>(m_bufferTransfers.size()),
+                         m_bufferTransfers.data(),
+                         as<uint32_t>(m_imageTransfers.size()),
+                         m_imageTransfers.data());
+
+    m_bufferTransfers.clear();
+    m_imageTransfers.clear();
+}
+
+bool ComputeQueue::transfersOwnership() const
+{
+    return m_info.queueFamily != m_info.graphicsQueueFamily;
+}
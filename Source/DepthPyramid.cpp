@@ -0,0 +1,306 @@
+#include "DepthPyramid.hpp"
+#include "Descriptors.hpp"
+#include "VkMemory.hpp"
+
+#include <algorithm>
+
+// Must match local_size_x and local_size_y in Glsl/DepthPyramid.comp.
+static constexpr uint32_t kPyramidGroupSize = 8;
+
+// Must match PyramidParams in Glsl/DepthPyramid.comp.
+struct PyramidParams
+{
+    int32_t srcWidth;
+    int32_t srcHeight;
+    int32_t dstWidth;
+    int32_t dstHeight;
+};
+
+// Where to read from, and write to, for one level.
+struct PyramidSetData
+{
+    VkDescriptorImageInfo src;
+    VkDescriptorImageInfo dst;
+};
+
+DepthPyramid::~DepthPyramid()
+{
+    deInit();
+}
+
+VkResult DepthPyramid::init(DepthPyramidInfo const& info)
+{
+    VkResult result;
+
+    Assert(info.device        != nullptr);
+    Assert(info.pDescriptors  != nullptr);
+    Assert(info.pyramidModule != nullptr);
+    Assert(info.depthExtent.width > 0 && info.depthExtent.height > 0);
+    m_info = info;
+
+    result = createImages(info.depthExtent);
+    AssertVk(result);
+
+    // Only ever used with texelFetch(), so filtering doesn't matter.
+    VkSamplerCreateInfo samplerInfo = {};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter    = VK_FILTER_NEAREST;
+    samplerInfo.minFilter    = VK_FILTER_NEAREST;
+    samplerInfo.mipmapMode   = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.maxLod       = as<float>(levelCount());
+
+    result = vkCreateSampler(info.device, &samplerInfo, info.pAlloc,
+                             &m_vkSampler);
+    AssertVk(result);
+
+    DescriptorBinding bindings[2] = {};
+    bindings[0].binding = 0;
+    bindings[0].type    = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[0].count   = 1;
+    bindings[0].stages  = VK_SHADER_STAGE_COMPUTE_BIT;
+    bindings[0].offset  = offsetof(PyramidSetData, src);
+    bindings[0].stride  = sizeof(VkDescriptorImageInfo);
+    bindings[1].binding = 1;
+    bindings[1].type    = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    bindings[1].count   = 1;
+    bindings[1].stages  = VK_SHADER_STAGE_COMPUTE_BIT;
+    bindings[1].offset  = offsetof(PyramidSetData, dst);
+    bindings[1].stride  = sizeof(VkDescriptorImageInfo);
+    m_pSetLayout = info.pDescriptors->getLayout(bindings,
+                                                array_size(bindings));
+
+    VkPushConstantRange pushRange = {};
+    pushRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushRange.offset     = 0;
+    pushRange.size       = sizeof(PyramidParams);
+
+    VkPipelineLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layoutInfo.setLayoutCount         = 1;
+    layoutInfo.pSetLayouts            = &m_pSetLayout->vkLayout;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges    = &pushRange;
+
+    result = vkCreatePipelineLayout(info.device, &layoutInfo, info.pAlloc,
+                                    &m_vkPipelineLayout);
+    AssertVk(result);
+
+    VkComputePipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage  = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = info.pyramidModule;
+    pipelineInfo.stage.pName  = "main";
+    pipelineInfo.layout       = m_vkPipelineLayout;
+
+    result = vkCreateComputePipelines(info.device, info.cache, 1,
+                                      &pipelineInfo, info.pAlloc,
+                                      &m_vkPipeline);
+    AssertVk(result);
+
+    Info("Depth pyramid: %u levels, %ux%u at the base",
+         levelCount(), m_levels[0].extent.width, m_levels[0].extent.height);
+
+    return result;
+}
+
+void DepthPyramid::deInit()
+{
+    if (m_info.device == nullptr) {
+        return;
+    }
+
+    vkDestroyPipeline(m_info.device, m_vkPipeline, m_info.pAlloc);
+    vkDestroyPipelineLayout(m_info.device, m_vkPipelineLayout, m_info.pAlloc);
+    m_vkPipeline       = nullptr;
+    m_vkPipelineLayout = nullptr;
+    // Descriptors owns the set layout.
+    m_pSetLayout       = nullptr;
+
+    vkDestroySampler(m_info.device, m_vkSampler, m_info.pAlloc);
+    m_vkSampler = nullptr;
+    destroyImages();
+
+    m_info = {};
+}
+
+VkResult DepthPyramid::resize(VkExtent2D depthExtent)
+{
+    Assert(m_info.device != nullptr);
+    Assert(depthExtent.width > 0 && depthExtent.height > 0);
+
+    destroyImages();
+    m_info.depthExtent = depthExtent;
+    VkResult result = createImages(depthExtent);
+
+    Info("Depth pyramid: %u levels, %ux%u at the base",
+         levelCount(), m_levels[0].extent.width, m_levels[0].extent.height);
+    return result;
+}
+
+VkResult DepthPyramid::createImages(VkExtent2D depthExtent)
+{
+    VkResult result;
+
+    // Halve, rounding up, until we get to 1x1.
+    VkExtent2D extent = depthExtent;
+    do {
+        extent.width  = std::max((extent.width  + 1) / 2, 1u);
+        extent.height = std::max((extent.height + 1) / 2, 1u);
+        Level level;
+        level.extent = extent;
+        m_levels.push_back(level);
+    } while (extent.width > 1 || extent.height > 1);
+
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType     = VK_IMAGE_TYPE_2D;
+    imageInfo.format        = VK_FORMAT_R32_SFLOAT;
+    imageInfo.extent        = { m_levels[0].extent.width,
+                                m_levels[0].extent.height, 1 };
+    imageInfo.mipLevels     = levelCount();
+    imageInfo.arrayLayers   = 1;
+    imageInfo.samples       = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling        = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage         = VK_IMAGE_USAGE_STORAGE_BIT |
+                              VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.sharingMode   = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    result = vkCreateImage(m_info.device, &imageInfo, m_info.pAlloc, &m_vkImage);
+    AssertVk(result);
+
+    VkMemoryRequirements memReq = {};
+    vkGetImageMemoryRequirements(m_info.device, m_vkImage, &memReq);
+
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize  = memReq.size;
+    allocInfo.memoryTypeIndex = findMemoryType(m_info.memoryProperties,
+                                               memReq.memoryTypeBits,
+                                               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    AssertMsg(allocInfo.memoryTypeIndex != VK_MAX_MEMORY_TYPES,
+              "No device local memory for the depth pyramid");
+
+    result = vkAllocateMemory(m_info.device, &allocInfo, m_info.pAlloc, &m_vkMemory);
+    AssertVk(result);
+    result = vkBindImageMemory(m_info.device, m_vkImage, m_vkMemory, 0);
+    AssertVk(result);
+
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image    = m_vkImage;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format   = VK_FORMAT_R32_SFLOAT;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.levelCount = levelCount();
+    viewInfo.subresourceRange.layerCount = 1;
+
+    result = vkCreateImageView(m_info.device, &viewInfo, m_info.pAlloc, &m_vkView);
+    AssertVk(result);
+
+    // Storage images are written one level at a time.
+    for (uint32_t i = 0; i < levelCount(); i += 1) {
+        viewInfo.subresourceRange.baseMipLevel = i;
+        viewInfo.subresourceRange.levelCount   = 1;
+        result = vkCreateImageView(m_info.device, &viewInfo, m_info.pAlloc,
+                                   &m_levels[i].view);
+        AssertVk(result);
+    }
+
+    return result;
+}
+
+void DepthPyramid::destroyImages()
+{
+    for (Level const& level : m_levels) {
+        vkDestroyImageView(m_info.device, level.view, m_info.pAlloc);
+    }
+    m_levels.clear();
+    vkDestroyImageView(m_info.device, m_vkView, m_info.pAlloc);
+    vkDestroyImage(m_info.device, m_vkImage, m_info.pAlloc);
+    vkFreeMemory(m_info.device, m_vkMemory, m_info.pAlloc);
+    m_vkView    = nullptr;
+    m_vkImage   = nullptr;
+    m_vkMemory  = nullptr;
+}
+
+void DepthPyramid::record(VkCommandBuffer cmd, VkImageView depthView)
+{
+    // Last frame's pyramid is thrown away, but whoever read it has to be
+    // done first.
+    VkImageMemoryBarrier discard = {};
+    discard.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    discard.srcAccessMask       = 0;
+    discard.dstAccessMask       = VK_ACCESS_SHADER_WRITE_BIT;
+    discard.oldLayout           = VK_IMAGE_LAYOUT_UNDEFINED;
+    discard.newLayout           = VK_IMAGE_LAYOUT_GENERAL;
+    discard.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    discard.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    discard.image               = m_vkImage;
+    discard.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    discard.subresourceRange.levelCount = levelCount();
+    discard.subresourceRange.layerCount = 1;
+    vkCmdPipelineBarrier(cmd,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0,
+                         0, nullptr,
+                         0, nullptr,
+                         1, &discard);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_vkPipeline);
+
+    VkExtent2D srcExtent = m_info.depthExtent;
+    for (uint32_t i = 0; i < levelCount(); i += 1) {
+        Level const& level = m_levels[i];
+
+        PyramidSetData data = {};
+        data.src.sampler     = m_vkSampler;
+        data.src.imageView   = i == 0 ? depthView : m_levels[i - 1].view;
+        data.src.imageLayout = i == 0 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+                                      : VK_IMAGE_LAYOUT_GENERAL;
+        data.dst.imageView   = level.view;
+        data.dst.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        VkDescriptorSet set = m_info.pDescriptors->allocateFrameSet(*m_pSetLayout,
+                                                                    &data);
+
+        PyramidParams params = {};
+        params.srcWidth  = as<int32_t>(srcExtent.width);
+        params.srcHeight = as<int32_t>(srcExtent.height);
+        params.dstWidth  = as<int32_t>(level.extent.width);
+        params.dstHeight = as<int32_t>(level.extent.height);
+
+        vkCmdBindDescriptorSets(cmd,
+                                VK_PIPELINE_BIND_POINT_COMPUTE,
+                                m_vkPipelineLayout,
+                                0, // firstSet
+                                1, &set,
+                                0, nullptr);
+        vkCmdPushConstants(cmd, m_vkPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                           0, sizeof(params), &params);
+        vkCmdDispatch(cmd,
+                      (level.extent.width  + kPyramidGroupSize - 1) / kPyramidGroupSize,
+                      (level.extent.height + kPyramidGroupSize - 1) / kPyramidGroupSize,
+                      1);
+
+        // The next level reads this one. After the last, the culling shader
+        // reads all of them.
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(cmd,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0,
+                             1, &barrier,
+                             0, nullptr,
+                             0, nullptr);
+
+        srcExtent = level.extent;
+    }
+}
@@ -0,0 +1,489 @@
+#include "Descriptors.hpp"
+
+#include <algorithm>
+
+// Every pool in a chain is the same size. These are per set, and roughly match
+// what our layouts ask for. Running out of one type just chains another pool.
+static constexpr uint32_t kSetsPerPool = 128;
+
+static constexpr struct
+{
+    VkDescriptorType    type;
+    uint32_t            perSet;
+} kPoolSizes[] = {
+    { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,          2 },
+    { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,  1 },
+    { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,          4 },
+    { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,  1 },
+    { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,  4 },
+    { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,           2 },
+    { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,           2 },
+    { VK_DESCRIPTOR_TYPE_SAMPLER,                 1 },
+    { VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,        1 },
+};
+
+// Which VkDescriptor*Info a descriptor type is written with.
+enum class DescriptorInfoKind
+{
+    Buffer,
+    Image,
+    TexelBuffer,
+};
+
+static DescriptorInfoKind infoKindOf(VkDescriptorType type)
+{
+    switch (type) {
+        case VK_DESCRIPTOR_TYPE_SAMPLER:
+        case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+        case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+        case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+        case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
+            return DescriptorInfoKind::Image;
+        case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
+        case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
+            return DescriptorInfoKind::TexelBuffer;
+        default:
+            return DescriptorInfoKind::Buffer;
+    }
+}
+
+static size_t infoSizeOf(DescriptorInfoKind kind)
+{
+    switch (kind) {
+        case DescriptorInfoKind::Image:       return sizeof(VkDescriptorImageInfo);
+        case DescriptorInfoKind::TexelBuffer: return sizeof(VkBufferView);
+        case DescriptorInfoKind::Buffer:      return sizeof(VkDescriptorBufferInfo);
+    }
+    return 0;
+}
+
+// ==== DescriptorAllocator =====================================================
+
+void DescriptorAllocator::init(VkDevice                     device,
+                               VkAllocationCallbacks const* pAlloc,
+                               bool                         poolErrors)
+{
+    Assert(device != nullptr);
+    m_device     = device;
+    m_pAlloc     = pAlloc;
+    m_poolErrors = poolErrors;
+}
+
+void DescriptorAllocator::deInit()
+{
+    reset();
+    for (VkDescriptorPool pool : m_freePools) {
+        vkDestroyDescriptorPool(m_device, pool, m_pAlloc);
+    }
+    m_freePools.clear();
+}
+
+VkResult DescriptorAllocator::allocate(VkDescriptorSetLayout layout,
+                                       VkDescriptorSet*      pSet)
+{
+    VkResult result;
+
+    if (m_current == nullptr) {
+        result = grabPool(&m_current);
+        AssertVk(result);
+    }
+
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool     = m_current;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts        = &layout;
+
+    result = vkAllocateDescriptorSets(m_device, &allocInfo, pSet);
+    bool poolFull = result == VK_ERROR_FRAGMENTED_POOL ||
+                    result == VK_ERROR_OUT_OF_POOL_MEMORY_KHR;
+    // Before VK_KHR_maintenance1, drivers report a full pool however they
+    // like. If it really is memory, the fresh pool fails too.
+    if (!m_poolErrors) {
+        poolFull = poolFull ||
+                   result == VK_ERROR_OUT_OF_DEVICE_MEMORY ||
+                   result == VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    if (!poolFull) {
+        return result;
+    }
+
+    // This pool is done. Chain on a new one, and try again once - a fresh
+    // pool failing means the layout itself is too big for our pools.
+    result = grabPool(&m_current);
+    AssertVk(result);
+
+    allocInfo.descriptorPool = m_current;
+    result = vkAllocateDescriptorSets(m_device, &allocInfo, pSet);
+    AssertMsg(result == VK_SUCCESS,
+              "A fresh descriptor pool couldn't fit one set: %s",
+              ToCStr(result));
+    return result;
+}
+
+void DescriptorAllocator::reset()
+{
+    for (VkDescriptorPool pool : m_usedPools) {
+        vkResetDescriptorPool(m_device, pool, 0);
+        m_freePools.push_back(pool);
+    }
+    m_usedPools.clear();
+    m_current = nullptr;
+}
+
+uint32_t DescriptorAllocator::poolCount() const
+{
+    return as<uint32_t>(m_usedPools.size() + m_freePools.size());
+}
+
+VkResult DescriptorAllocator::grabPool(VkDescriptorPool* pPool)
+{
+    VkResult result = VK_SUCCESS;
+
+    if (!m_freePools.empty()) {
+        *pPool = m_freePools.back();
+        m_freePools.pop_back();
+        m_usedPools.push_back(*pPool);
+        return result;
+    }
+
+    VkDescriptorPoolSize poolSizes[array_size(kPoolSizes)] = {};
+    for (uint32_t i = 0; i < array_size(kPoolSizes); i += 1) {
+        poolSizes[i].type            = kPoolSizes[i].type;
+        poolSizes[i].descriptorCount = kPoolSizes[i].perSet * kSetsPerPool;
+    }
+
+    // No FREE_DESCRIPTOR_SET_BIT. Sets are only ever freed by resetting.
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags         = 0;
+    poolInfo.maxSets       = kSetsPerPool;
+    poolInfo.poolSizeCount = array_size(poolSizes);
+    poolInfo.pPoolSizes    = poolSizes;
+
+    result = vkCreateDescriptorPool(m_device, &poolInfo, m_pAlloc, pPool);
+    AssertVk(result);
+
+    m_usedPools.push_back(*pPool);
+    Verbose("Chained descriptor pool #%u", poolCount());
+
+    return result;
+}
+
+// ==== Descriptors =============================================================
+
+Descriptors::~Descriptors()
+{
+    deInit();
+}
+
+void Descriptors::init(DescriptorsInfo const& info)
+{
+    Assert(info.device     != nullptr);
+    Assert(info.frameCount != 0);
+    m_info = info;
+
+    m_persistentAllocator.init(info.device, info.pAlloc, info.poolErrors);
+    m_frameAllocators.resize(info.frameCount);
+    for (DescriptorAllocator& allocator : m_frameAllocators) {
+        allocator.init(info.device, info.pAlloc, info.poolErrors);
+    }
+
+    if (info.updateTemplates) {
+        m_pfnCreateTemplate = reinterpret_cast<PFN_vkCreateDescriptorUpdateTemplateKHR>(
+            vkGetDeviceProcAddr(info.device,
+                                "vkCreateDescriptorUpdateTemplateKHR"));
+        m_pfnDestroyTemplate = reinterpret_cast<PFN_vkDestroyDescriptorUpdateTemplateKHR>(
+            vkGetDeviceProcAddr(info.device,
+                                "vkDestroyDescriptorUpdateTemplateKHR"));
+        m_pfnUpdateTemplate = reinterpret_cast<PFN_vkUpdateDescriptorSetWithTemplateKHR>(
+            vkGetDeviceProcAddr(info.device,
+                                "vkUpdateDescriptorSetWithTemplateKHR"));
+
+        if (m_pfnCreateTemplate  == nullptr ||
+            m_pfnDestroyTemplate == nullptr ||
+            m_pfnUpdateTemplate  == nullptr) {
+            Bug("VK_KHR_descriptor_update_template is enabled, "
+                "but its functions couldn't be loaded");
+            m_pfnCreateTemplate  = nullptr;
+            m_pfnDestroyTemplate = nullptr;
+            m_pfnUpdateTemplate  = nullptr;
+        }
+    }
+    Info("Descriptor writes use %s",
+         m_pfnUpdateTemplate != nullptr ? "update templates"
+                                        : "vkUpdateDescriptorSets");
+}
+
+void Descriptors::deInit()
+{
+    if (m_info.device == nullptr) {
+        return;
+    }
+    logStats();
+
+    m_persistentSets.clear();
+    m_persistentAllocator.deInit();
+    for (DescriptorAllocator& allocator : m_frameAllocators) {
+        allocator.deInit();
+    }
+    m_frameAllocators.clear();
+
+    for (auto const& entry : m_layouts) {
+        DescriptorLayout const& layout = *entry.second;
+        if (layout.vkTemplate != nullptr) {
+            m_pfnDestroyTemplate(m_info.device, layout.vkTemplate,
+                                 m_info.pAlloc);
+        }
+        vkDestroyDescriptorSetLayout(m_info.device, layout.vkLayout,
+                                     m_info.pAlloc);
+    }
+    m_layouts.clear();
+
+    m_info = {};
+}
+
+DescriptorLayout const* Descriptors::getLayout(DescriptorBinding const* pBindings,
+                                               uint32_t                 count)
+{
+    // Binding order doesn't change the layout, so don't let it change the hash.
+    std::vector<DescriptorBinding> bindings(pBindings, pBindings + count);
+    std::sort(bindings.begin(), bindings.end(),
+        [](DescriptorBinding const& lhs, DescriptorBinding const& rhs) {
+            return lhs.binding < rhs.binding;
+        });
+
+    // Fields are hashed one by one, so struct padding never gets in.
+    uint64_t hash = kHashSeed;
+    for (DescriptorBinding const& binding : bindings) {
+        hash = hashBytes(&binding.binding, sizeof(binding.binding), hash);
+        hash = hashBytes(&binding.type,    sizeof(binding.type),    hash);
+        hash = hashBytes(&binding.count,   sizeof(binding.count),   hash);
+        hash = hashBytes(&binding.stages,  sizeof(binding.stages),  hash);
+        hash = hashBytes(&binding.offset,  sizeof(binding.offset),  hash);
+        hash = hashBytes(&binding.stride,  sizeof(binding.stride),  hash);
+    }
+
+    auto found = m_layouts.find(hash);
+    if (found != m_layouts.end()) {
+        return found->second.get();
+    }
+
+    std::vector<VkDescriptorSetLayoutBinding> vkBindings(bindings.size());
+    for (size_t i = 0; i < bindings.size(); i += 1) {
+        vkBindings[i].binding         = bindings[i].binding;
+        vkBindings[i].descriptorType  = bindings[i].type;
+        vkBindings[i].descriptorCount = bindings[i].count;
+        vkBindings[i].stageFlags      = bindings[i].stages;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = as<uint32_t>(vkBindings.size());
+    layoutInfo.pBindings    = vkBindings.data();
+
+    auto pLayout = std::make_unique<DescriptorLayout>();
+    pLayout->bindings = std::move(bindings);
+    pLayout->hash     = hash;
+
+    VkResult result = vkCreateDescriptorSetLayout(m_info.device, &layoutInfo,
+                                                  m_info.pAlloc,
+                                                  &pLayout->vkLayout);
+    AssertVk(result);
+
+    pLayout->vkTemplate = createTemplate(*pLayout);
+
+    Verbose("Created descriptor set layout 0x%016llx (%zu bindings)",
+            as<unsigned long long>(hash), pLayout->bindings.size());
+
+    DescriptorLayout const* pResult = pLayout.get();
+    m_layouts.emplace(hash, std::move(pLayout));
+    return pResult;
+}
+
+void Descriptors::beginFrame(uint32_t frameIndex)
+{
+    Assert(frameIndex < m_frameAllocators.size());
+    m_frameIndex = frameIndex;
+    m_frameAllocators[frameIndex].reset();
+}
+
+VkDescriptorSet Descriptors::allocateFrameSet(DescriptorLayout const& layout,
+                                              void const*             pData)
+{
+    VkDescriptorSet set = nullptr;
+    VkResult result = m_frameAllocators[m_frameIndex].allocate(layout.vkLayout,
+                                                               &set);
+    AssertVk(result);
+
+    write(layout, set, pData);
+    m_frameSetCount += 1;
+    return set;
+}
+
+VkDescriptorSet Descriptors::getPersistentSet(DescriptorLayout const& layout,
+                                              void const*             pData)
+{
+    uint64_t hash = hashResources(layout, pData);
+
+    auto found = m_persistentSets.find(hash);
+    if (found != m_persistentSets.end()) {
+        m_persistentHits += 1;
+        return found->second;
+    }
+    m_persistentMisses += 1;
+
+    VkDescriptorSet set = nullptr;
+    VkResult result = m_persistentAllocator.allocate(layout.vkLayout, &set);
+    AssertVk(result);
+
+    write(layout, set, pData);
+    m_persistentSets.emplace(hash, set);
+    return set;
+}
+
+void Descriptors::invalidatePersistentSet(DescriptorLayout const& layout,
+                                          void const*             pData)
+{
+    m_persistentSets.erase(hashResources(layout, pData));
+}
+
+void Descriptors::write(DescriptorLayout const& layout,
+                        VkDescriptorSet         set,
+                        void const*             pData) const
+{
+    if (layout.vkTemplate != nullptr) {
+        m_pfnUpdateTemplate(m_info.device, set, layout.vkTemplate, pData);
+        return;
+    }
+
+    // No templates, so build the equivalent writes by hand. Arrays that aren't
+    // tightly packed in 'pData' need one write per element.
+    auto const* pBytes = ptr_as<const uint8_t>(pData);
+
+    std::vector<VkWriteDescriptorSet> writes;
+    writes.reserve(layout.bindings.size());
+    for (DescriptorBinding const& binding : layout.bindings) {
+        DescriptorInfoKind kind   = infoKindOf(binding.type);
+        size_t             size   = infoSizeOf(kind);
+        bool               packed = binding.count == 1 || binding.stride == size;
+
+        uint32_t elementCount = packed ? 1 : binding.count;
+        for (uint32_t i = 0; i < elementCount; i += 1) {
+            uint8_t const* pInfo = pBytes + binding.offset + i * binding.stride;
+
+            VkWriteDescriptorSet write = {};
+            write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write.dstSet          = set;
+            write.dstBinding      = binding.binding;
+            write.dstArrayElement = i;
+            write.descriptorCount = packed ? binding.count : 1;
+            write.descriptorType  = binding.type;
+            switch (kind) {
+                case DescriptorInfoKind::Buffer:
+                    write.pBufferInfo =
+                        ptr_as<const VkDescriptorBufferInfo>(pInfo);
+                    break;
+                case DescriptorInfoKind::Image:
+                    write.pImageInfo =
+                        ptr_as<const VkDescriptorImageInfo>(pInfo);
+                    break;
+                case DescriptorInfoKind::TexelBuffer:
+                    write.pTexelBufferView = ptr_as<const VkBufferView>(pInfo);
+                    break;
+            }
+            writes.push_back(write);
+        }
+    }
+
+    vkUpdateDescriptorSets(m_info.device, as<uint32_t>(writes.size()),
+                           writes.data(), 0, nullptr);
+}
+
+void Descriptors::logStats() const
+{
+    uint32_t framePools = 0;
+    for (DescriptorAllocator const& allocator : m_frameAllocators) {
+        framePools += allocator.poolCount();
+    }
+
+    Info("Descriptors:\n"
+         "    Layouts:          %zu\n"
+         "    Persistent sets:  %zu (%u hits, %u misses), %u pool(s)\n"
+         "    Frame sets:       %u, %u pool(s) across %zu frames",
+         m_layouts.size(),
+         m_persistentSets.size(), m_persistentHits, m_persistentMisses,
+         m_persistentAllocator.poolCount(),
+         m_frameSetCount, framePools, m_frameAllocators.size());
+}
+
+uint64_t Descriptors::hashResources(DescriptorLayout const& layout,
+                                    void const*             pData) const
+{
+    auto const* pBytes = ptr_as<const uint8_t>(pData);
+
+    // Hash the handles and ranges, not raw bytes - VkDescriptorImageInfo has
+    // padding on 64-bit platforms.
+    uint64_t hash = layout.hash;
+    for (DescriptorBinding const& binding : layout.bindings) {
+        for (uint32_t i = 0; i < binding.count; i += 1) {
+            uint8_t const* pInfo = pBytes + binding.offset + i * binding.stride;
+
+            switch (infoKindOf(binding.type)) {
+                case DescriptorInfoKind::Buffer: {
+                    auto const& info = *ptr_as<const VkDescriptorBufferInfo>(pInfo);
+                    hash = hashBytes(&info.buffer, sizeof(info.buffer), hash);
+                    hash = hashBytes(&info.offset, sizeof(info.offset), hash);
+                    hash = hashBytes(&info.range,  sizeof(info.range),  hash);
+                    break;
+                }
+                case DescriptorInfoKind::Image: {
+                    auto const& info = *ptr_as<const VkDescriptorImageInfo>(pInfo);
+                    hash = hashBytes(&info.sampler,     sizeof(info.sampler),     hash);
+                    hash = hashBytes(&info.imageView,   sizeof(info.imageView),   hash);
+                    hash = hashBytes(&info.imageLayout, sizeof(info.imageLayout), hash);
+                    break;
+                }
+                case DescriptorInfoKind::TexelBuffer: {
+                    hash = hashBytes(pInfo, sizeof(VkBufferView), hash);
+                    break;
+                }
+            }
+        }
+    }
+    return hash;
+}
+
+VkDescriptorUpdateTemplateKHR
+Descriptors::createTemplate(DescriptorLayout const& layout) const
+{
+    if (m_pfnCreateTemplate == nullptr) {
+        return nullptr;
+    }
+
+    std::vector<VkDescriptorUpdateTemplateEntryKHR> entries(layout.bindings.size());
+    for (size_t i = 0; i < layout.bindings.size(); i += 1) {
+        DescriptorBinding const& binding = layout.bindings[i];
+        entries[i].dstBinding      = binding.binding;
+        entries[i].dstArrayElement = 0;
+        entries[i].descriptorCount = binding.count;
+        entries[i].descriptorType  = binding.type;
+        entries[i].offset          = binding.offset;
+        entries[i].stride          = binding.stride;
+    }
+
+    VkDescriptorUpdateTemplateCreateInfoKHR templateInfo = {};
+    templateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO_KHR;
+    templateInfo.descriptorUpdateEntryCount = as<uint32_t>(entries.size());
+    templateInfo.pDescriptorUpdateEntries   = entries.data();
+    templateInfo.templateType =
+        VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET_KHR;
+    templateInfo.descriptorSetLayout        = layout.vkLayout;
+
+    VkDescriptorUpdateTemplateKHR vkTemplate = nullptr;
+    VkResult result = m_pfnCreateTemplate(m_info.device, &templateInfo,
+                                          m_info.pAlloc, &vkTemplate);
+    AssertVk(result);
+
+    return vkTemplate;
+}
@@ -0,0 +1,200 @@
+#include "DrawList.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+using Clock = std::chrono::steady_clock;
+
+// ==== Keys ====================================================================
+
+static constexpr uint32_t kPassShift     = 60;
+static constexpr uint32_t kPipelineShift = 48;
+static constexpr uint32_t kMaterialShift = 32;
+static constexpr uint32_t kDepthShift    = 16;
+
+static constexpr uint64_t kPassMask      = 0xF;
+static constexpr uint64_t kPipelineMask  = 0xFFF;
+static constexpr uint64_t kFieldMask     = 0xFFFF;
+
+uint64_t makeDrawKey(uint32_t pass,
+                     uint32_t pipeline,
+                     uint32_t material,
+                     uint32_t depth,
+                     uint32_t mesh)
+{
+    return ((pass     & kPassMask)     << kPassShift)     |
+           ((pipeline & kPipelineMask) << kPipelineShift) |
+           ((material & kFieldMask)    << kMaterialShift) |
+           ((depth    & kFieldMask)    << kDepthShift)    |
+           (mesh      & kFieldMask);
+}
+
+uint32_t drawKeyPass(uint64_t key)
+{
+    return as<uint32_t>((key >> kPassShift) & kPassMask);
+}
+
+uint32_t drawDepthBucket(float distance)
+{
+    // Non-negative floats order the same as their bits. The top 16 are the
+    // exponent and 7 bits of mantissa, so each bucket is under 1% wide.
+    distance = std::max(distance, 0.f);
+    uint32_t bits = 0;
+    memcpy(&bits, &distance, sizeof(bits));
+    return bits >> 16;
+}
+
+// ==== DrawList ================================================================
+
+DrawList::~DrawList()
+{
+    deInit();
+}
+
+void DrawList::init(DrawListInfo const& info)
+{
+    m_info = info;
+}
+
+void DrawList::deInit()
+{
+    m_binds.clear();
+    m_draws.clear();
+    m_keys.clear();
+    m_order.clear();
+}
+
+void DrawList::clear()
+{
+    if (!m_draws.empty()) {
+        m_frames       += 1;
+        m_totalDraws   += m_stats.draws;
+        m_totalBinds   += m_stats.binds;
+        m_totalAvoided += m_stats.bindsAvoided;
+        m_totalSortMs  += m_stats.sortMs;
+    }
+
+    m_binds.clear();
+    m_draws.clear();
+    m_keys.clear();
+    m_order.clear();
+    m_sorted = true;
+    m_stats  = {};
+}
+
+uint32_t DrawList::addBinds(DrawBinds const& binds)
+{
+    AssertMsg(m_binds.size() <= kPipelineMask,
+              "At most %u bind states fit in a draw key",
+              as<uint32_t>(kPipelineMask + 1));
+    m_binds.push_back(binds);
+    return as<uint32_t>(m_binds.size() - 1);
+}
+
+void DrawList::add(uint64_t                            key,
+                   uint32_t                            binds,
+                   VkDrawIndexedIndirectCommand const& draw)
+{
+    Assert(binds < m_binds.size());
+    m_keys.push_back(key);
+    m_order.push_back(as<uint32_t>(m_draws.size()));
+    m_draws.push_back({ draw, binds });
+    m_sorted = false;
+}
+
+void DrawList::sort()
+{
+    Clock::time_point start = Clock::now();
+    radixSort(m_keys.data(), m_order.data(), as<uint32_t>(m_keys.size()),
+              &m_scratch, m_info.pJobs);
+    m_stats.sortMs = std::chrono::duration<double, std::milli>(
+        Clock::now() - start).count();
+    m_sorted = true;
+}
+
+void DrawList::record(VkCommandBuffer cmd, uint32_t pass)
+{
+    AssertMsg(m_sorted, "Sort the draw list before recording it");
+
+    // The pass is the top of the key, so its draws are one run.
+    uint64_t first = makeDrawKey(pass, 0, 0, 0, 0);
+    auto     begin = std::lower_bound(m_keys.begin(), m_keys.end(), first);
+    uint32_t i     = as<uint32_t>(begin - m_keys.begin());
+
+    // Each render pass starts from nothing, as far as we know.
+    DrawBinds bound;
+    bool      hasSet = false;
+    uint32_t  binds  = 0;
+    uint32_t  draws  = 0;
+    for (; i < m_keys.size() && drawKeyPass(m_keys[i]) == pass; i += 1) {
+        Draw const&      draw  = m_draws[m_order[i]];
+        DrawBinds const& wants = m_binds[draw.binds];
+
+        if (wants.pipeline != bound.pipeline) {
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                              wants.pipeline);
+            bound.pipeline = wants.pipeline;
+            binds += 1;
+        }
+        if (!hasSet || wants.layout != bound.layout || wants.set != bound.set ||
+            wants.dynamicOffset != bound.dynamicOffset) {
+            vkCmdBindDescriptorSets(cmd,
+                                    VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                    wants.layout,
+                                    0, // firstSet
+                                    1, &wants.set,
+                                    1, &wants.dynamicOffset);
+            bound.layout        = wants.layout;
+            bound.set           = wants.set;
+            bound.dynamicOffset = wants.dynamicOffset;
+            hasSet = true;
+            binds += 1;
+        }
+        if (wants.vertexBuffers[0] != bound.vertexBuffers[0] ||
+            wants.vertexBuffers[1] != bound.vertexBuffers[1]) {
+            VkDeviceSize offsets[2] = { 0, 0 };
+            vkCmdBindVertexBuffers(cmd, 0, array_size(wants.vertexBuffers),
+                                   wants.vertexBuffers, offsets);
+            bound.vertexBuffers[0] = wants.vertexBuffers[0];
+            bound.vertexBuffers[1] = wants.vertexBuffers[1];
+            binds += 1;
+        }
+        if (wants.indexBuffer != bound.indexBuffer) {
+            vkCmdBindIndexBuffer(cmd, wants.indexBuffer, 0,
+                                 VK_INDEX_TYPE_UINT32);
+            bound.indexBuffer = wants.indexBuffer;
+            binds += 1;
+        }
+
+        VkDrawIndexedIndirectCommand const& command = draw.command;
+        vkCmdDrawIndexed(cmd,
+                         command.indexCount,
+                         command.instanceCount,
+                         command.firstIndex,
+                         command.vertexOffset,
+                         command.firstInstance);
+        draws += 1;
+    }
+
+    // Without sorting or checking, every draw would bind all four.
+    m_stats.draws        += draws;
+    m_stats.binds        += binds;
+    m_stats.bindsAvoided += 4 * draws - binds;
+}
+
+void DrawList::logStats() const
+{
+    if (m_frames == 0) {
+        return;
+    }
+
+    double frames = as<double>(m_frames);
+    double needed = as<double>(m_totalBinds + m_totalAvoided);
+    Info("Draw list: %.1f draws, %.1f binds, and %.1f binds avoided (%.1f%%) "
+         "a frame, sorted in %.3f ms",
+         as<double>(m_totalDraws) / frames,
+         as<double>(m_totalBinds) / frames,
+         as<double>(m_totalAvoided) / frames,
+         needed > 0.0 ? 100.0 * as<double>(m_totalAvoided) / needed : 0.0,
+         m_totalSortMs / frames);
+}
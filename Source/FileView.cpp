@@ -0,0 +1,188 @@
+#include "FileView.hpp"
+
+#include <algorithm>
+#include <utility>
+
+#if !OS_WINDOWS
+    #include <cerrno>
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+FileView::~FileView()
+{
+    close();
+}
+
+FileView::FileView(FileView&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+FileView& FileView::operator=(FileView&& other) noexcept
+{
+    if (this != &other) {
+        close();
+        m_pData     = std::exchange(other.m_pData,    nullptr);
+        m_size      = std::exchange(other.m_size,     0);
+        m_pMapping  = std::exchange(other.m_pMapping, nullptr);
+        m_pFallback = std::move(other.m_pFallback);
+    }
+    return *this;
+}
+
+void FileView::close()
+{
+    if (m_pMapping != nullptr) {
+        #if OS_WINDOWS
+        UnmapViewOfFile(m_pMapping);
+        #else
+        munmap(m_pMapping, m_size);
+        #endif
+    }
+    m_pData    = nullptr;
+    m_size     = 0;
+    m_pMapping = nullptr;
+    m_pFallback.reset();
+}
+
+#if OS_WINDOWS
+
+bool FileView::open(const char* pFilename, FileAccess access)
+{
+    close();
+
+    DWORD flags = (access == FileAccess::Sequential) ? FILE_FLAG_SEQUENTIAL_SCAN
+                                                     : FILE_FLAG_RANDOM_ACCESS;
+    HANDLE hFile = CreateFileA(pFilename,
+                               GENERIC_READ,
+                               FILE_SHARE_READ,
+                               nullptr,
+                               OPEN_EXISTING,
+                               flags,
+                               nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        Info("Unable to open file '%s'", pFilename);
+        return false;
+    }
+
+    LARGE_INTEGER fileSize = {};
+    GetFileSizeEx(hFile, &fileSize);
+    m_size = as<size_t>(fileSize.QuadPart);
+
+    bool okay = true;
+    if (m_size != 0) {
+        // The mapping object can go away as soon as we have a view of it.
+        HANDLE hMapping = CreateFileMappingA(hFile, nullptr, PAGE_READONLY,
+                                             0, 0, nullptr);
+        if (hMapping != nullptr) {
+            m_pMapping = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(hMapping);
+        }
+
+        if (m_pMapping != nullptr) {
+            m_pData = ptr_as<const uint8_t>(m_pMapping);
+        } else {
+            Verbose("Unable to map '%s', reading it instead", pFilename);
+            m_pFallback.reset(new uint8_t[m_size]);
+
+            size_t done = 0;
+            while (okay && done < m_size) {
+                DWORD chunk = as<DWORD>(std::min<size_t>(m_size - done,
+                                                         1u << 30));
+                DWORD read  = 0;
+                okay = ReadFile(hFile, &m_pFallback[done], chunk, &read,
+                                nullptr) && read != 0;
+                done += read;
+            }
+            m_pData = m_pFallback.get();
+        }
+    }
+    CloseHandle(hFile);
+
+    if (!okay) {
+        Bug("Failed reading '%s'", pFilename);
+        close();
+        return false;
+    }
+
+    Verbose("Viewing %zu bytes from %s (%s)", m_size, pFilename,
+            isMapped() ? "mapped" : "copied");
+    return true;
+}
+
+#else
+
+bool FileView::open(const char* pFilename, FileAccess access)
+{
+    close();
+
+    int fd = ::open(pFilename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        Info("Unable to open file '%s'", pFilename);
+        return false;
+    }
+
+    struct stat fileStat = {};
+    if (fstat(fd, &fileStat) != 0) {
+        Bug("Unable to stat '%s'", pFilename);
+        ::close(fd);
+        return false;
+    }
+    m_size = as<size_t>(fileStat.st_size);
+
+    bool okay = true;
+    if (m_size != 0) {
+        void* pMapping = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (pMapping != MAP_FAILED) {
+            m_pMapping = pMapping;
+            m_pData    = ptr_as<const uint8_t>(m_pMapping);
+
+            // These are only hints, so we don't care if they fail.
+            if (access == FileAccess::Sequential) {
+                madvise(pMapping, m_size, MADV_SEQUENTIAL);
+                madvise(pMapping, m_size, MADV_WILLNEED);
+            } else {
+                madvise(pMapping, m_size, MADV_RANDOM);
+            }
+        } else {
+            Verbose("Unable to map '%s', reading it instead", pFilename);
+            #if OS_LINUX
+            posix_fadvise(fd, 0, 0, (access == FileAccess::Sequential)
+                                        ? POSIX_FADV_SEQUENTIAL
+                                        : POSIX_FADV_RANDOM);
+            #endif
+
+            // Not a std::vector - we don't want to zero this first.
+            m_pFallback.reset(new uint8_t[m_size]);
+
+            size_t done = 0;
+            while (done < m_size) {
+                ssize_t got = ::read(fd, &m_pFallback[done], m_size - done);
+                if (got < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (got <= 0) {
+                    okay = false;
+                    break;
+                }
+                done += as<size_t>(got);
+            }
+            m_pData = m_pFallback.get();
+        }
+    }
+    ::close(fd);
+
+    if (!okay) {
+        Bug("Failed reading '%s'", pFilename);
+        close();
+        return false;
+    }
+
+    Verbose("Viewing %zu bytes from %s (%s)", m_size, pFilename,
+            isMapped() ? "mapped" : "copied");
+    return true;
+}
+
+#endif
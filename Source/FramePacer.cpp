@@ -0,0 +1,142 @@
+#include "FramePacer.hpp"
+
+#include <algorithm>
+#include <thread>
+
+using Milliseconds = std::chrono::duration<double, std::milli>;
+
+void FramePacer::init(FramePacerInfo const& info)
+{
+    m_info     = info;
+    m_period   = {};
+    m_deadline = {};
+    m_spinMs   = info.minSpinMs;
+    if (info.targetHz > 0.0) {
+        m_period = std::chrono::duration_cast<Clock::duration>(
+            Milliseconds(1000.0 / info.targetHz));
+        Info("Frame pacing: %.1f Hz", info.targetHz);
+    }
+}
+
+void FramePacer::wait()
+{
+    if (m_period == Clock::duration::zero()) {
+        return;
+    }
+
+    Clock::time_point now = Clock::now();
+    if (m_deadline == Clock::time_point()) {
+        m_deadline = now;
+    }
+    m_deadline += m_period;
+    m_frameCount += 1;
+
+    // Already late. Start right away, and pace from here, instead of rushing
+    // through frames to catch up.
+    if (now >= m_deadline) {
+        m_lateFrames += 1;
+        m_deadline = now;
+        return;
+    }
+
+    // Sleep until a little before the deadline.
+    Clock::time_point wakeUp = m_deadline -
+        std::chrono::duration_cast<Clock::duration>(Milliseconds(m_spinMs));
+    if (now < wakeUp) {
+        std::this_thread::sleep_until(wakeUp);
+
+        // Keep enough margin for the latest wake up we've seen lately. It
+        // decays, so one bad wake up doesn't make us spin forever.
+        double overshootMs = Milliseconds(Clock::now() - wakeUp).count();
+        m_overshootMs = std::max(overshootMs, 0.98 * m_overshootMs);
+        double periodMs = Milliseconds(m_period).count();
+        m_spinMs = std::min(std::max(1.25 * m_overshootMs, m_info.minSpinMs),
+                            0.5 * periodMs);
+    }
+
+    // Then spin the rest of the way.
+    Clock::time_point spinStart = Clock::now();
+    while (Clock::now() < m_deadline) {
+        std::this_thread::yield();
+    }
+
+    Clock::time_point done = Clock::now();
+    m_spinMsSum  += Milliseconds(done - spinStart).count();
+    m_errorMsSum += Milliseconds(done - m_deadline).count();
+}
+
+void FramePacer::logStats() const
+{
+    if (m_frameCount == 0) {
+        return;
+    }
+
+    double frames = as<double>(m_frameCount);
+    Info("Frame pacing: %.1f%% of frames late, woke %.3f ms past the "
+         "deadline, and spun %.3f ms, on average",
+         100.0 * as<double>(m_lateFrames) / frames,
+         m_errorMsSum / frames,
+         m_spinMsSum / frames);
+}
+
+// ==== Latency =================================================================
+
+void FrameLatency::mark(LatencyMarker marker)
+{
+    mark(marker, Clock::now());
+}
+
+void FrameLatency::mark(LatencyMarker marker, Clock::time_point time)
+{
+    uint32_t index = as<uint32_t>(marker);
+    m_marks[index]  = time;
+    m_marked[index] = true;
+}
+
+void FrameLatency::endFrame()
+{
+    uint32_t input = as<uint32_t>(LatencyMarker::Input);
+    if (m_marked[input]) {
+        for (uint32_t i = input + 1; i < kMarkerCount; i += 1) {
+            if (!m_marked[i]) {
+                continue;
+            }
+            float ms = as<float>(Milliseconds(m_marks[i] - m_marks[input]).count());
+            if (m_samples[i].size() < kMaxSamples) {
+                m_samples[i].push_back(ms);
+            } else {
+                m_samples[i][m_frameCount % kMaxSamples] = ms;
+            }
+        }
+        m_frameCount += 1;
+    }
+
+    for (bool& marked : m_marked) {
+        marked = false;
+    }
+}
+
+void FrameLatency::logStats() const
+{
+    static const char* const kNames[kMarkerCount] = {
+        "input", "latch", "submit", "present",
+    };
+
+    for (uint32_t i = 1; i < kMarkerCount; i += 1) {
+        if (m_samples[i].empty()) {
+            continue;
+        }
+
+        std::vector<float> sorted = m_samples[i];
+        std::sort(sorted.begin(), sorted.end());
+        double sum = 0.0;
+        for (float ms : sorted) {
+            sum += ms;
+        }
+        Info("Latency, input to %-7s: %.3f ms mean, %.3f ms p50, %.3f ms p99",
+             kNames[i],
+             sum / as<double>(sorted.size()),
+             sorted[sorted.size() / 2],
+             sorted[(sorted.size() * 99) / 100]);
+    }
+}
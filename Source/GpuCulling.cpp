@@ -0,0 +1,683 @@
+#include "GpuCulling.hpp"
+#include "Descriptors.hpp"
+#include "VkMemory.hpp"
+
+#include <algorithm>
+
+// Must match local_size_x in Glsl/include/Cull.glsl.
+static constexpr uint32_t kCullGroupSize = 64;
+
+// Must match the constant_ids in Glsl/include/Cull.glsl.
+enum CullSpecConstantId : uint32_t
+{
+    CullSpecConstantId_Compact     = 0,
+    CullSpecConstantId_ConeCulling = 1,
+};
+
+// Every binding any phase uses. Each phase uses the first few.
+struct CullSetData
+{
+    VkDescriptorBufferInfo  objects;
+    VkDescriptorBufferInfo  draws;
+    VkDescriptorBufferInfo  visibility;
+    VkDescriptorImageInfo   pyramid;
+};
+
+static uint32_t phaseBit(CullPhase phase)
+{
+    return 1u << as<uint32_t>(phase);
+}
+
+// ==== Culling =================================================================
+
+CullParams makeCullParams(Mat4 const& viewProjection,
+                          Vec3 const& eye,
+                          uint32_t    objectCount)
+{
+    CullParams params;
+    params.viewProjection = viewProjection;
+    params.eye            = glm::vec4(eye, 1.f);
+    params.objectCount    = objectCount;
+    return params;
+}
+
+// Must match frustumPlane() in Glsl/include/Cull.glsl.
+//
+// Gribb & Hartmann. Each plane is the last row of the matrix, plus or minus
+// one of the others, normalized so distances are in world units. glm is
+// column major, so m[column][row].
+static glm::vec4 frustumPlane(Mat4 const& m, int i)
+{
+    int       r   = i / 2;
+    glm::vec4 row(m[0][r], m[1][r], m[2][r], m[3][r]);
+    glm::vec4 w(m[0][3], m[1][3], m[2][3], m[3][3]);
+    glm::vec4 plane = (i % 2 == 0) ? w + row : w - row;
+    return plane / glm::length(Vec3(plane.x, plane.y, plane.z));
+}
+
+// Must behave exactly like isVisible() in Glsl/include/Cull.glsl.
+static bool isVisible(MeshObject const& object,
+                      CullParams const& params,
+                      bool              coneCulling)
+{
+    Vec3  center(object.sphere.x, object.sphere.y, object.sphere.z);
+    float radius = object.sphere.w;
+
+    if (object.instanceCount == 0) {
+        return false;
+    }
+
+    for (int i = 0; i < 6; i += 1) {
+        glm::vec4 plane = frustumPlane(params.viewProjection, i);
+        float distance = glm::dot(Vec3(plane.x, plane.y, plane.z), center) +
+                         plane.w;
+        if (distance < -radius) {
+            return false;
+        }
+    }
+
+    if (coneCulling) {
+        // Culled if the eye sees the back of every triangle, from anywhere in
+        // the sphere. See meshoptimizer's meshopt_computeClusterBounds().
+        Vec3  axis(object.cone.x, object.cone.y, object.cone.z);
+        Vec3  toCenter = center - Vec3(params.eye.x, params.eye.y, params.eye.z);
+        float cutoff   = object.cone.w;
+        if (glm::dot(toCenter, axis) >=
+                cutoff * glm::length(toCenter) + radius) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+uint32_t cullObjects(MeshObject const*             pObjects,
+                     CullParams const&             params,
+                     bool                          coneCulling,
+                     VkDrawIndexedIndirectCommand* pOut,
+                     uint8_t const*                pVisible,
+                     uint32_t*                     pOutObjects)
+{
+    uint32_t drawCount = 0;
+    for (uint32_t i = 0; i < params.objectCount; i += 1) {
+        MeshObject const& object = pObjects[i];
+        if (pVisible != nullptr && pVisible[i] == 0) {
+            continue;
+        }
+        if (!isVisible(object, params, coneCulling)) {
+            continue;
+        }
+
+        VkDrawIndexedIndirectCommand& command = pOut[drawCount];
+        command.indexCount    = object.indexCount;
+        command.instanceCount = object.instanceCount;
+        command.firstIndex    = object.firstIndex;
+        command.vertexOffset  = object.vertexOffset;
+        command.firstInstance = object.firstInstance;
+        if (pOutObjects != nullptr) {
+            pOutObjects[drawCount] = i;
+        }
+        drawCount += 1;
+    }
+    return drawCount;
+}
+
+// ==== GpuCulling ==============================================================
+
+// Of every copy of the object.
+static uint64_t objectTriangles(MeshObject const& object)
+{
+    return as<uint64_t>(object.indexCount / 3) * object.instanceCount;
+}
+
+GpuCulling::~GpuCulling()
+{
+    deInit();
+}
+
+VkResult GpuCulling::init(GpuCullingInfo const& info)
+{
+    VkResult result;
+
+    Assert(info.device       != nullptr);
+    Assert(info.pDescriptors != nullptr);
+    Assert(info.frameCount   != 0);
+    m_info = info;
+    m_frames.resize(info.frameCount);
+
+    if (info.occlusion) {
+        Assert(info.earlyModule != nullptr && info.lateModule != nullptr);
+        result = createPipeline(CullPhase::Early, info.earlyModule, 3);
+        AssertVk(result);
+        result = createPipeline(CullPhase::Late, info.lateModule, 4);
+        AssertVk(result);
+    } else {
+        Assert(info.cullModule != nullptr);
+        result = createPipeline(CullPhase::All, info.cullModule, 2);
+        AssertVk(result);
+    }
+
+    Info("GPU culling: %s, %s%s%s",
+         info.pfnDrawIndirectCount != nullptr
+             ? "compacted, with an indirect count"
+             : "uncompacted, culled draws have no instances",
+         info.coneCulling ? "frustum and cone" : "frustum",
+         info.occlusion ? ", and two phase occlusion" : "",
+         info.validate && !info.occlusion ? ", validated against the CPU" : "");
+    if (info.validate && info.occlusion) {
+        Info("GPU culling: occlusion results can't be validated on the CPU");
+    }
+
+    return result;
+}
+
+void GpuCulling::deInit()
+{
+    if (m_info.device == nullptr) {
+        return;
+    }
+
+    destroyBuffers();
+    m_frames.clear();
+    m_objectCount = 0;
+
+    for (Pipeline& pipeline : m_pipelines) {
+        vkDestroyPipeline(m_info.device, pipeline.vkPipeline, m_info.pAlloc);
+        vkDestroyPipelineLayout(m_info.device, pipeline.vkLayout,
+                                m_info.pAlloc);
+        // Descriptors owns the set layout.
+        pipeline = {};
+    }
+
+    m_info = {};
+}
+
+VkResult GpuCulling::createPipeline(CullPhase      phase,
+                                    VkShaderModule module,
+                                    uint32_t       bindingCount)
+{
+    VkResult result;
+
+    Pipeline& pipeline = m_pipelines[as<uint32_t>(phase)];
+
+    DescriptorBinding bindings[4] = {};
+    Assert(bindingCount <= array_size(bindings));
+    for (uint32_t i = 0; i < array_size(bindings); i += 1) {
+        bindings[i].binding = i;
+        bindings[i].type    = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].count   = 1;
+        bindings[i].stages  = VK_SHADER_STAGE_COMPUTE_BIT;
+        bindings[i].stride  = sizeof(VkDescriptorBufferInfo);
+    }
+    bindings[0].offset = offsetof(CullSetData, objects);
+    bindings[1].offset = offsetof(CullSetData, draws);
+    bindings[2].offset = offsetof(CullSetData, visibility);
+    bindings[3].offset = offsetof(CullSetData, pyramid);
+    bindings[3].type   = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[3].stride = sizeof(VkDescriptorImageInfo);
+    pipeline.pSetLayout = m_info.pDescriptors->getLayout(bindings,
+                                                         bindingCount);
+
+    VkPushConstantRange pushRange = {};
+    pushRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushRange.offset     = 0;
+    pushRange.size       = sizeof(CullParams);
+
+    VkPipelineLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layoutInfo.setLayoutCount         = 1;
+    layoutInfo.pSetLayouts            = &pipeline.pSetLayout->vkLayout;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges    = &pushRange;
+
+    result = vkCreatePipelineLayout(m_info.device, &layoutInfo, m_info.pAlloc,
+                                    &pipeline.vkLayout);
+    AssertVk(result);
+
+    // Both choices are made once, so they're compiled in, not branched on.
+    VkBool32 specValues[2] = {
+        m_info.pfnDrawIndirectCount != nullptr,
+        m_info.coneCulling,
+    };
+    VkSpecializationMapEntry specEntries[2] = {};
+    specEntries[0].constantID = CullSpecConstantId_Compact;
+    specEntries[0].offset     = 0;
+    specEntries[0].size       = sizeof(VkBool32);
+    specEntries[1].constantID = CullSpecConstantId_ConeCulling;
+    specEntries[1].offset     = sizeof(VkBool32);
+    specEntries[1].size       = sizeof(VkBool32);
+
+    VkSpecializationInfo specInfo = {};
+    specInfo.mapEntryCount = array_size(specEntries);
+    specInfo.pMapEntries   = specEntries;
+    specInfo.dataSize      = sizeof(specValues);
+    specInfo.pData         = specValues;
+
+    VkComputePipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage  = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = module;
+    pipelineInfo.stage.pName  = "main";
+    pipelineInfo.stage.pSpecializationInfo = &specInfo;
+    pipelineInfo.layout       = pipeline.vkLayout;
+
+    result = vkCreateComputePipelines(m_info.device, m_info.cache, 1,
+                                      &pipelineInfo, m_info.pAlloc,
+                                      &pipeline.vkPipeline);
+    AssertVk(result);
+
+    return result;
+}
+
+VkResult GpuCulling::setObjects(MeshObject const* pObjects, uint32_t count)
+{
+    VkResult result = VK_SUCCESS;
+
+    destroyBuffers();
+    m_objectCount = count;
+    if (count == 0) {
+        return result;
+    }
+
+    if (m_info.occlusion) {
+        // Cleared by the first early phase, so nothing starts out visible.
+        result = createBuffer(m_info.device, m_info.pAlloc,
+                              m_info.memoryProperties,
+                              count * sizeof(uint32_t),
+                              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                              VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                              &m_vkVisibilityBuffer,
+                              &m_vkVisibilityMemory);
+        AssertVk(result);
+        m_visibilityCleared = false;
+    }
+
+    // Only the GPU touches the commands, unless we're reading them back.
+    bool readBack = m_info.validate && !m_info.occlusion;
+    VkMemoryPropertyFlags drawProperties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    if (readBack) {
+        drawProperties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    }
+
+    m_drawBufferSize = kDrawsOffset +
+                       count * sizeof(VkDrawIndexedIndirectCommand);
+    uint32_t outputCount = m_info.occlusion ? 2 : 1;
+    for (Frame& frame : m_frames) {
+        // Each frame has its own copy, so updateObjects() never touches one
+        // the GPU is using. Moving objects rewrite it from the CPU, so it
+        // stays host visible rather than being staged.
+        result = createBuffer(m_info.device, m_info.pAlloc,
+                              m_info.memoryProperties,
+                              count * sizeof(MeshObject),
+                              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                              VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                              &frame.objectBuffer,
+                              &frame.objectMemory);
+        AssertVk(result);
+
+        void* pObjectsDst = nullptr;
+        result = vkMapMemory(m_info.device, frame.objectMemory, 0,
+                             VK_WHOLE_SIZE, 0, &pObjectsDst);
+        AssertVk(result);
+        frame.pObjects = static_cast<MeshObject*>(pObjectsDst);
+        memcpy(frame.pObjects, pObjects, count * sizeof(MeshObject));
+        frame.objectTriangles = 0;
+        for (uint32_t i = 0; i < count; i += 1) {
+            frame.objectTriangles += objectTriangles(pObjects[i]);
+        }
+
+        for (uint32_t i = 0; i < outputCount; i += 1) {
+            Output& output = frame.outputs[i];
+            result = createBuffer(m_info.device, m_info.pAlloc,
+                                  m_info.memoryProperties,
+                                  m_drawBufferSize,
+                                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                  VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                                  VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                                  VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                  drawProperties,
+                                  &output.buffer,
+                                  &output.memory);
+            AssertVk(result);
+
+            if (readBack) {
+                result = vkMapMemory(m_info.device, output.memory, 0,
+                                     VK_WHOLE_SIZE, 0, &output.pMapped);
+                AssertVk(result);
+            }
+        }
+
+        result = createBuffer(m_info.device, m_info.pAlloc,
+                              m_info.memoryProperties,
+                              array_size(frame.outputs) * sizeof(CullHeader),
+                              VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                              VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                              &frame.statsBuffer,
+                              &frame.statsMemory);
+        AssertVk(result);
+
+        void* pStats = nullptr;
+        result = vkMapMemory(m_info.device, frame.statsMemory, 0,
+                             VK_WHOLE_SIZE, 0, &pStats);
+        AssertVk(result);
+        frame.pStats = static_cast<CullHeader*>(pStats);
+    }
+
+    Info("GPU culling: %u objects, %llu triangles", count,
+         as<unsigned long long>(m_frames[0].objectTriangles));
+    return result;
+}
+
+void GpuCulling::updateObjects(MeshObject const* pObjects, uint32_t count)
+{
+    Assert(count == objectCount());
+    if (count == 0) {
+        return;
+    }
+
+    Frame& frame = m_frames[m_frameIndex];
+    memcpy(frame.pObjects, pObjects, count * sizeof(MeshObject));
+    frame.objectTriangles = 0;
+    for (uint32_t i = 0; i < count; i += 1) {
+        frame.objectTriangles += objectTriangles(pObjects[i]);
+    }
+}
+
+void GpuCulling::beginFrame(uint32_t frameIndex)
+{
+    Assert(frameIndex < m_frames.size());
+    m_frameIndex = frameIndex;
+
+    Frame& frame = m_frames[frameIndex];
+    if (frame.recordedPhases != 0) {
+        m_frameCount      += 1;
+        m_testedObjects   += objectCount();
+        m_testedTriangles += frame.objectTriangles;
+        // Output 1 is only written by the late phase. Without occlusion
+        // culling, its header is whatever the memory held.
+        uint32_t outputPhases[2] = {
+            phaseBit(CullPhase::All) | phaseBit(CullPhase::Early),
+            phaseBit(CullPhase::Late),
+        };
+        for (uint32_t i = 0; i < array_size(frame.outputs); i += 1) {
+            if ((frame.recordedPhases & outputPhases[i]) == 0) {
+                continue;
+            }
+            m_drawnObjects   += frame.pStats[i].drawCount;
+            m_drawnTriangles += frame.pStats[i].triangleCount;
+        }
+        if ((frame.recordedPhases & phaseBit(CullPhase::Late)) != 0) {
+            m_lateTriangles += frame.pStats[1].triangleCount;
+        }
+
+        if (frame.outputs[0].pMapped != nullptr &&
+            (frame.recordedPhases & phaseBit(CullPhase::All)) != 0) {
+            validate(frame);
+        }
+    }
+    frame.recordedPhases = 0;
+}
+
+void GpuCulling::record(VkCommandBuffer              cmd,
+                        CullPhase                    phase,
+                        CullParams const&            params,
+                        VkDescriptorImageInfo const* pPyramid)
+{
+    Assert(params.objectCount == objectCount());
+    Assert((phase == CullPhase::All) != m_info.occlusion);
+    Assert(phase != CullPhase::Late || pPyramid != nullptr);
+    if (m_objectCount == 0) {
+        return;
+    }
+    Frame&          frame    = m_frames[m_frameIndex];
+    Output const&   out      = output(phase);
+    Pipeline const& pipeline = m_pipelines[as<uint32_t>(phase)];
+    uint32_t        outIndex = phase == CullPhase::Late ? 1 : 0;
+
+    // The counts start at zero. Without compaction, the shader writes every
+    // command, so those can be left alone.
+    vkCmdFillBuffer(cmd, out.buffer, 0, kDrawsOffset, 0);
+    VkMemoryBarrier fillBarrier = {};
+    fillBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    fillBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    fillBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT |
+                                VK_ACCESS_SHADER_WRITE_BIT;
+    VkPipelineStageFlags srcStages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    if (phase == CullPhase::Early && !m_visibilityCleared) {
+        vkCmdFillBuffer(cmd, m_vkVisibilityBuffer, 0, VK_WHOLE_SIZE, 0);
+        m_visibilityCleared = true;
+    }
+    if (phase == CullPhase::Early) {
+        // Last frame's late phase wrote the visibility we're about to read.
+        fillBarrier.srcAccessMask |= VK_ACCESS_SHADER_WRITE_BIT;
+        srcStages                 |= VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    }
+
+    vkCmdPipelineBarrier(cmd,
+                         srcStages,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0,
+                         1, &fillBarrier,
+                         0, nullptr,
+                         0, nullptr);
+
+    // The buffers change with the objects, so the set is rebuilt each frame,
+    // out of that frame's pool.
+    CullSetData data = {};
+    data.objects.buffer    = frame.objectBuffer;
+    data.objects.range     = VK_WHOLE_SIZE;
+    data.draws.buffer      = out.buffer;
+    data.draws.range       = VK_WHOLE_SIZE;
+    data.visibility.buffer = m_vkVisibilityBuffer;
+    data.visibility.range  = VK_WHOLE_SIZE;
+    if (pPyramid != nullptr) {
+        data.pyramid = *pPyramid;
+    }
+    VkDescriptorSet set = m_info.pDescriptors->allocateFrameSet(
+        *pipeline.pSetLayout, &data);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.vkPipeline);
+    vkCmdBindDescriptorSets(cmd,
+                            VK_PIPELINE_BIND_POINT_COMPUTE,
+                            pipeline.vkLayout,
+                            0, // firstSet
+                            1, &set,
+                            0, nullptr);
+    vkCmdPushConstants(cmd, pipeline.vkLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                       0, sizeof(CullParams), &params);
+    vkCmdDispatch(cmd,
+                  (params.objectCount + kCullGroupSize - 1) / kCullGroupSize,
+                  1, 1);
+
+    // Ready to draw. The header goes to the CPU too, for stats.
+    VkMemoryBarrier drawBarrier = {};
+    drawBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    drawBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    drawBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT |
+                                VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(cmd,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0,
+                         1, &drawBarrier,
+                         0, nullptr,
+                         0, nullptr);
+
+    VkBufferCopy statsCopy = {};
+    statsCopy.srcOffset = 0;
+    statsCopy.dstOffset = outIndex * sizeof(CullHeader);
+    statsCopy.size      = sizeof(CullHeader);
+    vkCmdCopyBuffer(cmd, out.buffer, frame.statsBuffer, 1, &statsCopy);
+
+    // The frame's fence makes these visible to beginFrame().
+    VkMemoryBarrier hostBarrier = {};
+    hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    hostBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT |
+                                VK_ACCESS_TRANSFER_WRITE_BIT;
+    hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(cmd,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT,
+                         0,
+                         1, &hostBarrier,
+                         0, nullptr,
+                         0, nullptr);
+
+    frame.params          = params;
+    frame.recordedPhases |= phaseBit(phase);
+}
+
+VkBuffer GpuCulling::drawBuffer(CullPhase phase) const
+{
+    return output(phase).buffer;
+}
+
+void GpuCulling::draw(VkCommandBuffer cmd, CullPhase phase) const
+{
+    if (m_objectCount == 0) {
+        return;
+    }
+    VkBuffer buffer = output(phase).buffer;
+    uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+
+    if (m_info.pfnDrawIndirectCount != nullptr) {
+        m_info.pfnDrawIndirectCount(cmd,
+                                    buffer, kDrawsOffset,
+                                    buffer, 0,
+                                    objectCount(),
+                                    stride);
+    } else if (m_info.multiDrawIndirect) {
+        vkCmdDrawIndexedIndirect(cmd, buffer, kDrawsOffset, objectCount(),
+                                 stride);
+    } else {
+        // Without multiDrawIndirect, drawCount has to be 0 or 1.
+        for (uint32_t i = 0; i < objectCount(); i += 1) {
+            vkCmdDrawIndexedIndirect(cmd, buffer, kDrawsOffset + i * stride,
+                                     1, stride);
+        }
+    }
+}
+
+GpuCulling::Output const& GpuCulling::output(CullPhase phase) const
+{
+    Assert(m_frameIndex < m_frames.size());
+    return m_frames[m_frameIndex].outputs[phase == CullPhase::Late ? 1 : 0];
+}
+
+void GpuCulling::validate(Frame const& frame)
+{
+    void const* pMapped  = frame.outputs[0].pMapped;
+    uint32_t    gpuCount = frame.pStats[0].drawCount;
+    auto const* pDraws = reinterpret_cast<VkDrawIndexedIndirectCommand const*>(
+        static_cast<uint8_t const*>(pMapped) + kDrawsOffset);
+
+    // The objects this frame was culled with, which may have been updated
+    // since setObjects().
+    std::vector<VkDrawIndexedIndirectCommand> expected(m_objectCount);
+    uint32_t expectedCount = cullObjects(frame.pObjects,
+                                         frame.params,
+                                         m_info.coneCulling,
+                                         expected.data());
+    expected.resize(expectedCount);
+
+    // Compacted commands land in whatever order the atomics went in, and
+    // uncompacted ones include the culled ones.
+    std::vector<VkDrawIndexedIndirectCommand> actual;
+    if (m_info.pfnDrawIndirectCount != nullptr) {
+        actual.assign(pDraws, pDraws + std::min(gpuCount, objectCount()));
+    } else {
+        for (uint32_t i = 0; i < objectCount(); i += 1) {
+            if (pDraws[i].instanceCount != 0) {
+                actual.push_back(pDraws[i]);
+            }
+        }
+    }
+    auto byFirstIndex = [](VkDrawIndexedIndirectCommand const& a,
+                           VkDrawIndexedIndirectCommand const& b) {
+        return a.firstIndex != b.firstIndex ? a.firstIndex   < b.firstIndex
+                                            : a.vertexOffset < b.vertexOffset;
+    };
+    std::sort(actual.begin(), actual.end(), byFirstIndex);
+    std::sort(expected.begin(), expected.end(), byFirstIndex);
+
+    bool match = (gpuCount == expectedCount) &&
+                 (actual.size() == expected.size());
+    for (size_t i = 0; match && i < actual.size(); i += 1) {
+        match = actual[i].indexCount    == expected[i].indexCount    &&
+                actual[i].instanceCount == expected[i].instanceCount &&
+                actual[i].firstIndex    == expected[i].firstIndex    &&
+                actual[i].vertexOffset  == expected[i].vertexOffset  &&
+                actual[i].firstInstance == expected[i].firstInstance;
+    }
+
+    m_validatedFrames += 1;
+    if (!match) {
+        m_mismatchedFrames += 1;
+        Bug("GPU culling: the GPU drew %u objects, the CPU would've drawn %u",
+            gpuCount, expectedCount);
+    }
+}
+
+void GpuCulling::logStats() const
+{
+    if (m_frameCount == 0) {
+        return;
+    }
+
+    auto percent = [](uint64_t part, uint64_t whole) {
+        return 100.0 * as<double>(part) / as<double>(std::max<uint64_t>(whole, 1));
+    };
+    Info("GPU culling: %llu frames, %.1f%% of objects and %.1f%% of "
+         "triangles culled, %llu triangles per frame",
+         as<unsigned long long>(m_frameCount),
+         percent(m_testedObjects   - m_drawnObjects,   m_testedObjects),
+         percent(m_testedTriangles - m_drawnTriangles, m_testedTriangles),
+         as<unsigned long long>(m_drawnTriangles / m_frameCount));
+    if (m_info.occlusion) {
+        Info("GPU culling: %.1f%% of drawn triangles were only found visible "
+             "by the late phase",
+             percent(m_lateTriangles, m_drawnTriangles));
+    }
+    if (m_validatedFrames > 0) {
+        Info("GPU culling: %llu of %llu frames matched the CPU",
+             as<unsigned long long>(m_validatedFrames - m_mismatchedFrames),
+             as<unsigned long long>(m_validatedFrames));
+    }
+}
+
+void GpuCulling::destroyBuffers()
+{
+    for (Frame& frame : m_frames) {
+        for (Output& output : frame.outputs) {
+            if (output.pMapped != nullptr) {
+                vkUnmapMemory(m_info.device, output.memory);
+            }
+            vkDestroyBuffer(m_info.device, output.buffer, m_info.pAlloc);
+            vkFreeMemory(m_info.device, output.memory, m_info.pAlloc);
+        }
+        if (frame.pStats != nullptr) {
+            vkUnmapMemory(m_info.device, frame.statsMemory);
+        }
+        vkDestroyBuffer(m_info.device, frame.statsBuffer, m_info.pAlloc);
+        vkFreeMemory(m_info.device, frame.statsMemory, m_info.pAlloc);
+        if (frame.pObjects != nullptr) {
+            vkUnmapMemory(m_info.device, frame.objectMemory);
+        }
+        vkDestroyBuffer(m_info.device, frame.objectBuffer, m_info.pAlloc);
+        vkFreeMemory(m_info.device, frame.objectMemory, m_info.pAlloc);
+        frame = {};
+    }
+
+    vkDestroyBuffer(m_info.device, m_vkVisibilityBuffer, m_info.pAlloc);
+    vkFreeMemory(m_info.device, m_vkVisibilityMemory, m_info.pAlloc);
+    m_vkVisibilityBuffer = nullptr;
+    m_vkVisibilityMemory = nullptr;
+    m_drawBufferSize     = 0;
+}
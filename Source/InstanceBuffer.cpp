@@ -0,0 +1,135 @@
+#include "InstanceBuffer.hpp"
+#include "VkMemory.hpp"
+
+InstanceBuffer::~InstanceBuffer()
+{
+    deInit();
+}
+
+VkResult InstanceBuffer::init(InstanceBufferInfo const& info)
+{
+    Assert(info.device     != nullptr);
+    Assert(info.frameCount != 0);
+    // m_staleFrames has a bit per frame.
+    Assert(info.frameCount <= 8);
+    m_info = info;
+    m_frames.resize(info.frameCount);
+
+    return VK_SUCCESS;
+}
+
+void InstanceBuffer::deInit()
+{
+    if (m_info.device == nullptr) {
+        return;
+    }
+
+    destroyBuffers();
+    m_frames.clear();
+    m_instances.clear();
+    m_staleFrames.clear();
+
+    m_info = {};
+}
+
+VkResult InstanceBuffer::setInstances(InstanceData const* pInstances,
+                                      uint32_t            count)
+{
+    VkResult result = VK_SUCCESS;
+
+    destroyBuffers();
+    m_instances.assign(pInstances, pInstances + count);
+    m_staleFrames.assign(count, 0);
+    if (count == 0) {
+        return result;
+    }
+
+    // Host visible on purpose: dirty instances are written straight into
+    // each frame's copy. It's read once per instance, so it's cached.
+    for (Frame& frame : m_frames) {
+        result = createBuffer(m_info.device, m_info.pAlloc,
+                              m_info.memoryProperties,
+                              count * sizeof(InstanceData),
+                              VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                              VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                              &frame.buffer,
+                              &frame.memory);
+        AssertVk(result);
+
+        void* pMapped = nullptr;
+        result = vkMapMemory(m_info.device, frame.memory, 0, VK_WHOLE_SIZE, 0,
+                             &pMapped);
+        AssertVk(result);
+        frame.pMapped = static_cast<InstanceData*>(pMapped);
+        memcpy(frame.pMapped, pInstances, count * sizeof(InstanceData));
+    }
+
+    Info("Instance buffer: %u instances, %zu bytes per frame in flight",
+         count, count * sizeof(InstanceData));
+    return result;
+}
+
+void InstanceBuffer::setInstance(uint32_t index, InstanceData const& instance)
+{
+    Assert(index < instanceCount());
+    m_instances[index] = instance;
+
+    // Each frame writes it once, however often it changes before then.
+    uint8_t& stale = m_staleFrames[index];
+    for (uint32_t i = 0; i < m_frames.size(); i += 1) {
+        uint8_t bit = as<uint8_t>(1u << i);
+        if ((stale & bit) == 0) {
+            stale |= bit;
+            m_frames[i].dirty.push_back(index);
+        }
+    }
+}
+
+void InstanceBuffer::beginFrame(uint32_t frameIndex)
+{
+    Assert(frameIndex < m_frames.size());
+    m_frameIndex = frameIndex;
+
+    Frame&  frame = m_frames[frameIndex];
+    uint8_t bit   = as<uint8_t>(1u << frameIndex);
+    for (uint32_t index : frame.dirty) {
+        frame.pMapped[index] = m_instances[index];
+        m_staleFrames[index] &= as<uint8_t>(~bit);
+    }
+
+    m_frameCount       += 1;
+    m_writtenInstances += frame.dirty.size();
+    frame.dirty.clear();
+}
+
+VkBuffer InstanceBuffer::buffer() const
+{
+    if (m_frames.empty()) {
+        return nullptr;
+    }
+    return m_frames[m_frameIndex].buffer;
+}
+
+void InstanceBuffer::logStats() const
+{
+    if (m_frameCount == 0) {
+        return;
+    }
+
+    Info("Instance buffer: wrote %.1f of %u instances per frame",
+         as<double>(m_writtenInstances) / as<double>(m_frameCount),
+         instanceCount());
+}
+
+void InstanceBuffer::destroyBuffers()
+{
+    for (Frame& frame : m_frames) {
+        if (frame.pMapped != nullptr) {
+            vkUnmapMemory(m_info.device, frame.memory);
+        }
+        vkDestroyBuffer(m_info.device, frame.buffer, m_info.pAlloc);
+        vkFreeMemory(m_info.device, frame.memory, m_info.pAlloc);
+        frame = {};
+    }
+}
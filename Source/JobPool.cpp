@@ -0,0 +1,149 @@
+#include "JobPool.hpp"
+
+#include <algorithm>
+#include <memory>
+
+JobPool::~JobPool()
+{
+    deInit();
+}
+
+void JobPool::init(uint32_t threadCount)
+{
+    Assert(m_threads.empty());
+
+    if (threadCount == 0) {
+        uint32_t cores = std::thread::hardware_concurrency();
+        threadCount = std::max(cores, 2u) - 1;
+    }
+
+    m_quitting = false;
+    m_threads.reserve(threadCount);
+    for (uint32_t i = 0; i < threadCount; i += 1) {
+        m_threads.emplace_back([this]() { workerMain(); });
+    }
+    Info("JobPool started with %u worker thread(s)", threadCount);
+}
+
+void JobPool::deInit()
+{
+    if (m_threads.empty()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quitting = true;
+    }
+    m_wakeup.notify_all();
+
+    for (std::thread& thread : m_threads) {
+        thread.join();
+    }
+    m_threads.clear();
+
+    // Anything left over never ran. That's the caller's problem, but say so.
+    if (!m_jobs.empty()) {
+        Bug("JobPool shut down with %zu job(s) still queued", m_jobs.size());
+        m_jobs.clear();
+    }
+}
+
+void JobPool::push(Job job)
+{
+    // Without threads, the only sensible thing to do is run it right now.
+    if (m_threads.empty()) {
+        job();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(std::move(job));
+    }
+    m_wakeup.notify_one();
+}
+
+void JobPool::parallelFor(uint32_t        count,
+                          uint32_t        grainSize,
+                          RangeJob const& fn)
+{
+    if (count == 0) {
+        return;
+    }
+    grainSize = std::max(grainSize, 1u);
+
+    uint32_t chunkCount = (count + grainSize - 1) / grainSize;
+    if (chunkCount == 1 || m_threads.empty()) {
+        fn(0, count);
+        return;
+    }
+
+    // Helpers may start after we've returned (if the workers are busy), so
+    // they hold on to this with a shared_ptr. They only touch 'pFn' when they
+    // actually claim a chunk, and every chunk is finished before we return.
+    struct State
+    {
+        RangeJob const*         pFn;
+        uint32_t                count;
+        uint32_t                grainSize;
+        uint32_t                chunkCount;
+        std::atomic<uint32_t>   nextChunk;
+        std::atomic<uint32_t>   doneChunks;
+    };
+    auto pState = std::make_shared<State>();
+    pState->pFn        = &fn;
+    pState->count      = count;
+    pState->grainSize  = grainSize;
+    pState->chunkCount = chunkCount;
+    pState->nextChunk  = 0;
+    pState->doneChunks = 0;
+
+    auto runChunks = [](State& state) {
+        for (;;) {
+            uint32_t chunk = state.nextChunk.fetch_add(1);
+            if (chunk >= state.chunkCount) {
+                break;
+            }
+            uint32_t begin = chunk * state.grainSize;
+            uint32_t end   = std::min(begin + state.grainSize, state.count);
+            (*state.pFn)(begin, end);
+            state.doneChunks.fetch_add(1, std::memory_order_release);
+        }
+    };
+
+    uint32_t helperCount = std::min(threadCount(), chunkCount - 1);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (uint32_t i = 0; i < helperCount; i += 1) {
+            m_jobs.push_back([pState, runChunks]() { runChunks(*pState); });
+        }
+    }
+    m_wakeup.notify_all();
+
+    runChunks(*pState);
+
+    // Wait for chunks that other threads claimed.
+    while (pState->doneChunks.load(std::memory_order_acquire) != chunkCount) {
+        std::this_thread::yield();
+    }
+}
+
+void JobPool::workerMain()
+{
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeup.wait(lock, [this]() {
+                return m_quitting || !m_jobs.empty();
+            });
+            if (m_quitting) {
+                return;
+            }
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+        job();
+    }
+}
@@ -1,31 +1,77 @@
 #include "00-Prelude.hpp"
 
+#include "AssetArchive.hpp"
+#include "FramePacer.hpp"
 #include "Renderer.hpp"
-
-#include "tiny_obj_loader.h"
+#include "RenderThread.hpp"
+#include "JobPool.hpp"
+#include "Mesh.hpp"
+#include "MeshLod.hpp"
+#include "Scene.hpp"
+#include "Simulation.hpp"
 
 #include <algorithm>
 #include <string>
 #include <vector>
 
+// ==== Camera ==================================================================
+
+// Dragging with the left mouse button orbits the camera around its target.
+struct OrbitCamera
+{
+    Vec3    eye         = {};
+    Vec3    target      = {};
+    bool    dragging    = false;
+    double  lastX       = 0.0;
+    double  lastY       = 0.0;
+};
+
+// The window's user pointer. Everything here belongs to the main thread,
+// except pRenderThread, which is how the main thread talks to the renderer.
 struct UberContext
 {
     bool fullscreen = false;
     uint32_t height = 0;
     uint32_t width  = 0;
+
+    OrbitCamera         camera;
+    PipelineVariantKey  meshVariant;
+    bool                depthPrepass  = false;
+    RenderThread*       pRenderThread = nullptr;
 };
 
-struct Vertex
+// Cheap enough to call as late as possible. GLFW asks the OS where the cursor
+// is right now, instead of waiting for the next poll to hear about it.
+void orbitCamera(GLFWwindow* pWindow, OrbitCamera* pCamera)
 {
-    float x = 0.f;
-    float y = 0.f;
-    float z = 0.f;
-    float w = 1.f;
-
-    Vertex() = default;
-    Vertex(float x, float y, float z, float w = 1.f)
-            : x(x), y(y), z(z), w(w) {}
-};
+    double x = 0.0;
+    double y = 0.0;
+    glfwGetCursorPos(pWindow, &x, &y);
+    bool dragging =
+        glfwGetMouseButton(pWindow, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+
+    if (dragging && pCamera->dragging) {
+        constexpr float kRadiansPerPixel = 0.005f;
+        float yaw   = as<float>(x - pCamera->lastX) * kRadiansPerPixel;
+        float pitch = as<float>(y - pCamera->lastY) * kRadiansPerPixel;
+
+        Vec3  target   = pCamera->target;
+        Vec3  offset   = pCamera->eye - target;
+        float distance = glm::length(offset);
+        float azimuth  = std::atan2(offset.x, offset.z) - yaw;
+        float altitude = std::asin(offset.y / distance) + pitch;
+        altitude = glm::clamp(altitude, -1.5f, 1.5f);
+
+        offset = distance * Vec3(std::cos(altitude) * std::sin(azimuth),
+                                 std::sin(altitude),
+                                 std::cos(altitude) * std::cos(azimuth));
+        pCamera->eye = target + offset;
+    }
+
+    pCamera->dragging = dragging;
+    pCamera->lastX    = x;
+    pCamera->lastY    = y;
+}
 
 // ==== GLFW Callbacks ==========================================================
 
@@ -74,6 +120,29 @@ void glfwKeyCallback(GLFWwindow* pWindow,
             Debug("TODO: Toggle fullscreen");
             break;
 
+        // Switching variants compiles new pipelines in the background. The
+        // next snapshot carries the change to the render thread.
+        case GLFW_KEY_L: {
+            auto* pCtx = ptr_as<UberContext>(glfwGetWindowUserPointer(pWindow));
+            PipelineVariantKey& variant = pCtx->meshVariant;
+            variant.lightCount = (variant.lightCount + 1) % (kMaxLights + 1);
+            Info("Mesh variant: %u light(s)", variant.lightCount);
+            break;
+        }
+        case GLFW_KEY_V: {
+            auto* pCtx = ptr_as<UberContext>(glfwGetWindowUserPointer(pWindow));
+            PipelineVariantKey& variant = pCtx->meshVariant;
+            variant.quantizedPositions = !variant.quantizedPositions;
+            Info("Mesh variant: %s positions",
+                 variant.quantizedPositions ? "quantized" : "float");
+            break;
+        }
+        case GLFW_KEY_P: {
+            auto* pCtx = ptr_as<UberContext>(glfwGetWindowUserPointer(pWindow));
+            pCtx->depthPrepass = !pCtx->depthPrepass;
+            break;
+        }
+
         default:
             UNUSED("Ignore other keys");
             break;
@@ -86,6 +155,13 @@ void glfwFramebufferSizeCallback(GLFWwindow* pWindow,
                                  int         height)
 {
     Info("GLFW Framebuffer resized -> (%d, %d)", width, height);
+
+    // The render thread picks the new size up before its next frame.
+    auto* pCtx = ptr_as<UberContext>(glfwGetWindowUserPointer(pWindow));
+    if (pCtx->pRenderThread != nullptr) {
+        pCtx->pRenderThread->resize(as<uint32_t>(std::max(width, 0)),
+                                    as<uint32_t>(std::max(height, 0)));
+    }
 }
 
 void glfwJoystickCallback(int jid, int event)
@@ -200,6 +276,7 @@ int real_main(int argc, char** argv)
     }
 
     // Set Glfw Callbacks
+    glfwSetWindowUserPointer(pWindow, &ctx);
     glfwSetKeyCallback(pWindow, glfwKeyCallback);
     glfwSetFramebufferSizeCallback(pWindow, glfwFramebufferSizeCallback);
 
@@ -212,80 +289,235 @@ int real_main(int argc, char** argv)
     Info("Framebuffer resolution: %d x %d", framebufferWidth,
                                             framebufferHeight);
 
+    // ==== Jobs ================================================================
+    // Declared before anything that queues work, so it's destroyed after them.
+    JobPool jobs;
+    jobs.init();
+    Info("Started %u worker thread(s)", jobs.threadCount());
+
+    // ==== Assets ==============================================================
+    // The build packs shaders and models into one archive, next to the
+    // executable. If it's missing (e.g. while iterating on a single shader),
+    // we load loose files instead.
+    AssetArchive assets;
+    std::string  archivePath = executableDir() + "assets.pak";
+    if (assets.open(archivePath.c_str())) {
+        Info("Loaded asset archive with %u entries", assets.entryCount());
+    } else {
+        Info("No asset archive at '%s', loading loose files",
+             archivePath.c_str());
+    }
+
     // ==== Renderer Init =======================================================
     RendererInfo rendererInfo;
     rendererInfo.pWindow           = pWindow;
     rendererInfo.framebufferWidth  = framebufferWidth;
     rendererInfo.framebufferHeight = framebufferHeight;
+    rendererInfo.pAssets           = assets.isOpen() ? &assets : nullptr;
+    rendererInfo.pJobs             = &jobs;
+
+    // Shader variants are picked up front. Each one is its own pipeline, with
+    // the unused paths compiled out.
+    {
+        auto& variant = rendererInfo.meshVariant;
+        variant.lightCount = as<uint32_t>(atoi(getEnvVarOr("LIGHT_COUNT", "2")));
+        variant.lightCount = std::min(variant.lightCount, kMaxLights);
+        variant.quantizedPositions =
+            (strcmp(getEnvVarOr("QUANTIZED_POSITIONS", "0"), "1") == 0);
+        Info("Mesh variant: %u light(s), %s positions",
+             variant.lightCount,
+             variant.quantizedPositions ? "quantized" : "float");
+    }
+
+    // "bandwidth" (D16 first), "balanced" (D24 first), or "precision" (D32).
+    {
+        const char* pPrecision = getEnvVarOr("DEPTH_PRECISION", "balanced");
+        if (strcmp(pPrecision, "bandwidth") == 0) {
+            rendererInfo.depthPrecision = DepthPrecision::Bandwidth;
+        } else if (strcmp(pPrecision, "precision") == 0) {
+            rendererInfo.depthPrecision = DepthPrecision::Precision;
+        } else {
+            rendererInfo.depthPrecision = DepthPrecision::Balanced;
+        }
+    }
+
+    // Which GPU to run on, by index or by part of its name. Otherwise the
+    // renderer picks the best one it can find. "--gpu=" beats the env var.
+    {
+        const char* pGpu = getEnvVarOr("GPU", nullptr);
+        for (int i = 1; i < argc; i += 1) {
+            if (strncmp(argv[i], "--gpu=", 6) == 0) {
+                pGpu = argv[i] + 6;
+            }
+        }
+        rendererInfo.pPhysicalDevice = pGpu;
+    }
+
+    // ASYNC_COMPUTE=0 puts compute on the graphics queue, for comparison.
+    rendererInfo.asyncCompute =
+        (strcmp(getEnvVarOr("ASYNC_COMPUTE", "1"), "0") != 0);
+
+    // GPU_CULLING=0 culls on the CPU instead. CONE_CULLING=1 also culls
+    // objects facing away, and VALIDATE_CULLING=1 checks the GPU's results.
+    // OCCLUSION_CULLING=0 turns off culling hidden objects. With GPU culling
+    // off, SOFTWARE_OCCLUSION=1 culls them on the CPU instead.
+    rendererInfo.gpuCulling =
+        (strcmp(getEnvVarOr("GPU_CULLING", "1"), "0") != 0);
+    rendererInfo.coneCulling =
+        (strcmp(getEnvVarOr("CONE_CULLING", "0"), "0") != 0);
+    rendererInfo.validateCulling =
+        (strcmp(getEnvVarOr("VALIDATE_CULLING", "0"), "0") != 0);
+    rendererInfo.occlusionCulling =
+        (strcmp(getEnvVarOr("OCCLUSION_CULLING", "1"), "0") != 0);
+    rendererInfo.softwareOcclusion =
+        (strcmp(getEnvVarOr("SOFTWARE_OCCLUSION", "0"), "0") != 0);
+
+    // DEPTH_PREPASS=1 draws depth first, then shades each pixel once. It
+    // pays off in scenes with a lot of overdraw. P toggles it.
+    rendererInfo.depthPrepass =
+        (strcmp(getEnvVarOr("DEPTH_PREPASS", "0"), "0") != 0);
+
+    // How many pixels a LOD may be off by. MESH_LODS=0 doesn't build any.
+    rendererInfo.lodErrorPixels =
+        as<float>(atof(getEnvVarOr("LOD_ERROR_PIXELS", "1")));
+    bool buildLods = (strcmp(getEnvVarOr("MESH_LODS", "1"), "0") != 0);
+
+    // Draws an NxN grid of copies of the mesh, as instances.
+    int instanceGrid = std::max(atoi(getEnvVarOr("INSTANCE_GRID", "1")), 1);
+
+    // SPIN spins the instances, in radians per second, on a simulation
+    // thread stepping at SIM_RATE Hz.
+    SimulationInfo simInfo;
+    simInfo.stepHz   = std::max(atof(getEnvVarOr("SIM_RATE", "60")), 1.0);
+    simInfo.spinRate = as<float>(atof(getEnvVarOr("SPIN", "0")));
+
+    // FRAME_RATE caps the frame rate, in Hz. 0 runs as fast as presenting
+    // allows. LATE_LATCH=0 reads the mouse at the start of the frame, instead
+    // of right before it's submitted.
+    FramePacerInfo pacerInfo;
+    pacerInfo.targetHz = atof(getEnvVarOr("FRAME_RATE", "0"));
+
+    // The render thread can't read the mouse, so the late latch takes the
+    // newest camera the main thread has seen.
+    RenderThread renderThread;
+    rendererInfo.lateLatch =
+        (strcmp(getEnvVarOr("LATE_LATCH", "1"), "0") != 0);
+    rendererInfo.latchInput = [&renderThread]() {
+        renderThread.latchCamera();
+    };
 
     Renderer renderer;
     VkResult result = renderer.init(rendererInfo);
     AssertVk(result);
 
+    // From here on, the main thread owns the camera and the mesh variant, and
+    // hands copies of them to the render thread.
+    ctx.camera.eye    = renderer.eye();
+    ctx.camera.target = renderer.cameraTarget();
+    ctx.meshVariant   = renderer.meshVariant();
+    ctx.depthPrepass  = renderer.depthPrepass();
+
     // Load a model!
     {
-        using namespace tinyobj;
-
-        const char* pFilename = "../External/tinyobjloader/models/"
-                                "cornell_box.obj";
-
-        attrib_t                attrib;
-        std::vector<shape_t>    shapes;
-        std::vector<material_t> materials;
-        std::string errMsg;
-
-        Info("Loading wavefront file \"%s\"", pFilename);
-        bool okay = LoadObj(&attrib,
-                            &shapes,
-                            &materials,
-                            &errMsg,
-                            pFilename,
-                            nullptr /*mtl base directroy*/);
-        AssertMsg(okay, "tinyobj: %s", errMsg.c_str());
-
-        Info("Loaded %u vertices", attrib.vertices.size());
-        std::vector<Vertex> verts;
-        verts.reserve(attrib.vertices.size());
-
-        Vec3 min(0, 0, 0);
-        Vec3 max(0, 0, 0);
-
-        for (const auto& shape : shapes) {
-            for (const index_t& index : shape.mesh.indices) {
-                size_t i = index.vertex_index;
-                Vec3& pos = *reinterpret_cast<Vec3*>(&attrib.vertices[3*i]);
-                min = glm::min(min, pos);
-                max = glm::max(max, pos);
-            }
+        MeshData mesh;
+        bool loaded = loadObjMesh(assets.isOpen() ? &assets : nullptr,
+                                  "cornell_box.obj",
+                                  &mesh);
+        AssertMsg(loaded, "Unable to load cornell_box.obj");
+
+        // Distant objects draw coarser versions of themselves. They're all
+        // in the same buffers, so nothing else needs to know.
+        if (buildLods) {
+            buildMeshLods(&mesh);
         }
 
-        Info("min:    (% 6.1f, % 6.1f, % 6.1f)", min.x, min.y, min.z);
-        Info("max:    (% 6.1f, % 6.1f, % 6.1f)", max.x, max.y, max.z);
-
-        Vec3 offset = -0.5f * (max - min);
-        offset.z = 0;
-        Vec3 scale = 3.f / (max - min);
+        // The grid spreads out sideways, and away from the camera, with
+        // the original in the middle of the front row.
+        if (instanceGrid > 1) {
+            float spacing = 1.25f * 3.f;
+            for (int z = 0; z < instanceGrid; z += 1) {
+                for (int x = 0; x < instanceGrid; x += 1) {
+                    Vec3 offset((x - instanceGrid / 2) * spacing,
+                                0.f,
+                                z * spacing);
+                    for (uint32_t i = 0; i < mesh.objects.size(); i += 1) {
+                        MeshInstance instance;
+                        instance.object             = i;
+                        instance.data.transform     = glm::translate(Mat4(1.f), offset);
+                        instance.data.materialIndex = mesh.objects[i].materialIndex;
+                        mesh.instances.push_back(instance);
+                    }
+                }
+            }
+            Info("Instanced the mesh %d times", instanceGrid * instanceGrid);
+        }
 
-        Info("offset: (% 6.1f, % 6.1f, % 6.1f)", offset.x, offset.y, offset.z);
-        Info("scale:  (% 3.3f, % 3.3f, % 3.3f)", scale.x, scale.y, scale.z);
+        result = renderer.uploadMesh(mesh);
+        AssertVk(result);
 
-        for (const auto& shape : shapes) {
-            for (const index_t& index : shape.mesh.indices) {
-                size_t i = index.vertex_index;
-                Vec3 pos = *reinterpret_cast<Vec3*>(&attrib.vertices[3*i]);
-                pos = scale * (pos + offset);
-                verts.emplace_back(pos.x, pos.y, pos.z);
-            }
+        for (MeshInstance const& instance : mesh.instances) {
+            simInfo.instances.push_back(instance.data);
         }
     }
 
+    // ==== Simulation ==========================================================
+    // Only worth a thread if there's something to move.
+    Simulation simulation;
+    bool simulate = simInfo.spinRate != 0.f && !simInfo.instances.empty();
+    if (simulate) {
+        simulation.init(simInfo);
+    }
+
+    // ==== Render Thread =======================================================
+    RenderThreadInfo renderThreadInfo;
+    renderThreadInfo.pRenderer   = &renderer;
+    renderThreadInfo.pSimulation = simulate ? &simulation : nullptr;
+    renderThread.init(renderThreadInfo);
+    ctx.pRenderThread = &renderThread;
+
     // Main loop
+    // Waiting happens before input is polled, so the frame starts with the
+    // freshest input it can. The render thread draws the frame, while this
+    // one goes on to the next.
+    FramePacer pacer;
+    pacer.init(pacerInfo);
+    uint64_t frame = 0;
     while (!glfwWindowShouldClose(pWindow)) {
-        glfwPollEvents();
-
-        renderer.doOneFrame();
+        pacer.wait();
 
+        glfwPollEvents();
+        auto inputTime = FrameLatency::Clock::now();
+        orbitCamera(pWindow, &ctx.camera);
+        renderThread.setLatestCamera(ctx.camera.eye, ctx.camera.target,
+                                     inputTime);
+
+        FrameSnapshot snapshot;
+        snapshot.frame       = frame;
+        snapshot.eye         = ctx.camera.eye;
+        snapshot.target      = ctx.camera.target;
+        snapshot.meshVariant  = ctx.meshVariant;
+        snapshot.depthPrepass = ctx.depthPrepass;
+        snapshot.inputTime    = inputTime;
+
+        // The render thread is behind. Keep the window responsive, and the
+        // late latch fed, until there's room.
+        while (!renderThread.submit(snapshot)) {
+            glfwWaitEventsTimeout(0.001);
+            orbitCamera(pWindow, &ctx.camera);
+            renderThread.setLatestCamera(ctx.camera.eye, ctx.camera.target,
+                                         FrameLatency::Clock::now());
+            if (glfwWindowShouldClose(pWindow)) {
+                break;
+            }
+        }
+        frame += 1;
     }
+    pacer.logStats();
+
+    // The render thread uses the renderer until it's joined.
+    ctx.pRenderThread = nullptr;
+    renderThread.deInit();
+    simulation.deInit();
 
     glfwTerminate();
 
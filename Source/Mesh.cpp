@@ -0,0 +1,137 @@
+#include "Mesh.hpp"
+
+#include <algorithm>
+
+glm::vec4 quantizePositions(Vertex const*                 pVerts,
+                            uint32_t                      count,
+                            std::vector<QuantizedVertex>* pOut)
+{
+    Assert(pOut != nullptr);
+
+    // SNORM covers [-1, 1], so we scale each axis by its largest magnitude.
+    Vec3 extent(0.f, 0.f, 0.f);
+    for (uint32_t i = 0; i < count; i += 1) {
+        extent.x = std::max(extent.x, std::abs(pVerts[i].x));
+        extent.y = std::max(extent.y, std::abs(pVerts[i].y));
+        extent.z = std::max(extent.z, std::abs(pVerts[i].z));
+    }
+    // Flat axes would divide by zero. Any scale works for them.
+    for (int axis = 0; axis < 3; axis += 1) {
+        if (extent[axis] == 0.f) {
+            extent[axis] = 1.f;
+        }
+    }
+
+    auto quantize = [](float value, float extent) -> int16_t {
+        float normalized = std::min(std::max(value / extent, -1.f), 1.f);
+        return as<int16_t>(std::lround(normalized * INT16_MAX));
+    };
+
+    pOut->resize(count);
+    for (uint32_t i = 0; i < count; i += 1) {
+        QuantizedVertex& quantized = (*pOut)[i];
+        quantized.x = quantize(pVerts[i].x, extent.x);
+        quantized.y = quantize(pVerts[i].y, extent.y);
+        quantized.z = quantize(pVerts[i].z, extent.z);
+        quantized.w = INT16_MAX;
+    }
+
+    return glm::vec4(extent, 1.f);
+}
+
+MeshObject makeMeshObject(MeshData const& mesh,
+                          uint32_t        firstIndex,
+                          uint32_t        indexCount)
+{
+    Assert(indexCount % 3 == 0);
+    Assert(firstIndex + indexCount <= mesh.indices.size());
+
+    MeshObject object;
+    object.firstIndex = firstIndex;
+    object.indexCount = indexCount;
+    if (indexCount == 0) {
+        return object;
+    }
+
+    auto position = [&](uint32_t i) -> Vec3 {
+        Vertex const& vertex = mesh.vertices[mesh.indices[firstIndex + i]];
+        return Vec3(vertex.x, vertex.y, vertex.z);
+    };
+
+    // The box's center is close enough, and the sphere just has to hold it.
+    Vec3 min = position(0);
+    Vec3 max = min;
+    for (uint32_t i = 1; i < indexCount; i += 1) {
+        min = glm::min(min, position(i));
+        max = glm::max(max, position(i));
+    }
+    Vec3  center = 0.5f * (min + max);
+    float radius = 0.f;
+    for (uint32_t i = 0; i < indexCount; i += 1) {
+        radius = std::max(radius, glm::length(position(i) - center));
+    }
+    object.sphere = glm::vec4(center, radius);
+
+    // The cone's axis is the average of the triangle normals, and it's as
+    // wide as the normal furthest from it.
+    std::vector<Vec3> normals;
+    normals.reserve(indexCount / 3);
+    Vec3 axis(0.f, 0.f, 0.f);
+    for (uint32_t i = 0; i < indexCount; i += 3) {
+        Vec3 a = position(i);
+        Vec3 normal = glm::cross(position(i + 1) - a, position(i + 2) - a);
+        float length = glm::length(normal);
+        if (length > 0.f) {
+            normals.push_back(normal / length);
+            axis += normals.back();
+        }
+    }
+    float axisLength = glm::length(axis);
+    if (normals.empty() || axisLength == 0.f) {
+        return object;
+    }
+    axis = axis / axisLength;
+
+    float minDot = 1.f;
+    for (Vec3 const& normal : normals) {
+        minDot = std::min(minDot, glm::dot(normal, axis));
+    }
+    // Normals more than 90 degrees apart can always see someone.
+    if (minDot <= 0.f) {
+        return object;
+    }
+    object.cone = glm::vec4(axis, std::sqrt(1.f - minDot * minDot));
+
+    return object;
+}
+
+glm::vec4 transformSphere(Mat4 const& transform, glm::vec4 const& sphere)
+{
+    glm::vec4 center = transform * glm::vec4(sphere.x, sphere.y, sphere.z, 1.f);
+
+    // The radius grows by the largest scale along any axis.
+    float scale = 0.f;
+    for (int axis = 0; axis < 3; axis += 1) {
+        Vec3 column(transform[axis].x, transform[axis].y, transform[axis].z);
+        scale = std::max(scale, glm::length(column));
+    }
+
+    return glm::vec4(center.x, center.y, center.z, sphere.w * scale);
+}
+
+glm::vec4 mergeSpheres(glm::vec4 const& a, glm::vec4 const& b)
+{
+    Vec3  toB(b.x - a.x, b.y - a.y, b.z - a.z);
+    float distance = glm::length(toB);
+    if (distance + b.w <= a.w) {
+        return a;
+    }
+    if (distance + a.w <= b.w) {
+        return b;
+    }
+
+    // Neither holds the other, so they can't share a center.
+    float radius = 0.5f * (distance + a.w + b.w);
+    Vec3  center = Vec3(a.x, a.y, a.z) + toB * ((radius - a.w) / distance);
+    return glm::vec4(center, radius);
+}
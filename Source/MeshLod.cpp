@@ -0,0 +1,345 @@
+#include "MeshLod.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+
+// ==== Quadrics ================================================================
+
+// The symmetric 4x4 matrix p p^T, for a plane p = (a, b, c, d). Summed over
+// planes, v^T Q v is the sum of squared distances from v to all of them.
+struct Quadric
+{
+    // aa, ab, ac, ad, bb, bc, bd, cc, cd, dd
+    double m[10] = {};
+};
+
+static Quadric planeQuadric(Vec3 const& p0, Vec3 const& p1, Vec3 const& p2)
+{
+    Quadric q;
+    Vec3  normal = glm::cross(p1 - p0, p2 - p0);
+    float length = glm::length(normal);
+    if (length == 0.f) {
+        return q;
+    }
+    normal = normal / length;
+
+    double a = normal.x;
+    double b = normal.y;
+    double c = normal.z;
+    double d = -glm::dot(normal, p0);
+    q.m[0] = a * a; q.m[1] = a * b; q.m[2] = a * c; q.m[3] = a * d;
+    q.m[4] = b * b; q.m[5] = b * c; q.m[6] = b * d;
+    q.m[7] = c * c; q.m[8] = c * d;
+    q.m[9] = d * d;
+    return q;
+}
+
+static void addQuadric(Quadric* pInto, Quadric const& q)
+{
+    for (int i = 0; i < 10; i += 1) {
+        pInto->m[i] += q.m[i];
+    }
+}
+
+static double evaluate(Quadric const& q, Vec3 const& p)
+{
+    double x = p.x;
+    double y = p.y;
+    double z = p.z;
+    double error = q.m[0] * x * x + 2.0 * q.m[1] * x * y + 2.0 * q.m[2] * x * z
+                 + 2.0 * q.m[3] * x
+                 + q.m[4] * y * y + 2.0 * q.m[5] * y * z + 2.0 * q.m[6] * y
+                 + q.m[7] * z * z + 2.0 * q.m[8] * z
+                 + q.m[9];
+    // Rounding can take it just under zero.
+    return std::max(error, 0.0);
+}
+
+// ==== Simplification ==========================================================
+
+float simplifyMesh(Vertex const*          pVerts,
+                   uint32_t const*        pIndices,
+                   uint32_t               indexCount,
+                   uint32_t               targetIndexCount,
+                   std::vector<uint32_t>* pOut)
+{
+    Assert(indexCount % 3 == 0);
+    Assert(pOut != nullptr);
+
+    // Work on a compact copy of just the vertices these triangles use.
+    std::unordered_map<uint32_t, uint32_t> toLocal;
+    std::vector<uint32_t> toGlobal;
+    std::vector<Vec3>     positions;
+    std::vector<uint32_t> tris(indexCount);
+    for (uint32_t i = 0; i < indexCount; i += 1) {
+        auto inserted = toLocal.emplace(pIndices[i], as<uint32_t>(toGlobal.size()));
+        if (inserted.second) {
+            Vertex const& v = pVerts[pIndices[i]];
+            toGlobal.push_back(pIndices[i]);
+            positions.push_back(Vec3(v.x, v.y, v.z));
+        }
+        tris[i] = inserted.first->second;
+    }
+    uint32_t vertexCount = as<uint32_t>(positions.size());
+
+    std::vector<Quadric> quadrics(vertexCount);
+    for (uint32_t i = 0; i < indexCount; i += 3) {
+        Quadric q = planeQuadric(positions[tris[i]],
+                                 positions[tris[i + 1]],
+                                 positions[tris[i + 2]]);
+        for (uint32_t k = 0; k < 3; k += 1) {
+            addQuadric(&quadrics[tris[i + k]], q);
+        }
+    }
+
+    // Edges with only one triangle are on a boundary. Their vertices stay
+    // put, so outlines don't shrink.
+    std::unordered_map<uint64_t, uint32_t> edgeUses;
+    auto edgeKey = [](uint32_t a, uint32_t b) {
+        return (as<uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+    };
+    for (uint32_t i = 0; i < indexCount; i += 3) {
+        for (uint32_t k = 0; k < 3; k += 1) {
+            edgeUses[edgeKey(tris[i + k], tris[i + (k + 1) % 3])] += 1;
+        }
+    }
+    std::vector<uint8_t> locked(vertexCount, 0);
+    for (auto const& edge : edgeUses) {
+        if (edge.second == 1) {
+            locked[as<uint32_t>(edge.first >> 32)]        = 1;
+            locked[as<uint32_t>(edge.first & UINT32_MAX)] = 1;
+        }
+    }
+
+    struct Collapse
+    {
+        uint32_t    from;
+        uint32_t    to;
+        double      cost;
+    };
+
+    double maxCost = 0.0;
+    std::vector<uint32_t> firstTri;
+    std::vector<uint32_t> vertexTris;
+    std::vector<Collapse> collapses;
+    std::vector<uint8_t>  touched;
+
+    // Each pass collapses the cheapest edges it can, touching each vertex at
+    // most once, so costs and adjacency stay valid for the whole pass.
+    while (tris.size() > targetIndexCount) {
+        uint32_t triCount = as<uint32_t>(tris.size() / 3);
+
+        // Which triangles use each vertex, as one flat array.
+        firstTri.assign(vertexCount + 1, 0);
+        for (uint32_t index : tris) {
+            firstTri[index + 1] += 1;
+        }
+        for (uint32_t v = 0; v < vertexCount; v += 1) {
+            firstTri[v + 1] += firstTri[v];
+        }
+        vertexTris.resize(tris.size());
+        std::vector<uint32_t> cursor(firstTri.begin(), firstTri.end() - 1);
+        for (uint32_t t = 0; t < triCount; t += 1) {
+            for (uint32_t k = 0; k < 3; k += 1) {
+                vertexTris[cursor[tris[t * 3 + k]]++] = t;
+            }
+        }
+
+        // Both directions of every edge, unless 'from' is locked.
+        collapses.clear();
+        for (uint32_t t = 0; t < triCount; t += 1) {
+            for (uint32_t k = 0; k < 3; k += 1) {
+                uint32_t a = tris[t * 3 + k];
+                uint32_t b = tris[t * 3 + (k + 1) % 3];
+                for (uint32_t flip = 0; flip < 2; flip += 1) {
+                    uint32_t from = flip == 0 ? a : b;
+                    uint32_t to   = flip == 0 ? b : a;
+                    if (locked[from] != 0) {
+                        continue;
+                    }
+                    Quadric q = quadrics[from];
+                    addQuadric(&q, quadrics[to]);
+                    collapses.push_back({ from, to, evaluate(q, positions[to]) });
+                }
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(),
+                  [](Collapse const& a, Collapse const& b) {
+                      return a.cost < b.cost;
+                  });
+
+        touched.assign(vertexCount, 0);
+        uint32_t remaining = as<uint32_t>(tris.size());
+        uint32_t collapsed = 0;
+        for (Collapse const& collapse : collapses) {
+            if (remaining <= targetIndexCount) {
+                break;
+            }
+            uint32_t from = collapse.from;
+            uint32_t to   = collapse.to;
+            if (touched[from] != 0 || touched[to] != 0) {
+                continue;
+            }
+
+            // Moving 'from' onto 'to' mustn't turn any triangle around, or
+            // even most of the way.
+            bool flips = false;
+            for (uint32_t i = firstTri[from]; i < firstTri[from + 1]; i += 1) {
+                uint32_t const* pTri = &tris[vertexTris[i] * 3];
+                if (pTri[0] == to || pTri[1] == to || pTri[2] == to) {
+                    continue;
+                }
+                Vec3 p[3];
+                Vec3 moved[3];
+                for (uint32_t k = 0; k < 3; k += 1) {
+                    p[k]     = positions[pTri[k]];
+                    moved[k] = pTri[k] == from ? positions[to] : p[k];
+                }
+                Vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                Vec3 after  = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+                if (glm::dot(before, after) <=
+                        0.25f * glm::length(before) * glm::length(after)) {
+                    flips = true;
+                    break;
+                }
+            }
+            if (flips) {
+                continue;
+            }
+
+            for (uint32_t i = firstTri[from]; i < firstTri[from + 1]; i += 1) {
+                uint32_t* pTri = &tris[vertexTris[i] * 3];
+                bool degenerate = pTri[0] == to || pTri[1] == to || pTri[2] == to;
+                for (uint32_t k = 0; k < 3; k += 1) {
+                    if (pTri[k] == from) {
+                        pTri[k] = to;
+                    }
+                }
+                remaining -= degenerate ? 3 : 0;
+            }
+            addQuadric(&quadrics[to], quadrics[from]);
+            touched[from] = 1;
+            touched[to]   = 1;
+            maxCost       = std::max(maxCost, collapse.cost);
+            collapsed    += 1;
+        }
+
+        // Drop the triangles that collapsed to lines.
+        uint32_t kept = 0;
+        for (uint32_t t = 0; t < triCount; t += 1) {
+            uint32_t a = tris[t * 3];
+            uint32_t b = tris[t * 3 + 1];
+            uint32_t c = tris[t * 3 + 2];
+            if (a == b || b == c || c == a) {
+                continue;
+            }
+            tris[kept * 3]     = a;
+            tris[kept * 3 + 1] = b;
+            tris[kept * 3 + 2] = c;
+            kept += 1;
+        }
+        tris.resize(kept * 3);
+
+        if (collapsed == 0) {
+            break;
+        }
+    }
+
+    pOut->resize(tris.size());
+    for (size_t i = 0; i < tris.size(); i += 1) {
+        (*pOut)[i] = toGlobal[tris[i]];
+    }
+    return as<float>(std::sqrt(maxCost));
+}
+
+// ==== LODs ====================================================================
+
+void buildMeshLods(MeshData* pMesh)
+{
+    Assert(pMesh != nullptr);
+
+    // Anything smaller isn't worth a draw of its own.
+    static constexpr uint32_t kMinLodTriangles = 16;
+
+    uint32_t lodCount  = 0;
+    size_t   baseCount = pMesh->indices.size();
+    std::vector<uint32_t> base;
+    std::vector<uint32_t> simplified;
+
+    pMesh->lods.assign(pMesh->objects.size(), {});
+    for (size_t i = 0; i < pMesh->objects.size(); i += 1) {
+        MeshObject&     object = pMesh->objects[i];
+        MeshObjectLods& chain  = pMesh->lods[i];
+        chain.count = 1;
+        chain.lods[0].firstIndex = object.firstIndex;
+        chain.lods[0].indexCount = object.indexCount;
+        chain.lods[0].error      = 0.f;
+
+        // Appending may move the indices, so work from a copy.
+        base.assign(pMesh->indices.begin() + object.firstIndex,
+                    pMesh->indices.begin() + object.firstIndex +
+                        object.indexCount);
+
+        while (chain.count < kMaxMeshLods) {
+            MeshLod const& last = chain.lods[chain.count - 1];
+            uint32_t target = (last.indexCount / 6) * 3;
+            if (target < kMinLodTriangles * 3) {
+                break;
+            }
+
+            // From full detail every time. The error doesn't stack up.
+            float error = simplifyMesh(pMesh->vertices.data(),
+                                       base.data(),
+                                       as<uint32_t>(base.size()),
+                                       target,
+                                       &simplified);
+            if (simplified.size() * 5 > last.indexCount * 4) {
+                break;
+            }
+
+            MeshLod& lod = chain.lods[chain.count];
+            lod.firstIndex = as<uint32_t>(pMesh->indices.size());
+            lod.indexCount = as<uint32_t>(simplified.size());
+            lod.error      = std::max(error, last.error);
+            pMesh->indices.insert(pMesh->indices.end(),
+                                  simplified.begin(), simplified.end());
+            chain.count += 1;
+            lodCount    += 1;
+        }
+
+        // The normal cone was built from full detail. Coarser LODs face
+        // other ways, so it can't be trusted for them.
+        if (chain.count > 1) {
+            object.cone = glm::vec4(0.f, 0.f, 0.f, 1.f);
+        }
+    }
+
+    Info("Built %u LODs for %zu objects, adding %zu indices to %zu",
+         lodCount, pMesh->objects.size(),
+         pMesh->indices.size() - baseCount, baseCount);
+}
+
+uint32_t selectLod(MeshObjectLods const&  lods,
+                   glm::vec4 const&       sphere,
+                   uint32_t               current,
+                   LodSelectParams const& params)
+{
+    Vec3  center(sphere.x, sphere.y, sphere.z);
+    float distance = std::max(glm::length(center - params.eye) - sphere.w,
+                              1e-3f);
+    auto pixels = [&](uint32_t lod) {
+        return lods.lods[lod].error * params.pixelsPerUnit / distance;
+    };
+
+    // Finer as soon as we're over the limit, coarser only once comfortably
+    // under it.
+    uint32_t lod = std::min(current, lods.count - 1);
+    while (lod > 0 && pixels(lod) > params.maxErrorPixels) {
+        lod -= 1;
+    }
+    while (lod + 1 < lods.count &&
+           pixels(lod + 1) <= params.maxErrorPixels * (1.f - params.hysteresis)) {
+        lod += 1;
+    }
+    return lod;
+}
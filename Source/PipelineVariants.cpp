@@ -0,0 +1,406 @@
+#include "PipelineVariants.hpp"
+#include "JobPool.hpp"
+#include "Mesh.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+// ==== PipelineVariants ========================================================
+
+static bool sameKey(PipelineVariantKey const& a, PipelineVariantKey const& b)
+{
+    return a.lightCount         == b.lightCount         &&
+           a.quantizedPositions == b.quantizedPositions &&
+           a.depthEqual         == b.depthEqual;
+}
+
+PipelineVariants::~PipelineVariants()
+{
+    deInit();
+}
+
+void PipelineVariants::init(PipelineVariantsInfo const& info)
+{
+    Assert(info.device     != nullptr);
+    Assert(info.renderPass != nullptr);
+    Assert(info.layout     != nullptr);
+    Assert(info.vertModule != nullptr);
+
+    m_info = info;
+}
+
+void PipelineVariants::deInit()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    // Workers write into m_variants, so let them finish first.
+    m_compiled.wait(lock, [this]() { return m_compilingCount == 0; });
+
+    if (m_variants.empty()) {
+        return;
+    }
+    lock.unlock();
+    logStats();
+    lock.lock();
+
+    for (auto const& variant : m_variants) {
+        vkDestroyPipeline(m_info.device, variant.second.pipeline, m_info.pAlloc);
+    }
+    m_variants.clear();
+}
+
+void PipelineVariants::setRenderPass(VkRenderPass renderPass,
+                                     uint64_t     renderPassClass)
+{
+    Assert(renderPass != nullptr);
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    // Workers read m_info while they compile.
+    m_compiled.wait(lock, [this]() { return m_compilingCount == 0; });
+    m_info.renderPass      = renderPass;
+    m_info.renderPassClass = renderPassClass;
+}
+
+VkPipeline PipelineVariants::request(PipelineVariantKey const& key)
+{
+    uint64_t hash     = hashState(key);
+    bool     started  = false;
+    Variant* pVariant = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        pVariant = &findOrStart(key, hash, &started);
+        if (!started) {
+            // nullptr while it's compiling, or if it failed.
+            return pVariant->pipeline;
+        }
+    }
+
+    if (m_info.pJobs == nullptr) {
+        compile(*pVariant, hash);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return pVariant->pipeline;
+    }
+
+    m_info.pJobs->push([this, pVariant, hash]() {
+        compile(*pVariant, hash);
+    });
+    return nullptr;
+}
+
+VkPipeline PipelineVariants::get(PipelineVariantKey const& key)
+{
+    using Clock = std::chrono::steady_clock;
+
+    uint64_t hash     = hashState(key);
+    bool     started  = false;
+    bool     waiting  = false;
+    Variant* pVariant = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        pVariant = &findOrStart(key, hash, &started);
+        waiting  = started || pVariant->state == State::Compiling;
+    }
+
+    Clock::time_point start = Clock::now();
+
+    // Nobody else is compiling it, and we need it now anyway.
+    if (started) {
+        compile(*pVariant, hash);
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    Variant& variant = *pVariant;
+    m_compiled.wait(lock, [&variant]() {
+        return variant.state != State::Compiling;
+    });
+
+    if (waiting) {
+        double ms = std::chrono::duration<double, std::milli>(
+                        Clock::now() - start).count();
+        m_blockingCount += 1;
+        Verbose("Blocked %.2f ms on pipeline variant 0x%016llx", ms,
+                as<unsigned long long>(hash));
+    }
+
+    return variant.pipeline;
+}
+
+uint32_t PipelineVariants::variantCount() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return as<uint32_t>(m_variants.size());
+}
+
+void PipelineVariants::logStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    double averageMs = m_compiledCount > 0 ? m_totalMs / m_compiledCount : 0.0;
+    Info("Pipeline variants:\n"
+         "    Compiled:        %u (%s)\n"
+         "    Compile time:    %.2f ms total, %.2f ms average, %.2f ms max\n"
+         "    Hitches:         %u over %.1f ms\n"
+         "    Blocking waits:  %u",
+         m_compiledCount,
+         m_info.pJobs != nullptr ? "on workers" : "on the caller",
+         m_totalMs, averageMs, m_maxMs,
+         m_hitchCount, m_info.hitchMs,
+         m_blockingCount);
+}
+
+uint64_t PipelineVariants::hashState(PipelineVariantKey const& key) const
+{
+    Assert(key.lightCount <= kMaxLights);
+
+    // Everything that ends up in VkGraphicsPipelineCreateInfo.
+    // Fields are hashed one by one, so struct padding never gets in.
+    uint8_t  quantized = key.quantizedPositions ? 1 : 0;
+    uint8_t  equal     = key.depthEqual ? 1 : 0;
+
+    // The render pass handle isn't hashed, its compatibility class is.
+    // Pipelines work with any render pass that's compatible.
+    uint64_t hash = kHashSeed;
+    hash = hashBytes(&m_info.renderPassClass, sizeof(m_info.renderPassClass),
+                     hash);
+    hash = hashBytes(&m_info.subpass,    sizeof(m_info.subpass),    hash);
+    hash = hashBytes(&m_info.layout,     sizeof(m_info.layout),     hash);
+    hash = hashBytes(&m_info.vertModule, sizeof(m_info.vertModule), hash);
+    hash = hashBytes(&m_info.fragModule, sizeof(m_info.fragModule), hash);
+    hash = hashBytes(&key.lightCount,    sizeof(key.lightCount),    hash);
+    hash = hashBytes(&quantized,         sizeof(quantized),         hash);
+    hash = hashBytes(&equal,             sizeof(equal),             hash);
+    return hash;
+}
+
+PipelineVariants::Variant&
+PipelineVariants::findOrStart(PipelineVariantKey const& key,
+                              uint64_t                  hash,
+                              bool*                     pStarted)
+{
+    auto range = m_variants.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        Variant& variant = it->second;
+        if (sameKey(variant.key, key) &&
+            variant.renderPassClass == m_info.renderPassClass) {
+            *pStarted = false;
+            return variant;
+        }
+    }
+    if (range.first != range.second) {
+        Info("Pipeline variant hash 0x%016llx collided",
+             as<unsigned long long>(hash));
+    }
+
+    Verbose("Compiling pipeline variant 0x%016llx "
+            "(lights=%u, quantized=%s, depth equal=%s)",
+            as<unsigned long long>(hash),
+            key.lightCount,
+            ToCStr(as<VkBool32>(key.quantizedPositions)),
+            ToCStr(as<VkBool32>(key.depthEqual)));
+
+    m_compilingCount += 1;
+    *pStarted = true;
+
+    Variant& variant = m_variants.emplace(hash, Variant())->second;
+    variant.key             = key;
+    variant.renderPassClass = m_info.renderPassClass;
+    return variant;
+}
+
+void PipelineVariants::compile(Variant& variant, uint64_t hash)
+{
+    using Clock = std::chrono::steady_clock;
+
+    Clock::time_point start = Clock::now();
+
+    // The key is only written before the variant is handed out.
+    VkPipeline pipeline = nullptr;
+    VkResult   result   = createVariant(variant.key, &pipeline);
+
+    double ms = std::chrono::duration<double, std::milli>(
+                    Clock::now() - start).count();
+
+    if (result != VK_SUCCESS) {
+        Bug("Unable to create pipeline variant 0x%016llx: %s",
+            as<unsigned long long>(hash), ToCStr(result));
+    } else if (ms > m_info.hitchMs) {
+        // On a worker, this is the frame time we saved. On the caller, it's
+        // a frame we dropped.
+        Info("Pipeline variant 0x%016llx took %.2f ms to compile%s",
+             as<unsigned long long>(hash), ms, m_info.pJobs != nullptr ? " (on a worker)" : "");
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        variant.state    = result == VK_SUCCESS ? State::Ready : State::Failed;
+        variant.pipeline = pipeline;
+
+        m_compilingCount -= 1;
+        m_compiledCount  += 1;
+        m_totalMs        += ms;
+        m_maxMs           = std::max(m_maxMs, ms);
+        if (ms > m_info.hitchMs) {
+            m_hitchCount += 1;
+        }
+    }
+    m_compiled.notify_all();
+}
+
+VkResult PipelineVariants::createVariant(PipelineVariantKey const& key,
+                                         VkPipeline*               pPipeline) const
+{
+    bool depthOnly = m_info.fragModule == nullptr;
+
+    // ---- Specialization ----------------------------------------------------
+    struct SpecData
+    {
+        uint32_t lightCount;
+        VkBool32 quantizedPositions;
+    };
+    SpecData specData = {};
+    specData.lightCount         = key.lightCount;
+    specData.quantizedPositions = key.quantizedPositions ? VK_TRUE : VK_FALSE;
+
+    VkSpecializationMapEntry specEntries[2] = {};
+    specEntries[0].constantID = SpecConstantId_LightCount;
+    specEntries[0].offset     = offsetof(SpecData, lightCount);
+    specEntries[0].size       = sizeof(SpecData::lightCount);
+    specEntries[1].constantID = SpecConstantId_QuantizedPositions;
+    specEntries[1].offset     = offsetof(SpecData, quantizedPositions);
+    specEntries[1].size       = sizeof(SpecData::quantizedPositions);
+
+    // Both stages share the same constants. Stages ignore IDs they don't use.
+    VkSpecializationInfo specInfo = {};
+    specInfo.mapEntryCount = array_size(specEntries);
+    specInfo.pMapEntries   = specEntries;
+    specInfo.dataSize      = sizeof(specData);
+    specInfo.pData         = &specData;
+
+    VkPipelineShaderStageCreateInfo stages[2] = {};
+    stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stages[0].stage               = VK_SHADER_STAGE_VERTEX_BIT;
+    stages[0].module              = m_info.vertModule;
+    stages[0].pName               = "main";
+    stages[0].pSpecializationInfo = &specInfo;
+    stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stages[1].stage               = VK_SHADER_STAGE_FRAGMENT_BIT;
+    stages[1].module              = m_info.fragModule;
+    stages[1].pName               = "main";
+    stages[1].pSpecializationInfo = &specInfo;
+    uint32_t stageCount = depthOnly ? 1 : 2;
+
+    // ---- Fixed function ----------------------------------------------------
+    // Binding 0 is the vertices, binding 1 the instances.
+    VkVertexInputBindingDescription bindings[2] = {};
+    bindings[0].binding   = 0;
+    bindings[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    bindings[0].stride    = key.quantizedPositions ? sizeof(QuantizedVertex)
+                                                   : sizeof(Vertex);
+    bindings[1].binding   = 1;
+    bindings[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+    bindings[1].stride    = sizeof(InstanceData);
+
+    // The position, then the transform's four columns, and the material.
+    // Depth only needs the first five.
+    VkVertexInputAttributeDescription attributes[6] = {};
+    attributes[0].location = 0;
+    attributes[0].binding  = 0;
+    attributes[0].offset   = 0;
+    attributes[0].format   = key.quantizedPositions
+                                 ? VK_FORMAT_R16G16B16A16_SNORM
+                                 : VK_FORMAT_R32G32B32A32_SFLOAT;
+    for (uint32_t i = 0; i < 4; i += 1) {
+        attributes[1 + i].location = 1 + i;
+        attributes[1 + i].binding  = 1;
+        attributes[1 + i].offset   = as<uint32_t>(offsetof(InstanceData, transform) +
+                                                  i * sizeof(glm::vec4));
+        attributes[1 + i].format   = VK_FORMAT_R32G32B32A32_SFLOAT;
+    }
+    attributes[5].location = 5;
+    attributes[5].binding  = 1;
+    attributes[5].offset   = as<uint32_t>(offsetof(InstanceData, materialIndex));
+    attributes[5].format   = VK_FORMAT_R32_UINT;
+
+    VkPipelineVertexInputStateCreateInfo vertexInput = {};
+    vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertexInput.vertexBindingDescriptionCount   = array_size(bindings);
+    vertexInput.pVertexBindingDescriptions      = bindings;
+    vertexInput.vertexAttributeDescriptionCount =
+        depthOnly ? 5 : array_size(attributes);
+    vertexInput.pVertexAttributeDescriptions    = attributes;
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+    // Viewport and scissor are dynamic, so resizing doesn't need new variants.
+    VkPipelineViewportStateCreateInfo viewport = {};
+    viewport.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewport.viewportCount = 1;
+    viewport.scissorCount  = 1;
+
+    VkPipelineRasterizationStateCreateInfo raster = {};
+    raster.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    raster.polygonMode = VK_POLYGON_MODE_FILL;
+    raster.cullMode    = VK_CULL_MODE_NONE;
+    raster.frontFace   = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    raster.lineWidth   = 1.f;
+
+    // Every render pass is single sampled.
+    VkPipelineMultisampleStateCreateInfo multisample = {};
+    multisample.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencil.depthTestEnable  = VK_TRUE;
+    depthStencil.depthWriteEnable = key.depthEqual ? VK_FALSE : VK_TRUE;
+    depthStencil.depthCompareOp   = key.depthEqual ? VK_COMPARE_OP_EQUAL
+                                                   : VK_COMPARE_OP_LESS;
+
+    VkPipelineColorBlendAttachmentState blendAttachment = {};
+    blendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT |
+                                     VK_COLOR_COMPONENT_G_BIT |
+                                     VK_COLOR_COMPONENT_B_BIT |
+                                     VK_COLOR_COMPONENT_A_BIT;
+
+    VkPipelineColorBlendStateCreateInfo blend = {};
+    blend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    blend.attachmentCount = depthOnly ? 0 : 1;
+    blend.pAttachments    = &blendAttachment;
+
+    VkDynamicState dynamicStates[] = {
+        VK_DYNAMIC_STATE_VIEWPORT,
+        VK_DYNAMIC_STATE_SCISSOR,
+    };
+    VkPipelineDynamicStateCreateInfo dynamic = {};
+    dynamic.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamic.dynamicStateCount = array_size(dynamicStates);
+    dynamic.pDynamicStates    = dynamicStates;
+
+    // ---- Pipeline ----------------------------------------------------------
+    VkGraphicsPipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.stageCount          = stageCount;
+    pipelineInfo.pStages             = stages;
+    pipelineInfo.pVertexInputState   = &vertexInput;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState      = &viewport;
+    pipelineInfo.pRasterizationState = &raster;
+    pipelineInfo.pMultisampleState   = &multisample;
+    pipelineInfo.pDepthStencilState  = &depthStencil;
+    pipelineInfo.pColorBlendState    = &blend;
+    pipelineInfo.pDynamicState       = &dynamic;
+    pipelineInfo.layout              = m_info.layout;
+    pipelineInfo.renderPass          = m_info.renderPass;
+    pipelineInfo.subpass             = m_info.subpass;
+
+    // The cache is internally synchronized, so every worker can share it.
+    return vkCreateGraphicsPipelines(m_info.device,
+                                     m_info.cache,
+                                     1,
+                                     &pipelineInfo,
+                                     m_info.pAlloc,
+                                     pPipeline);
+}
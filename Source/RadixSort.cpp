@@ -0,0 +1,110 @@
+#include "RadixSort.hpp"
+#include "JobPool.hpp"
+
+#include <algorithm>
+
+static constexpr uint32_t kDigitBits    = 8;
+static constexpr uint32_t kDigitCount   = 1u << kDigitBits;
+static constexpr uint64_t kDigitMask    = kDigitCount - 1;
+// Below this many keys a chunk, splitting costs more than it saves.
+static constexpr uint32_t kMinChunkKeys = 16 * 1024;
+
+void radixSort(uint64_t*         pKeys,
+               uint32_t*         pValues,
+               uint32_t          count,
+               RadixSortScratch* pScratch,
+               JobPool*          pJobs)
+{
+    if (count < 2) {
+        return;
+    }
+
+    RadixSortScratch& scratch = *pScratch;
+    if (scratch.keys.size() < count) {
+        scratch.keys.resize(count);
+        scratch.values.resize(count);
+    }
+
+    // Bits that are the same in every key can't change the order.
+    uint64_t anySet = 0;
+    uint64_t allSet = ~0ull;
+    for (uint32_t i = 0; i < count; i += 1) {
+        anySet |= pKeys[i];
+        allSet &= pKeys[i];
+    }
+    uint64_t varying = anySet ^ allSet;
+
+    uint32_t chunkCount = 1;
+    if (pJobs != nullptr) {
+        chunkCount = std::min(std::max(count / kMinChunkKeys, 1u),
+                              pJobs->threadCount() + 1);
+    }
+    uint32_t chunkSize = (count + chunkCount - 1) / chunkCount;
+    scratch.counts.resize(chunkCount * kDigitCount);
+
+    auto forEachChunk = [&](auto const& fn) {
+        if (chunkCount == 1) {
+            fn(0u);
+            return;
+        }
+        pJobs->parallelFor(chunkCount, 1, [&fn](uint32_t begin, uint32_t end) {
+            for (uint32_t chunk = begin; chunk < end; chunk += 1) {
+                fn(chunk);
+            }
+        });
+    };
+
+    uint64_t* pSrcKeys   = pKeys;
+    uint32_t* pSrcValues = pValues;
+    uint64_t* pDstKeys   = scratch.keys.data();
+    uint32_t* pDstValues = scratch.values.data();
+    uint32_t* pCounts    = scratch.counts.data();
+
+    for (uint32_t shift = 0; shift < 64; shift += kDigitBits) {
+        if (((varying >> shift) & kDigitMask) == 0) {
+            continue;
+        }
+
+        forEachChunk([&](uint32_t chunk) {
+            uint32_t* pChunkCounts = pCounts + chunk * kDigitCount;
+            std::fill(pChunkCounts, pChunkCounts + kDigitCount, 0u);
+            uint32_t begin = chunk * chunkSize;
+            uint32_t end   = std::min(begin + chunkSize, count);
+            for (uint32_t i = begin; i < end; i += 1) {
+                pChunkCounts[(pSrcKeys[i] >> shift) & kDigitMask] += 1;
+            }
+        });
+
+        // Counts become where each chunk's run of each digit starts. Digit
+        // by digit, then chunk by chunk, so equal digits keep their order.
+        uint32_t offset = 0;
+        for (uint32_t digit = 0; digit < kDigitCount; digit += 1) {
+            for (uint32_t chunk = 0; chunk < chunkCount; chunk += 1) {
+                uint32_t& slot = pCounts[chunk * kDigitCount + digit];
+                uint32_t  n    = slot;
+                slot    = offset;
+                offset += n;
+            }
+        }
+
+        forEachChunk([&](uint32_t chunk) {
+            uint32_t* pOffsets = pCounts + chunk * kDigitCount;
+            uint32_t  begin    = chunk * chunkSize;
+            uint32_t  end      = std::min(begin + chunkSize, count);
+            for (uint32_t i = begin; i < end; i += 1) {
+                uint32_t to = pOffsets[(pSrcKeys[i] >> shift) & kDigitMask]++;
+                pDstKeys[to]   = pSrcKeys[i];
+                pDstValues[to] = pSrcValues[i];
+            }
+        });
+
+        std::swap(pSrcKeys,   pDstKeys);
+        std::swap(pSrcValues, pDstValues);
+    }
+
+    // An odd number of passes left the result in the scratch.
+    if (pSrcKeys != pKeys) {
+        std::copy(pSrcKeys,   pSrcKeys + count,   pKeys);
+        std::copy(pSrcValues, pSrcValues + count, pValues);
+    }
+}
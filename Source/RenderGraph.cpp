@@ -0,0 +1,1047 @@
+#include "RenderGraph.hpp"
+#include "VkMemory.hpp"
+
+#include <algorithm>
+
+// ==== Usages ==================================================================
+
+struct RgUsageInfo
+{
+    VkImageLayout           layout;
+    VkPipelineStageFlags    stages;
+    VkAccessFlags           access;
+    VkImageUsageFlags       imageUsage;
+    bool                    write;
+};
+
+static constexpr VkPipelineStageFlags kDepthStages =
+    VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+    VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+
+// Indexed by RgUsage.
+static RgUsageInfo const kUsageInfos[] = {
+    // ColorAttachment
+    { VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+      true },
+    // DepthAttachment
+    { VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+      kDepthStages,
+      VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+      VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+      VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+      true },
+    // DepthAttachmentRead
+    { VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+      kDepthStages,
+      VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+      VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+      false },
+    // SampledFragment
+    { VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+      VK_ACCESS_SHADER_READ_BIT,
+      VK_IMAGE_USAGE_SAMPLED_BIT,
+      false },
+    // SampledCompute
+    { VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_ACCESS_SHADER_READ_BIT,
+      VK_IMAGE_USAGE_SAMPLED_BIT,
+      false },
+    // StorageReadCompute
+    { VK_IMAGE_LAYOUT_GENERAL,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_ACCESS_SHADER_READ_BIT,
+      VK_IMAGE_USAGE_STORAGE_BIT,
+      false },
+    // StorageWriteCompute
+    { VK_IMAGE_LAYOUT_GENERAL,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+      VK_IMAGE_USAGE_STORAGE_BIT,
+      true },
+    // TransferSrc
+    { VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_ACCESS_TRANSFER_READ_BIT,
+      VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+      false },
+    // TransferDst
+    { VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+      true },
+};
+static_assert(array_size(kUsageInfos) == static_cast<uint32_t>(RgUsage::Count),
+              "kUsageInfos is missing an RgUsage");
+
+// Only writes need to be made available. Reads just need to be waited on.
+static constexpr VkAccessFlags kWriteAccess =
+    VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT         |
+    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_SHADER_WRITE_BIT                   |
+    VK_ACCESS_TRANSFER_WRITE_BIT;
+
+static RgUsageInfo const& usageInfo(RgUsage usage)
+{
+    return kUsageInfos[as<uint32_t>(usage)];
+}
+
+static bool isAttachment(RgUsage usage)
+{
+    return usage == RgUsage::ColorAttachment ||
+           usage == RgUsage::DepthAttachment ||
+           usage == RgUsage::DepthAttachmentRead;
+}
+
+// Whether the access depends on the image's previous contents.
+static bool readsPrevious(RgUsage usage, RgLoadOp loadOp)
+{
+    return !usageInfo(usage).write || loadOp == RgLoadOp::Load;
+}
+
+static VkImageAspectFlags aspectOf(VkFormat format)
+{
+    switch (format) {
+        case VK_FORMAT_D16_UNORM:
+        case VK_FORMAT_X8_D24_UNORM_PACK32:
+        case VK_FORMAT_D32_SFLOAT:
+            return VK_IMAGE_ASPECT_DEPTH_BIT;
+        case VK_FORMAT_D16_UNORM_S8_UINT:
+        case VK_FORMAT_D24_UNORM_S8_UINT:
+        case VK_FORMAT_D32_SFLOAT_S8_UINT:
+            return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+        case VK_FORMAT_S8_UINT:
+            return VK_IMAGE_ASPECT_STENCIL_BIT;
+        default:
+            return VK_IMAGE_ASPECT_COLOR_BIT;
+    }
+}
+
+static VkAttachmentLoadOp toVk(RgLoadOp loadOp)
+{
+    switch (loadOp) {
+        case RgLoadOp::Load:     return VK_ATTACHMENT_LOAD_OP_LOAD;
+        case RgLoadOp::Clear:    return VK_ATTACHMENT_LOAD_OP_CLEAR;
+        case RgLoadOp::DontCare: return VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    }
+    return VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+}
+
+// ==== Formats =================================================================
+
+VkFormat chooseDepthFormat(VkPhysicalDevice physicalDevice,
+                           DepthPrecision   precision)
+{
+    struct Candidate
+    {
+        VkFormat    format;
+        const char* pName;
+    };
+    static constexpr Candidate kD16 = { VK_FORMAT_D16_UNORM,
+                                        "D16_UNORM" };
+    static constexpr Candidate kD24 = { VK_FORMAT_X8_D24_UNORM_PACK32,
+                                        "X8_D24_UNORM_PACK32" };
+    static constexpr Candidate kD32 = { VK_FORMAT_D32_SFLOAT,
+                                        "D32_SFLOAT" };
+
+    // Indexed by DepthPrecision.
+    static constexpr Candidate kCandidates[3][3] = {
+        { kD16, kD24, kD32 },   // Bandwidth
+        { kD24, kD32, kD16 },   // Balanced
+        { kD32, kD24, kD16 },   // Precision
+    };
+    Candidate const (&candidates)[3] = kCandidates[as<uint32_t>(precision)];
+
+    for (auto const& candidate : candidates) {
+        VkFormatProperties properties = {};
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, candidate.format,
+                                            &properties);
+        if ((properties.optimalTilingFeatures &
+             VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) != 0) {
+            Info("Depth format: %s", candidate.pName);
+            return candidate.format;
+        }
+        Verbose("Depth format %s isn't supported", candidate.pName);
+    }
+
+    // The spec requires D16, and one of D24 or D32.
+    Bug("No depth format is supported as an attachment");
+    return VK_FORMAT_D16_UNORM;
+}
+
+// ==== RgPass ==================================================================
+
+RgPass& RgPass::color(RgImage image, RgLoadOp loadOp, VkClearColorValue clearValue)
+{
+    Access access;
+    access.image            = image;
+    access.usage            = RgUsage::ColorAttachment;
+    access.loadOp           = loadOp;
+    access.clearValue.color = clearValue;
+    m_accesses.push_back(access);
+    return *this;
+}
+
+RgPass& RgPass::depth(RgImage                  image,
+                      RgLoadOp                 loadOp,
+                      VkClearDepthStencilValue clearValue,
+                      bool                     write)
+{
+    AssertMsg(write || loadOp == RgLoadOp::Load,
+              "'%s' can't clear a depth buffer it doesn't write",
+              m_name.c_str());
+
+    Access access;
+    access.image                   = image;
+    access.usage                   = write ? RgUsage::DepthAttachment
+                                           : RgUsage::DepthAttachmentRead;
+    access.loadOp                  = loadOp;
+    access.clearValue.depthStencil = clearValue;
+    m_accesses.push_back(access);
+    return *this;
+}
+
+RgPass& RgPass::read(RgImage image, RgUsage usage)
+{
+    AssertMsg(!usageInfo(usage).write, "'%s' reads with a write usage",
+              m_name.c_str());
+
+    Access access;
+    access.image  = image;
+    access.usage  = usage;
+    access.loadOp = RgLoadOp::Load;
+    m_accesses.push_back(access);
+    return *this;
+}
+
+RgPass& RgPass::write(RgImage image, RgUsage usage, RgLoadOp loadOp)
+{
+    AssertMsg(usageInfo(usage).write, "'%s' writes with a read usage",
+              m_name.c_str());
+    AssertMsg(!isAttachment(usage), "Use color() or depth() for attachments");
+
+    Access access;
+    access.image  = image;
+    access.usage  = usage;
+    access.loadOp = loadOp;
+    m_accesses.push_back(access);
+    return *this;
+}
+
+RgPass& RgPass::sideEffects()
+{
+    m_sideEffects = true;
+    return *this;
+}
+
+RgPass& RgPass::execute(RgExecuteFn fn)
+{
+    m_execute = std::move(fn);
+    return *this;
+}
+
+// ==== RenderGraph =============================================================
+
+RenderGraph::~RenderGraph()
+{
+    deInit();
+}
+
+void RenderGraph::init(RenderGraphInfo const& info)
+{
+    Assert(info.device != nullptr);
+    m_info = info;
+}
+
+void RenderGraph::deInit()
+{
+    if (m_info.device == nullptr) {
+        return;
+    }
+
+    for (auto const& entry : m_framebuffers) {
+        vkDestroyFramebuffer(m_info.device, entry.second, m_info.pAlloc);
+    }
+    m_framebuffers.clear();
+
+    for (auto const& pPass : m_passes) {
+        vkDestroyRenderPass(m_info.device, pPass->m_vkRenderPass,
+                            m_info.pAlloc);
+    }
+    m_passes.clear();
+
+    for (Image const& image : m_images) {
+        if (image.imported) {
+            continue;
+        }
+        vkDestroyImageView(m_info.device, image.vkView, m_info.pAlloc);
+        vkDestroyImageView(m_info.device, image.vkSampledView, m_info.pAlloc);
+        vkDestroyImage(m_info.device, image.vkImage, m_info.pAlloc);
+    }
+    m_images.clear();
+
+    for (MemoryBlock const& block : m_blocks) {
+        vkFreeMemory(m_info.device, block.memory, m_info.pAlloc);
+    }
+    m_blocks.clear();
+
+    m_finalBarriers.clear();
+    m_culledPasses   = 0;
+    m_unaliasedBytes = 0;
+    m_aliasedBytes   = 0;
+    m_lazyBytes      = 0;
+}
+
+RgImage RenderGraph::createImage(const char* pName, RgImageDesc const& desc)
+{
+    RgImage handle;
+    handle.index = as<uint32_t>(m_images.size());
+
+    m_images.emplace_back();
+    m_images.back().name = pName;
+    m_images.back().desc = desc;
+    return handle;
+}
+
+RgImage RenderGraph::importImage(const char*         pName,
+                                 RgImageDesc const&  desc,
+                                 RgImportInfo const& importInfo)
+{
+    RgImage handle = createImage(pName, desc);
+    m_images.back().imported   = true;
+    m_images.back().importInfo = importInfo;
+    return handle;
+}
+
+RgPass& RenderGraph::addPass(const char* pName)
+{
+    m_passes.push_back(std::make_unique<RgPass>());
+    m_passes.back()->m_name = pName;
+    return *m_passes.back();
+}
+
+VkResult RenderGraph::compile()
+{
+    VkResult result = VK_SUCCESS;
+
+    for (auto const& pPass : m_passes) {
+        for (size_t i = 0; i < pPass->m_accesses.size(); i += 1) {
+            RgImage image = pPass->m_accesses[i].image;
+            AssertMsg(image.index < m_images.size(),
+                      "'%s' uses an image from another graph",
+                      pPass->m_name.c_str());
+            for (size_t j = 0; j < i; j += 1) {
+                AssertMsg(pPass->m_accesses[j].image.index != image.index,
+                          "'%s' uses '%s' twice",
+                          pPass->m_name.c_str(),
+                          m_images[image.index].name.c_str());
+            }
+        }
+    }
+
+    cullPasses();
+
+    result = createTransientImages();
+    AssertVk(result);
+
+    computeBarriers();
+
+    for (auto const& pPass : m_passes) {
+        if (pPass->m_live) {
+            result = createRenderPass(pPass.get());
+            AssertVk(result);
+        }
+    }
+
+    logStats();
+
+    return result;
+}
+
+void RenderGraph::setImportedImage(RgImage image, VkImage vkImage,
+                                   VkImageView vkView)
+{
+    Assert(image.index < m_images.size());
+    Assert(m_images[image.index].imported);
+    m_images[image.index].vkImage = vkImage;
+    m_images[image.index].vkView  = vkView;
+}
+
+void RenderGraph::execute(VkCommandBuffer cmd)
+{
+    std::vector<VkImageMemoryBarrier> vkBarriers;
+
+    auto emitBarriers = [&](std::vector<RgPass::Barrier> const& barriers,
+                            VkPipelineStageFlags                srcStages,
+                            VkPipelineStageFlags                dstStages) {
+        if (barriers.empty()) {
+            return;
+        }
+        vkBarriers.clear();
+        for (RgPass::Barrier const& barrier : barriers) {
+            Image const& image = m_images[barrier.image];
+            AssertMsg(image.vkImage != nullptr,
+                      "'%s' was never given an image", image.name.c_str());
+
+            VkImageMemoryBarrier vkBarrier = {};
+            vkBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            vkBarrier.srcAccessMask       = barrier.srcAccess;
+            vkBarrier.dstAccessMask       = barrier.dstAccess;
+            vkBarrier.oldLayout           = barrier.oldLayout;
+            vkBarrier.newLayout           = barrier.newLayout;
+            vkBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            vkBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            vkBarrier.image               = image.vkImage;
+            vkBarrier.subresourceRange.aspectMask = aspectOf(image.desc.format);
+            vkBarrier.subresourceRange.levelCount = 1;
+            vkBarrier.subresourceRange.layerCount = 1;
+            vkBarriers.push_back(vkBarrier);
+        }
+        vkCmdPipelineBarrier(cmd, srcStages, dstStages, 0,
+                             0, nullptr,
+                             0, nullptr,
+                             as<uint32_t>(vkBarriers.size()), vkBarriers.data());
+    };
+
+    for (auto const& pPass : m_passes) {
+        RgPass const& pass = *pPass;
+        if (!pass.m_live) {
+            continue;
+        }
+
+        emitBarriers(pass.m_barriers, pass.m_srcStages, pass.m_dstStages);
+
+        RgPassContext context;
+        context.cmd        = cmd;
+        context.renderPass = pass.m_vkRenderPass;
+        context.extent     = pass.m_extent;
+        context.pGraph     = this;
+
+        if (pass.m_vkRenderPass == nullptr) {
+            if (pass.m_execute) {
+                pass.m_execute(context);
+            }
+            continue;
+        }
+
+        VkRenderPassBeginInfo passInfo = {};
+        passInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        passInfo.renderPass        = pass.m_vkRenderPass;
+        passInfo.framebuffer       = getFramebuffer(pass);
+        passInfo.renderArea.extent = pass.m_extent;
+        passInfo.clearValueCount   = as<uint32_t>(pass.m_clearValues.size());
+        passInfo.pClearValues      = pass.m_clearValues.data();
+
+        vkCmdBeginRenderPass(cmd, &passInfo, VK_SUBPASS_CONTENTS_INLINE);
+        if (pass.m_execute) {
+            pass.m_execute(context);
+        }
+        vkCmdEndRenderPass(cmd);
+    }
+
+    emitBarriers(m_finalBarriers, m_finalSrcStages, m_finalDstStages);
+}
+
+VkRenderPass RenderGraph::renderPass(RgPass const& pass) const
+{
+    return pass.m_vkRenderPass;
+}
+
+uint64_t RenderGraph::renderPassClass(RgPass const& pass) const
+{
+    return pass.m_renderPassClass;
+}
+
+VkImageView RenderGraph::imageView(RgImage image) const
+{
+    Assert(image.index < m_images.size());
+    return m_images[image.index].vkView;
+}
+
+VkImageView RenderGraph::sampledView(RgImage image) const
+{
+    Assert(image.index < m_images.size());
+    Image const& graphImage = m_images[image.index];
+    return graphImage.vkSampledView != nullptr ? graphImage.vkSampledView
+                                               : graphImage.vkView;
+}
+
+VkImage RenderGraph::image(RgImage image) const
+{
+    Assert(image.index < m_images.size());
+    return m_images[image.index].vkImage;
+}
+
+void RenderGraph::logStats() const
+{
+    uint32_t transientCount = 0;
+    for (Image const& image : m_images) {
+        if (!image.imported && image.vkImage != nullptr) {
+            transientCount += 1;
+        }
+    }
+
+    Info("Render graph: %zu passes (%u culled), "
+         "%u transient images in %zu memory blocks, "
+         "%llu KiB instead of %llu KiB",
+         m_passes.size(), m_culledPasses,
+         transientCount, m_blocks.size(),
+         as<unsigned long long>(m_aliasedBytes / 1024),
+         as<unsigned long long>(m_unaliasedBytes / 1024));
+
+    if (m_lazyBytes == 0) {
+        return;
+    }
+    VkDeviceSize committedBytes = 0;
+    for (MemoryBlock const& block : m_blocks) {
+        if (block.lazy) {
+            VkDeviceSize committed = 0;
+            vkGetDeviceMemoryCommitment(m_info.device, block.memory,
+                                        &committed);
+            committedBytes += committed;
+        }
+    }
+    Info("Render graph: %llu KiB of that is lazily allocated, "
+         "%llu KiB committed",
+         as<unsigned long long>(m_lazyBytes / 1024),
+         as<unsigned long long>(committedBytes / 1024));
+}
+
+// Walks back from the outputs. A pass is live if something live needs what it
+// writes. Whatever a live pass reads is needed in turn, and whatever it
+// overwrites entirely isn't needed from anyone before it.
+void RenderGraph::cullPasses()
+{
+    std::vector<bool> needed(m_images.size(), false);
+    for (size_t i = 0; i < m_images.size(); i += 1) {
+        needed[i] = m_images[i].imported;
+    }
+
+    m_culledPasses = 0;
+    for (size_t i = m_passes.size(); i > 0; i -= 1) {
+        RgPass& pass = *m_passes[i - 1];
+
+        pass.m_live = pass.m_sideEffects;
+        for (RgPass::Access const& access : pass.m_accesses) {
+            if (usageInfo(access.usage).write && needed[access.image.index]) {
+                pass.m_live = true;
+            }
+        }
+        if (!pass.m_live) {
+            Verbose("Render graph: culled '%s'", pass.m_name.c_str());
+            m_culledPasses += 1;
+            continue;
+        }
+
+        for (RgPass::Access const& access : pass.m_accesses) {
+            if (!readsPrevious(access.usage, access.loadOp)) {
+                needed[access.image.index] = false;
+            }
+        }
+        for (RgPass::Access const& access : pass.m_accesses) {
+            if (readsPrevious(access.usage, access.loadOp)) {
+                needed[access.image.index] = true;
+            }
+        }
+    }
+}
+
+VkResult RenderGraph::createTransientImages()
+{
+    VkResult result = VK_SUCCESS;
+
+    // Lifetimes, and everything each image gets used for.
+    std::vector<bool> firstUseReads(m_images.size(), false);
+    for (uint32_t p = 0; p < m_passes.size(); p += 1) {
+        RgPass const& pass = *m_passes[p];
+        if (!pass.m_live) {
+            continue;
+        }
+        for (RgPass::Access const& access : pass.m_accesses) {
+            Image& image = m_images[access.image.index];
+            if (image.firstPass == UINT32_MAX) {
+                image.firstPass = p;
+                firstUseReads[access.image.index] =
+                    readsPrevious(access.usage, access.loadOp);
+                if (!image.imported &&
+                    readsPrevious(access.usage, access.loadOp)) {
+                    Bug("Render graph: '%s' reads '%s' before anything "
+                        "writes it",
+                        pass.m_name.c_str(), image.name.c_str());
+                }
+            }
+            image.lastPass        = p;
+            image.usage          |= usageInfo(access.usage).imageUsage;
+            image.attachmentOnly  = image.attachmentOnly &&
+                                    isAttachment(access.usage);
+        }
+    }
+
+    std::vector<uint32_t> transients;
+    for (uint32_t i = 0; i < m_images.size(); i += 1) {
+        Image& image = m_images[i];
+        if (image.imported || image.firstPass == UINT32_MAX) {
+            continue;
+        }
+
+        // Never loaded, never stored, so it only ever has to exist in tile
+        // memory.
+        image.lazy = image.attachmentOnly &&
+                     image.firstPass == image.lastPass &&
+                     !firstUseReads[i];
+        if (image.lazy) {
+            image.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+        }
+
+        VkImageCreateInfo imageInfo = {};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType     = VK_IMAGE_TYPE_2D;
+        imageInfo.format        = image.desc.format;
+        imageInfo.extent        = { image.desc.extent.width,
+                                    image.desc.extent.height, 1 };
+        imageInfo.mipLevels     = 1;
+        imageInfo.arrayLayers   = 1;
+        imageInfo.samples       = image.desc.samples;
+        imageInfo.tiling        = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage         = image.usage;
+        imageInfo.sharingMode   = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        result = vkCreateImage(m_info.device, &imageInfo, m_info.pAlloc,
+                               &image.vkImage);
+        AssertVk(result);
+
+        vkGetImageMemoryRequirements(m_info.device, image.vkImage,
+                                     &image.memReq);
+        m_unaliasedBytes += image.memReq.size;
+        transients.push_back(i);
+    }
+
+    // Biggest first, so smaller images fill in behind them. Each image goes
+    // into the first block that it's memory type compatible with, and that
+    // nothing alive at the same time is using.
+    std::sort(transients.begin(), transients.end(),
+        [&](uint32_t lhs, uint32_t rhs) {
+            return m_images[lhs].memReq.size > m_images[rhs].memReq.size;
+        });
+
+    for (uint32_t index : transients) {
+        Image& image = m_images[index];
+
+        for (uint32_t b = 0; b < m_blocks.size(); b += 1) {
+            MemoryBlock& block = m_blocks[b];
+            if (block.lazy != image.lazy ||
+                (block.memoryTypeBits & image.memReq.memoryTypeBits) == 0) {
+                continue;
+            }
+
+            bool overlaps = false;
+            for (uint32_t other : block.images) {
+                Image const& otherImage = m_images[other];
+                if (image.firstPass <= otherImage.lastPass &&
+                    otherImage.firstPass <= image.lastPass) {
+                    overlaps = true;
+                    break;
+                }
+            }
+            if (!overlaps) {
+                image.memoryBlock = b;
+                break;
+            }
+        }
+
+        if (image.memoryBlock == UINT32_MAX) {
+            image.memoryBlock = as<uint32_t>(m_blocks.size());
+            m_blocks.emplace_back();
+            m_blocks.back().memoryTypeBits = image.memReq.memoryTypeBits;
+            m_blocks.back().lazy           = image.lazy;
+        }
+
+        MemoryBlock& block = m_blocks[image.memoryBlock];
+        block.size            = std::max(block.size, image.memReq.size);
+        block.memoryTypeBits &= image.memReq.memoryTypeBits;
+        block.images.push_back(index);
+    }
+
+    for (MemoryBlock& block : m_blocks) {
+        auto const& memoryProperties = m_info.memoryProperties;
+        uint32_t    memoryType       = VK_MAX_MEMORY_TYPES;
+        if (block.lazy) {
+            memoryType = findMemoryType(memoryProperties, block.memoryTypeBits,
+                                        VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+            if (memoryType == VK_MAX_MEMORY_TYPES) {
+                Verbose("Render graph: no lazily allocated memory, "
+                        "transient attachments use device local memory");
+                block.lazy = false;
+            }
+        }
+        if (memoryType == VK_MAX_MEMORY_TYPES) {
+            memoryType = findMemoryType(memoryProperties, block.memoryTypeBits,
+                                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        }
+        if (memoryType == VK_MAX_MEMORY_TYPES) {
+            memoryType = findMemoryType(memoryProperties, block.memoryTypeBits,
+                                        0);
+        }
+        AssertMsg(memoryType != VK_MAX_MEMORY_TYPES,
+                  "Couldn't find a memory type for transient images");
+
+        VkMemoryAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize  = block.size;
+        allocInfo.memoryTypeIndex = memoryType;
+
+        result = vkAllocateMemory(m_info.device, &allocInfo, m_info.pAlloc,
+                                  &block.memory);
+        AssertVk(result);
+        m_aliasedBytes += block.size;
+        if (block.lazy) {
+            m_lazyBytes += block.size;
+        }
+
+        for (uint32_t index : block.images) {
+            Image& image = m_images[index];
+
+            result = vkBindImageMemory(m_info.device, image.vkImage,
+                                       block.memory, 0);
+            AssertVk(result);
+
+            VkImageViewCreateInfo viewInfo = {};
+            viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            viewInfo.image    = image.vkImage;
+            viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            viewInfo.format   = image.desc.format;
+            viewInfo.subresourceRange.aspectMask = aspectOf(image.desc.format);
+            viewInfo.subresourceRange.levelCount = 1;
+            viewInfo.subresourceRange.layerCount = 1;
+
+            result = vkCreateImageView(m_info.device, &viewInfo, m_info.pAlloc,
+                                       &image.vkView);
+            AssertVk(result);
+
+            // Shaders can only read one aspect at a time. Depth is the one
+            // anybody wants.
+            VkImageUsageFlags shaderUsage = VK_IMAGE_USAGE_SAMPLED_BIT |
+                                            VK_IMAGE_USAGE_STORAGE_BIT;
+            if ((image.usage & shaderUsage) != 0 &&
+                viewInfo.subresourceRange.aspectMask ==
+                    (VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT)) {
+                viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+                result = vkCreateImageView(m_info.device, &viewInfo,
+                                           m_info.pAlloc, &image.vkSampledView);
+                AssertVk(result);
+            }
+        }
+
+        if (block.images.size() > 1) {
+            std::string names;
+            for (uint32_t index : block.images) {
+                names.append(" '");
+                names.append(m_images[index].name);
+                names.append("'");
+            }
+            Verbose("Render graph: aliased%s (%llu KiB)",
+                    names.c_str(), as<unsigned long long>(block.size / 1024));
+        }
+    }
+
+    // Anything that used a block, this frame or the last one, has to finish
+    // before the next image in it gets its contents thrown away.
+    for (auto const& pPass : m_passes) {
+        if (!pPass->m_live) {
+            continue;
+        }
+        for (RgPass::Access const& access : pPass->m_accesses) {
+            Image const& image = m_images[access.image.index];
+            if (image.memoryBlock == UINT32_MAX) {
+                continue;
+            }
+            RgUsageInfo const& info = usageInfo(access.usage);
+            MemoryBlock& block = m_blocks[image.memoryBlock];
+            block.lastStages |= info.stages;
+            block.lastAccess |= info.access & kWriteAccess;
+        }
+    }
+
+    return result;
+}
+
+// Tracks what each image was last used for, and emits a barrier only when the
+// next use actually needs one: layout changes, anything after a write that
+// isn't visible yet, and writes after reads.
+void RenderGraph::computeBarriers()
+{
+    struct State
+    {
+        VkImageLayout           layout          = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkPipelineStageFlags    writeStages     = 0;
+        VkAccessFlags           writeAccess     = 0;
+        VkPipelineStageFlags    readStages      = 0;    // Since the last write
+        VkPipelineStageFlags    visibleStages   = 0;    // Can see the last write
+    };
+
+    std::vector<State> states(m_images.size());
+    for (size_t i = 0; i < m_images.size(); i += 1) {
+        Image const& image = m_images[i];
+        State&       state = states[i];
+        if (image.imported) {
+            state.layout      = image.importInfo.initialLayout;
+            state.writeStages = image.importInfo.initialStages;
+            state.writeAccess = image.importInfo.initialAccess;
+        } else if (image.memoryBlock != UINT32_MAX) {
+            state.writeStages = m_blocks[image.memoryBlock].lastStages;
+            state.writeAccess = m_blocks[image.memoryBlock].lastAccess;
+        }
+    }
+
+    auto srcStagesOf = [](State const& state) {
+        VkPipelineStageFlags stages = state.writeStages | state.readStages;
+        return stages != 0 ? stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    };
+
+    for (auto const& pPass : m_passes) {
+        RgPass& pass = *pPass;
+        if (!pass.m_live) {
+            continue;
+        }
+        pass.m_barriers.clear();
+        pass.m_srcStages = 0;
+        pass.m_dstStages = 0;
+
+        for (RgPass::Access const& access : pass.m_accesses) {
+            RgUsageInfo const& info  = usageInfo(access.usage);
+            State&             state = states[access.image.index];
+            bool               keep  = readsPrevious(access.usage,
+                                                     access.loadOp);
+
+            RgPass::Barrier barrier;
+            barrier.image     = access.image.index;
+            barrier.oldLayout = keep ? state.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+            barrier.newLayout = info.layout;
+            barrier.dstAccess = info.access;
+
+            if (!info.write) {
+                bool sameLayout = state.layout == info.layout;
+                bool canSee     = state.writeStages == 0 ||
+                                  (info.stages & ~state.visibleStages) == 0;
+                if (sameLayout && canSee) {
+                    state.readStages |= info.stages;
+                    continue;
+                }
+
+                // A layout change is a write of its own, that anyone after
+                // has to wait on.
+                VkPipelineStageFlags srcStages =
+                    sameLayout ? state.writeStages : srcStagesOf(state);
+                barrier.srcAccess = state.writeAccess;
+                pass.m_srcStages |= srcStages != 0
+                                    ? srcStages
+                                    : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+                pass.m_dstStages |= info.stages;
+
+                if (!sameLayout) {
+                    state.writeStages   = info.stages;
+                    state.visibleStages = 0;
+                    state.readStages    = 0;
+                }
+                state.layout         = info.layout;
+                state.readStages    |= info.stages;
+                state.visibleStages |= info.stages;
+            } else {
+                // Writes always wait, on earlier writes and earlier reads.
+                barrier.srcAccess = state.writeAccess;
+                pass.m_srcStages |= srcStagesOf(state);
+                pass.m_dstStages |= info.stages;
+
+                state.layout        = info.layout;
+                state.writeStages   = info.stages;
+                state.writeAccess   = info.access & kWriteAccess;
+                state.readStages    = 0;
+                state.visibleStages = info.stages;
+            }
+            pass.m_barriers.push_back(barrier);
+        }
+    }
+
+    // Hand imported images back the way they're expected.
+    m_finalBarriers.clear();
+    m_finalSrcStages = 0;
+    m_finalDstStages = 0;
+    for (size_t i = 0; i < m_images.size(); i += 1) {
+        Image const& image = m_images[i];
+        State const& state = states[i];
+        if (!image.imported ||
+            image.importInfo.finalLayout == VK_IMAGE_LAYOUT_UNDEFINED ||
+            image.importInfo.finalLayout == state.layout) {
+            continue;
+        }
+
+        RgPass::Barrier barrier;
+        barrier.image     = as<uint32_t>(i);
+        barrier.oldLayout = state.layout;
+        barrier.newLayout = image.importInfo.finalLayout;
+        barrier.srcAccess = state.writeAccess;
+        barrier.dstAccess = image.importInfo.finalAccess;
+        m_finalBarriers.push_back(barrier);
+
+        m_finalSrcStages |= srcStagesOf(state);
+        m_finalDstStages |= image.importInfo.finalStages;
+    }
+}
+
+// Attachments stay in the layout the barriers put them in, so the render pass
+// itself never transitions anything. It only decides what gets loaded and
+// stored.
+VkResult RenderGraph::createRenderPass(RgPass* pPass)
+{
+    VkResult result = VK_SUCCESS;
+    RgPass&  pass   = *pPass;
+
+    uint32_t passIndex = 0;
+    while (m_passes[passIndex].get() != pPass) {
+        passIndex += 1;
+    }
+
+    std::vector<VkAttachmentDescription> attachmentDescs;
+    std::vector<VkAttachmentReference>   colorRefs;
+    VkAttachmentReference                depthRef   = {};
+    bool                                 hasDepth   = false;
+
+    pass.m_attachments.clear();
+    pass.m_clearValues.clear();
+
+    // Colors first, then depth. Pipelines only care about the order of the
+    // colors, so that's the order they were declared in.
+    for (uint32_t depthPass = 0; depthPass < 2; depthPass += 1) {
+        for (RgPass::Access const& access : pass.m_accesses) {
+            if (!isAttachment(access.usage) ||
+                (access.usage == RgUsage::ColorAttachment) == (depthPass == 1)) {
+                continue;
+            }
+            Image const& image = m_images[access.image.index];
+
+            if (pass.m_attachments.empty()) {
+                pass.m_extent = image.desc.extent;
+            }
+            AssertMsg(image.desc.extent.width  == pass.m_extent.width &&
+                      image.desc.extent.height == pass.m_extent.height,
+                      "'%s' has attachments of different sizes",
+                      pass.m_name.c_str());
+
+            // Only store what someone looks at later.
+            bool store = image.imported || image.lastPass > passIndex;
+
+            VkImageLayout layout = usageInfo(access.usage).layout;
+
+            VkAttachmentDescription desc = {};
+            desc.format         = image.desc.format;
+            desc.samples        = image.desc.samples;
+            desc.loadOp         = toVk(access.loadOp);
+            desc.storeOp        = store ? VK_ATTACHMENT_STORE_OP_STORE
+                                        : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            desc.stencilLoadOp  = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+            desc.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            desc.initialLayout  = layout;
+            desc.finalLayout    = layout;
+
+            if ((aspectOf(image.desc.format) & VK_IMAGE_ASPECT_STENCIL_BIT) != 0) {
+                desc.stencilLoadOp  = desc.loadOp;
+                desc.stencilStoreOp = desc.storeOp;
+            }
+
+            VkAttachmentReference ref = {};
+            ref.attachment = as<uint32_t>(attachmentDescs.size());
+            ref.layout     = layout;
+            if (depthPass == 1) {
+                AssertMsg(!hasDepth, "'%s' has two depth attachments",
+                          pass.m_name.c_str());
+                depthRef = ref;
+                hasDepth = true;
+            } else {
+                colorRefs.push_back(ref);
+            }
+
+            attachmentDescs.push_back(desc);
+            pass.m_attachments.push_back(access.image.index);
+            pass.m_clearValues.push_back(access.clearValue);
+        }
+    }
+
+    if (attachmentDescs.empty()) {
+        return result;
+    }
+
+    VkSubpassDescription subpassDesc = {};
+    subpassDesc.pipelineBindPoint       = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpassDesc.colorAttachmentCount    = as<uint32_t>(colorRefs.size());
+    subpassDesc.pColorAttachments       = colorRefs.data();
+    subpassDesc.pDepthStencilAttachment = hasDepth ? &depthRef : nullptr;
+
+    VkRenderPassCreateInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.attachmentCount = as<uint32_t>(attachmentDescs.size());
+    renderPassInfo.pAttachments    = attachmentDescs.data();
+    renderPassInfo.subpassCount    = 1;
+    renderPassInfo.pSubpasses      = &subpassDesc;
+
+    result = vkCreateRenderPass(m_info.device, &renderPassInfo, m_info.pAlloc,
+                                &pass.m_vkRenderPass);
+    AssertVk(result);
+
+    // Compatibility only depends on formats and sample counts, and which
+    // attachment each reference uses. Colors always come before depth.
+    uint64_t hash       = kHashSeed;
+    uint32_t colorCount = subpassDesc.colorAttachmentCount;
+    uint8_t  depth      = hasDepth ? 1 : 0;
+    for (VkAttachmentDescription const& desc : attachmentDescs) {
+        hash = hashBytes(&desc.format,  sizeof(desc.format),  hash);
+        hash = hashBytes(&desc.samples, sizeof(desc.samples), hash);
+    }
+    hash = hashBytes(&colorCount, sizeof(colorCount), hash);
+    hash = hashBytes(&depth,      sizeof(depth),      hash);
+    pass.m_renderPassClass = hash;
+
+    return result;
+}
+
+VkFramebuffer RenderGraph::getFramebuffer(RgPass const& pass)
+{
+    std::vector<VkImageView> views(pass.m_attachments.size());
+    for (size_t i = 0; i < views.size(); i += 1) {
+        views[i] = m_images[pass.m_attachments[i]].vkView;
+        AssertMsg(views[i] != nullptr, "'%s' was never given an image",
+                  m_images[pass.m_attachments[i]].name.c_str());
+    }
+
+    uint64_t hash = hashBytes(&pass.m_vkRenderPass, sizeof(VkRenderPass));
+    hash = hashBytes(views.data(), views.size() * sizeof(VkImageView), hash);
+
+    auto found = m_framebuffers.find(hash);
+    if (found != m_framebuffers.end()) {
+        return found->second;
+    }
+
+    VkFramebufferCreateInfo fbInfo = {};
+    fbInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    fbInfo.renderPass      = pass.m_vkRenderPass;
+    fbInfo.attachmentCount = as<uint32_t>(views.size());
+    fbInfo.pAttachments    = views.data();
+    fbInfo.width           = pass.m_extent.width;
+    fbInfo.height          = pass.m_extent.height;
+    fbInfo.layers          = 1;
+
+    VkFramebuffer framebuffer = nullptr;
+    VkResult result = vkCreateFramebuffer(m_info.device, &fbInfo, m_info.pAlloc,
+                                          &framebuffer);
+    AssertVk(result);
+
+    Verbose("Render graph: created framebuffer #%zu for '%s'",
+            m_framebuffers.size() + 1, pass.m_name.c_str());
+    m_framebuffers.emplace(hash, framebuffer);
+    return framebuffer;
+}
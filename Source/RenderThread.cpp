@@ -0,0 +1,169 @@
+#include "RenderThread.hpp"
+#include "Renderer.hpp"
+#include "Simulation.hpp"
+
+RenderThread::~RenderThread()
+{
+    deInit();
+}
+
+void RenderThread::init(RenderThreadInfo const& info)
+{
+    Assert(info.pRenderer != nullptr);
+    Assert(!m_thread.joinable());
+
+    m_info = info;
+    m_pendingSize.store(kNoResize);
+    m_quitting.store(false);
+    m_framesDrawn = 0;
+    m_queueFull   = 0;
+    m_thread = std::thread([this]() { threadMain(); });
+    Info("Rendering on its own thread, up to %u frame(s) queued", kQueueDepth);
+}
+
+void RenderThread::deInit()
+{
+    if (!m_thread.joinable()) {
+        return;
+    }
+
+    m_quitting.store(true);
+    wake();
+    m_thread.join();
+
+    Info("Render thread drew %llu frame(s). The main thread found the queue "
+         "full %llu time(s)",
+         as<unsigned long long>(m_framesDrawn),
+         as<unsigned long long>(m_queueFull));
+}
+
+bool RenderThread::submit(FrameSnapshot const& snapshot)
+{
+    if (!m_snapshots.tryPush(snapshot)) {
+        m_queueFull += 1;
+        return false;
+    }
+    wake();
+    return true;
+}
+
+void RenderThread::resize(uint32_t width, uint32_t height)
+{
+    uint64_t packed = (as<uint64_t>(width) << 32) | as<uint64_t>(height);
+    m_pendingSize.store(packed);
+    wake();
+}
+
+void RenderThread::setLatestCamera(Vec3 const&                     eye,
+                                   Vec3 const&                     target,
+                                   FrameLatency::Clock::time_point inputTime)
+{
+    std::lock_guard<std::mutex> lock(m_latestMutex);
+    m_latestEye    = eye;
+    m_latestTarget = target;
+    m_latestTime   = inputTime;
+    m_hasLatest    = true;
+}
+
+void RenderThread::latchCamera()
+{
+    std::lock_guard<std::mutex> lock(m_latestMutex);
+    if (!m_hasLatest) {
+        return;
+    }
+    m_info.pRenderer->setCamera(m_latestEye, m_latestTarget);
+    m_info.pRenderer->markInput(m_latestTime);
+}
+
+void RenderThread::wake()
+{
+    // Pairs with the fence in threadMain(). Either it sees what we just
+    // published before it sleeps, or we see that it's asleep.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleeping.load(std::memory_order_relaxed)) {
+        // Taking the lock means it's either not waiting yet, and will check
+        // again, or it's waiting, and gets the notification.
+        { std::lock_guard<std::mutex> lock(m_sleepMutex); }
+        m_wakeup.notify_one();
+    }
+}
+
+bool RenderThread::applyResize()
+{
+    uint64_t packed = m_pendingSize.exchange(kNoResize);
+    if (packed == kNoResize) {
+        return false;
+    }
+    uint32_t width  = as<uint32_t>(packed >> 32);
+    uint32_t height = as<uint32_t>(packed & 0xFFFFFFFFu);
+    VkResult result = m_info.pRenderer->resize(width, height);
+    AssertVk(result);
+    return true;
+}
+
+void RenderThread::drawFrame()
+{
+    Renderer& renderer = *m_info.pRenderer;
+
+    Simulation* pSimulation = m_info.pSimulation;
+    if (pSimulation != nullptr &&
+        pSimulation->sample(Simulation::Clock::now(), &m_instances)) {
+        for (uint32_t i = 0; i < m_instances.size(); i += 1) {
+            renderer.setInstance(i, m_instances[i]);
+        }
+    }
+
+    renderer.doOneFrame();
+    m_framesDrawn += 1;
+}
+
+void RenderThread::threadMain()
+{
+    Renderer& renderer = *m_info.pRenderer;
+
+    FrameSnapshot snapshot;
+    bool          hasSnapshot = false;
+    for (;;) {
+        FrameSnapshot next;
+        bool popped = m_snapshots.tryPop(&next);
+
+        if (!popped) {
+            if (m_quitting.load()) {
+                break;
+            }
+
+            // Redraw the last frame at the new size, so the window isn't left
+            // stretched while the main thread is stuck (e.g. in a modal
+            // resize loop).
+            if (applyResize()) {
+                if (hasSnapshot) {
+                    drawFrame();
+                }
+                continue;
+            }
+
+            m_sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            {
+                std::unique_lock<std::mutex> lock(m_sleepMutex);
+                m_wakeup.wait(lock, [this]() {
+                    return !m_snapshots.empty() ||
+                           m_quitting.load() ||
+                           m_pendingSize.load() != kNoResize;
+                });
+            }
+            m_sleeping.store(false, std::memory_order_relaxed);
+            continue;
+        }
+
+        snapshot    = next;
+        hasSnapshot = true;
+        applyResize();
+
+        renderer.setCamera(snapshot.eye, snapshot.target);
+        renderer.setMeshVariant(snapshot.meshVariant);
+        renderer.setDepthPrepass(snapshot.depthPrepass);
+        renderer.markInput(snapshot.inputTime);
+        drawFrame();
+    }
+}
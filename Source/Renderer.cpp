@@ -1,7 +1,37 @@
 #include "Renderer.hpp"
+#include "AssetArchive.hpp"
+#include "FileView.hpp"
+#include "MeshLod.hpp"
+#include "VkMemory.hpp"
 
 #include <algorithm>
 
+// Lives next to the binary. Drivers validate it, so a stale one is harmless.
+static const char* const kPipelineCacheFilename = "pipeline_cache.bin";
+
+// Every shader init() might load. Unused ones are read anyway, they're small.
+static const char* const kStartupShaders[] = {
+    "shaders/Mesh.vert.spv",
+    "shaders/Mesh.frag.spv",
+    "shaders/MeshDepth.vert.spv",
+    "shaders/Cull.comp.spv",
+    "shaders/CullEarly.comp.spv",
+    "shaders/CullLate.comp.spv",
+    "shaders/DepthPyramid.comp.spv",
+};
+
+// The draw list's passes, in the order they're drawn.
+static constexpr uint32_t kDepthDrawPass = 0;
+static constexpr uint32_t kMeshDrawPass  = 1;
+
+// The depth prepass only needs positions, so lights don't matter to it.
+static PipelineVariantKey depthVariantOf(PipelineVariantKey const& key)
+{
+    PipelineVariantKey depthKey;
+    depthKey.quantizedPositions = key.quantizedPositions;
+    return depthKey;
+}
+
 Renderer::~Renderer()
 {
     deInit();
@@ -9,15 +39,102 @@ Renderer::~Renderer()
 
 void Renderer::deInit()
 {
+    if (m_vkDevice == nullptr) {
+        return;
+    }
     vkDeviceWaitIdle(m_vkDevice);
+
+    m_meshPipelines.deInit();
+    m_depthPipelines.deInit();
+    m_hasDepthPipelines = false;
+    m_latency.logStats();
+    m_drawList.logStats();
+    m_drawList.deInit();
+    m_gpuCulling.logStats();
+    m_gpuCulling.deInit();
+    m_instanceBuffer.logStats();
+    m_instanceBuffer.deInit();
+    m_depthPyramid.deInit();
+    m_softwareOcclusion.logStats();
+    m_softwareOcclusion.deInit();
+    if (m_fullDetailTriangles > 0) {
+        Info("LODs: drew %.1f%% of the full detail triangles",
+             100.0 * as<double>(m_lodTriangles) /
+                 as<double>(m_fullDetailTriangles));
+    }
+    m_computeQueue.deInit();
+    m_renderGraph.logStats();
+    m_renderGraph.deInit();
+    m_pMeshPass         = nullptr;
+    m_vkRenderPass      = nullptr;
+    m_vkDepthRenderPass = nullptr;
+    savePipelineCache();
+    vkDestroyPipelineCache(m_vkDevice, m_vkPipelineCache, getVkAlloc());
+    m_vkPipelineCache = nullptr;
+    destroyBuffer(&m_vkVertexBuffer,    &m_vkVertexDeviceMemory);
+    destroyBuffer(&m_vkQuantizedBuffer, &m_vkQuantizedDeviceMemory);
+    destroyBuffer(&m_vkIndexBuffer,     &m_vkIndexDeviceMemory);
+    destroyBuffer(&m_vkMaterialBuffer,  &m_vkMaterialDeviceMemory);
+    m_materialCount = 0;
+    vkDestroyPipelineLayout(m_vkDevice, m_vkPipelineLayout, getVkAlloc());
+    m_descriptors.deInit();
+    m_vkDescriptorSetLayout = nullptr;
+    m_vkDescriptorSet       = nullptr;
+    m_pMeshSetLayout        = nullptr;
+
+    m_uniformRing.deInit();
+    if (m_vkUniformDeviceMemory != nullptr) {
+        vkUnmapMemory(m_vkDevice, m_vkUniformDeviceMemory);
+    }
+    destroyBuffer(&m_vkUniformBuffer, &m_vkUniformDeviceMemory);
+
+    vkDestroyQueryPool(m_vkDevice, m_vkTimestampPool, getVkAlloc());
+    m_vkTimestampPool = nullptr;
+
+    destroyPresentImages();
+
+    for (uint32_t i = 0; i < kFramesInFlight; i += 1) {
+        vkDestroyFence(m_vkDevice, m_vkFrameFences[i], getVkAlloc());
+        vkDestroySemaphore(m_vkDevice, m_vkAcquireSemaphores[i], getVkAlloc());
+        vkDestroySemaphore(m_vkDevice, m_vkRenderSemaphores[i], getVkAlloc());
+        m_vkFrameFences[i]       = nullptr;
+        m_vkAcquireSemaphores[i] = nullptr;
+        m_vkRenderSemaphores[i]  = nullptr;
+    }
+
+    vkDestroyShaderModule(m_vkDevice, m_vkMeshVertModule, getVkAlloc());
+    vkDestroyShaderModule(m_vkDevice, m_vkMeshFragModule, getVkAlloc());
+    vkDestroyShaderModule(m_vkDevice, m_vkMeshDepthVertModule, getVkAlloc());
+    m_vkPipelineLayout      = nullptr;
+    m_vkMeshVertModule      = nullptr;
+    m_vkMeshFragModule      = nullptr;
+    m_vkMeshDepthVertModule = nullptr;
+
     // TODO: Vulkan tear down
 }
 
 VkResult Renderer::init(RendererInfo const& info)
 {
     m_logger.reserve(255);
-    m_pGlfwWindow = info.pWindow;
-    glfwSetWindowUserPointer(m_pGlfwWindow, this);
+    m_pGlfwWindow    = info.pWindow;
+    m_headless       = info.headless;
+    m_pAssets        = info.pAssets;
+    m_pJobs          = info.pJobs;
+    m_meshVariant    = info.meshVariant;
+    m_depthPrecision = info.depthPrecision;
+    m_physicalDeviceOverride = info.pPhysicalDevice != nullptr
+                               ? info.pPhysicalDevice : "";
+    m_asyncCompute   = info.asyncCompute;
+    m_useGpuCulling  = info.gpuCulling;
+    m_coneCulling    = info.coneCulling;
+    m_validateCulling = info.validateCulling;
+    m_occlusionCulling = info.occlusionCulling && info.gpuCulling;
+    m_useSoftwareOcclusion = info.softwareOcclusion && !info.gpuCulling;
+    m_lodErrorPixels = info.lodErrorPixels;
+    m_lateLatch      = info.lateLatch && info.latchInput != nullptr;
+    m_latchInput     = info.latchInput;
+    m_depthPrepass     = info.depthPrepass;
+    m_wantDepthPrepass = info.depthPrepass;
 
     Info("sizeof(Renderer) == %zu", sizeof(*this));
 
@@ -27,14 +144,14 @@ VkResult Renderer::init(RendererInfo const& info)
         /*width*/  as<uint32_t>(info.framebufferWidth),
         /*height*/ as<uint32_t>(info.framebufferHeight),
     };
-    VkExtent3D extent3d = {
-        /*width*/  as<uint32_t>(info.framebufferWidth),
-        /*height*/ as<uint32_t>(info.framebufferHeight),
-        /*depth*/  1
-    };
+    m_framebufferExtent = extent2d;
 
     Info("Built with Vulkan SDK %d", VK_HEADER_VERSION);
 
+    // Init m_startupReader. The disk works on shaders while the device comes
+    // up, and nothing waits until the first of them is needed.
+    beginStartupReads();
+
     // Init m_layers
     result = createLayers();
 
@@ -47,29 +164,95 @@ VkResult Renderer::init(RendererInfo const& info)
     // Init m_vkDevice and m_vkGraphicsQueue
     result = createDevice();
 
-    // Init m_vkAcquireFence and m_vkRenderSemaphore.
+    // Init m_vkFrameFences, m_vkAcquireSemaphores, and m_vkRenderSemaphores
     result = createFencesAndSemaphores();
 
-    // Init m_vkSurface
-    result = glfwCreateWindowSurface(m_vkInstance,
-                                     m_pGlfwWindow,
-                                     nullptr,
-                                     &m_vkSurface);
+    // Init m_vkTimestampPool
+    result = createTimestampQueries();
 
-    // Create a swapchain
-    result = createSwapChain();
+    // Init m_vkSurface, and create a swapchain. Headless, there's nothing to
+    // present to.
+    if (!m_headless) {
+        result = glfwCreateWindowSurface(m_vkInstance,
+                                         m_pGlfwWindow,
+                                         nullptr,
+                                         &m_vkSurface);
+
+        result = createSwapChain();
+    }
 
-    // Init m_vkPresentImages, and m_vkPresentImageViews
+    // Init m_vkPresentImages, and m_vkPresentImageViews. Headless, also
+    // m_vkOffscreenMemory.
     result = createPresentImages();
 
-    // Init m_vkCommandPool
+    // Init m_vkCommandPool and m_vkFrameCmdBuffers
     result = createCommandPool();
 
-    // Init m_vkDepthImage, m_vkDepthImageView, and m_vkDepthDeviceMemory
-    result = createDepthBuffer(extent3d);
+    // Init m_computeQueue
+    ComputeQueueInfo computeInfo = {};
+    computeInfo.device              = m_vkDevice;
+    computeInfo.pAlloc              = getVkAlloc();
+    computeInfo.queue               = m_vkComputeQueue;
+    computeInfo.queueFamily         = m_vkComputeQueueIndex;
+    computeInfo.graphicsQueueFamily = m_vkGraphicsQueueIndex;
+    computeInfo.frameCount          = kFramesInFlight;
+    result = m_computeQueue.init(computeInfo);
+
+    // Init m_renderGraph, m_rgBackbuffer, m_rgDepth, m_pMeshPass,
+    // m_vkRenderPass, and m_vkDepthRenderPass
+    result = createRenderGraph(m_framebufferExtent);
+
+    // Occlusion tests compare against depth drawn with the latched camera,
+    // so they'd need to be latched too, and they're already recorded.
+    if (m_lateLatch && (m_occlusionCulling || m_useSoftwareOcclusion)) {
+        Info("Late latching is off, since occlusion culling is on");
+        m_lateLatch = false;
+    }
+
+    // Init m_vkUniformBuffer, m_vkUniformDeviceMemory, and m_uniformRing
+    result = createUniformBuffer();
+
+    // Init m_descriptors, m_vkDescriptorSetLayout, m_vkDescriptorSet, and a
+    // material table to start with
+    result = createDescriptorSet();
+
+    // Everything from here on reads m_startupFiles.
+    finishStartupReads();
 
-    // Init m_Framebuffer, and ???
-    result = createRenderPassAndFramebuffer(extent3d);
+    // Init m_vkPipelineCache
+    result = createPipelineCache();
+
+    // Init m_vkPipelineLayout, m_meshPipelines, m_depthPipelines, and the
+    // shaders they use.
+    result = createMeshPipelines();
+
+    // Init m_gpuCulling and m_depthPyramid
+    result = createGpuCulling();
+
+    // Every shader module has been created.
+    m_startupFiles.clear();
+
+    // Init m_instanceBuffer
+    InstanceBufferInfo instanceInfo = {};
+    instanceInfo.device           = m_vkDevice;
+    instanceInfo.pAlloc           = getVkAlloc();
+    instanceInfo.memoryProperties =
+        m_queriedInfo.physicalDeviceInfos[m_queriedInfo.physicalDeviceIndex]
+            .memoryProperties;
+    instanceInfo.frameCount       = kFramesInFlight;
+    result = m_instanceBuffer.init(instanceInfo);
+
+    // Init m_softwareOcclusion
+    if (m_useSoftwareOcclusion) {
+        SoftwareOcclusionInfo occlusionInfo;
+        occlusionInfo.pJobs = m_pJobs;
+        m_softwareOcclusion.init(occlusionInfo);
+    }
+
+    // Init m_drawList. Only CPU culling draws through it.
+    DrawListInfo drawListInfo;
+    drawListInfo.pJobs = m_pJobs;
+    m_drawList.init(drawListInfo);
 
     return result;
 }
@@ -78,34 +261,114 @@ void Renderer::doOneFrame()
 {
     VkResult result;
 
-    uint32_t frameId = -1;
-    result = vkAcquireNextImageKHR(m_vkDevice,
-                                   m_vkSwapchain,
-                                   UINT64_MAX, // timeout (ns)
-                                   nullptr,    // semaphore
-                                   m_vkAcquireFence,
-                                   &frameId);
-    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+    // Minimized, there's nothing to draw into.
+    if (m_framebufferExtent.width == 0 || m_framebufferExtent.height == 0) {
         return;
     }
+    if (m_swapchainOutOfDate) {
+        result = resize(m_framebufferExtent.width, m_framebufferExtent.height);
+        AssertVk(result);
+    }
+    if (m_wantDepthPrepass != m_depthPrepass) {
+        applyDepthPrepass();
+    }
+
+    // Wait until the GPU is done with this frame's objects, the last time we
+    // used them. The other frame in flight keeps the GPU busy meanwhile.
+    VkFence frameFence = m_vkFrameFences[m_frameIndex];
+    result = vkWaitForFences(m_vkDevice, 1, &frameFence, VK_TRUE, UINT64_MAX);
     AssertVk(result);
 
-    vkWaitForFences(m_vkDevice, 1, &m_vkAcquireFence, true, UINT64_MAX);
+    // Headless, each frame in flight has its own image, and the fence is all
+    // the waiting it needs.
+    uint32_t frameId = m_frameIndex;
+    if (!m_headless) {
+        result = vkAcquireNextImageKHR(m_vkDevice,
+                                       m_vkSwapchain,
+                                       UINT64_MAX, // timeout (ns)
+                                       m_vkAcquireSemaphores[m_frameIndex],
+                                       nullptr,    // fence
+                                       &frameId);
+        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+            m_swapchainOutOfDate = true;
+            return;
+        }
+        // The image is still ours and the semaphore will be signaled, so
+        // finish this frame and recreate the swapchain before the next.
+        if (result == VK_SUBOPTIMAL_KHR) {
+            m_swapchainOutOfDate = true;
+            result = VK_SUCCESS;
+        }
+        AssertVk(result);
+    }
     Assert(frameId < Renderer::N);
 
-    VkExtent2D extent2d = {};
-    glfwGetFramebufferSize(m_pGlfwWindow,
-                           ptr_as<int>(&extent2d.width),
-                           ptr_as<int>(&extent2d.height));
+    // The fence also means this frame's timestamps, from the last time it
+    // ran, are in.
+    if (m_timestampsWritten[m_frameIndex]) {
+        uint64_t ticks[2] = {};
+        result = vkGetQueryPoolResults(m_vkDevice, m_vkTimestampPool,
+                                       2 * m_frameIndex, 2,
+                                       sizeof(ticks), ticks, sizeof(ticks[0]),
+                                       VK_QUERY_RESULT_64_BIT);
+        AssertVk(result);
+        uint64_t elapsed = (ticks[1] - ticks[0]) & m_timestampMask;
+        m_lastGpuFrameMs = as<double>(elapsed) * m_timestampPeriodNs / 1e6;
+    }
+
+    result = vkResetFences(m_vkDevice, 1, &frameFence);
+    AssertVk(result);
 
-    VkCommandBufferAllocateInfo cmdBufAllocInfo;
-    cmdBufAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    cmdBufAllocInfo.commandPool        = m_vkCommandPool;
-    cmdBufAllocInfo.level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    cmdBufAllocInfo.commandBufferCount = 1;
+    // Nothing on the GPU reads this frame's slice, or its sets, anymore.
+    m_uniformRing.beginFrame(m_frameIndex);
+    m_descriptors.beginFrame(m_frameIndex);
+    m_computeQueue.beginFrame(m_frameIndex);
+    m_instanceBuffer.beginFrame(m_frameIndex);
+    if (m_useGpuCulling) {
+        m_gpuCulling.beginFrame(m_frameIndex);
+    }
 
-    VkCommandBuffer simpleDraw;
-    result = vkAllocateCommandBuffers(m_vkDevice, &cmdBufAllocInfo, &simpleDraw);
+    updateCamera();
+    updateInstances();
+    selectLods();
+    selectMeshVariant();
+    m_latchedUniforms.clear();
+    if (!m_lateLatch) {
+        m_latency.mark(LatencyMarker::Latch);
+    }
+    buildDrawList();
+
+    // GPU culling keeps a copy of the objects per frame in flight, so a
+    // change has to reach each of them in turn.
+    if (m_useGpuCulling && m_staleObjectFrames > 0) {
+        m_gpuCulling.updateObjects(m_meshObjects.data(),
+                                   as<uint32_t>(m_meshObjects.size()));
+        m_staleObjectFrames -= 1;
+    }
+
+    // Cull on the compute queue. The mesh pass draws whatever survives.
+    // Occlusion culling needs this frame's depth, so the render graph does
+    // that on the graphics queue instead.
+    if (m_useGpuCulling && !m_occlusionCulling &&
+            m_gpuCulling.objectCount() > 0) {
+        CullParams params = makeCullParams(m_viewProjection, m_eye,
+                                           m_gpuCulling.objectCount());
+        m_gpuCulling.record(m_computeQueue.commandBuffer(), CullPhase::All,
+                            params);
+        m_computeQueue.releaseBuffer(m_gpuCulling.drawBuffer(CullPhase::All),
+                                     0,
+                                     m_gpuCulling.drawBufferSize(),
+                                     VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                                     VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+    }
+
+    // Compute work goes first, so graphics can wait on it. Graphics only
+    // waits at the stages that use its results.
+    VkPipelineStageFlags computeWaitStages = 0;
+    VkSemaphore computeSemaphore = m_computeQueue.submit(&computeWaitStages);
+
+    VkCommandBuffer simpleDraw = m_vkFrameCmdBuffers[m_frameIndex];
+    result = vkResetCommandBuffer(simpleDraw, 0);
     AssertVk(result);
 
     // Record CmdBuffer
@@ -114,61 +377,471 @@ void Renderer::doOneFrame()
     cmdInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     result = vkBeginCommandBuffer(simpleDraw, &cmdInfo);
     AssertVk(result);
-    {
-        VkRenderPassBeginInfo passInfo = {};
-        passInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        passInfo.renderPass  = m_vkRenderPass;
-        passInfo.framebuffer = m_vkFramebuffers[frameId];
-        passInfo.renderArea.extent = extent2d;
-
-        VkClearValue clearValues[2] = {};
-        float c = 25.f / 255.f;
-        clearValues[0].color = { 1.f, 0.f, 1.f };
-        clearValues[1].depthStencil = { 1.f, 0 };
-        passInfo.clearValueCount = array_size(clearValues);
-        passInfo.pClearValues    = clearValues;
-
-        vkCmdBeginRenderPass(simpleDraw,
-                             &passInfo,
-                             VK_SUBPASS_CONTENTS_INLINE);
-        VkViewport viewport = {};
-        viewport.x        = 0.f;
-        viewport.y        = as<float>(extent2d.height);
-        viewport.width    = as<float>(extent2d.width);
-        viewport.height   = -as<float>(extent2d.height);
-        viewport.minDepth = 0.f;
-        viewport.maxDepth = 1.f;
-        vkCmdSetViewport(simpleDraw, 0, 1, &viewport);
-
-        vkCmdEndRenderPass(simpleDraw);
+
+    if (m_vkTimestampPool != nullptr) {
+        vkCmdResetQueryPool(simpleDraw, m_vkTimestampPool, 2 * m_frameIndex, 2);
+        vkCmdWriteTimestamp(simpleDraw, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                            m_vkTimestampPool, 2 * m_frameIndex);
     }
+
+    // Take ownership of whatever compute handed over.
+    m_computeQueue.acquire(simpleDraw);
+
+    // Barriers, render passes, and the passes themselves.
+    m_renderGraph.setImportedImage(m_rgBackbuffer,
+                                   m_vkPresentImages[frameId],
+                                   m_vkPresentImageViews[frameId]);
+    m_renderGraph.execute(simpleDraw);
+
+    if (m_vkTimestampPool != nullptr) {
+        vkCmdWriteTimestamp(simpleDraw, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                            m_vkTimestampPool, 2 * m_frameIndex + 1);
+        m_timestampsWritten[m_frameIndex] = true;
+    }
+
     // End
     result = vkEndCommandBuffer(simpleDraw);
     AssertVk(result);
 
+    // Late latch. Sample input as late as we can, and write the camera it
+    // gives over what the frame was recorded with. Culling and LODs keep the
+    // old one, which is a fraction of a frame away.
+    if (m_lateLatch) {
+        m_latency.mark(LatencyMarker::Input);
+        m_latchInput();
+        updateCamera();
+        for (MeshUniforms* pUniforms : m_latchedUniforms) {
+            pUniforms->mvp = m_viewProjection;
+        }
+        m_latency.mark(LatencyMarker::Latch);
+    }
+
+    // The GPU reads uniforms when it runs, so they need to be visible by then.
+    m_uniformRing.flush();
+
     // Submit
+    // Wait for the image before writing color, and signal when we're done so
+    // presentation can wait on us.
+    // Headless, there's no image to wait for, and nothing to present.
+    VkSemaphore          waitSemaphores[2] = {};
+    VkPipelineStageFlags waitStages[2]     = {};
+    uint32_t             waitCount         = 0;
+    if (!m_headless) {
+        waitSemaphores[waitCount] = m_vkAcquireSemaphores[m_frameIndex];
+        waitStages[waitCount]     = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        waitCount += 1;
+    }
+    if (computeSemaphore != nullptr) {
+        waitSemaphores[waitCount] = computeSemaphore;
+        waitStages[waitCount]     = computeWaitStages;
+        waitCount += 1;
+    }
+
     VkSubmitInfo submitInfo = {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.waitSemaphoreCount   = waitCount;
+    submitInfo.pWaitSemaphores      = waitSemaphores;
+    submitInfo.pWaitDstStageMask    = waitStages;
     submitInfo.commandBufferCount   = 1;
     submitInfo.pCommandBuffers      = &simpleDraw;
-    result = vkQueueSubmit(m_vkGraphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+    submitInfo.signalSemaphoreCount = m_headless ? 0 : 1;
+    submitInfo.pSignalSemaphores    = &m_vkRenderSemaphores[m_frameIndex];
+    result = vkQueueSubmit(m_vkGraphicsQueue, 1, &submitInfo, frameFence);
+    AssertVk(result);
+    m_latency.mark(LatencyMarker::Submit);
+
+    if (m_headless) {
+        m_latency.endFrame();
+        m_frameIndex = (m_frameIndex + 1) % kFramesInFlight;
+        return;
+    }
 
     // Present
     VkPresentInfoKHR presentInfo = {};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    presentInfo.waitSemaphoreCount  = 1;
+    presentInfo.pWaitSemaphores     = &m_vkRenderSemaphores[m_frameIndex];
     presentInfo.swapchainCount      = 1;
     presentInfo.pSwapchains         = &m_vkSwapchain;
     presentInfo.pImageIndices       = &frameId;
     result = vkQueuePresentKHR(m_vkGraphicsQueue, &presentInfo);
-    if (result != VK_SUCCESS) {
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+        m_swapchainOutOfDate = true;
+    } else if (result != VK_SUCCESS) {
         Bug("vkQueuePresentKHR() -> %s", ToCStr(result));
     }
+    m_latency.mark(LatencyMarker::Present);
+    m_latency.endFrame();
 
-    // Wait - Who needs synchronization anyway?
-    vkDeviceWaitIdle(m_vkDevice);
+    m_frameIndex = (m_frameIndex + 1) % kFramesInFlight;
+}
+
+void Renderer::selectMeshVariant()
+{
+    m_frameMeshPipeline  = nullptr;
+    m_frameDepthPipeline = nullptr;
+    if (m_vertexCount == 0) {
+        return;
+    }
+
+    // A new variant compiles in the background. Until it's ready, we draw
+    // with the last variant that was, instead of hitching. With a depth
+    // prepass, that's both of its pipelines, so they agree on the positions.
+    PipelineVariantKey wanted = m_meshVariant;
+    wanted.depthEqual = m_depthPrepass;
+
+    VkPipeline mesh  = m_meshPipelines.request(wanted);
+    VkPipeline depth = nullptr;
+    if (m_depthPrepass) {
+        depth = m_depthPipelines.request(depthVariantOf(wanted));
+    }
+    if (mesh != nullptr && (depth != nullptr || !m_depthPrepass)) {
+        if (m_meshSubstitutedFrames > 0) {
+            Info("Mesh variant ready after %u substituted frame(s)",
+                 m_meshSubstitutedFrames);
+            m_meshSubstitutedFrames = 0;
+        }
+        m_meshReadyVariant = wanted;
+    } else {
+        m_meshSubstitutedFrames += 1;
+        mesh = m_meshPipelines.request(m_meshReadyVariant);
+        if (m_depthPrepass) {
+            depth = m_depthPipelines.request(depthVariantOf(m_meshReadyVariant));
+        }
+    }
+
+    m_frameVariant       = m_meshReadyVariant;
+    m_frameMeshPipeline  = mesh;
+    m_frameDepthPipeline = depth;
+}
+
+UniformAllocation Renderer::pushMeshUniforms()
+{
+    // A pointer bump and a memcpy. Every draw shares one descriptor set, and
+    // only the dynamic offset changes.
+    MeshUniforms uniforms = {};
+    uniforms.mvp           = m_viewProjection;
+    uniforms.baseColor     = glm::vec4(0.9f, 0.9f, 0.9f, 1.f);
+    uniforms.positionScale = m_positionScale;
+    UniformAllocation meshUniforms = m_uniformRing.push(uniforms);
+    if (m_lateLatch && meshUniforms.pData != nullptr) {
+        m_latchedUniforms.push_back(ptr_as<MeshUniforms>(meshUniforms.pData));
+    }
+    return meshUniforms;
+}
+
+void Renderer::buildDrawList()
+{
+    m_drawList.clear();
+    if (m_useGpuCulling || m_frameMeshPipeline == nullptr) {
+        return;
+    }
+
+    // The ring already complained if it's full.
+    UniformAllocation meshUniforms = pushMeshUniforms();
+    if (meshUniforms.pData == nullptr) {
+        return;
+    }
+
+    // The same test as GPU culling, one draw per survivor.
+    CullParams params = makeCullParams(m_viewProjection, m_eye,
+                                       as<uint32_t>(m_meshObjects.size()));
+    // The occluders are the objects where they were built, so that's the
+    // only place they can hide anything.
+    uint8_t const* pVisible = nullptr;
+    if (m_useSoftwareOcclusion && m_identityInstances) {
+        m_cpuVisible.resize(m_meshObjects.size());
+        m_softwareOcclusion.cull(m_viewProjection, m_cpuVisible.data());
+        pVisible = m_cpuVisible.data();
+    }
+    m_cpuDraws.resize(m_meshObjects.size());
+    m_cpuDrawObjects.resize(m_meshObjects.size());
+    uint32_t drawCount = cullObjects(m_meshObjects.data(),
+                                     params,
+                                     m_coneCulling,
+                                     m_cpuDraws.data(),
+                                     pVisible,
+                                     m_cpuDrawObjects.data());
+
+    DrawBinds binds;
+    binds.layout           = m_vkPipelineLayout;
+    binds.set              = m_vkDescriptorSet;
+    binds.dynamicOffset    = meshUniforms.offset;
+    binds.vertexBuffers[0] = m_frameVariant.quantizedPositions
+                                 ? m_vkQuantizedBuffer
+                                 : m_vkVertexBuffer;
+    binds.vertexBuffers[1] = m_instanceBuffer.buffer();
+    binds.indexBuffer      = m_vkIndexBuffer;
+
+    binds.pipeline = m_frameMeshPipeline;
+    uint32_t meshBinds  = m_drawList.addBinds(binds);
+    uint32_t depthBinds = 0;
+    if (m_depthPrepass) {
+        binds.pipeline = m_frameDepthPipeline;
+        depthBinds = m_drawList.addBinds(binds);
+    }
+
+    // The prepass goes front to back, so it rejects as much as it can. After
+    // it, shading only passes the EQUAL test once a pixel, whatever the
+    // order, so it's grouped by material instead. Without it, materials
+    // still come first, then front to back within each.
+    for (uint32_t i = 0; i < drawCount; i += 1) {
+        VkDrawIndexedIndirectCommand const& draw = m_cpuDraws[i];
+        uint32_t object = m_cpuDrawObjects[i];
+        Vec3 center(m_meshObjects[object].sphere.x,
+                    m_meshObjects[object].sphere.y,
+                    m_meshObjects[object].sphere.z);
+        uint32_t depth    = drawDepthBucket(glm::length(center - m_eye));
+        uint32_t material =
+            m_instanceBuffer.instance(draw.firstInstance).materialIndex;
+
+        if (m_depthPrepass) {
+            m_drawList.add(makeDrawKey(kDepthDrawPass, depthBinds, 0, depth,
+                                       object),
+                           depthBinds, draw);
+            depth = 0;
+        }
+        m_drawList.add(makeDrawKey(kMeshDrawPass, meshBinds, material, depth,
+                                   object),
+                       meshBinds, draw);
+    }
+    m_drawList.sort();
+}
+
+void Renderer::recordMeshPass(RgPassContext const& context,
+                              CullPhase            phase,
+                              bool                 depthOnly)
+{
+    VkCommandBuffer cmd    = context.cmd;
+    VkExtent2D      extent = context.extent;
+
+    VkViewport viewport = {};
+    viewport.x        = 0.f;
+    viewport.y        = as<float>(extent.height);
+    viewport.width    = as<float>(extent.width);
+    viewport.height   = -as<float>(extent.height);
+    viewport.minDepth = 0.f;
+    viewport.maxDepth = 1.f;
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+
+    VkRect2D scissor = {};
+    scissor.extent = extent;
+    vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+    // Culled, sorted, and bound by the draw list.
+    if (!m_useGpuCulling) {
+        m_drawList.record(cmd, depthOnly ? kDepthDrawPass : kMeshDrawPass);
+        return;
+    }
+
+    VkPipeline pipeline = depthOnly ? m_frameDepthPipeline : m_frameMeshPipeline;
+    if (pipeline == nullptr) {
+        return;
+    }
+
+    // One draw for everything, so there's nothing to sort.
+    UniformAllocation meshUniforms = pushMeshUniforms();
+    if (meshUniforms.pData == nullptr) {
+        return;
+    }
+    VkBuffer vertexBuffers[2] = {
+        m_frameVariant.quantizedPositions ? m_vkQuantizedBuffer
+                                          : m_vkVertexBuffer,
+        m_instanceBuffer.buffer(),
+    };
+    VkDeviceSize vertexOffsets[2] = { 0, 0 };
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    vkCmdBindDescriptorSets(cmd,
+                            VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            m_vkPipelineLayout,
+                            0, // firstSet
+                            1, &m_vkDescriptorSet,
+                            1, &meshUniforms.offset);
+    vkCmdBindVertexBuffers(cmd, 0, array_size(vertexBuffers),
+                           vertexBuffers, vertexOffsets);
+    vkCmdBindIndexBuffer(cmd, m_vkIndexBuffer, 0, VK_INDEX_TYPE_UINT32);
+    m_gpuCulling.draw(cmd, phase);
+}
+
+void Renderer::updateCamera()
+{
+    VkExtent2D extent = m_framebufferExtent;
+    float aspect = as<float>(extent.width) /
+                   as<float>(std::max(extent.height, 1u));
+    float fovY = glm::radians(45.f);
+    Mat4  proj = glm::perspective(fovY, aspect, 0.1f, 100.f);
+    m_pixelsPerUnit = as<float>(extent.height) / (2.f * std::tan(0.5f * fovY));
+
+    Mat4 view = glm::lookAt(m_eye,
+                            m_cameraTarget,
+                            Vec3(0.f, 1.f, 0.f));   // up
+
+    m_viewProjection = proj * view;
+}
+
+void Renderer::setCamera(Vec3 const& eye, Vec3 const& target)
+{
+    m_eye          = eye;
+    m_cameraTarget = target;
+}
+
+VkResult Renderer::resize(uint32_t width, uint32_t height)
+{
+    VkResult result = VK_SUCCESS;
+
+    // Minimized. Frames are skipped until there's something to draw into.
+    if (width == 0 || height == 0) {
+        m_framebufferExtent = { 0, 0 };
+        return result;
+    }
 
-    vkFreeCommandBuffers(m_vkDevice, m_vkCommandPool, 1, &simpleDraw);
-    vkResetFences(m_vkDevice, 1, &m_vkAcquireFence);
+    bool sameSize = width  == m_framebufferExtent.width &&
+                    height == m_framebufferExtent.height;
+    if (sameSize && !m_swapchainOutOfDate) {
+        return result;
+    }
+    m_swapchainOutOfDate = false;
+
+    // Everything sized by the framebuffer goes, so the GPU can't be using
+    // any of it.
+    result = vkDeviceWaitIdle(m_vkDevice);
+    AssertVk(result);
+
+    destroyPresentImages();
+    m_framebufferExtent = { width, height };
+    if (!m_headless) {
+        result = createSwapChain();
+        AssertVk(result);
+        if (m_framebufferExtent.width == 0 || m_framebufferExtent.height == 0) {
+            m_swapchainOutOfDate = true;
+            return result;
+        }
+    }
+    result = createPresentImages();
+    AssertVk(result);
+
+    result = rebuildRenderGraph();
+    AssertVk(result);
+
+    if (m_occlusionCulling) {
+        result = m_depthPyramid.resize(m_framebufferExtent);
+        AssertVk(result);
+    }
+
+    Info("Resized to %u x %u",
+         m_framebufferExtent.width, m_framebufferExtent.height);
+    return result;
+}
+
+VkDeviceSize Renderer::deviceMemoryUsage() const
+{
+    if (m_pfnGetMemoryProperties2 == nullptr) {
+        return 0;
+    }
+
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {};
+    budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+    VkPhysicalDeviceMemoryProperties2KHR properties = {};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+    properties.pNext = &budget;
+    m_pfnGetMemoryProperties2(m_vkPhysicalDevice, &properties);
+
+    VkDeviceSize usage = 0;
+    for (uint32_t i = 0; i < properties.memoryProperties.memoryHeapCount;
+         i += 1) {
+        usage += budget.heapUsage[i];
+    }
+    return usage;
+}
+
+char const* Renderer::deviceName() const
+{
+    return m_queriedInfo.physicalDeviceInfos[m_queriedInfo.physicalDeviceIndex]
+        .properties.deviceName;
+}
+
+void Renderer::selectLods()
+{
+    if (m_meshLods.empty()) {
+        return;
+    }
+    Assert(m_meshLods.size() == m_meshObjects.size());
+
+    LodSelectParams params;
+    params.eye            = m_eye;
+    params.pixelsPerUnit  = m_pixelsPerUnit;
+    params.maxErrorPixels = m_lodErrorPixels;
+
+    // Culling, and drawing, only look at the object's index range, so
+    // picking a LOD is pointing that at another one. Every copy of an object
+    // gets the same one, picked for the nearest edge of its sphere.
+    for (size_t i = 0; i < m_meshObjects.size(); i += 1) {
+        MeshObjectLods const& chain  = m_meshLods[i];
+        MeshObject&           object = m_meshObjects[i];
+        uint32_t lod = 0;
+        if (m_lodErrorPixels > 0.f) {
+            lod = selectLod(chain, object.sphere, m_objectLods[i], params);
+        }
+        if (lod != m_objectLods[i]) {
+            m_staleObjectFrames = kFramesInFlight;
+        }
+        m_objectLods[i]   = as<uint8_t>(lod);
+        object.firstIndex = chain.lods[lod].firstIndex;
+        object.indexCount = chain.lods[lod].indexCount;
+
+        m_fullDetailTriangles += chain.lods[0].indexCount   / 3 * object.instanceCount;
+        m_lodTriangles        += chain.lods[lod].indexCount / 3 * object.instanceCount;
+    }
+}
+
+void Renderer::setInstance(uint32_t instance, InstanceData const& data)
+{
+    Assert(instance < m_instanceSlots.size());
+    AssertMsg(data.materialIndex < m_materialCount,
+              "Instance %u uses material %u, of %u",
+              instance, data.materialIndex, m_materialCount);
+    m_instanceBuffer.setInstance(m_instanceSlots[instance], data);
+
+    m_movedObjects[m_instanceObjects[instance]] = 1;
+    m_instancesMoved    = true;
+    m_identityInstances = false;
+}
+
+void Renderer::updateInstances()
+{
+    if (!m_instancesMoved) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < m_movedObjects.size(); i += 1) {
+        if (m_movedObjects[i] != 0) {
+            updateObjectSphere(i);
+            m_movedObjects[i] = 0;
+        }
+    }
+    m_instancesMoved    = false;
+    m_staleObjectFrames = kFramesInFlight;
+}
+
+void Renderer::updateObjectSphere(uint32_t object)
+{
+    MeshObject const& base   = m_baseObjects[object];
+    MeshObject&       merged = m_meshObjects[object];
+
+    glm::vec4 sphere = base.sphere;
+    for (uint32_t i = 0; i < merged.instanceCount; i += 1) {
+        InstanceData const& instance =
+            m_instanceBuffer.instance(merged.firstInstance + i);
+        glm::vec4 moved = transformSphere(instance.transform, base.sphere);
+        sphere = (i == 0) ? moved : mergeSpheres(sphere, moved);
+    }
+    merged.sphere = sphere;
+
+    // The cone only holds where the object was built.
+    merged.cone = m_identityInstances ? base.cone
+                                      : glm::vec4(0.f, 0.f, 0.f, 1.f);
 }
 
 VkResult Renderer::createLayers()
@@ -270,18 +943,28 @@ VkResult Renderer::createInstance()
     Verbose("Instance extensions found:%s", m_logger.c_str());
     m_logger.clear();
 
-    // Pick our instance extensions
-    instExtsCount = 0;
-    const char** glfwInstExts = glfwGetRequiredInstanceExtensions(&instExtsCount);
-    Assert(glfwInstExts != nullptr);
-
+    // Pick our instance extensions. Headless, Glfw isn't even initialized,
+    // and nothing needs a surface.
     auto& enabledInstExts = m_queriedInfo.enabledInstExts;
-    std::copy(&glfwInstExts[0],
-              &glfwInstExts[instExtsCount],
-              std::back_inserter(enabledInstExts));
+    if (!m_headless) {
+        instExtsCount = 0;
+        const char** glfwInstExts =
+            glfwGetRequiredInstanceExtensions(&instExtsCount);
+        Assert(glfwInstExts != nullptr);
+
+        std::copy(&glfwInstExts[0],
+                  &glfwInstExts[instExtsCount],
+                  std::back_inserter(enabledInstExts));
+    }
 
-    // Any extensions we want to add go here.
-    // Right now, it's just Glfw's required extensions.
+    // Optional. Lets us ask the device how much memory we're using.
+    for (const auto& properties : availableInstExts) {
+        if (strcmp(properties.extensionName,
+                   VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0) {
+            enabledInstExts.push_back(
+                VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+        }
+    }
 
     // Verify that our extension is available!
     for (const char* pExtName : enabledInstExts) {
@@ -298,7 +981,7 @@ VkResult Renderer::createInstance()
     }
 
     instanceInfo.enabledExtensionCount = as<uint32_t>(enabledInstExts.size());
-    instanceInfo.ppEnabledExtensionNames = &enabledInstExts[0];
+    instanceInfo.ppEnabledExtensionNames = enabledInstExts.data();
 
     for (const char* pInstExtName : enabledInstExts) {
         m_logger.append("\n    ");
@@ -398,10 +1081,98 @@ VkResult Renderer::createPhysicalDevice()
             deviceProperties.deviceName,
             m_logger.c_str());
         m_logger.clear();
+
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount,
+                                                 nullptr);
+        deviceInfo.queueFamilies.resize(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount,
+                                                 deviceInfo.queueFamilies.data());
+
+        deviceInfo.score = scorePhysicalDevice(deviceInfo);
+    }
+
+    // Rank every device, best first.
+    auto const& deviceInfos = m_queriedInfo.physicalDeviceInfos;
+    std::vector<size_t> ranking(deviceInfos.size());
+    for (size_t i = 0; i < ranking.size(); i += 1) {
+        ranking[i] = i;
+    }
+    std::stable_sort(ranking.begin(), ranking.end(),
+        [&](size_t lhs, size_t rhs) {
+            return deviceInfos[lhs].score > deviceInfos[rhs].score;
+        });
+
+    char line[256] = "";
+    for (size_t rank = 0; rank < ranking.size(); rank += 1) {
+        auto const& deviceInfo = deviceInfos[ranking[rank]];
+        auto const& score      = deviceInfo.score;
+        if (score.usable) {
+            snprintf(line, array_size(line),
+                     "\n    #%zu: [%zu] %s (%s, %llu MiB device local, "
+                     "%u extra(s))",
+                     rank + 1, ranking[rank],
+                     deviceInfo.properties.deviceName,
+                     ToCStr(deviceInfo.properties.deviceType),
+                     as<unsigned long long>(score.deviceLocalBytes /
+                                            (1024 * 1024)),
+                     score.extras);
+        } else {
+            snprintf(line, array_size(line),
+                     "\n    --: [%zu] %s (unusable: %s)",
+                     ranking[rank],
+                     deviceInfo.properties.deviceName,
+                     score.reason.c_str());
+        }
+        m_logger.append(line);
     }
+    Info("Physical device ranking:%s", m_logger.c_str());
+    m_logger.clear();
+
+    m_queriedInfo.physicalDeviceIndex = ranking[0];
+    AssertMsg(deviceInfos[ranking[0]].score.usable,
+              "No physical device can run the demo");
+
+    // An override by index, or by part of the name. We still refuse devices
+    // that can't run the demo at all.
+    if (!m_physicalDeviceOverride.empty()) {
+        char const* pOverride = m_physicalDeviceOverride.c_str();
+        size_t      found     = SIZE_MAX;
+
+        char* pEnd  = nullptr;
+        unsigned long index = strtoul(pOverride, &pEnd, 10);
+        if (pEnd != pOverride && *pEnd == '\0') {
+            if (index < deviceInfos.size()) {
+                found = index;
+            }
+        } else {
+            std::string wanted = pOverride;
+            for (char& c : wanted) {
+                c = as<char>(tolower(c));
+            }
+            for (size_t i = 0; i < deviceInfos.size() && found == SIZE_MAX; i += 1) {
+                std::string name = deviceInfos[i].properties.deviceName;
+                for (char& c : name) {
+                    c = as<char>(tolower(c));
+                }
+                if (name.find(wanted) != std::string::npos) {
+                    found = i;
+                }
+            }
+        }
 
-    // Pretend we did something more involved here.
-    m_queriedInfo.physicalDeviceIndex = 0;
+        if (found == SIZE_MAX) {
+            Bug("No physical device matches '%s'", pOverride);
+        } else if (!deviceInfos[found].score.usable) {
+            Bug("'%s' matches '%s', but it can't be used: %s",
+                pOverride,
+                deviceInfos[found].properties.deviceName,
+                deviceInfos[found].score.reason.c_str());
+        } else {
+            Info("Physical device overridden by '%s'", pOverride);
+            m_queriedInfo.physicalDeviceIndex = found;
+        }
+    }
 
     m_vkPhysicalDevice = physicalDevices[m_queriedInfo.physicalDeviceIndex];
     Assert(m_vkPhysicalDevice != nullptr);
@@ -419,13 +1190,104 @@ VkResult Renderer::createPhysicalDevice()
     return result;
 }
 
+bool PhysicalDeviceScore::operator>(PhysicalDeviceScore const& other) const
+{
+    if (usable != other.usable) {
+        return usable;
+    }
+    if (typeRank != other.typeRank) {
+        return typeRank > other.typeRank;
+    }
+    if (deviceLocalBytes != other.deviceLocalBytes) {
+        return deviceLocalBytes > other.deviceLocalBytes;
+    }
+    return extras > other.extras;
+}
+
+PhysicalDeviceScore Renderer::scorePhysicalDevice(
+    QueriedVulkanInfo::PhysicalDeviceInfo const& deviceInfo) const
+{
+    PhysicalDeviceScore score;
+
+    switch (deviceInfo.properties.deviceType) {
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:   score.typeRank = 4; break;
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: score.typeRank = 3; break;
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:    score.typeRank = 2; break;
+        case VK_PHYSICAL_DEVICE_TYPE_CPU:            score.typeRank = 1; break;
+        default:                                     score.typeRank = 0; break;
+    }
+
+    // Integrated GPUs report system memory as device local, so this only
+    // breaks ties within a type.
+    auto const& memoryProperties = deviceInfo.memoryProperties;
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i += 1) {
+        if (memoryProperties.memoryHeaps[i].flags &
+            VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+            score.deviceLocalBytes += memoryProperties.memoryHeaps[i].size;
+        }
+    }
+
+    auto hasExtension = [&](const char* pName) {
+        for (auto const& extension : deviceInfo.availableDeviceExts) {
+            if (strcmp(extension.extensionName, pName) == 0) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // Requirements
+    if (!m_headless && !hasExtension(VK_KHR_SWAPCHAIN_EXTENSION_NAME)) {
+        score.reason = "no " VK_KHR_SWAPCHAIN_EXTENSION_NAME;
+        return score;
+    }
+    if (!deviceInfo.features.shaderClipDistance) {
+        score.reason = "no shaderClipDistance";
+        return score;
+    }
+
+    bool canPresent      = false;
+    bool hasAsyncCompute = false;
+    for (uint32_t i = 0; i < deviceInfo.queueFamilies.size(); i += 1) {
+        VkQueueFlags flags = deviceInfo.queueFamilies[i].queueFlags;
+        if ((flags & VK_QUEUE_GRAPHICS_BIT) &&
+            (m_headless ||
+             glfwGetPhysicalDevicePresentationSupport(m_vkInstance,
+                                                      deviceInfo.device, i))) {
+            canPresent = true;
+        }
+        if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+            hasAsyncCompute = true;
+        }
+    }
+    if (!canPresent) {
+        score.reason = m_headless ? "no graphics queue"
+                                  : "no graphics queue that can present";
+        return score;
+    }
+    score.usable = true;
+
+    // Nice-to-haves
+    score.extras += hasAsyncCompute ? 1 : 0;
+    score.extras += deviceInfo.features.multiDrawIndirect ? 1 : 0;
+    score.extras += deviceInfo.features.drawIndirectFirstInstance ? 1 : 0;
+    score.extras +=
+        hasExtension(VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME) ? 1 : 0;
+    score.extras +=
+        hasExtension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) ? 1 : 0;
+
+    return score;
+}
+
 VkResult Renderer::createDevice()
 {
     VkResult result = VK_SUCCESS;
 
     // Choose device extensions
     auto& enabledExts = m_queriedInfo.enabledDeviceExts;
-    enabledExts.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    if (!m_headless) {
+        enabledExts.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    }
 
     if (OS_MACOS) {
         // TODO: Runtime vendor checks
@@ -433,8 +1295,45 @@ VkResult Renderer::createDevice()
         enabledExts.push_back("VK_AMD_negative_viewport_height");
     }
 
-    if (OS_WINDOWS) {
-         enabledExts.push_back("VK_KHR_maintenance1");
+    // Optional. Descriptors falls back to vkUpdateDescriptorSets without it.
+    // GPU culling falls back to uncompacted draws. The memory budget needs
+    // an instance extension too. Without maintenance1, a full descriptor
+    // pool can't say so, and looks like it's out of memory instead.
+    bool hasProperties2 = false;
+    for (const char* pExtName : m_queriedInfo.enabledInstExts) {
+        if (strcmp(pExtName,
+                   VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0) {
+            hasProperties2 = true;
+        }
+    }
+    auto const& deviceInfo =
+        m_queriedInfo.physicalDeviceInfos[m_queriedInfo.physicalDeviceIndex];
+    for (const auto& extension : deviceInfo.availableDeviceExts) {
+        if (strcmp(extension.extensionName,
+                   VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME) == 0) {
+            enabledExts.push_back(
+                VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME);
+            m_hasUpdateTemplates = true;
+        }
+        if (strcmp(extension.extensionName, "VK_KHR_maintenance1") == 0) {
+            enabledExts.push_back("VK_KHR_maintenance1");
+            m_hasMaintenance1 = true;
+        }
+        if (strcmp(extension.extensionName,
+                   VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0) {
+            enabledExts.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+            m_hasDrawIndirectCount = true;
+        }
+        if (strcmp(extension.extensionName,
+                   VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0 &&
+            hasProperties2) {
+            enabledExts.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+            m_pfnGetMemoryProperties2 =
+                reinterpret_cast<PFN_vkGetPhysicalDeviceMemoryProperties2KHR>(
+                    vkGetInstanceProcAddr(
+                        m_vkInstance,
+                        "vkGetPhysicalDeviceMemoryProperties2KHR"));
+        }
     }
 
     Info("Using %d device extensions", enabledExts.size());
@@ -478,29 +1377,70 @@ VkResult Renderer::createDevice()
 
     // Select a graphics queue (by index)
     for (uint32_t i = 0; i < queueFamilies.size(); i += 1) {
-        // Take the first graphics queue that we find.
-        if (queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+        // Take the first graphics queue that we can present from.
+        if ((queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) &&
+            (m_headless ||
+             glfwGetPhysicalDevicePresentationSupport(m_vkInstance,
+                                                      m_vkPhysicalDevice, i))) {
             m_vkGraphicsQueueIndex = i;
             break;
         }
     }
     Info("Using queue family #%d for graphics", m_vkGraphicsQueueIndex);
 
+    // Select a compute queue. A compute-only family is the best bet for
+    // running alongside graphics. Failing that, a second queue from the
+    // graphics family may still overlap. Failing that, share the graphics
+    // queue - it all still works, just in order.
+    m_vkComputeQueueIndex = m_vkGraphicsQueueIndex;
+    uint32_t computeQueueSlot = 0;
+    if (m_asyncCompute) {
+        for (uint32_t i = 0; i < queueFamilies.size(); i += 1) {
+            if ((queueFamilies[i].queueFlags & VK_QUEUE_COMPUTE_BIT) &&
+                !(queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+                m_vkComputeQueueIndex = i;
+                break;
+            }
+        }
+        if (m_vkComputeQueueIndex == m_vkGraphicsQueueIndex &&
+            queueFamilies[m_vkGraphicsQueueIndex].queueCount > 1) {
+            computeQueueSlot = 1;
+        }
+    }
+    if (m_vkComputeQueueIndex != m_vkGraphicsQueueIndex) {
+        Info("Using queue family #%d for async compute", m_vkComputeQueueIndex);
+    } else if (computeQueueSlot != 0) {
+        Info("Using a second queue from family #%d for async compute",
+             m_vkComputeQueueIndex);
+    } else {
+        Info("Compute shares the graphics queue");
+    }
+
     // Actually create the device
-    VkDeviceQueueCreateInfo queueInfo = {};
-    queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    queueInfo.queueFamilyIndex = m_vkGraphicsQueueIndex;
-    queueInfo.queueCount       = 1;
-    const float queuePriority  = 1.0f;
-    queueInfo.pQueuePriorities = &queuePriority;
+    const float queuePriorities[2] = { 1.0f, 1.0f };
+
+    VkDeviceQueueCreateInfo queueInfos[2] = {};
+    uint32_t queueInfoCount = 1;
+    queueInfos[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueInfos[0].queueFamilyIndex = m_vkGraphicsQueueIndex;
+    queueInfos[0].queueCount       = 1 + computeQueueSlot;
+    queueInfos[0].pQueuePriorities = queuePriorities;
+    if (m_vkComputeQueueIndex != m_vkGraphicsQueueIndex) {
+        queueInfos[1].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queueInfos[1].queueFamilyIndex = m_vkComputeQueueIndex;
+        queueInfos[1].queueCount       = 1;
+        queueInfos[1].pQueuePriorities = queuePriorities;
+        queueInfoCount += 1;
+    }
 
     VkPhysicalDeviceFeatures features = {};
     features.shaderClipDistance = VK_TRUE;
+    features.multiDrawIndirect  = deviceInfo.features.multiDrawIndirect;
 
     VkDeviceCreateInfo deviceCreateInfo = {};
     deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    deviceCreateInfo.queueCreateInfoCount    = 1;
-    deviceCreateInfo.pQueueCreateInfos       = &queueInfo;
+    deviceCreateInfo.queueCreateInfoCount    = queueInfoCount;
+    deviceCreateInfo.pQueueCreateInfos       = queueInfos;
     deviceCreateInfo.enabledLayerCount       = as<uint32_t>(m_layers.size());
     deviceCreateInfo.ppEnabledLayerNames     = m_layers.data();
     deviceCreateInfo.enabledExtensionCount   = as<uint32_t>(enabledExts.size());
@@ -516,35 +1456,83 @@ VkResult Renderer::createDevice()
 
     vkGetDeviceQueue(m_vkDevice,
                      m_vkGraphicsQueueIndex,
-                     0, // We only made 1
+                     0, // Graphics always gets the first one
                      &m_vkGraphicsQueue);
     Assert(m_vkGraphicsQueue != nullptr);
 
+    vkGetDeviceQueue(m_vkDevice,
+                     m_vkComputeQueueIndex,
+                     computeQueueSlot,
+                     &m_vkComputeQueue);
+    Assert(m_vkComputeQueue != nullptr);
+
     return result;
 }
 
 VkResult Renderer::createFencesAndSemaphores()
 {
-    VkResult result;
+    VkResult result = VK_SUCCESS;
+
+    // Fences start signaled, so the first wait on each frame returns at once.
     VkFenceCreateInfo fenceInfo = {};
     fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fenceInfo.flags = 0;
-    result = vkCreateFence(m_vkDevice, &fenceInfo, getVkAlloc(),
-                           &m_vkAcquireFence);
-    AssertVk(result);
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
     VkSemaphoreCreateInfo semaphoreInfo = {};
     semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
     semaphoreInfo.flags = 0;
-    result = vkCreateSemaphore(m_vkDevice, &semaphoreInfo, getVkAlloc(),
-                               &m_vkRenderSemaphore);
-    AssertVk(result);
 
-    return result;
-}
+    for (uint32_t i = 0; i < kFramesInFlight; i += 1) {
+        result = vkCreateFence(m_vkDevice, &fenceInfo, getVkAlloc(),
+                               &m_vkFrameFences[i]);
+        AssertVk(result);
 
-VkResult Renderer::createSwapChain()
-{
+        result = vkCreateSemaphore(m_vkDevice, &semaphoreInfo, getVkAlloc(),
+                                   &m_vkAcquireSemaphores[i]);
+        AssertVk(result);
+
+        result = vkCreateSemaphore(m_vkDevice, &semaphoreInfo, getVkAlloc(),
+                                   &m_vkRenderSemaphores[i]);
+        AssertVk(result);
+    }
+
+    return result;
+}
+
+VkResult Renderer::createTimestampQueries()
+{
+    VkResult result = VK_SUCCESS;
+
+    // Not every queue can write timestamps. Without them, GPU frame times
+    // are just unknown.
+    auto const& deviceInfo =
+        m_queriedInfo.physicalDeviceInfos[m_queriedInfo.physicalDeviceIndex];
+    uint32_t validBits =
+        m_queriedInfo.queueFamilies[m_vkGraphicsQueueIndex].timestampValidBits;
+    if (validBits == 0) {
+        Info("The graphics queue can't write timestamps, so GPU frame times "
+             "are unknown");
+        return result;
+    }
+    m_timestampMask     = validBits >= 64 ? UINT64_MAX
+                                          : (1ull << validBits) - 1;
+    m_timestampPeriodNs = deviceInfo.properties.limits.timestampPeriod;
+
+    // Two per frame in flight, one at each end.
+    VkQueryPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType  = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = 2 * kFramesInFlight;
+
+    result = vkCreateQueryPool(m_vkDevice, &poolInfo, getVkAlloc(),
+                               &m_vkTimestampPool);
+    AssertVk(result);
+
+    return result;
+}
+
+VkResult Renderer::createSwapChain()
+{
     VkResult result;
 
     // Query a bunch of stuff about the surface
@@ -597,6 +1585,16 @@ VkResult Renderer::createSwapChain()
                                                        surfacePresentModes.data());
     AssertVk(result);
 
+    // The surface's size wins, unless it lets the swapchain decide.
+    if (surfaceCapabilities.currentExtent.width != UINT32_MAX) {
+        m_framebufferExtent = surfaceCapabilities.currentExtent;
+    }
+    // Minimized since the resize was asked for. Keep the old swapchain until
+    // there's a size to give the new one.
+    if (m_framebufferExtent.width == 0 || m_framebufferExtent.height == 0) {
+        return VK_SUCCESS;
+    }
+
     // And then use FIFO anyway.
     AssertMsg(std::find(std::begin(surfacePresentModes),
                         std::end(surfacePresentModes),
@@ -612,7 +1610,7 @@ VkResult Renderer::createSwapChain()
     swapchainInfo.minImageCount    = 3;
     swapchainInfo.imageFormat      = VK_FORMAT_B8G8R8A8_UNORM;
     swapchainInfo.imageColorSpace  = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
-    swapchainInfo.imageExtent      = surfaceCapabilities.currentExtent;
+    swapchainInfo.imageExtent      = m_framebufferExtent;
     swapchainInfo.imageArrayLayers = 1;
     swapchainInfo.imageUsage       = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
     swapchainInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
@@ -620,14 +1618,18 @@ VkResult Renderer::createSwapChain()
     swapchainInfo.compositeAlpha   = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     swapchainInfo.presentMode      = presentMode;
     swapchainInfo.clipped          = VK_TRUE;
-    swapchainInfo.oldSwapchain     = nullptr;
+    swapchainInfo.oldSwapchain     = m_vkSwapchain;
 
+    // Resizing retires the old swapchain. Anything it still had queued
+    // finishes presenting first.
+    VkSwapchainKHR oldSwapchain = m_vkSwapchain;
     result = vkCreateSwapchainKHR(m_vkDevice,
                                   &swapchainInfo,
                                   nullptr,
                                   &m_vkSwapchain);
     AssertVk(result);
     Assert(m_vkSwapchain != nullptr);
+    vkDestroySwapchainKHR(m_vkDevice, oldSwapchain, nullptr);
 
     return result;
 }
@@ -637,15 +1639,21 @@ VkResult Renderer::createPresentImages()
     VkResult result;
 
     // VkImage
-    uint32_t n_images = 0;
-    result = vkGetSwapchainImagesKHR(m_vkDevice, m_vkSwapchain, &n_images,
-                                     nullptr);
-    AssertMsg(n_images == Renderer::N,
-              "Expected %d present images, but got %d", Renderer::N, n_images);
-    AssertVk(result);
-    result = vkGetSwapchainImagesKHR(m_vkDevice, m_vkSwapchain, &n_images,
-                                     &m_vkPresentImages[0]);
-    AssertVk(result);
+    if (m_headless) {
+        result = createOffscreenImages();
+        AssertVk(result);
+    } else {
+        uint32_t n_images = 0;
+        result = vkGetSwapchainImagesKHR(m_vkDevice, m_vkSwapchain, &n_images,
+                                         nullptr);
+        AssertMsg(n_images == Renderer::N,
+                  "Expected %d present images, but got %d", Renderer::N,
+                  n_images);
+        AssertVk(result);
+        result = vkGetSwapchainImagesKHR(m_vkDevice, m_vkSwapchain, &n_images,
+                                         &m_vkPresentImages[0]);
+        AssertVk(result);
+    }
 
     VkImageViewCreateInfo viewInfo = {};
     viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -672,6 +1680,73 @@ VkResult Renderer::createPresentImages()
     return result;
 }
 
+void Renderer::destroyPresentImages()
+{
+    // Swapchain images belong to the swapchain, but their views are ours.
+    for (uint32_t i = 0; i < N; i += 1) {
+        vkDestroyImageView(m_vkDevice, m_vkPresentImageViews[i], nullptr);
+        m_vkPresentImageViews[i] = nullptr;
+        if (m_headless) {
+            vkDestroyImage(m_vkDevice, m_vkPresentImages[i], nullptr);
+            vkFreeMemory(m_vkDevice, m_vkOffscreenMemory[i], nullptr);
+            m_vkOffscreenMemory[i] = nullptr;
+        }
+        m_vkPresentImages[i] = nullptr;
+    }
+}
+
+VkResult Renderer::createOffscreenImages()
+{
+    VkResult result = VK_SUCCESS;
+
+    // Like the swapchain's, so the render graph can't tell the difference.
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType     = VK_IMAGE_TYPE_2D;
+    imageInfo.format        = VK_FORMAT_B8G8R8A8_UNORM;
+    imageInfo.extent.width  = m_framebufferExtent.width;
+    imageInfo.extent.height = m_framebufferExtent.height;
+    imageInfo.extent.depth  = 1;
+    imageInfo.mipLevels     = 1;
+    imageInfo.arrayLayers   = 1;
+    imageInfo.samples       = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling        = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage         = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                              VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    imageInfo.sharingMode   = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    for (uint32_t i = 0; i < N; i += 1) {
+        result = vkCreateImage(m_vkDevice, &imageInfo, nullptr,
+                               &m_vkPresentImages[i]);
+        AssertVk(result);
+
+        VkMemoryRequirements memReq = {};
+        vkGetImageMemoryRequirements(m_vkDevice, m_vkPresentImages[i], &memReq);
+
+        VkMemoryAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize  = memReq.size;
+        allocInfo.memoryTypeIndex =
+            findMemoryType(memReq.memoryTypeBits,
+                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        AssertMsg(allocInfo.memoryTypeIndex != VK_MAX_MEMORY_TYPES,
+                  "No memory type for the offscreen images");
+
+        result = vkAllocateMemory(m_vkDevice, &allocInfo, nullptr,
+                                  &m_vkOffscreenMemory[i]);
+        AssertVk(result);
+
+        result = vkBindImageMemory(m_vkDevice, m_vkPresentImages[i],
+                                   m_vkOffscreenMemory[i], 0);
+        AssertVk(result);
+    }
+
+    Info("Rendering headless, into %u offscreen %u x %u images", N,
+         m_framebufferExtent.width, m_framebufferExtent.height);
+    return result;
+}
+
 VkResult Renderer::createCommandPool()
 {
     VkResult result;
@@ -684,185 +1759,1006 @@ VkResult Renderer::createCommandPool()
 
     result = vkCreateCommandPool(m_vkDevice, &poolInfo, nullptr,
                                  &m_vkCommandPool);
+    AssertVk(result);
+
+    // Each frame in flight re-records its own command buffer.
+    VkCommandBufferAllocateInfo cmdBufAllocInfo = {};
+    cmdBufAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    cmdBufAllocInfo.commandPool        = m_vkCommandPool;
+    cmdBufAllocInfo.level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    cmdBufAllocInfo.commandBufferCount = kFramesInFlight;
+
+    result = vkAllocateCommandBuffers(m_vkDevice, &cmdBufAllocInfo,
+                                      m_vkFrameCmdBuffers);
+    AssertVk(result);
 
     return result;
 }
 
-VkResult Renderer::createDepthBuffer(VkExtent3D const& extent)
+VkResult Renderer::createRenderGraph(VkExtent2D const& extent)
 {
     VkResult result;
 
-    // m_vkDepthImage
-    VkImageCreateInfo imageInfo = {};
-    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-    imageInfo.imageType     = VK_IMAGE_TYPE_2D;
-    imageInfo.extent        = extent;
-    imageInfo.mipLevels     = 1;
-    imageInfo.arrayLayers   = 1;
-    imageInfo.format        = VK_FORMAT_D32_SFLOAT;
-    imageInfo.tiling        = VK_IMAGE_TILING_OPTIMAL;
-    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    imageInfo.usage         = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-    imageInfo.samples       = VK_SAMPLE_COUNT_1_BIT;
-    imageInfo.sharingMode   = VK_SHARING_MODE_EXCLUSIVE;
+    RenderGraphInfo graphInfo = {};
+    graphInfo.device           = m_vkDevice;
+    graphInfo.pAlloc           = getVkAlloc();
+    graphInfo.memoryProperties =
+        m_queriedInfo.physicalDeviceInfos[m_queriedInfo.physicalDeviceIndex]
+            .memoryProperties;
+    m_renderGraph.init(graphInfo);
+
+    // The swapchain image is only ours once the acquire semaphore has been
+    // waited on, at COLOR_ATTACHMENT_OUTPUT. After us, it's presented.
+    // Headless, it's left ready to copy out.
+    RgImageDesc backbufferDesc = {};
+    backbufferDesc.format = VK_FORMAT_B8G8R8A8_UNORM;
+    backbufferDesc.extent = extent;
+
+    RgImportInfo backbufferImport = {};
+    backbufferImport.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    backbufferImport.initialStages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    backbufferImport.initialAccess = 0;
+    backbufferImport.finalLayout   = m_headless
+                                         ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                         : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    backbufferImport.finalStages   = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+    backbufferImport.finalAccess   = 0;
+
+    m_rgBackbuffer = m_renderGraph.importImage("Backbuffer", backbufferDesc,
+                                               backbufferImport);
+
+    // Without occlusion culling or a depth prepass, nothing else touches
+    // depth, so the graph makes it a lazily allocated transient attachment.
+    // On tiled GPUs, it never touches memory.
+    RgImageDesc depthDesc = {};
+    depthDesc.format = chooseDepthFormat(m_vkPhysicalDevice, m_depthPrecision);
+    depthDesc.extent = extent;
+    m_rgDepth = m_renderGraph.createImage("Depth", depthDesc);
+
+    // The depth pyramid is built by sampling it.
+    if (m_occlusionCulling) {
+        VkFormatProperties properties = {};
+        vkGetPhysicalDeviceFormatProperties(m_vkPhysicalDevice,
+                                            depthDesc.format, &properties);
+        if ((properties.optimalTilingFeatures &
+             VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) == 0) {
+            Info("Occlusion culling is off, depth format %d can't be sampled",
+                 depthDesc.format);
+            m_occlusionCulling = false;
+        }
+    }
 
-    result = vkCreateImage(m_vkDevice, &imageInfo, nullptr, &m_vkDepthImage);
-    AssertVk(result);
+    VkClearColorValue clearColor = {};
+    clearColor.float32[0] = 1.f;
+    clearColor.float32[1] = 0.f;
+    clearColor.float32[2] = 1.f;
+    clearColor.float32[3] = 0.f;
+
+    // A depth prepass lays down the nearest depth first, so shading only runs
+    // once per pixel. The mesh passes after it test EQUAL, and don't write.
+    RgPass*  pDepthPass    = nullptr;
+    RgLoadOp meshDepthLoad = m_depthPrepass ? RgLoadOp::Load : RgLoadOp::Clear;
+    bool     meshDepthWrite = !m_depthPrepass;
+
+    if (!m_occlusionCulling) {
+        if (m_depthPrepass) {
+            pDepthPass = &m_renderGraph.addPass("Depth Prepass")
+                .depth(m_rgDepth, RgLoadOp::Clear, { 1.f, 0 })
+                .execute([this](RgPassContext const& context) {
+                    recordMeshPass(context, CullPhase::All, true);
+                });
+        }
 
-    // Allocate
-    VkMemoryRequirements memReq = {};
-    vkGetImageMemoryRequirements(m_vkDevice, m_vkDepthImage, &memReq);
+        m_pMeshPass = &m_renderGraph.addPass("Mesh")
+            .color(m_rgBackbuffer, RgLoadOp::Clear, clearColor)
+            .depth(m_rgDepth, meshDepthLoad, { 1.f, 0 }, meshDepthWrite)
+            .execute([this](RgPassContext const& context) {
+                recordMeshPass(context, CullPhase::All);
+            });
+    } else {
+        // Draw what was visible last frame, build a depth pyramid from it,
+        // then draw whatever that shows we missed. Culling only touches
+        // buffers, which GpuCulling does its own barriers for.
+        m_renderGraph.addPass("Cull Early")
+            .sideEffects()
+            .execute([this](RgPassContext const& context) {
+                CullParams params = makeCullParams(m_viewProjection, m_eye,
+                                                   m_gpuCulling.objectCount());
+                m_gpuCulling.record(context.cmd, CullPhase::Early, params);
+            });
 
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize  = memReq.size;
-    allocInfo.memoryTypeIndex = VK_MAX_MEMORY_TYPES;
+        if (m_depthPrepass) {
+            pDepthPass = &m_renderGraph.addPass("Depth Prepass Early")
+                .depth(m_rgDepth, RgLoadOp::Clear, { 1.f, 0 })
+                .execute([this](RgPassContext const& context) {
+                    recordMeshPass(context, CullPhase::Early, true);
+                });
+        }
 
-    // TODO: This should be a function.
-    {
-        VkPhysicalDeviceMemoryProperties memoryProperties = {};
-        vkGetPhysicalDeviceMemoryProperties(m_vkPhysicalDevice,
-                                            &memoryProperties);
-        for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
-            // Use the first memory type that works.
-            if (memReq.memoryTypeBits & (1u << i)) {
-                allocInfo.memoryTypeIndex = i;
-                break;
-            }
+        m_pMeshPass = &m_renderGraph.addPass("Mesh Early")
+            .color(m_rgBackbuffer, RgLoadOp::Clear, clearColor)
+            .depth(m_rgDepth, meshDepthLoad, { 1.f, 0 }, meshDepthWrite)
+            .execute([this](RgPassContext const& context) {
+                recordMeshPass(context, CullPhase::Early);
+            });
+
+        m_renderGraph.addPass("Depth Pyramid")
+            .read(m_rgDepth, RgUsage::SampledCompute)
+            .sideEffects()
+            .execute([this](RgPassContext const& context) {
+                m_depthPyramid.record(context.cmd,
+                                      m_renderGraph.sampledView(m_rgDepth));
+            });
+
+        m_renderGraph.addPass("Cull Late")
+            .sideEffects()
+            .execute([this](RgPassContext const& context) {
+                CullParams params = makeCullParams(m_viewProjection, m_eye,
+                                                   m_gpuCulling.objectCount());
+                params.depthWidth  = as<float>(m_framebufferExtent.width);
+                params.depthHeight = as<float>(m_framebufferExtent.height);
+
+                VkDescriptorImageInfo pyramid = {};
+                pyramid.sampler     = m_depthPyramid.sampler();
+                pyramid.imageView   = m_depthPyramid.view();
+                pyramid.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+                m_gpuCulling.record(context.cmd, CullPhase::Late, params,
+                                    &pyramid);
+            });
+
+        if (m_depthPrepass) {
+            m_renderGraph.addPass("Depth Prepass Late")
+                .depth(m_rgDepth, RgLoadOp::Load)
+                .execute([this](RgPassContext const& context) {
+                    recordMeshPass(context, CullPhase::Late, true);
+                });
         }
-        AssertMsg(allocInfo.memoryTypeIndex < memoryProperties.memoryTypeCount,
-                  "Couldn't find a valid memory type index");
+
+        // The render passes only differ in load ops and layouts, so they're
+        // compatible, and the same pipelines work in both.
+        m_renderGraph.addPass("Mesh Late")
+            .color(m_rgBackbuffer, RgLoadOp::Load)
+            .depth(m_rgDepth, RgLoadOp::Load, { 1.f, 0 }, meshDepthWrite)
+            .execute([this](RgPassContext const& context) {
+                recordMeshPass(context, CullPhase::Late);
+            });
     }
-    result = vkAllocateMemory(m_vkDevice, &allocInfo, nullptr,
-                              &m_vkDepthDeviceMemory);
+
+    result = m_renderGraph.compile();
     AssertVk(result);
 
-    constexpr VkDeviceSize memoryOffset = 0;
-    result = vkBindImageMemory(m_vkDevice, m_vkDepthImage, m_vkDepthDeviceMemory,
-                               memoryOffset);
+    // Pipelines are created against it.
+    m_vkRenderPass      = m_renderGraph.renderPass(*m_pMeshPass);
+    m_meshPassClass     = m_renderGraph.renderPassClass(*m_pMeshPass);
+    m_vkDepthRenderPass = pDepthPass != nullptr
+                              ? m_renderGraph.renderPass(*pDepthPass)
+                              : nullptr;
+    m_depthPassClass    = pDepthPass != nullptr
+                              ? m_renderGraph.renderPassClass(*pDepthPass)
+                              : 0;
+
+    return result;
+}
+
+VkResult Renderer::rebuildRenderGraph()
+{
+    VkResult result;
+
+    // The new render passes are usually compatible with the old ones, so
+    // the pipelines don't need recompiling. If they aren't, frames still
+    // need something to fall back on.
+    m_renderGraph.deInit();
+    result = createRenderGraph(m_framebufferExtent);
     AssertVk(result);
+    m_meshPipelines.setRenderPass(m_vkRenderPass, m_meshPassClass);
+    if (m_meshPipelines.get(m_meshReadyVariant) == nullptr) {
+        Bug("Couldn't create the mesh pipeline");
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    if (m_depthPrepass) {
+        result = createDepthPipelines();
+        AssertVk(result);
+    }
 
-    // m_vkDepthImageView
-    VkImageViewCreateInfo viewInfo = {};
-    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    return result;
+}
+
+void Renderer::beginStartupReads()
+{
+    AsyncReadRequest request;
+    request.onComplete = [this](AsyncReadResult& result) {
+        if (result.error == 0) {
+            std::string filename = result.filename;
+            m_startupFiles[filename] = std::move(result);
+        }
+    };
+
+    std::vector<AsyncReadRequest> requests;
+    for (const char* pFilename : kStartupShaders) {
+        // Archived shaders are already mapped.
+        if (m_pAssets != nullptr && m_pAssets->find(pFilename) != nullptr) {
+            continue;
+        }
+        request.filename = pFilename;
+        requests.push_back(request);
+    }
+    // There's no cache until the first run saves one.
+    if (AsyncFileReader::fileSize(kPipelineCacheFilename) != 0) {
+        request.filename = kPipelineCacheFilename;
+        requests.push_back(request);
+    }
+
+    // Deep enough that the whole batch goes out in one submit.
+    m_startupReader.init(as<uint32_t>(requests.size()), m_pJobs);
+    for (AsyncReadRequest& pending : requests) {
+        m_startupReader.enqueue(std::move(pending));
+    }
+    uint32_t submitted = m_startupReader.submit();
+    Info("Reading %u startup file(s)", submitted);
+}
 
-    viewInfo.flags    = 0;
-    viewInfo.image    = m_vkDepthImage;
-    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    viewInfo.format   = VK_FORMAT_D32_SFLOAT;
+void Renderer::finishStartupReads()
+{
+    m_startupReader.waitAll();
+    m_startupReader.deInit();
+}
 
-    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-    viewInfo.subresourceRange.levelCount = 1;
-    viewInfo.subresourceRange.layerCount = 1;
+AsyncReadResult const* Renderer::startupFile(const char* pFilename) const
+{
+    auto it = m_startupFiles.find(pFilename);
+    return it != m_startupFiles.end() ? &it->second : nullptr;
+}
 
-    result = vkCreateImageView(m_vkDevice, &viewInfo, nullptr,
-                               &m_vkDepthImageView);
+VkResult Renderer::createShaderModule(const char*     pFilename,
+                                      VkShaderModule* pShaderModule)
+{
+    VkResult result;
+
+    // Vulkan copies the code during vkCreateShaderModule, so the bytes only
+    // need to live for the length of this function.
+    // Shaders are packed under the same relative path they're copied to, so
+    // 'pFilename' works as the archive name too.
+    AssetBlob blob;
+    FileView  spirv;
+    if (m_pAssets != nullptr) {
+        blob = m_pAssets->get(pFilename);
+    }
+    // Loose shaders init() needs were read in one batch.
+    AsyncReadResult const* pFile = startupFile(pFilename);
+    if (!blob.valid() && pFile != nullptr) {
+        blob.pData = pFile->ownedBuffer.data();
+        blob.size  = pFile->bytesRead;
+    }
+    if (!blob.valid()) {
+        if (!spirv.open(pFilename, FileAccess::Sequential)) {
+            Bug("Unable to load SPIR-V from '%s'", pFilename);
+            return VK_ERROR_INITIALIZATION_FAILED;
+        }
+        blob.pData = spirv.data();
+        blob.size  = spirv.size();
+    }
+    // SPIR-V is a stream of 32-bit words. Mapped memory, archive entries,
+    // decompressed blobs, and read buffers are all suitably aligned, so we
+    // only check the size.
+    AssertMsg(blob.size % sizeof(uint32_t) == 0,
+              "'%s' is not valid SPIR-V (%zu bytes)", pFilename, blob.size);
+
+    VkShaderModuleCreateInfo moduleInfo = {};
+    moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    moduleInfo.codeSize = blob.size;
+    moduleInfo.pCode    = ptr_as<const uint32_t>(blob.pData);
+
+    result = vkCreateShaderModule(m_vkDevice, &moduleInfo, getVkAlloc(),
+                                  pShaderModule);
     AssertVk(result);
 
     return result;
 }
 
-VkResult Renderer::createRenderPassAndFramebuffer(VkExtent3D const& extent)
+VkResult Renderer::createUniformBuffer()
 {
     VkResult result;
 
-    uint32_t attachmentCount = 0;
-
-    // Presentable Color Attachment
-    VkAttachmentDescription colorDesc = {};
-    colorDesc.format         = VK_FORMAT_B8G8R8A8_UNORM;
-    colorDesc.samples        = VK_SAMPLE_COUNT_1_BIT;
-    colorDesc.loadOp         = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    colorDesc.storeOp        = VK_ATTACHMENT_STORE_OP_STORE;
-    colorDesc.stencilLoadOp  = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    colorDesc.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    colorDesc.initialLayout  = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorDesc.finalLayout    = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-    VkAttachmentReference colorRef = {};
-    colorRef.attachment = attachmentCount;
-    colorRef.layout     = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-    attachmentCount += 1;
-
-    // Depth Attachment
-    VkAttachmentDescription depthDesc = {};
-    depthDesc.format         = VK_FORMAT_D32_SFLOAT;
-    depthDesc.samples        = VK_SAMPLE_COUNT_1_BIT;
-    depthDesc.loadOp         = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    depthDesc.storeOp        = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    depthDesc.stencilLoadOp  = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    depthDesc.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    depthDesc.initialLayout  = VK_IMAGE_LAYOUT_UNDEFINED;
-    depthDesc.finalLayout    = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-    VkAttachmentReference depthRef = {};
-    depthRef.attachment = attachmentCount;
-    depthRef.layout     = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-    attachmentCount += 1;
-
-    VkAttachmentReference colorRefs[] = {
-        colorRef,
+    VkPhysicalDeviceLimits const& limits =
+        m_queriedInfo.physicalDeviceInfos[m_queriedInfo.physicalDeviceIndex]
+                     .properties.limits;
+
+    // Prefer coherent memory. If there isn't any, we flush what we write,
+    // and flushes have to cover whole atoms.
+    VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    bool coherent = findMemoryType(~0u, properties) != VK_MAX_MEMORY_TYPES;
+    if (!coherent) {
+        properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    }
+
+    VkDeviceSize alignment = limits.minUniformBufferOffsetAlignment;
+    if (!coherent) {
+        // Both are powers of two, so the larger is a multiple of the smaller.
+        alignment = std::max(alignment, limits.nonCoherentAtomSize);
+    }
+    alignment = std::max<VkDeviceSize>(alignment, 1);
+
+    VkDeviceSize frameSize = UniformRing::frameSize(kUniformBytesPerFrame,
+                                                    alignment);
+
+    result = createBuffer(frameSize * kFramesInFlight,
+                          VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                          properties,
+                          &m_vkUniformBuffer,
+                          &m_vkUniformDeviceMemory);
+    AssertVk(result);
+
+    // Mapped for as long as the buffer lives.
+    void* pMapped = nullptr;
+    result = vkMapMemory(m_vkDevice, m_vkUniformDeviceMemory, 0, VK_WHOLE_SIZE,
+                         0, &pMapped);
+    AssertVk(result);
+
+    UniformRingInfo ringInfo;
+    ringInfo.device        = m_vkDevice;
+    ringInfo.memory        = m_vkUniformDeviceMemory;
+    ringInfo.pMapped       = pMapped;
+    ringInfo.coherent      = coherent;
+    ringInfo.frameCount    = kFramesInFlight;
+    ringInfo.bytesPerFrame = frameSize;
+    ringInfo.alignment     = alignment;
+    m_uniformRing.init(ringInfo);
+
+    Info("Uniform ring: %u x %llu bytes, %llu byte alignment, %s",
+         kFramesInFlight,
+         as<unsigned long long>(frameSize),
+         as<unsigned long long>(alignment),
+         coherent ? "coherent" : "flushed");
+
+    return result;
+}
+
+// One dynamic uniform buffer, and the material table. Draws differ only by
+// their dynamic offset, and the material their instance picks, so this one
+// set serves all of them.
+struct MeshSetData
+{
+    VkDescriptorBufferInfo uniforms;
+    VkDescriptorBufferInfo materials;
+};
+
+static MeshSetData makeMeshSetData(VkBuffer uniforms, VkBuffer materials)
+{
+    // The uniforms' range is one draw's worth. The dynamic offset picks
+    // which one.
+    MeshSetData data = {};
+    data.uniforms.buffer  = uniforms;
+    data.uniforms.offset  = 0;
+    data.uniforms.range   = sizeof(MeshUniforms);
+    data.materials.buffer = materials;
+    data.materials.offset = 0;
+    data.materials.range  = VK_WHOLE_SIZE;
+    return data;
+}
+
+// For meshes without materials. Plain white, and a few tints.
+static std::vector<MeshMaterial> defaultMaterials()
+{
+    static const float kTints[][3] = {
+        { 1.00f, 1.00f, 1.00f },
+        { 1.00f, 0.75f, 0.60f },
+        { 0.65f, 0.85f, 1.00f },
+        { 0.75f, 1.00f, 0.70f },
     };
 
-    VkSubpassDescription subpassDesc = {};
-    subpassDesc.pipelineBindPoint       = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    subpassDesc.colorAttachmentCount    = array_size(colorRefs);
-    subpassDesc.pColorAttachments       = colorRefs;
-    subpassDesc.pDepthStencilAttachment = &depthRef;
+    std::vector<MeshMaterial> materials(array_size(kTints));
+    for (uint32_t i = 0; i < materials.size(); i += 1) {
+        materials[i].baseColor =
+            glm::vec4(kTints[i][0], kTints[i][1], kTints[i][2], 1.f);
+    }
+    return materials;
+}
+
+VkResult Renderer::createDescriptorSet()
+{
+    VkResult result = VK_SUCCESS;
+
+    DescriptorsInfo descriptorsInfo = {};
+    descriptorsInfo.device          = m_vkDevice;
+    descriptorsInfo.pAlloc          = getVkAlloc();
+    descriptorsInfo.frameCount      = kFramesInFlight;
+    descriptorsInfo.updateTemplates = m_hasUpdateTemplates;
+    descriptorsInfo.poolErrors      = m_hasMaintenance1;
+    m_descriptors.init(descriptorsInfo);
+
+    DescriptorBinding bindings[2] = {};
+    bindings[0].binding = 0;
+    bindings[0].type    = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    bindings[0].count   = 1;
+    bindings[0].stages  = VK_SHADER_STAGE_VERTEX_BIT |
+                          VK_SHADER_STAGE_FRAGMENT_BIT;
+    bindings[0].offset  = offsetof(MeshSetData, uniforms);
+    bindings[0].stride  = sizeof(VkDescriptorBufferInfo);
+    bindings[1].binding = 1;
+    bindings[1].type    = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[1].count   = 1;
+    bindings[1].stages  = VK_SHADER_STAGE_FRAGMENT_BIT;
+    bindings[1].offset  = offsetof(MeshSetData, materials);
+    bindings[1].stride  = sizeof(VkDescriptorBufferInfo);
+
+    m_pMeshSetLayout = m_descriptors.getLayout(bindings, array_size(bindings));
+    m_vkDescriptorSetLayout = m_pMeshSetLayout->vkLayout;
+
+    // Something to draw with until a mesh brings its own.
+    std::vector<MeshMaterial> materials = defaultMaterials();
+    result = uploadMaterials(materials.data(), as<uint32_t>(materials.size()));
+    AssertVk(result);
+
+    return result;
+}
+
+VkResult Renderer::uploadMaterials(MeshMaterial const* pMaterials,
+                                   uint32_t            count)
+{
+    VkResult result;
+
+    Assert(count > 0);
+    VkDeviceSize size = count * sizeof(MeshMaterial);
+    VkPhysicalDeviceLimits const& limits =
+        m_queriedInfo.physicalDeviceInfos[m_queriedInfo.physicalDeviceIndex]
+                     .properties.limits;
+    AssertMsg(size <= limits.maxStorageBufferRange,
+              "%u materials don't fit in one storage buffer", count);
+
+    // The set is cached by the buffers in it, so the old table's set must be
+    // forgotten before its buffer is destroyed.
+    if (m_vkDescriptorSet != nullptr) {
+        MeshSetData old = makeMeshSetData(m_vkUniformBuffer, m_vkMaterialBuffer);
+        m_descriptors.invalidatePersistentSet(*m_pMeshSetLayout, &old);
+        m_vkDescriptorSet = nullptr;
+    }
+    destroyBuffer(&m_vkMaterialBuffer, &m_vkMaterialDeviceMemory);
+
+    result = uploadBuffer(pMaterials,
+                          size,
+                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                          &m_vkMaterialBuffer,
+                          &m_vkMaterialDeviceMemory);
+    AssertVk(result);
+    m_materialCount = count;
+
+    // A new table gets a new set. Draws pick it up from m_vkDescriptorSet.
+    MeshSetData data = makeMeshSetData(m_vkUniformBuffer, m_vkMaterialBuffer);
+    m_vkDescriptorSet = m_descriptors.getPersistentSet(*m_pMeshSetLayout, &data);
+
+    Info("Material table: %u materials, %llu bytes", count,
+         as<unsigned long long>(size));
+
+    return result;
+}
+
+VkResult Renderer::createPipelineCache()
+{
+    VkResult result;
 
-    VkAttachmentDescription attachmentDescs[] = {
-        colorDesc,
-        depthDesc,
+    // Seed the cache with last run's pipelines, if they were built by this
+    // device and driver. The header layout is defined by the Vulkan spec.
+    struct CacheHeader
+    {
+        uint32_t    headerSize;
+        uint32_t    headerVersion;
+        uint32_t    vendorID;
+        uint32_t    deviceID;
+        uint8_t     pipelineCacheUUID[VK_UUID_SIZE];
     };
-    Assert(attachmentCount == array_size(attachmentDescs));
 
-    VkSubpassDescription subpasses[] = {
-        subpassDesc,
+    VkPhysicalDeviceProperties const& properties =
+        m_queriedInfo.physicalDeviceInfos[m_queriedInfo.physicalDeviceIndex]
+                     .properties;
+
+    AsyncReadResult const* pCacheFile   = startupFile(kPipelineCacheFilename);
+    bool                   useCacheFile = false;
+    if (pCacheFile != nullptr && pCacheFile->bytesRead >= sizeof(CacheHeader)) {
+        auto const* pHeader =
+            ptr_as<const CacheHeader>(pCacheFile->ownedBuffer.data());
+        useCacheFile =
+            pHeader->headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+            pHeader->vendorID      == properties.vendorID &&
+            pHeader->deviceID      == properties.deviceID &&
+            memcmp(pHeader->pipelineCacheUUID,
+                   properties.pipelineCacheUUID,
+                   VK_UUID_SIZE) == 0;
+        if (!useCacheFile) {
+            Info("Ignoring '%s', it's from another device or driver",
+                 kPipelineCacheFilename);
+        }
+    }
+
+    VkPipelineCacheCreateInfo cacheInfo = {};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    if (useCacheFile) {
+        cacheInfo.initialDataSize = pCacheFile->bytesRead;
+        cacheInfo.pInitialData    = pCacheFile->ownedBuffer.data();
+        Info("Loaded %llu byte pipeline cache",
+             as<unsigned long long>(pCacheFile->bytesRead));
+    }
+
+    result = vkCreatePipelineCache(m_vkDevice, &cacheInfo, getVkAlloc(),
+                                   &m_vkPipelineCache);
+    AssertVk(result);
+
+    return result;
+}
+
+void Renderer::savePipelineCache()
+{
+    if (m_vkPipelineCache == nullptr) {
+        return;
+    }
+
+    size_t size = 0;
+    VkResult result = vkGetPipelineCacheData(m_vkDevice, m_vkPipelineCache,
+                                             &size, nullptr);
+    if (result != VK_SUCCESS || size == 0) {
+        return;
+    }
+
+    std::vector<uint8_t> data(size);
+    result = vkGetPipelineCacheData(m_vkDevice, m_vkPipelineCache,
+                                    &size, data.data());
+    if (result != VK_SUCCESS) {
+        Bug("vkGetPipelineCacheData() -> %s", ToCStr(result));
+        return;
+    }
+
+    FILE* pFile = fopen(kPipelineCacheFilename, "wb");
+    if (pFile == nullptr) {
+        Bug("Unable to write '%s'", kPipelineCacheFilename);
+        return;
+    }
+    fwrite(data.data(), 1, size, pFile);
+    fclose(pFile);
+    Verbose("Saved %zu byte pipeline cache", size);
+}
+
+VkResult Renderer::createMeshPipelines()
+{
+    VkResult result;
+
+    result = createShaderModule("shaders/Mesh.vert.spv", &m_vkMeshVertModule);
+    AssertVk(result);
+    result = createShaderModule("shaders/Mesh.frag.spv", &m_vkMeshFragModule);
+    AssertVk(result);
+    result = createShaderModule("shaders/MeshDepth.vert.spv",
+                                &m_vkMeshDepthVertModule);
+    AssertVk(result);
+
+    VkPipelineLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts    = &m_vkDescriptorSetLayout;
+
+    result = vkCreatePipelineLayout(m_vkDevice, &layoutInfo, getVkAlloc(),
+                                    &m_vkPipelineLayout);
+    AssertVk(result);
+
+    PipelineVariantsInfo variantsInfo;
+    variantsInfo.device          = m_vkDevice;
+    variantsInfo.pAlloc          = getVkAlloc();
+    variantsInfo.cache           = m_vkPipelineCache;
+    variantsInfo.renderPass      = m_vkRenderPass;
+    variantsInfo.renderPassClass = m_meshPassClass;
+    variantsInfo.subpass         = 0;
+    variantsInfo.layout          = m_vkPipelineLayout;
+    variantsInfo.vertModule      = m_vkMeshVertModule;
+    variantsInfo.fragModule      = m_vkMeshFragModule;
+    variantsInfo.pJobs           = m_pJobs;
+    m_meshPipelines.init(variantsInfo);
+
+    // Block on the variant we start with. Frames can't substitute anything
+    // until at least one variant is ready.
+    AssertMsg(m_meshVariant.lightCount <= kMaxLights,
+              "At most %u lights are supported, not %u",
+              kMaxLights, m_meshVariant.lightCount);
+    m_meshReadyVariant = m_meshVariant;
+    m_meshReadyVariant.depthEqual = m_depthPrepass;
+    if (m_meshPipelines.get(m_meshReadyVariant) == nullptr) {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    if (m_depthPrepass) {
+        result = createDepthPipelines();
+    }
+
+    return result;
+}
+
+VkResult Renderer::createDepthPipelines()
+{
+    // Created the first time a depth prepass is turned on. After that, only
+    // the render pass changes.
+    if (!m_hasDepthPipelines) {
+        PipelineVariantsInfo variantsInfo;
+        variantsInfo.device          = m_vkDevice;
+        variantsInfo.pAlloc          = getVkAlloc();
+        variantsInfo.cache           = m_vkPipelineCache;
+        variantsInfo.renderPass      = m_vkDepthRenderPass;
+        variantsInfo.renderPassClass = m_depthPassClass;
+        variantsInfo.subpass         = 0;
+        variantsInfo.layout          = m_vkPipelineLayout;
+        variantsInfo.vertModule      = m_vkMeshDepthVertModule;
+        variantsInfo.fragModule      = nullptr;
+        variantsInfo.pJobs           = m_pJobs;
+        m_depthPipelines.init(variantsInfo);
+        m_hasDepthPipelines = true;
+    } else {
+        m_depthPipelines.setRenderPass(m_vkDepthRenderPass, m_depthPassClass);
+    }
+
+    // The shading variant we fall back to needs its prepass too.
+    if (m_depthPipelines.get(depthVariantOf(m_meshReadyVariant)) == nullptr) {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    return VK_SUCCESS;
+}
+
+void Renderer::applyDepthPrepass()
+{
+    // Every pass, and which pipelines they use, changes.
+    vkDeviceWaitIdle(m_vkDevice);
+    m_depthPrepass = m_wantDepthPrepass;
+    m_meshReadyVariant.depthEqual = m_depthPrepass;
+    VkResult result = rebuildRenderGraph();
+    AssertVk(result);
+    Info("Depth prepass %s", m_depthPrepass ? "on" : "off");
+}
+
+VkResult Renderer::uploadMesh(MeshData const& mesh)
+{
+    VkResult result = VK_SUCCESS;
+
+    vkDeviceWaitIdle(m_vkDevice);
+    destroyBuffer(&m_vkVertexBuffer,    &m_vkVertexDeviceMemory);
+    destroyBuffer(&m_vkQuantizedBuffer, &m_vkQuantizedDeviceMemory);
+    destroyBuffer(&m_vkIndexBuffer,     &m_vkIndexDeviceMemory);
+    m_vertexCount = 0;
+    m_meshObjects.clear();
+    m_meshLods.clear();
+    m_objectLods.clear();
+    m_baseObjects.clear();
+    m_instanceSlots.clear();
+    m_instanceObjects.clear();
+    m_movedObjects.clear();
+    m_instancesMoved    = false;
+    m_identityInstances = true;
+    m_staleObjectFrames = 0;
+    result = m_instanceBuffer.setInstances(nullptr, 0);
+    AssertVk(result);
+    if (m_useGpuCulling) {
+        result = m_gpuCulling.setObjects(nullptr, 0);
+        AssertVk(result);
+    }
+
+    // Draws pick materials by index, so the whole table goes up at once.
+    if (mesh.materials.empty()) {
+        std::vector<MeshMaterial> materials = defaultMaterials();
+        result = uploadMaterials(materials.data(),
+                                 as<uint32_t>(materials.size()));
+    } else {
+        result = uploadMaterials(mesh.materials.data(),
+                                 as<uint32_t>(mesh.materials.size()));
+    }
+    AssertVk(result);
+
+    Vertex const* pVerts = mesh.vertices.data();
+    uint32_t      count  = as<uint32_t>(mesh.vertices.size());
+    if (count == 0 || mesh.indices.empty()) {
+        return result;
+    }
+
+    std::vector<QuantizedVertex> quantized;
+    m_positionScale = quantizePositions(pVerts, count, &quantized);
+
+    struct Upload
+    {
+        void const*     pSrc;
+        VkDeviceSize        size;
+        VkBufferUsageFlags  usage;
+        VkBuffer*           pBuffer;
+        VkDeviceMemory*     pMemory;
+    };
+    Upload uploads[] = {
+        { pVerts,              count * sizeof(Vertex),
+          VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+          &m_vkVertexBuffer,    &m_vkVertexDeviceMemory },
+        { quantized.data(),    count * sizeof(QuantizedVertex),
+          VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+          &m_vkQuantizedBuffer, &m_vkQuantizedDeviceMemory },
+        { mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t),
+          VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+          &m_vkIndexBuffer,     &m_vkIndexDeviceMemory },
     };
 
-    VkRenderPassCreateInfo renderPassInfo = {};
-    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    renderPassInfo.attachmentCount = array_size(attachmentDescs);
-    renderPassInfo.pAttachments    = attachmentDescs;
-    renderPassInfo.subpassCount    = array_size(subpasses);
-    renderPassInfo.pSubpasses      = subpasses;
-
-    result = vkCreateRenderPass(m_vkDevice, &renderPassInfo, getVkAlloc(),
-                                &m_vkRenderPass);
-    AssertVk(result);
-
-    VkFramebufferCreateInfo fbInfo = {};
-    fbInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-    fbInfo.renderPass = m_vkRenderPass;
-    fbInfo.width      = extent.width;
-    fbInfo.height     = extent.height;
-    fbInfo.layers     = extent.depth;
-
-    Info("VkFramebufferCreateInfo {\n"
-         "    renderPass = 0x%016x,\n"
-         "    width      = %u,\n"
-         "    height     = %u,\n"
-         "    depth      = %u\n"
-         "}",
-         m_vkRenderPass,
-         extent.width,
-         extent.height,
-         extent.depth
-    );
-
-    for (uint32_t i = 0; i < array_size(m_vkFramebuffers); i += 1) {
-        VkImageView attachmentsViews[2] = {
-            m_vkPresentImageViews[i],
-            m_vkDepthImageView,
-        };
-        fbInfo.attachmentCount = array_size(attachmentsViews);
-        fbInfo.pAttachments    = attachmentsViews;
+    for (Upload const& upload : uploads) {
+        result = uploadBuffer(upload.pSrc,
+                              upload.size,
+                              upload.usage,
+                              upload.pBuffer,
+                              upload.pMemory);
+        AssertVk(result);
+    }
+
+    m_vertexCount = count;
+    m_meshObjects = mesh.objects;
+    m_baseObjects = mesh.objects;
+    m_meshLods    = mesh.lods;
+    m_objectLods.assign(mesh.lods.size(), 0);
+
+    // Without instances, each object is drawn once, where it is.
+    std::vector<MeshInstance> defaultInstances;
+    std::vector<MeshInstance> const* pInstances = &mesh.instances;
+    if (mesh.instances.empty()) {
+        defaultInstances.resize(mesh.objects.size());
+        for (uint32_t i = 0; i < defaultInstances.size(); i += 1) {
+            defaultInstances[i].object             = i;
+            defaultInstances[i].data.materialIndex = mesh.objects[i].materialIndex;
+        }
+        pInstances = &defaultInstances;
+    }
+    std::vector<MeshInstance> const& instances = *pInstances;
+    uint32_t instanceCount = as<uint32_t>(instances.size());
+
+    // Mesh.frag indexes the material table without checking.
+    for (uint32_t i = 0; i < m_meshObjects.size(); i += 1) {
+        AssertMsg(m_meshObjects[i].materialIndex < m_materialCount,
+                  "Object %u uses material %u, of %u",
+                  i, m_meshObjects[i].materialIndex, m_materialCount);
+    }
+    for (uint32_t i = 0; i < instanceCount; i += 1) {
+        AssertMsg(instances[i].data.materialIndex < m_materialCount,
+                  "Instance %u uses material %u, of %u",
+                  i, instances[i].data.materialIndex, m_materialCount);
+    }
+
+    // Each object draws every copy of itself at once, so they have to be
+    // next to each other in the stream.
+    std::vector<uint32_t> order(instanceCount);
+    for (uint32_t i = 0; i < instanceCount; i += 1) {
+        Assert(instances[i].object < m_meshObjects.size());
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [&instances](uint32_t a, uint32_t b) {
+                         return instances[a].object < instances[b].object;
+                     });
+
+    std::vector<InstanceData> stream(instanceCount);
+    m_instanceSlots.resize(instanceCount);
+    m_instanceObjects.resize(instanceCount);
+    for (MeshObject& object : m_meshObjects) {
+        object.firstInstance = 0;
+        object.instanceCount = 0;
+    }
+    for (uint32_t slot = 0; slot < instanceCount; slot += 1) {
+        MeshInstance const& instance = instances[order[slot]];
+        MeshObject&         object   = m_meshObjects[instance.object];
+        if (object.instanceCount == 0) {
+            object.firstInstance = slot;
+        }
+        object.instanceCount += 1;
 
-        Info("Creating framebuffer #%u", i);
-        result = vkCreateFramebuffer(m_vkDevice, &fbInfo, getVkAlloc(),
-                                     &m_vkFramebuffers[i]);
+        stream[slot] = instance.data;
+        m_instanceSlots[order[slot]]   = slot;
+        m_instanceObjects[order[slot]] = instance.object;
+    }
+    result = m_instanceBuffer.setInstances(stream.data(), instanceCount);
+    AssertVk(result);
+
+    m_identityInstances = mesh.instances.empty();
+    m_movedObjects.assign(m_meshObjects.size(), 0);
+    for (uint32_t i = 0; i < m_meshObjects.size(); i += 1) {
+        updateObjectSphere(i);
+    }
+
+    if (m_useGpuCulling) {
+        result = m_gpuCulling.setObjects(m_meshObjects.data(),
+                                         as<uint32_t>(m_meshObjects.size()));
         AssertVk(result);
     }
+    if (m_useSoftwareOcclusion) {
+        if (m_identityInstances) {
+            m_softwareOcclusion.setMesh(mesh);
+        } else {
+            Info("Software occlusion: off, it only knows the uninstanced mesh");
+        }
+    }
+    Info("Uploaded mesh with %u vertices, %zu indices, %zu objects, and %u "
+         "instances",
+         count, mesh.indices.size(), mesh.objects.size(), instanceCount);
+
+    return result;
+}
+
+VkResult Renderer::createGpuCulling()
+{
+    VkResult result = VK_SUCCESS;
+
+    if (!m_useGpuCulling) {
+        Info("GPU culling is off, the CPU culls instead");
+        return result;
+    }
+
+    auto const& deviceInfo =
+        m_queriedInfo.physicalDeviceInfos[m_queriedInfo.physicalDeviceIndex];
+
+    // The pipelines keep what they need, so the modules can go right away.
+    VkShaderModule cullModule    = nullptr;
+    VkShaderModule earlyModule   = nullptr;
+    VkShaderModule lateModule    = nullptr;
+    VkShaderModule pyramidModule = nullptr;
+    if (m_occlusionCulling) {
+        result = createShaderModule("shaders/CullEarly.comp.spv", &earlyModule);
+        AssertVk(result);
+        result = createShaderModule("shaders/CullLate.comp.spv", &lateModule);
+        AssertVk(result);
+        result = createShaderModule("shaders/DepthPyramid.comp.spv",
+                                    &pyramidModule);
+        AssertVk(result);
+    } else {
+        result = createShaderModule("shaders/Cull.comp.spv", &cullModule);
+        AssertVk(result);
+    }
+
+    if (m_hasDrawIndirectCount) {
+        m_pfnDrawIndirectCount =
+            reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(
+                vkGetDeviceProcAddr(m_vkDevice,
+                                    "vkCmdDrawIndexedIndirectCountKHR"));
+    }
+
+    GpuCullingInfo cullingInfo;
+    cullingInfo.device               = m_vkDevice;
+    cullingInfo.pAlloc               = getVkAlloc();
+    cullingInfo.memoryProperties     = deviceInfo.memoryProperties;
+    cullingInfo.cache                = m_vkPipelineCache;
+    cullingInfo.pDescriptors         = &m_descriptors;
+    cullingInfo.cullModule           = cullModule;
+    cullingInfo.earlyModule          = earlyModule;
+    cullingInfo.lateModule           = lateModule;
+    cullingInfo.frameCount           = kFramesInFlight;
+    cullingInfo.pfnDrawIndirectCount = m_pfnDrawIndirectCount;
+    cullingInfo.multiDrawIndirect    = deviceInfo.features.multiDrawIndirect;
+    cullingInfo.coneCulling          = m_coneCulling;
+    cullingInfo.occlusion            = m_occlusionCulling;
+    cullingInfo.validate             = m_validateCulling;
+    result = m_gpuCulling.init(cullingInfo);
+
+    if (m_occlusionCulling) {
+        DepthPyramidInfo pyramidInfo;
+        pyramidInfo.device           = m_vkDevice;
+        pyramidInfo.pAlloc           = getVkAlloc();
+        pyramidInfo.memoryProperties = deviceInfo.memoryProperties;
+        pyramidInfo.cache            = m_vkPipelineCache;
+        pyramidInfo.pDescriptors     = &m_descriptors;
+        pyramidInfo.pyramidModule    = pyramidModule;
+        pyramidInfo.depthExtent      = m_framebufferExtent;
+        result = m_depthPyramid.init(pyramidInfo);
+    }
+
+    vkDestroyShaderModule(m_vkDevice, cullModule, getVkAlloc());
+    vkDestroyShaderModule(m_vkDevice, earlyModule, getVkAlloc());
+    vkDestroyShaderModule(m_vkDevice, lateModule, getVkAlloc());
+    vkDestroyShaderModule(m_vkDevice, pyramidModule, getVkAlloc());
+
+    return result;
+}
+
+uint32_t Renderer::findMemoryType(uint32_t              memoryTypeBits,
+                                  VkMemoryPropertyFlags properties) const
+{
+    auto const& deviceInfo =
+        m_queriedInfo.physicalDeviceInfos[m_queriedInfo.physicalDeviceIndex];
+    return ::findMemoryType(deviceInfo.memoryProperties, memoryTypeBits,
+                            properties);
+}
+
+VkResult Renderer::createBuffer(VkDeviceSize          size,
+                                VkBufferUsageFlags    usage,
+                                VkMemoryPropertyFlags properties,
+                                VkBuffer*             pBuffer,
+                                VkDeviceMemory*       pMemory)
+{
+    auto const& deviceInfo =
+        m_queriedInfo.physicalDeviceInfos[m_queriedInfo.physicalDeviceIndex];
+    return ::createBuffer(m_vkDevice, getVkAlloc(), deviceInfo.memoryProperties,
+                          size, usage, properties, pBuffer, pMemory);
+}
+
+void Renderer::destroyBuffer(VkBuffer* pBuffer, VkDeviceMemory* pMemory)
+{
+    vkDestroyBuffer(m_vkDevice, *pBuffer, getVkAlloc());
+    vkFreeMemory(m_vkDevice, *pMemory, getVkAlloc());
+    *pBuffer = nullptr;
+    *pMemory = nullptr;
+}
+
+VkResult Renderer::uploadBuffer(void const*        pSrc,
+                                VkDeviceSize       size,
+                                VkBufferUsageFlags usage,
+                                VkBuffer*          pBuffer,
+                                VkDeviceMemory*    pMemory)
+{
+    VkResult result;
+
+    result = createBuffer(size,
+                          usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                          pBuffer,
+                          pMemory);
+    AssertVk(result);
+
+    VkBuffer       stagingBuffer = nullptr;
+    VkDeviceMemory stagingMemory = nullptr;
+    result = createBuffer(size,
+                          VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                          &stagingBuffer,
+                          &stagingMemory);
+    AssertVk(result);
+
+    void* pDst = nullptr;
+    result = vkMapMemory(m_vkDevice, stagingMemory, 0, size, 0, &pDst);
+    AssertVk(result);
+    memcpy(pDst, pSrc, size);
+    vkUnmapMemory(m_vkDevice, stagingMemory);
+
+    VkCommandBufferAllocateInfo cmdBufAllocInfo = {};
+    cmdBufAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    cmdBufAllocInfo.commandPool        = m_vkCommandPool;
+    cmdBufAllocInfo.level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    cmdBufAllocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer cmd = nullptr;
+    result = vkAllocateCommandBuffers(m_vkDevice, &cmdBufAllocInfo, &cmd);
+    AssertVk(result);
+
+    VkCommandBufferBeginInfo cmdInfo = {};
+    cmdInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    cmdInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    result = vkBeginCommandBuffer(cmd, &cmdInfo);
+    AssertVk(result);
+
+    VkBufferCopy region = {};
+    region.size = size;
+    vkCmdCopyBuffer(cmd, stagingBuffer, *pBuffer, 1, &region);
+
+    // Waiting for the queue only covers execution. Later submissions still
+    // need the copy made visible to whatever reads the buffer.
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    vkCmdPipelineBarrier(cmd,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         0,
+                         1, &barrier,
+                         0, nullptr,
+                         0, nullptr);
+
+    result = vkEndCommandBuffer(cmd);
+    AssertVk(result);
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers    = &cmd;
+    result = vkQueueSubmit(m_vkGraphicsQueue, 1, &submitInfo, nullptr);
+    AssertVk(result);
+
+    // Uploads only happen while loading, so there's nothing to overlap with.
+    result = vkQueueWaitIdle(m_vkGraphicsQueue);
+    AssertVk(result);
+
+    vkFreeCommandBuffers(m_vkDevice, m_vkCommandPool, 1, &cmd);
+    destroyBuffer(&stagingBuffer, &stagingMemory);
 
     return result;
 }
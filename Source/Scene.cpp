@@ -0,0 +1,304 @@
+#include "Scene.hpp"
+#include "AssetArchive.hpp"
+#include "FileView.hpp"
+
+#include "tiny_obj_loader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <istream>
+
+// Each texture file gets one slot in 'pTextures', however many materials
+// use it.
+static uint32_t findOrAddTexture(std::string const&        name,
+                                 std::vector<std::string>* pTextures)
+{
+    if (name.empty()) {
+        return kNoTexture;
+    }
+    auto found = std::find(pTextures->begin(), pTextures->end(), name);
+    if (found != pTextures->end()) {
+        return as<uint32_t>(found - pTextures->begin());
+    }
+    pTextures->push_back(name);
+    return as<uint32_t>(pTextures->size() - 1);
+}
+
+bool loadObjMesh(AssetArchive const* pAssets,
+                 char const*         pName,
+                 MeshData*           pMesh)
+{
+    using namespace tinyobj;
+
+    Assert(pMesh != nullptr);
+    *pMesh = {};
+
+    // The materials sit next to the model, with the same name.
+    std::string objName = pName;
+    std::string mtlName = objName.substr(0, objName.rfind('.')) + ".mtl";
+
+    const char* pBaseDir  = "../External/tinyobjloader/models/";
+    std::string filename  = std::string(pBaseDir) + objName;
+    const char* pFilename = filename.c_str();
+
+    attrib_t                attrib;
+    std::vector<shape_t>    shapes;
+    std::vector<material_t> materials;
+    std::string errMsg;
+
+    // Parse straight out of the mapped file (or archive), instead of
+    // letting tinyobj copy it through an ifstream.
+    bool okay = false;
+    if (pAssets != nullptr) {
+        Info("Loading wavefront file \"models/%s\" from archive", pName);
+
+        AssetBlob obj = pAssets->get(("models/" + objName).c_str());
+        AssetBlob mtl = pAssets->get(("models/" + mtlName).c_str());
+        if (!obj.valid()) {
+            Bug("Asset archive is missing \"models/%s\"", pName);
+            return false;
+        }
+
+        // Not every model has materials.
+        ByteStreamBuf        objBuffer(obj.pData, obj.size);
+        ByteStreamBuf        mtlBuffer(mtl.valid() ? mtl.pData : nullptr,
+                                       mtl.valid() ? mtl.size  : 0);
+        std::istream         objStream(&objBuffer);
+        std::istream         mtlStream(&mtlBuffer);
+        MaterialStreamReader mtlReader(mtlStream);
+
+        okay = LoadObj(&attrib,
+                       &shapes,
+                       &materials,
+                       &errMsg,
+                       &objStream,
+                       &mtlReader);
+    } else {
+        Info("Loading wavefront file \"%s\"", pFilename);
+
+        FileView objView;
+        if (!objView.open(pFilename, FileAccess::Sequential)) {
+            Bug("Unable to open \"%s\"", pFilename);
+            return false;
+        }
+
+        ByteStreamBuf      objBuffer(objView);
+        std::istream       objStream(&objBuffer);
+        MaterialFileReader mtlReader(pBaseDir);
+
+        okay = LoadObj(&attrib,
+                       &shapes,
+                       &materials,
+                       &errMsg,
+                       &objStream,
+                       &mtlReader);
+    }
+    if (!okay) {
+        Bug("tinyobj: %s", errMsg.c_str());
+        return false;
+    }
+
+    Info("Loaded %u vertices", attrib.vertices.size());
+    MeshData& mesh = *pMesh;
+    mesh.vertices.reserve(attrib.vertices.size() / 3);
+
+    Vec3 min(0, 0, 0);
+    Vec3 max(0, 0, 0);
+
+    for (const auto& shape : shapes) {
+        for (const index_t& index : shape.mesh.indices) {
+            size_t i = index.vertex_index;
+            Vec3& pos = *reinterpret_cast<Vec3*>(&attrib.vertices[3*i]);
+            min = glm::min(min, pos);
+            max = glm::max(max, pos);
+        }
+    }
+
+    Info("min:    (% 6.1f, % 6.1f, % 6.1f)", min.x, min.y, min.z);
+    Info("max:    (% 6.1f, % 6.1f, % 6.1f)", max.x, max.y, max.z);
+
+    Vec3 offset = -0.5f * (max - min);
+    offset.z = 0;
+    Vec3 scale = 3.f / (max - min);
+
+    Info("offset: (% 6.1f, % 6.1f, % 6.1f)", offset.x, offset.y, offset.z);
+    Info("scale:  (% 3.3f, % 3.3f, % 3.3f)", scale.x, scale.y, scale.z);
+
+    for (size_t i = 0; i < attrib.vertices.size() / 3; i += 1) {
+        Vec3 pos = *reinterpret_cast<Vec3*>(&attrib.vertices[3*i]);
+        pos = scale * (pos + offset);
+        mesh.vertices.emplace_back(pos.x, pos.y, pos.z);
+    }
+
+    for (const material_t& material : materials) {
+        MeshMaterial& out = mesh.materials.emplace_back();
+        out.baseColor = glm::vec4(material.diffuse[0],
+                                  material.diffuse[1],
+                                  material.diffuse[2],
+                                  material.dissolve);
+        out.emissive  = glm::vec4(material.emission[0],
+                                  material.emission[1],
+                                  material.emission[2],
+                                  0.f);
+        out.specular  = glm::vec4(material.specular[0],
+                                  material.specular[1],
+                                  material.specular[2],
+                                  material.shininess);
+        out.baseColorTexture = findOrAddTexture(material.diffuse_texname,
+                                                &mesh.textures);
+    }
+    Info("Loaded %u materials, naming %u textures",
+         mesh.materials.size(), mesh.textures.size());
+
+    // Each shape is culled, and drawn, on its own. tinyobj gives each face
+    // a material, but a shape takes its first face's.
+    for (const auto& shape : shapes) {
+        uint32_t firstIndex = as<uint32_t>(mesh.indices.size());
+        for (const index_t& index : shape.mesh.indices) {
+            mesh.indices.push_back(as<uint32_t>(index.vertex_index));
+        }
+        uint32_t indexCount = as<uint32_t>(mesh.indices.size()) - firstIndex;
+        MeshObject object = makeMeshObject(mesh, firstIndex, indexCount);
+        if (!shape.mesh.material_ids.empty() &&
+            shape.mesh.material_ids[0] >= 0) {
+            object.materialIndex = as<uint32_t>(shape.mesh.material_ids[0]);
+        }
+        mesh.objects.push_back(object);
+    }
+
+    return true;
+}
+
+// ==== Synthetic scenes ========================================================
+
+// SplitMix64. Unlike <random>'s distributions, it gives the same numbers with
+// every standard library.
+struct SceneRandom
+{
+    uint64_t state = 0;
+
+    explicit SceneRandom(uint64_t seed) : state(seed) {}
+
+    uint64_t next()
+    {
+        state += 0x9e3779b97f4a7c15ull;
+        uint64_t z = state;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    // In [lo, hi), from the top 24 bits, which a float holds exactly.
+    float range(float lo, float hi)
+    {
+        float unit = as<float>(next() >> 40) / as<float>(1u << 24);
+        return lo + unit * (hi - lo);
+    }
+
+    uint32_t below(uint32_t count)
+    {
+        return as<uint32_t>(next() % count);
+    }
+};
+
+float sceneWidth(SceneDesc const& desc)
+{
+    return desc.spacing * std::sqrt(as<float>(desc.instanceCount));
+}
+
+void generateScene(std::vector<MeshData> const& models,
+                   SceneDesc const&             desc,
+                   MeshData*                    pOut)
+{
+    Assert(pOut != nullptr);
+    Assert(!models.empty());
+    Assert(desc.meshCount > 0);
+
+    MeshData& scene = *pOut;
+    scene = {};
+
+    // Every draw of a random number is its own statement. The order function
+    // arguments are evaluated in isn't, so the scene would depend on the
+    // compiler.
+    SceneRandom random(desc.seed);
+
+    // Unique meshes. Each one's objects are next to each other.
+    std::vector<uint32_t> firstObjects(desc.meshCount);
+    std::vector<uint32_t> objectCounts(desc.meshCount);
+    for (uint32_t i = 0; i < desc.meshCount; i += 1) {
+        MeshData const& model = models[i % models.size()];
+
+        Vec3 stretch;
+        stretch.x   = random.range(0.6f, 1.4f);
+        stretch.y   = random.range(0.6f, 1.4f);
+        stretch.z   = random.range(0.6f, 1.4f);
+        float shear = random.range(-0.3f, 0.3f);
+
+        uint32_t firstVertex = as<uint32_t>(scene.vertices.size());
+        for (Vertex const& vertex : model.vertices) {
+            scene.vertices.emplace_back(vertex.x * stretch.x + vertex.y * shear,
+                                        vertex.y * stretch.y,
+                                        vertex.z * stretch.z);
+        }
+
+        firstObjects[i] = as<uint32_t>(scene.objects.size());
+        objectCounts[i] = as<uint32_t>(model.objects.size());
+        for (MeshObject const& object : model.objects) {
+            uint32_t firstIndex = as<uint32_t>(scene.indices.size());
+            for (uint32_t j = 0; j < object.indexCount; j += 1) {
+                scene.indices.push_back(
+                    model.indices[object.firstIndex + j] + firstVertex);
+            }
+            scene.objects.push_back(
+                makeMeshObject(scene, firstIndex, object.indexCount));
+        }
+    }
+
+    // Instances. A copy of a mesh is a copy of each of its objects, all with
+    // the same transform.
+    float    width         = sceneWidth(desc);
+    uint32_t materialCount = std::max(desc.materialCount, 1u);
+    uint64_t triangleCount = 0;
+    for (uint32_t i = 0; i < desc.instanceCount; i += 1) {
+        uint32_t mesh = random.below(desc.meshCount);
+        float    x    = random.range(-0.5f, 0.5f) * width;
+        float    z    = random.range(-0.5f, 0.5f) * width;
+        float    yaw  = random.range(0.f, 2.f * PI);
+        float    size = random.range(0.5f, 1.5f);
+
+        MeshInstance instance;
+        instance.data.transform =
+            glm::translate(Mat4(1.f), Vec3(x, 0.f, z)) *
+            glm::rotate(Mat4(1.f), yaw, Vec3(0.f, 1.f, 0.f)) *
+            glm::scale(Mat4(1.f), Vec3(size, size, size));
+        instance.data.materialIndex = random.below(materialCount);
+
+        for (uint32_t j = 0; j < objectCounts[mesh]; j += 1) {
+            instance.object = firstObjects[mesh] + j;
+            scene.instances.push_back(instance);
+            triangleCount += scene.objects[instance.object].indexCount / 3;
+        }
+    }
+
+    // Pastels, spread around the hue wheel by the golden ratio. They don't
+    // draw random numbers, so the rest of the scene is what it always was.
+    for (uint32_t i = 0; i < materialCount; i += 1) {
+        float hue = std::fmod(as<float>(i) * 0.618034f, 1.f) * 6.f;
+        float rgb[3] = {
+            std::fabs(hue - 3.f) - 1.f,
+            2.f - std::fabs(hue - 2.f),
+            2.f - std::fabs(hue - 4.f),
+        };
+        for (float& channel : rgb) {
+            channel = 0.6f + 0.4f * std::min(std::max(channel, 0.f), 1.f);
+        }
+
+        MeshMaterial& material = scene.materials.emplace_back();
+        material.baseColor = glm::vec4(rgb[0], rgb[1], rgb[2], 1.f);
+    }
+
+    Info("Generated a scene with %u unique meshes, %u instances of them, and "
+         "%llu triangles, over %.0f x %.0f units",
+         desc.meshCount, desc.instanceCount,
+         as<unsigned long long>(triangleCount), width, width);
+}
@@ -0,0 +1,140 @@
+#include "Simulation.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using Milliseconds = std::chrono::duration<double, std::milli>;
+
+Simulation::~Simulation()
+{
+    deInit();
+}
+
+void Simulation::init(SimulationInfo const& info)
+{
+    Assert(!m_thread.joinable());
+    Assert(info.stepHz > 0.0);
+
+    m_info        = info;
+    m_step        = std::chrono::duration_cast<Clock::duration>(
+                        Milliseconds(1000.0 / info.stepHz));
+    m_stepSeconds = as<float>(1.0 / info.stepHz);
+
+    // Copies of a mesh are instances with the same transform, so keying the
+    // rate off where it is keeps their objects spinning together.
+    uint32_t count = instanceCount();
+    m_spinRates.resize(count);
+    m_yaw.assign(count, 0.f);
+    for (uint32_t i = 0; i < count; i += 1) {
+        float x        = info.instances[i].transform[3].x;
+        float z        = info.instances[i].transform[3].z;
+        float hash     = std::fabs(std::sin(x * 12.9898f + z * 78.233f) * 43758.5f);
+        float scale    = 0.5f + (hash - std::floor(hash));
+        m_spinRates[i] = info.spinRate * scale * m_stepSeconds;
+    }
+
+    m_quitting = false;
+    m_thread   = std::thread([this]() { threadMain(); });
+    Info("Simulating %u instance(s) at %.1f Hz", count, info.stepHz);
+}
+
+void Simulation::deInit()
+{
+    if (!m_thread.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quitting = true;
+    }
+    m_wakeup.notify_one();
+    m_thread.join();
+
+    if (m_stepCount > 0) {
+        Info("Simulation: %llu step(s), %.3f ms each on average, %llu dropped "
+             "to catch up",
+             as<unsigned long long>(m_stepCount),
+             m_stepMsSum / as<double>(m_stepCount),
+             as<unsigned long long>(m_droppedSteps));
+    }
+}
+
+bool Simulation::sample(Clock::time_point now, std::vector<InstanceData>* pOut)
+{
+    m_states.update();
+    SimState const& state = m_states.readBuffer();
+    if (state.step == 0) {
+        return false;
+    }
+
+    // 'now' is somewhere between this step and the next one, so drawing the
+    // same distance between the step before and this one is a step behind.
+    double alpha = Milliseconds(now - state.time).count() /
+                   Milliseconds(m_step).count();
+    float  t     = as<float>(std::min(std::max(alpha, 0.0), 1.0));
+
+    uint32_t count = instanceCount();
+    pOut->resize(count);
+    for (uint32_t i = 0; i < count; i += 1) {
+        float yaw = state.prevYaw[i] + t * (state.yaw[i] - state.prevYaw[i]);
+        InstanceData& instance = (*pOut)[i];
+        instance = m_info.instances[i];
+        instance.transform = instance.transform *
+            glm::rotate(Mat4(1.f), yaw, Vec3(0.f, 1.f, 0.f));
+    }
+    return true;
+}
+
+void Simulation::step()
+{
+    SimState& state = m_states.writeBuffer();
+    state.prevYaw.resize(m_yaw.size());
+    state.yaw.resize(m_yaw.size());
+
+    for (uint32_t i = 0; i < m_yaw.size(); i += 1) {
+        // Wrapped, but the previous step is kept on the same side of the
+        // wrap, so interpolating never goes the long way round.
+        float yaw = m_yaw[i] + m_spinRates[i];
+        if (yaw >= 2.f * PI) {
+            yaw -= 2.f * PI;
+        }
+        state.prevYaw[i] = yaw - m_spinRates[i];
+        state.yaw[i]     = yaw;
+        m_yaw[i]         = yaw;
+    }
+}
+
+void Simulation::threadMain()
+{
+    Clock::time_point next = Clock::now();
+    for (;;) {
+        next += m_step;
+
+        Clock::time_point now = Clock::now();
+        if (now - next > kMaxCatchUpSteps * m_step) {
+            m_droppedSteps += as<uint64_t>((now - next) / m_step);
+            next = now;
+        }
+
+        // Ahead, so wait for the step's time. Behind, step right away.
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeup.wait_until(lock, next, [this]() { return m_quitting; });
+            if (m_quitting) {
+                break;
+            }
+        }
+
+        Clock::time_point start = Clock::now();
+        step();
+        m_stepCount += 1;
+
+        SimState& state = m_states.writeBuffer();
+        state.step = m_stepCount;
+        state.time = next;
+        m_states.publish();
+
+        m_stepMsSum += Milliseconds(Clock::now() - start).count();
+    }
+}
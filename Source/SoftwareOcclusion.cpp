@@ -0,0 +1,459 @@
+#include "SoftwareOcclusion.hpp"
+#include "JobPool.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+
+#if defined(__AVX2__)
+    #define OCCLUSION_AVX2 1
+    #include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || \
+      (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define OCCLUSION_SSE2 1
+    #include <emmintrin.h>
+#endif
+
+// ==== Lanes ===================================================================
+
+// Just enough of a SIMD wrapper for rasterizing and testing. Masks are all
+// ones, or all zeros, per lane.
+#if OCCLUSION_AVX2
+struct Lanes
+{
+    using F = __m256;
+    static constexpr uint32_t kWidth = 8;
+
+    static F    set1(float v)                { return _mm256_set1_ps(v); }
+    // Pixel centers, relative to the first lane's pixel.
+    static F    centers()                    { return _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f,
+                                                                     4.5f, 5.5f, 6.5f, 7.5f); }
+    static F    load(float const* p)         { return _mm256_loadu_ps(p); }
+    static void store(float* p, F v)         { _mm256_storeu_ps(p, v); }
+    static F    add(F a, F b)                { return _mm256_add_ps(a, b); }
+    static F    mul(F a, F b)                { return _mm256_mul_ps(a, b); }
+    static F    min(F a, F b)                { return _mm256_min_ps(a, b); }
+    static F    greater(F a, F b)            { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static F    greaterEqual(F a, F b)       { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    static F    both(F a, F b)               { return _mm256_and_ps(a, b); }
+    static F    select(F mask, F a, F b)     { return _mm256_blendv_ps(b, a, mask); }
+    static bool any(F mask)                  { return _mm256_movemask_ps(mask) != 0; }
+    static bool all(F mask)                  { return _mm256_movemask_ps(mask) == 0xFF; }
+};
+#elif OCCLUSION_SSE2
+struct Lanes
+{
+    using F = __m128;
+    static constexpr uint32_t kWidth = 4;
+
+    static F    set1(float v)                { return _mm_set1_ps(v); }
+    static F    centers()                    { return _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f); }
+    static F    load(float const* p)         { return _mm_loadu_ps(p); }
+    static void store(float* p, F v)         { _mm_storeu_ps(p, v); }
+    static F    add(F a, F b)                { return _mm_add_ps(a, b); }
+    static F    mul(F a, F b)                { return _mm_mul_ps(a, b); }
+    static F    min(F a, F b)                { return _mm_min_ps(a, b); }
+    static F    greater(F a, F b)            { return _mm_cmpgt_ps(a, b); }
+    static F    greaterEqual(F a, F b)       { return _mm_cmpge_ps(a, b); }
+    static F    both(F a, F b)               { return _mm_and_ps(a, b); }
+    // No blendv before SSE4.1.
+    static F    select(F mask, F a, F b)     { return _mm_or_ps(_mm_and_ps(mask, a),
+                                                                _mm_andnot_ps(mask, b)); }
+    static bool any(F mask)                  { return _mm_movemask_ps(mask) != 0; }
+    static bool all(F mask)                  { return _mm_movemask_ps(mask) == 0xF; }
+};
+#else
+struct Lanes
+{
+    // Masks are just bools here.
+    using F = float;
+    static constexpr uint32_t kWidth = 1;
+
+    static F    set1(float v)                { return v; }
+    static F    centers()                    { return 0.5f; }
+    static F    load(float const* p)         { return *p; }
+    static void store(float* p, F v)         { *p = v; }
+    static F    add(F a, F b)                { return a + b; }
+    static F    mul(F a, F b)                { return a * b; }
+    static F    min(F a, F b)                { return std::min(a, b); }
+    static F    greater(F a, F b)            { return a > b ? 1.f : 0.f; }
+    static F    greaterEqual(F a, F b)       { return a >= b ? 1.f : 0.f; }
+    static F    both(F a, F b)               { return a * b; }
+    static F    select(F mask, F a, F b)     { return mask != 0.f ? a : b; }
+    static bool any(F mask)                  { return mask != 0.f; }
+    static bool all(F mask)                  { return mask != 0.f; }
+};
+#endif
+
+static_assert(8 % Lanes::kWidth == 0, "Rows are a multiple of 8 pixels");
+
+// ==== SoftwareOcclusion =======================================================
+
+using Clock = std::chrono::steady_clock;
+
+static double msSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start)
+               .count();
+}
+
+SoftwareOcclusion::~SoftwareOcclusion()
+{
+    deInit();
+}
+
+const char* SoftwareOcclusion::simdName()
+{
+    #if OCCLUSION_AVX2
+    return "AVX2";
+    #elif OCCLUSION_SSE2
+    return "SSE2";
+    #else
+    return "scalar";
+    #endif
+}
+
+void SoftwareOcclusion::init(SoftwareOcclusionInfo const& info)
+{
+    AssertMsg(info.width  % kTileSize == 0 && info.width  > 0 &&
+              info.height % kTileSize == 0 && info.height > 0,
+              "The occlusion buffer is %ux%u, not a multiple of %u",
+              info.width, info.height, kTileSize);
+    m_info   = info;
+    m_tilesX = info.width  / kTileSize;
+    m_tilesY = info.height / kTileSize;
+    m_depth.assign(info.width * info.height, 1.f);
+    m_tileMax.assign(m_tilesX * m_tilesY, 1.f);
+
+    Info("Software occlusion: %ux%u, %s", info.width, info.height, simdName());
+}
+
+void SoftwareOcclusion::deInit()
+{
+    m_depth.clear();
+    m_tileMax.clear();
+    m_spheres.clear();
+    m_occluderVerts.clear();
+    m_triangles.clear();
+    m_occluderCount = 0;
+    m_info = {};
+}
+
+void SoftwareOcclusion::setMesh(MeshData const& mesh)
+{
+    m_spheres.clear();
+    m_occluderVerts.clear();
+    m_occluderCount = 0;
+
+    std::vector<uint32_t> bySize(mesh.objects.size());
+    for (uint32_t i = 0; i < bySize.size(); i += 1) {
+        m_spheres.push_back(mesh.objects[i].sphere);
+        bySize[i] = i;
+    }
+    std::sort(bySize.begin(), bySize.end(), [&](uint32_t a, uint32_t b) {
+        return mesh.objects[a].sphere.w > mesh.objects[b].sphere.w;
+    });
+
+    // Biggest first. Ones that would blow the triangle budget are skipped, so
+    // a smaller, cheaper one can take their place.
+    uint32_t triangleCount = 0;
+    for (uint32_t index : bySize) {
+        if (m_occluderCount == m_info.maxOccluders) {
+            break;
+        }
+        MeshObject const& object = mesh.objects[index];
+        uint32_t objectTriangles = object.indexCount / 3;
+        if (triangleCount + objectTriangles > m_info.maxOccluderTriangles) {
+            continue;
+        }
+
+        for (uint32_t i = 0; i < objectTriangles * 3; i += 1) {
+            uint32_t vertex = mesh.indices[object.firstIndex + i] +
+                              object.vertexOffset;
+            Vertex const& v = mesh.vertices[vertex];
+            m_occluderVerts.push_back(Vec3(v.x, v.y, v.z));
+        }
+        triangleCount   += objectTriangles;
+        m_occluderCount += 1;
+    }
+    m_triangles.reserve(triangleCount);
+
+    Info("Software occlusion: %u of %zu objects are occluders, with %u "
+         "triangles", m_occluderCount, mesh.objects.size(), triangleCount);
+}
+
+void SoftwareOcclusion::cull(Mat4 const& viewProjection, uint8_t* pVisible)
+{
+    Clock::time_point start = Clock::now();
+
+    setupTriangles(viewProjection);
+    auto rasterizeRows = [this](uint32_t begin, uint32_t end) {
+        for (uint32_t tileY = begin; tileY < end; tileY += 1) {
+            rasterizeTileRow(tileY);
+        }
+    };
+    if (m_info.pJobs != nullptr) {
+        m_info.pJobs->parallelFor(m_tilesY, 1, rasterizeRows);
+    } else {
+        rasterizeRows(0, m_tilesY);
+    }
+
+    double rasterMs = msSince(start);
+    start = Clock::now();
+
+    auto test = [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i += 1) {
+            pVisible[i] = isOccluded(m_spheres[i], viewProjection) ? 0 : 1;
+        }
+    };
+    if (m_info.pJobs != nullptr) {
+        m_info.pJobs->parallelFor(objectCount(), 64, test);
+    } else {
+        test(0, objectCount());
+    }
+
+    SoftwareOcclusionStats& stats = m_lastFrame;
+    stats = {};
+    stats.rasterMs          = rasterMs;
+    stats.testMs            = msSince(start);
+    stats.occluderTriangles = as<uint32_t>(m_triangles.size());
+    stats.testedObjects     = objectCount();
+    for (uint32_t i = 0; i < objectCount(); i += 1) {
+        stats.occludedObjects += pVisible[i] == 0 ? 1 : 0;
+    }
+
+    m_frameCount      += 1;
+    m_totalRasterMs   += stats.rasterMs;
+    m_totalTestMs     += stats.testMs;
+    m_worstMs          = std::max(m_worstMs, stats.rasterMs + stats.testMs);
+    m_testedObjects   += stats.testedObjects;
+    m_occludedObjects += stats.occludedObjects;
+
+    Verbose("Software occlusion: %.3f ms rasterizing %u triangles, %.3f ms "
+            "testing, %u of %u objects (%.1f%%) occluded",
+            stats.rasterMs, stats.occluderTriangles, stats.testMs,
+            stats.occludedObjects, stats.testedObjects,
+            100.0 * stats.occludedObjects /
+                std::max(stats.testedObjects, 1u));
+}
+
+void SoftwareOcclusion::setupTriangles(Mat4 const& viewProjection)
+{
+    float width  = as<float>(m_info.width);
+    float height = as<float>(m_info.height);
+
+    m_triangles.clear();
+    for (size_t t = 0; t < m_occluderVerts.size(); t += 3) {
+        // Triangles that cross the near plane are dropped, not clipped. An
+        // occluder that's missing only makes us cull less.
+        float x[3];
+        float y[3];
+        float z[3];
+        bool  clipped = false;
+        for (uint32_t i = 0; i < 3; i += 1) {
+            glm::vec4 clip = viewProjection *
+                             glm::vec4(m_occluderVerts[t + i], 1.f);
+            if (clip.w <= 1e-5f || clip.z < 0.f) {
+                clipped = true;
+                break;
+            }
+            // Same mapping as Glsl/CullLate.comp: y is down, in pixels.
+            x[i] = (0.5f + 0.5f * clip.x / clip.w) * width;
+            y[i] = (0.5f - 0.5f * clip.y / clip.w) * height;
+            z[i] = clip.z / clip.w;
+        }
+        if (clipped) {
+            continue;
+        }
+
+        Triangle tri;
+        tri.minX = std::max(as<int32_t>(std::floor(std::min({ x[0], x[1], x[2] }))), 0);
+        tri.maxX = std::min(as<int32_t>(std::ceil(std::max({ x[0], x[1], x[2] }))),
+                            as<int32_t>(m_info.width) - 1);
+        tri.minY = std::max(as<int32_t>(std::floor(std::min({ y[0], y[1], y[2] }))), 0);
+        tri.maxY = std::min(as<int32_t>(std::ceil(std::max({ y[0], y[1], y[2] }))),
+                            as<int32_t>(m_info.height) - 1);
+        if (tri.minX > tri.maxX || tri.minY > tri.maxY) {
+            continue;
+        }
+
+        // Twice the signed area. Both windings are occluders, since the mesh
+        // pipeline doesn't cull back faces.
+        float area = (x[1] - x[0]) * (y[2] - y[0]) -
+                     (x[2] - x[0]) * (y[1] - y[0]);
+        if (std::abs(area) < 1e-6f) {
+            continue;
+        }
+        float sign = area > 0.f ? 1.f : -1.f;
+
+        for (uint32_t i = 0; i < 3; i += 1) {
+            uint32_t j = (i + 1) % 3;
+            tri.edgeA[i] = sign * (y[i] - y[j]);
+            tri.edgeB[i] = sign * (x[j] - x[i]);
+            tri.edgeC[i] = -(tri.edgeA[i] * x[i] + tri.edgeB[i] * y[i]);
+        }
+
+        tri.zA = ((z[1] - z[0]) * (y[2] - y[0]) -
+                  (z[2] - z[0]) * (y[1] - y[0])) / area;
+        tri.zB = ((z[2] - z[0]) * (x[1] - x[0]) -
+                  (z[1] - z[0]) * (x[2] - x[0])) / area;
+        tri.zC = z[0] - tri.zA * x[0] - tri.zB * y[0];
+
+        m_triangles.push_back(tri);
+    }
+}
+
+void SoftwareOcclusion::rasterizeTileRow(uint32_t tileY)
+{
+    int32_t rowBegin = as<int32_t>(tileY * kTileSize);
+    int32_t rowEnd   = rowBegin + as<int32_t>(kTileSize);
+    uint32_t width   = m_info.width;
+
+    for (int32_t y = rowBegin; y < rowEnd; y += 1) {
+        std::fill_n(&m_depth[y * width], width, 1.f);
+    }
+
+    Lanes::F zero    = Lanes::set1(0.f);
+    Lanes::F centers = Lanes::centers();
+    for (Triangle const& tri : m_triangles) {
+        int32_t minY = std::max(tri.minY, rowBegin);
+        int32_t maxY = std::min(tri.maxY, rowEnd - 1);
+        if (minY > maxY) {
+            continue;
+        }
+
+        // Edge values step by A per pixel, and the first lane starts at
+        // a multiple of the lane count, so loads stay inside the row.
+        int32_t  minX = tri.minX & ~as<int32_t>(Lanes::kWidth - 1);
+        Lanes::F a0   = Lanes::set1(tri.edgeA[0]);
+        Lanes::F a1   = Lanes::set1(tri.edgeA[1]);
+        Lanes::F a2   = Lanes::set1(tri.edgeA[2]);
+        Lanes::F zA   = Lanes::set1(tri.zA);
+
+        for (int32_t y = minY; y <= maxY; y += 1) {
+            float    cy  = as<float>(y) + 0.5f;
+            Lanes::F c0  = Lanes::set1(tri.edgeB[0] * cy + tri.edgeC[0]);
+            Lanes::F c1  = Lanes::set1(tri.edgeB[1] * cy + tri.edgeC[1]);
+            Lanes::F c2  = Lanes::set1(tri.edgeB[2] * cy + tri.edgeC[2]);
+            Lanes::F zC  = Lanes::set1(tri.zB * cy + tri.zC);
+            float*   pRow = &m_depth[y * width];
+
+            for (int32_t x = minX; x <= tri.maxX; x += Lanes::kWidth) {
+                Lanes::F px = Lanes::add(Lanes::set1(as<float>(x)), centers);
+                Lanes::F e0 = Lanes::add(Lanes::mul(a0, px), c0);
+                Lanes::F e1 = Lanes::add(Lanes::mul(a1, px), c1);
+                Lanes::F e2 = Lanes::add(Lanes::mul(a2, px), c2);
+
+                // Centers on an edge count, so there are no cracks between
+                // triangles that share it.
+                Lanes::F inside = Lanes::both(Lanes::greaterEqual(e0, zero),
+                                  Lanes::both(Lanes::greaterEqual(e1, zero),
+                                              Lanes::greaterEqual(e2, zero)));
+                if (!Lanes::any(inside)) {
+                    continue;
+                }
+
+                Lanes::F z     = Lanes::add(Lanes::mul(zA, px), zC);
+                Lanes::F depth = Lanes::load(&pRow[x]);
+                Lanes::store(&pRow[x],
+                             Lanes::select(inside, Lanes::min(depth, z), depth));
+            }
+        }
+    }
+
+    // The farthest depth in each tile, so most tests can stop there.
+    for (uint32_t tileX = 0; tileX < m_tilesX; tileX += 1) {
+        float farthest = 0.f;
+        for (int32_t y = rowBegin; y < rowEnd; y += 1) {
+            float const* pTile = &m_depth[y * width + tileX * kTileSize];
+            farthest = std::max(farthest,
+                                *std::max_element(pTile, pTile + kTileSize));
+        }
+        m_tileMax[tileY * m_tilesX + tileX] = farthest;
+    }
+}
+
+bool SoftwareOcclusion::isOccluded(glm::vec4 const& sphere,
+                                   Mat4 const&      viewProjection) const
+{
+    // The same bounds as Glsl/CullLate.comp: the box around the sphere.
+    float minX    = FLT_MAX;
+    float maxX    = -FLT_MAX;
+    float minY    = FLT_MAX;
+    float maxY    = -FLT_MAX;
+    float nearest = FLT_MAX;
+    for (uint32_t i = 0; i < 8; i += 1) {
+        glm::vec4 corner(sphere.x + ((i & 1) != 0 ? sphere.w : -sphere.w),
+                         sphere.y + ((i & 2) != 0 ? sphere.w : -sphere.w),
+                         sphere.z + ((i & 4) != 0 ? sphere.w : -sphere.w),
+                         1.f);
+        glm::vec4 clip = viewProjection * corner;
+        // Anything reaching past the near plane is too close to call.
+        if (clip.w <= 1e-5f || clip.z < 0.f) {
+            return false;
+        }
+        float x = (0.5f + 0.5f * clip.x / clip.w) * as<float>(m_info.width);
+        float y = (0.5f - 0.5f * clip.y / clip.w) * as<float>(m_info.height);
+        minX    = std::min(minX, x);
+        maxX    = std::max(maxX, x);
+        minY    = std::min(minY, y);
+        maxY    = std::max(maxY, y);
+        nearest = std::min(nearest, clip.z / clip.w);
+    }
+
+    // Off screen is the frustum's call, not ours.
+    int32_t x0 = std::max(as<int32_t>(std::floor(minX)), 0);
+    int32_t x1 = std::min(as<int32_t>(std::floor(maxX)),
+                          as<int32_t>(m_info.width) - 1);
+    int32_t y0 = std::max(as<int32_t>(std::floor(minY)), 0);
+    int32_t y1 = std::min(as<int32_t>(std::floor(maxY)),
+                          as<int32_t>(m_info.height) - 1);
+    if (x0 > x1 || y0 > y1) {
+        return false;
+    }
+
+    Lanes::F nearLanes = Lanes::set1(nearest);
+    int32_t  tile      = as<int32_t>(kTileSize);
+    for (int32_t tileY = y0 / tile; tileY <= y1 / tile; tileY += 1) {
+        for (int32_t tileX = x0 / tile; tileX <= x1 / tile; tileX += 1) {
+            if (nearest > m_tileMax[tileY * m_tilesX + tileX]) {
+                continue;
+            }
+
+            // Some of the tile is behind us. Check the pixels we cover.
+            // Testing a few too many, to stay lane aligned, only makes us
+            // more careful.
+            int32_t px0 = std::max(x0, tileX * tile) &
+                          ~as<int32_t>(Lanes::kWidth - 1);
+            int32_t px1 = std::min(x1, tileX * tile + tile - 1);
+            int32_t py0 = std::max(y0, tileY * tile);
+            int32_t py1 = std::min(y1, tileY * tile + tile - 1);
+            for (int32_t y = py0; y <= py1; y += 1) {
+                float const* pRow = &m_depth[y * m_info.width];
+                for (int32_t x = px0; x <= px1; x += Lanes::kWidth) {
+                    if (!Lanes::all(Lanes::greater(nearLanes, Lanes::load(&pRow[x])))) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+void SoftwareOcclusion::logStats() const
+{
+    if (m_frameCount == 0) {
+        return;
+    }
+
+    double frames = as<double>(m_frameCount);
+    Info("Software occlusion: %llu frames, %.3f ms rasterizing and %.3f ms "
+         "testing on average, %.3f ms at worst, %.1f%% of objects occluded",
+         as<unsigned long long>(m_frameCount),
+         m_totalRasterMs / frames,
+         m_totalTestMs   / frames,
+         m_worstMs,
+         100.0 * as<double>(m_occludedObjects) /
+             as<double>(std::max<uint64_t>(m_testedObjects, 1)));
+}
@@ -0,0 +1,250 @@
+#include "TransformHierarchy.hpp"
+#include "JobPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+#if defined(__SSE__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+    #define TRANSFORM_SSE 1
+    #include <xmmintrin.h>
+#endif
+
+// ==== Multiply ================================================================
+
+// out = a * b, column-major, like glm. 'out' can't be 'a' or 'b'.
+static inline void mulMat4(float* pOut, float const* pA, float const* pB)
+{
+    #if TRANSFORM_SSE
+    // Each column of the result is a's columns, weighted by a column of b.
+    __m128 a0 = _mm_loadu_ps(pA + 0);
+    __m128 a1 = _mm_loadu_ps(pA + 4);
+    __m128 a2 = _mm_loadu_ps(pA + 8);
+    __m128 a3 = _mm_loadu_ps(pA + 12);
+    for (uint32_t j = 0; j < 4; j += 1) {
+        float const* pCol = pB + 4 * j;
+        __m128 r = _mm_mul_ps(a0, _mm_set1_ps(pCol[0]));
+        r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(pCol[1])));
+        r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(pCol[2])));
+        r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(pCol[3])));
+        _mm_storeu_ps(pOut + 4 * j, r);
+    }
+    #else
+    for (uint32_t j = 0; j < 4; j += 1) {
+        for (uint32_t i = 0; i < 4; i += 1) {
+            pOut[4 * j + i] = pA[i]      * pB[4 * j + 0] +
+                              pA[4 + i]  * pB[4 * j + 1] +
+                              pA[8 + i]  * pB[4 * j + 2] +
+                              pA[12 + i] * pB[4 * j + 3];
+        }
+    }
+    #endif
+}
+
+static_assert(sizeof(Mat4) == 16 * sizeof(float), "Mat4 is 16 packed floats");
+
+// ==== TransformHierarchy ======================================================
+
+using Clock = std::chrono::steady_clock;
+
+TransformHierarchy::~TransformHierarchy()
+{
+    deInit();
+}
+
+void TransformHierarchy::init(TransformHierarchyInfo const& info)
+{
+    m_info = info;
+    m_info.grainSize = std::max(m_info.grainSize, 1u);
+}
+
+void TransformHierarchy::deInit()
+{
+    m_locals.clear();
+    m_worlds.clear();
+    m_parents.clear();
+    m_depths.clear();
+    m_dirty.clear();
+    m_ids.clear();
+    m_slots.clear();
+    m_levelStarts.clear();
+    m_unsorted      = false;
+    m_minDirtyDepth = UINT32_MAX;
+}
+
+TransformId TransformHierarchy::add(Mat4 const& local, TransformId parent)
+{
+    uint32_t parentSlot = kNoTransform;
+    uint32_t depth      = 0;
+    if (parent != kNoTransform) {
+        Assert(parent < m_slots.size());
+        parentSlot = m_slots[parent];
+        depth      = m_depths[parentSlot] + 1;
+    }
+
+    // Appending keeps the order, unless something deeper is already there.
+    if (!m_depths.empty() && depth < m_depths.back()) {
+        m_unsorted = true;
+    }
+
+    TransformId id   = as<TransformId>(m_slots.size());
+    uint32_t    slot = as<uint32_t>(m_locals.size());
+    m_locals.push_back(local);
+    m_worlds.push_back(local);
+    m_parents.push_back(parentSlot);
+    m_depths.push_back(depth);
+    m_dirty.push_back(1);
+    m_ids.push_back(id);
+    m_slots.push_back(slot);
+
+    // Levels are only kept up to date when appending in order. Otherwise
+    // sortByDepth() works them out.
+    if (!m_unsorted) {
+        if (m_levelStarts.empty()) {
+            m_levelStarts.push_back(0);
+        }
+        while (m_levelStarts.size() < depth + 2) {
+            m_levelStarts.push_back(slot);
+        }
+        m_levelStarts.back() = slot + 1;
+    }
+    m_minDirtyDepth = std::min(m_minDirtyDepth, depth);
+    return id;
+}
+
+void TransformHierarchy::setLocal(TransformId id, Mat4 const& local)
+{
+    uint32_t slot = m_slots[id];
+    m_locals[slot] = local;
+    m_dirty[slot]  = 1;
+    m_minDirtyDepth = std::min(m_minDirtyDepth, m_depths[slot]);
+}
+
+void TransformHierarchy::sortByDepth()
+{
+    uint32_t count      = as<uint32_t>(m_locals.size());
+    uint32_t levelCount = 0;
+    for (uint32_t depth : m_depths) {
+        levelCount = std::max(levelCount, depth + 1);
+    }
+
+    // Counting sort. It's stable, so each level keeps the order nodes were
+    // added in.
+    m_levelStarts.assign(levelCount + 1, 0);
+    for (uint32_t depth : m_depths) {
+        m_levelStarts[depth + 1] += 1;
+    }
+    for (uint32_t i = 0; i < levelCount; i += 1) {
+        m_levelStarts[i + 1] += m_levelStarts[i];
+    }
+
+    std::vector<uint32_t> newSlots(count);
+    std::vector<uint32_t> next(m_levelStarts.begin(), m_levelStarts.end() - 1);
+    for (uint32_t slot = 0; slot < count; slot += 1) {
+        newSlots[slot] = next[m_depths[slot]];
+        next[m_depths[slot]] += 1;
+    }
+
+    std::vector<Mat4>        locals(count);
+    std::vector<Mat4>        worlds(count);
+    std::vector<uint32_t>    parents(count);
+    std::vector<uint32_t>    depths(count);
+    std::vector<uint8_t>     dirty(count);
+    std::vector<TransformId> ids(count);
+    for (uint32_t slot = 0; slot < count; slot += 1) {
+        uint32_t to   = newSlots[slot];
+        uint32_t from = m_parents[slot];
+        locals[to]  = m_locals[slot];
+        worlds[to]  = m_worlds[slot];
+        parents[to] = from == kNoTransform ? kNoTransform : newSlots[from];
+        depths[to]  = m_depths[slot];
+        dirty[to]   = m_dirty[slot];
+        ids[to]     = m_ids[slot];
+        m_slots[m_ids[slot]] = to;
+    }
+    m_locals.swap(locals);
+    m_worlds.swap(worlds);
+    m_parents.swap(parents);
+    m_depths.swap(depths);
+    m_dirty.swap(dirty);
+    m_ids.swap(ids);
+
+    m_unsorted = false;
+}
+
+void TransformHierarchy::updateRange(uint32_t  begin,
+                                     uint32_t  end,
+                                     uint32_t* pUpdated)
+{
+    float*          pWorlds  = &m_worlds[0][0][0];
+    float const*    pLocals  = &m_locals[0][0][0];
+    uint32_t const* pParents = m_parents.data();
+    uint8_t*        pDirty   = m_dirty.data();
+
+    uint32_t updated = 0;
+    for (uint32_t slot = begin; slot < end; slot += 1) {
+        uint32_t parent = pParents[slot];
+        if (parent == kNoTransform) {
+            if (pDirty[slot] != 0) {
+                m_worlds[slot] = m_locals[slot];
+                updated += 1;
+            }
+            continue;
+        }
+
+        // A parent's flag is final by now, since its whole level is done.
+        if (pDirty[parent] != 0) {
+            pDirty[slot] = 1;
+        }
+        if (pDirty[slot] != 0) {
+            mulMat4(pWorlds + 16 * slot,
+                    pWorlds + 16 * parent,
+                    pLocals + 16 * slot);
+            updated += 1;
+        }
+    }
+    *pUpdated = updated;
+}
+
+void TransformHierarchy::update()
+{
+    m_stats = {};
+    if (m_minDirtyDepth == UINT32_MAX) {
+        return;
+    }
+
+    Clock::time_point start = Clock::now();
+    if (m_unsorted) {
+        sortByDepth();
+    }
+
+    uint32_t levelCount = as<uint32_t>(m_levelStarts.size()) - 1;
+    std::atomic<uint32_t> updatedNodes = { 0 };
+    for (uint32_t level = m_minDirtyDepth; level < levelCount; level += 1) {
+        uint32_t first = m_levelStarts[level];
+        uint32_t count = m_levelStarts[level + 1] - first;
+
+        auto updateChunk = [this, first, &updatedNodes](uint32_t begin,
+                                                        uint32_t end) {
+            uint32_t updated = 0;
+            updateRange(first + begin, first + end, &updated);
+            updatedNodes.fetch_add(updated, std::memory_order_relaxed);
+        };
+        if (m_info.pJobs != nullptr && count > m_info.grainSize) {
+            m_info.pJobs->parallelFor(count, m_info.grainSize, updateChunk);
+        } else {
+            updateChunk(0, count);
+        }
+    }
+
+    // Nothing above the shallowest dirty level was marked.
+    uint32_t firstDirty = m_levelStarts[m_minDirtyDepth];
+    std::fill(m_dirty.begin() + firstDirty, m_dirty.end(), 0);
+    m_minDirtyDepth = UINT32_MAX;
+
+    m_stats.updatedNodes = updatedNodes.load();
+    m_stats.levels       = levelCount;
+    m_stats.updateMs     =
+        std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
@@ -0,0 +1,81 @@
+#include "UniformRing.hpp"
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+VkDeviceSize UniformRing::frameSize(VkDeviceSize bytesPerFrame,
+                                    VkDeviceSize alignment)
+{
+    return alignUp(bytesPerFrame, alignment);
+}
+
+void UniformRing::init(UniformRingInfo const& info)
+{
+    Assert(info.pMapped    != nullptr);
+    Assert(info.frameCount != 0);
+    Assert(info.alignment  != 0);
+    AssertMsg(info.bytesPerFrame % info.alignment == 0,
+              "Use UniformRing::frameSize() to size each frame");
+
+    m_info = info;
+    beginFrame(0);
+}
+
+void UniformRing::deInit()
+{
+    m_info = {};
+    m_frameBegin = 0;
+    m_frameEnd   = 0;
+    m_head       = 0;
+    m_flushed    = 0;
+}
+
+void UniformRing::beginFrame(uint32_t frameIndex)
+{
+    Assert(frameIndex < m_info.frameCount);
+
+    m_frameBegin = frameIndex * m_info.bytesPerFrame;
+    m_frameEnd   = m_frameBegin + m_info.bytesPerFrame;
+    m_head       = m_frameBegin;
+    m_flushed    = m_frameBegin;
+}
+
+UniformAllocation UniformRing::allocate(VkDeviceSize size)
+{
+    UniformAllocation allocation;
+
+    VkDeviceSize offset = m_head;
+    VkDeviceSize end    = offset + size;
+    if (end > m_frameEnd) {
+        Bug("Uniform ring is full (%llu of %llu bytes used this frame)",
+            as<unsigned long long>(usedBytes()),
+            as<unsigned long long>(m_info.bytesPerFrame));
+        return allocation;
+    }
+    m_head = alignUp(end, m_info.alignment);
+
+    allocation.pData  = ptr_as<uint8_t>(m_info.pMapped) + offset;
+    allocation.offset = as<uint32_t>(offset);
+    return allocation;
+}
+
+void UniformRing::flush()
+{
+    if (m_info.coherent || m_head == m_flushed) {
+        return;
+    }
+
+    // 'alignment' includes nonCoherentAtomSize, so both ends are on atoms.
+    VkMappedMemoryRange range = {};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = m_info.memory;
+    range.offset = m_flushed;
+    range.size   = m_head - m_flushed;
+
+    VkResult result = vkFlushMappedMemoryRanges(m_info.device, 1, &range);
+    AssertVk(result);
+
+    m_flushed = m_head;
+}
@@ -1,6 +1,22 @@
 #include <00-Prelude.hpp>
 #include <fstream>
 
+#if OS_MACOS
+    #include <mach-o/dyld.h>
+#endif
+
+uint64_t hashBytes(void const* pBytes, size_t size, uint64_t seed)
+{
+    auto const* pByte = ptr_as<const uint8_t>(pBytes);
+
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; i += 1) {
+        hash ^= pByte[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
 std::vector<uint8_t> loadBytesFrom(const char *const filename)
 {
     // Open the file for binary reading, starting at the end.
@@ -21,3 +37,29 @@ std::vector<uint8_t> loadBytesFrom(const char *const filename)
 
     return bytes;
 }
+
+std::string executableDir()
+{
+    char path[4096] = {};
+#if OS_WINDOWS
+    DWORD length = GetModuleFileNameA(nullptr, path, sizeof(path));
+    if (length == 0 || length == sizeof(path)) {
+        return "";
+    }
+#elif OS_MACOS
+    uint32_t size = sizeof(path);
+    if (_NSGetExecutablePath(path, &size) != 0) {
+        return "";
+    }
+#else
+    ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (length <= 0) {
+        return "";
+    }
+    path[length] = '\0';
+#endif
+
+    std::string dir(path);
+    size_t      slash = dir.find_last_of("/\\");
+    return slash != std::string::npos ? dir.substr(0, slash + 1) : "";
+}
@@ -0,0 +1,56 @@
+#include "VkMemory.hpp"
+
+uint32_t findMemoryType(VkPhysicalDeviceMemoryProperties const& properties,
+                        uint32_t                                memoryTypeBits,
+                        VkMemoryPropertyFlags                   flags)
+{
+    for (uint32_t i = 0; i < properties.memoryTypeCount; i += 1) {
+        // Use the first memory type that works.
+        if ((memoryTypeBits & (1u << i)) != 0 &&
+            (properties.memoryTypes[i].propertyFlags & flags) == flags) {
+            return i;
+        }
+    }
+    return VK_MAX_MEMORY_TYPES;
+}
+
+VkResult createBuffer(VkDevice                                device,
+                      VkAllocationCallbacks const*            pAlloc,
+                      VkPhysicalDeviceMemoryProperties const& properties,
+                      VkDeviceSize                            size,
+                      VkBufferUsageFlags                      usage,
+                      VkMemoryPropertyFlags                   flags,
+                      VkBuffer*                               pBuffer,
+                      VkDeviceMemory*                         pMemory)
+{
+    VkResult result;
+
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size        = size;
+    bufferInfo.usage       = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    result = vkCreateBuffer(device, &bufferInfo, pAlloc, pBuffer);
+    AssertVk(result);
+
+    VkMemoryRequirements memReq = {};
+    vkGetBufferMemoryRequirements(device, *pBuffer, &memReq);
+
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize  = memReq.size;
+    allocInfo.memoryTypeIndex = findMemoryType(properties,
+                                               memReq.memoryTypeBits,
+                                               flags);
+    AssertMsg(allocInfo.memoryTypeIndex != VK_MAX_MEMORY_TYPES,
+              "Couldn't find a valid memory type index");
+
+    result = vkAllocateMemory(device, &allocInfo, pAlloc, pMemory);
+    AssertVk(result);
+
+    result = vkBindBufferMemory(device, *pBuffer, *pMemory, 0);
+    AssertVk(result);
+
+    return result;
+}
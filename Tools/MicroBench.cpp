@@ -0,0 +1,647 @@
+#include "00-Prelude.hpp"
+
+#include "AssetArchive.hpp"
+#include "FileView.hpp"
+#include "JobPool.hpp"
+#include "Mesh.hpp"
+#include "RadixSort.hpp"
+#include "Scene.hpp"
+#include "TransformHierarchy.hpp"
+
+#include "tiny_obj_loader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include <cerrno>
+#include <fcntl.h>
+#if OS_WINDOWS
+    #include <io.h>
+#endif
+#if OS_LINUX
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+#endif
+
+// Times the CPU paths Demo runs at startup, on every log line, and on every
+// frame, so changes to them can be measured instead of guessed at.
+//
+// Usage:
+//      MicroBench [--filter=<substring>] [--warmup=<reps>] [--reps=<reps>]
+//                 [--min-ms=<ms per rep>] [--perf]
+//
+// Each benchmark is calibrated to run enough iterations that one repetition
+// takes at least --min-ms. After the warm-up repetitions, each measured one
+// gives a time per iteration, and we report their spread. --perf also counts
+// cycles, instructions, and misses with perf_event_open (Linux only).
+static void printUsage(const char* pArgv0)
+{
+    printf("Usage: %s [--filter=<substring>] [--warmup=<reps>] [--reps=<reps>]"
+           " [--min-ms=<ms>] [--perf]\n",
+           pArgv0);
+}
+
+struct BenchOptions
+{
+    const char* pFilter     = nullptr;
+    uint32_t    warmupReps  = 5;
+    uint32_t    reps        = 25;
+    double      minRepMs    = 10.0;
+    bool        perf        = false;
+};
+
+// Anything a benchmark returns ends up here, so the compiler can't throw the
+// work away.
+static volatile uint64_t g_sink = 0;
+
+// ==== Perf Counters ===========================================================
+
+enum PerfCounter : uint32_t
+{
+    kPerfCycles,
+    kPerfInstructions,
+    kPerfCacheMisses,
+    kPerfBranchMisses,
+    kPerfCounterCount,
+};
+
+// One group of hardware counters, for this thread, in user space only. Most
+// kernels let anyone count their own process that way.
+class PerfCounters
+{
+    public:
+        PerfCounters() = default;
+        ~PerfCounters();
+
+        PerfCounters(PerfCounters const&)            = delete;
+        PerfCounters& operator=(PerfCounters const&) = delete;
+
+        // Returns false if the counters aren't available.
+        bool init();
+        bool valid() const { return m_fds[0] >= 0; }
+
+        void start();
+        // Counts since start().
+        void stop(uint64_t (&counts)[kPerfCounterCount]);
+
+    private:
+        void closeAll();
+
+        int m_fds[kPerfCounterCount] = { -1, -1, -1, -1 };
+};
+
+#if OS_LINUX
+
+PerfCounters::~PerfCounters()
+{
+    closeAll();
+}
+
+void PerfCounters::closeAll()
+{
+    for (int& fd : m_fds) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        fd = -1;
+    }
+}
+
+bool PerfCounters::init()
+{
+    const uint64_t configs[kPerfCounterCount] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES,
+    };
+
+    for (uint32_t i = 0; i < kPerfCounterCount; i += 1) {
+        perf_event_attr attr = {};
+        attr.type           = PERF_TYPE_HARDWARE;
+        attr.size           = sizeof(attr);
+        attr.config         = configs[i];
+        attr.disabled       = (i == 0);    // The leader starts the group
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        attr.read_format    = PERF_FORMAT_GROUP;
+
+        int leader = (i == 0) ? -1 : m_fds[0];
+        m_fds[i] = as<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+        if (m_fds[i] < 0) {
+            Info("perf_event_open failed (%s), so there are no counters",
+                 strerror(errno));
+            closeAll();
+            return false;
+        }
+    }
+    return true;
+}
+
+void PerfCounters::start()
+{
+    ioctl(m_fds[0], PERF_EVENT_IOC_RESET,  PERF_IOC_FLAG_GROUP);
+    ioctl(m_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void PerfCounters::stop(uint64_t (&counts)[kPerfCounterCount])
+{
+    ioctl(m_fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    // { count of counters, then each value }
+    uint64_t values[1 + kPerfCounterCount] = {};
+    if (read(m_fds[0], values, sizeof(values)) != sizeof(values)) {
+        memset(counts, 0, sizeof(counts));
+        return;
+    }
+    memcpy(counts, &values[1], sizeof(counts));
+}
+
+#else
+
+PerfCounters::~PerfCounters() = default;
+
+void PerfCounters::closeAll() {}
+
+bool PerfCounters::init()
+{
+    Info("Perf counters are only available on Linux");
+    return false;
+}
+
+void PerfCounters::start() {}
+
+void PerfCounters::stop(uint64_t (&counts)[kPerfCounterCount])
+{
+    memset(counts, 0, sizeof(counts));
+}
+
+#endif
+
+// ==== Harness =================================================================
+
+// Logging goes to stdout, which would drown the results, and make the terminal
+// part of what's timed. Benchmarks run with it pointed at the null device.
+class QuietStdout
+{
+    public:
+        QuietStdout()
+        {
+            fflush(stdout);
+            #if OS_WINDOWS
+            m_saved = _dup(_fileno(stdout));
+            int null = _open("NUL", _O_WRONLY);
+            _dup2(null, _fileno(stdout));
+            _close(null);
+            #else
+            m_saved = dup(fileno(stdout));
+            int null = open("/dev/null", O_WRONLY);
+            dup2(null, fileno(stdout));
+            close(null);
+            #endif
+        }
+
+        ~QuietStdout()
+        {
+            fflush(stdout);
+            #if OS_WINDOWS
+            _dup2(m_saved, _fileno(stdout));
+            _close(m_saved);
+            #else
+            dup2(m_saved, fileno(stdout));
+            close(m_saved);
+            #endif
+        }
+
+        QuietStdout(QuietStdout const&)            = delete;
+        QuietStdout& operator=(QuietStdout const&) = delete;
+
+    private:
+        int m_saved = -1;
+};
+
+struct BenchResult
+{
+    uint64_t iterations = 0;    // Per repetition
+    double   minNs      = 0.0;  // Per iteration, over repetitions
+    double   medianNs   = 0.0;
+    double   meanNs     = 0.0;
+    double   stddevNs   = 0.0;
+    bool     counted    = false;
+    double   counters[kPerfCounterCount] = {};  // Per iteration
+};
+
+static void printHeader(BenchOptions const& options)
+{
+    printf("%-28s %10s %12s %12s %12s %7s",
+           "benchmark", "iters", "min", "median", "mean", "stddev");
+    if (options.perf) {
+        printf(" %12s %12s %6s %10s %10s",
+               "cycles", "instrs", "IPC", "cache-miss", "branch-miss");
+    }
+    printf("\n");
+}
+
+static void printResult(const char* pName, BenchResult const& result)
+{
+    auto printNs = [](double ns) {
+        if (ns >= 1e6) {
+            printf(" %9.3f ms", ns / 1e6);
+        } else if (ns >= 1e3) {
+            printf(" %9.3f us", ns / 1e3);
+        } else {
+            printf(" %9.1f ns", ns);
+        }
+    };
+
+    printf("%-28s %10llu", pName, as<unsigned long long>(result.iterations));
+    printNs(result.minNs);
+    printNs(result.medianNs);
+    printNs(result.meanNs);
+    printf(" %6.1f%%", 100.0 * result.stddevNs / result.meanNs);
+    if (result.counted) {
+        double const* pCounts = result.counters;
+        printf(" %12.0f %12.0f %6.2f %10.1f %10.1f",
+               pCounts[kPerfCycles],
+               pCounts[kPerfInstructions],
+               pCounts[kPerfInstructions] / std::max(pCounts[kPerfCycles], 1.0),
+               pCounts[kPerfCacheMisses],
+               pCounts[kPerfBranchMisses]);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+// Runs 'fn' (which returns something to sink) and prints how long it took.
+template<typename Fn>
+static void runBench(const char*         pName,
+                     BenchOptions const& options,
+                     PerfCounters*       pCounters,
+                     Fn&&                fn)
+{
+    if (options.pFilter != nullptr && strstr(pName, options.pFilter) == nullptr) {
+        return;
+    }
+
+    using Clock = std::chrono::steady_clock;
+    auto runRep = [&fn](uint64_t iterations) {
+        auto start = Clock::now();
+        for (uint64_t i = 0; i < iterations; i += 1) {
+            g_sink = g_sink + fn();
+        }
+        return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    };
+
+    BenchResult         result;
+    std::vector<double> samples;    // ns per iteration, for each repetition
+    {
+        QuietStdout quiet;
+
+        // The first call pays for cold caches, and page faults. Then grow the
+        // iteration count until a repetition is long enough for the clock,
+        // and scheduling noise, to not matter.
+        runRep(1);
+        uint64_t iterations = 1;
+        double   minRepNs   = options.minRepMs * 1e6;
+        for (;;) {
+            double ns = runRep(iterations);
+            if (ns >= minRepNs || iterations >= (1ull << 32)) {
+                break;
+            }
+            double scale = (ns > 0.0) ? 1.2 * minRepNs / ns : 10.0;
+            iterations = as<uint64_t>(std::ceil(iterations * std::min(scale, 10.0)));
+        }
+        result.iterations = iterations;
+
+        for (uint32_t i = 0; i < options.warmupReps; i += 1) {
+            runRep(iterations);
+        }
+
+        uint64_t totals[kPerfCounterCount] = {};
+        for (uint32_t i = 0; i < options.reps; i += 1) {
+            bool count = (pCounters != nullptr && pCounters->valid());
+            if (count) {
+                pCounters->start();
+            }
+            double ns = runRep(iterations);
+            if (count) {
+                uint64_t counts[kPerfCounterCount] = {};
+                pCounters->stop(counts);
+                for (uint32_t j = 0; j < kPerfCounterCount; j += 1) {
+                    totals[j] += counts[j];
+                }
+                result.counted = true;
+            }
+            samples.push_back(ns / as<double>(iterations));
+        }
+
+        double totalIterations = as<double>(iterations) * options.reps;
+        for (uint32_t j = 0; j < kPerfCounterCount; j += 1) {
+            result.counters[j] = as<double>(totals[j]) / totalIterations;
+        }
+    }
+
+    std::sort(samples.begin(), samples.end());
+    double sum = 0.0;
+    for (double sample : samples) {
+        sum += sample;
+    }
+    result.minNs    = samples.front();
+    result.medianNs = samples[samples.size() / 2];
+    result.meanNs   = sum / samples.size();
+
+    double variance = 0.0;
+    for (double sample : samples) {
+        variance += (sample - result.meanNs) * (sample - result.meanNs);
+    }
+    result.stddevNs = std::sqrt(variance / std::max(samples.size() - 1, size_t(1)));
+
+    printResult(pName, result);
+}
+
+// ==== Benchmarks ==============================================================
+
+// Where Demo finds cornell_box, with or without the archive.
+static std::vector<uint8_t> loadModelBytes(AssetArchive const& assets,
+                                           const char*         pName)
+{
+    if (assets.isOpen()) {
+        AssetBlob blob = assets.get((std::string("models/") + pName).c_str());
+        if (blob.valid()) {
+            return std::vector<uint8_t>(blob.pData, blob.pData + blob.size);
+        }
+    }
+
+    std::string filename = std::string("../External/tinyobjloader/models/") + pName;
+    FileView    view;
+    if (!view.open(filename.c_str())) {
+        return {};
+    }
+    return std::vector<uint8_t>(view.begin(), view.end());
+}
+
+static bool writeTempFile(const char* pFilename, size_t size)
+{
+    FILE* pFile = fopen(pFilename, "wb");
+    if (pFile == nullptr) {
+        return false;
+    }
+    std::vector<uint8_t> bytes(size);
+    for (size_t i = 0; i < size; i += 1) {
+        bytes[i] = as<uint8_t>(i * 31);
+    }
+    bool written = fwrite(bytes.data(), 1, size, pFile) == size;
+    fclose(pFile);
+    return written;
+}
+
+static void benchObj(BenchOptions const& options, PerfCounters* pCounters)
+{
+    AssetArchive assets;
+    if (!assets.open("assets.pak")) {
+        Info("No asset archive, loading loose files");
+    }
+
+    std::vector<uint8_t> obj = loadModelBytes(assets, "cornell_box.obj");
+    std::vector<uint8_t> mtl = loadModelBytes(assets, "cornell_box.mtl");
+    if (obj.empty()) {
+        Bug("Unable to find cornell_box.obj, skipping the model benchmarks");
+        return;
+    }
+
+    // Just the parse, out of memory.
+    runBench("obj/LoadObj", options, pCounters, [&obj, &mtl]() -> uint64_t {
+        tinyobj::attrib_t                attrib;
+        std::vector<tinyobj::shape_t>    shapes;
+        std::vector<tinyobj::material_t> materials;
+        std::string                      errMsg;
+
+        ByteStreamBuf                 objBuffer(obj.data(), obj.size());
+        ByteStreamBuf                 mtlBuffer(mtl.data(), mtl.size());
+        std::istream                  objStream(&objBuffer);
+        std::istream                  mtlStream(&mtlBuffer);
+        tinyobj::MaterialStreamReader mtlReader(mtlStream);
+
+        tinyobj::LoadObj(&attrib, &shapes, &materials, &errMsg,
+                         &objStream, &mtlReader);
+        return attrib.vertices.size();
+    });
+
+    // Everything Demo does with it: the parse, the conversion to our
+    // vertices, and building the objects.
+    AssetArchive const* pAssets = assets.isOpen() ? &assets : nullptr;
+    runBench("obj/loadObjMesh", options, pCounters, [pAssets]() -> uint64_t {
+        MeshData mesh;
+        loadObjMesh(pAssets, "cornell_box.obj", &mesh);
+        return mesh.vertices.size();
+    });
+}
+
+static void benchFiles(BenchOptions const& options, PerfCounters* pCounters)
+{
+    const char* pFilename = "microbench.tmp";
+
+    const size_t sizes[]  = { 64 * 1024, 4 * 1024 * 1024 };
+    const char*  pNames[] = { "file/loadBytesFrom 64KiB", "file/loadBytesFrom 4MiB" };
+    const char*  pViews[] = { "file/FileView 64KiB",      "file/FileView 4MiB"      };
+    for (uint32_t i = 0; i < array_size(sizes); i += 1) {
+        if (!writeTempFile(pFilename, sizes[i])) {
+            Bug("Unable to write \"%s\", skipping the file benchmarks", pFilename);
+            return;
+        }
+
+        runBench(pNames[i], options, pCounters, [pFilename]() -> uint64_t {
+            std::vector<uint8_t> bytes = loadBytesFrom(pFilename);
+            return bytes[bytes.size() / 2];
+        });
+
+        // For comparison. This is what loadBytesFrom()'s callers could use.
+        runBench(pViews[i], options, pCounters, [pFilename]() -> uint64_t {
+            FileView view;
+            if (!view.open(pFilename)) {
+                return 0;
+            }
+            return view.data()[view.size() / 2];
+        });
+    }
+
+    remove(pFilename);
+}
+
+static void benchLogging(BenchOptions const& options, PerfCounters* pCounters)
+{
+    uint32_t line = 0;
+    runBench("log/single line", options, pCounters, [&line]() -> uint64_t {
+        Info("Loaded %u vertices from \"%s\"", line, "cornell_box.obj");
+        return line += 1;
+    });
+
+    // Each extra line is re-indented, through a second buffer.
+    runBench("log/multi-line", options, pCounters, [&line]() -> uint64_t {
+        Info("Frame %u:\n"
+             "    cpu:    %6.3f ms\n"
+             "    gpu:    %6.3f ms\n"
+             "    draws:  %u\n"
+             "    culled: %u\n",
+             line, 1.25, 2.5, 1000u, 250u);
+        return line += 1;
+    });
+
+    runBench("log/with location", options, pCounters, [&line]() -> uint64_t {
+        Debug("Loaded %u vertices from \"%s\"", line, "cornell_box.obj");
+        return line += 1;
+    });
+}
+
+static void benchToStr(BenchOptions const& options, PerfCounters* pCounters)
+{
+    // Every other feature, so both strings get used.
+    VkPhysicalDeviceFeatures features = {};
+    VkBool32* pFeatures = ptr_as<VkBool32>(&features);
+    for (size_t i = 0; i < sizeof(features) / sizeof(VkBool32); i += 1) {
+        pFeatures[i] = as<VkBool32>(i % 2);
+    }
+
+    runBench("ToStr(features)", options, pCounters, [&features]() -> uint64_t {
+        return ToStr(features).size();
+    });
+}
+
+// A wide, shallow-ish tree: a few thousand roots, each node a child of any
+// node before it.
+static void buildHierarchy(TransformHierarchy* pHierarchy, uint32_t count)
+{
+    uint64_t state = 1;
+    for (uint32_t i = 0; i < count; i += 1) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        TransformId parent = (i < 4096) ? kNoTransform
+                                        : as<TransformId>((state >> 33) % i);
+        Mat4 local = glm::translate(Mat4(1.f), Vec3(1.f, 0.f, 0.f)) *
+                     glm::rotate(Mat4(1.f), 0.01f, Vec3(0.f, 1.f, 0.f));
+        pHierarchy->add(local, parent);
+    }
+}
+
+static void benchTransforms(BenchOptions const& options, PerfCounters* pCounters)
+{
+    constexpr uint32_t kNodes = 100 * 1000;
+
+    JobPool jobs;
+    jobs.init();
+
+    const char* pNames[] = {
+        "transforms/100k all dirty",
+        "transforms/100k all dirty, jobs",
+        "transforms/100k 1% dirty, jobs",
+    };
+    for (uint32_t i = 0; i < array_size(pNames); i += 1) {
+        TransformHierarchyInfo info;
+        info.pJobs = (i == 0) ? nullptr : &jobs;
+
+        TransformHierarchy hierarchy;
+        hierarchy.init(info);
+        buildHierarchy(&hierarchy, kNodes);
+        hierarchy.update();
+
+        uint32_t stride = (i == 2) ? 100 : 1;
+        runBench(pNames[i], options, pCounters, [&hierarchy, stride]() -> uint64_t {
+            for (TransformId id = 0; id < kNodes; id += stride) {
+                hierarchy.setLocal(id, hierarchy.local(id));
+            }
+            hierarchy.update();
+            return hierarchy.stats().updatedNodes;
+        });
+    }
+}
+
+// Shaped like DrawList's keys: two passes, a few pipelines, and a few dozen
+// materials, then depth and mesh.
+static void benchSort(BenchOptions const& options, PerfCounters* pCounters)
+{
+    constexpr uint32_t kKeys = 100 * 1000;
+
+    std::vector<uint64_t> keys(kKeys);
+    uint64_t state = 1;
+    for (uint64_t& key : keys) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        uint64_t bits = state >> 16;
+        key = ((bits & 0x1)         << 60) |
+              (((bits >> 1) & 0x3)  << 48) |
+              (((bits >> 3) & 0x3F) << 32) |
+              ((bits >> 9) & 0xFFFFFFFF);
+    }
+
+    JobPool jobs;
+    jobs.init();
+
+    std::vector<uint64_t> sortedKeys(kKeys);
+    std::vector<uint32_t> values(kKeys);
+    RadixSortScratch      scratch;
+
+    const char* pNames[] = {
+        "sort/100k draw keys, std::sort",
+        "sort/100k draw keys, radix",
+        "sort/100k draw keys, radix, jobs",
+    };
+    for (uint32_t i = 0; i < array_size(pNames); i += 1) {
+        runBench(pNames[i], options, pCounters, [&, i]() -> uint64_t {
+            sortedKeys = keys;
+            for (uint32_t j = 0; j < kKeys; j += 1) {
+                values[j] = j;
+            }
+            if (i == 0) {
+                std::sort(sortedKeys.begin(), sortedKeys.end());
+            } else {
+                radixSort(sortedKeys.data(), values.data(), kKeys, &scratch,
+                          (i == 2) ? &jobs : nullptr);
+            }
+            return sortedKeys[kKeys / 2];
+        });
+    }
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    for (int i = 1; i < argc; i += 1) {
+        const char* pArg = argv[i];
+
+        if (strncmp(pArg, "--filter=", 9) == 0) {
+            options.pFilter = pArg + 9;
+        } else if (strncmp(pArg, "--warmup=", 9) == 0) {
+            options.warmupReps = as<uint32_t>(strtoul(pArg + 9, nullptr, 10));
+        } else if (strncmp(pArg, "--reps=", 7) == 0) {
+            options.reps = std::max(as<uint32_t>(strtoul(pArg + 7, nullptr, 10)), 1u);
+        } else if (strncmp(pArg, "--min-ms=", 9) == 0) {
+            options.minRepMs = strtod(pArg + 9, nullptr);
+        } else if (strcmp(pArg, "--perf") == 0) {
+            options.perf = true;
+        } else {
+            Bug("Unknown argument '%s'", pArg);
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    PerfCounters counters;
+    if (options.perf) {
+        options.perf = counters.init();
+    }
+    PerfCounters* pCounters = options.perf ? &counters : nullptr;
+
+    printHeader(options);
+    benchObj(options, pCounters);
+    benchFiles(options, pCounters);
+    benchLogging(options, pCounters);
+    benchToStr(options, pCounters);
+    benchTransforms(options, pCounters);
+    benchSort(options, pCounters);
+
+    return 0;
+}
@@ -0,0 +1,65 @@
+#include "00-Prelude.hpp"
+
+#include "AssetArchive.hpp"
+#include "FileView.hpp"
+
+#include <cstring>
+
+// Bundles cooked assets into one archive for the Demo to load at startup.
+//
+// Usage:
+//      PackAssets <output> [--compress | --no-compress] <name>=<path> ...
+//
+// '--compress' and '--no-compress' apply to every entry after them.
+// Entries are off by default.
+static void printUsage(const char* pArgv0)
+{
+    printf("Usage: %s <output> [--compress | --no-compress] <name>=<path> ...\n",
+           pArgv0);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    const char*        pOutput  = argv[1];
+    bool               compress = false;
+    AssetArchiveWriter writer;
+
+    for (int i = 2; i < argc; i += 1) {
+        const char* pArg = argv[i];
+
+        if (strcmp(pArg, "--compress") == 0) {
+            compress = true;
+            continue;
+        }
+        if (strcmp(pArg, "--no-compress") == 0) {
+            compress = false;
+            continue;
+        }
+
+        const char* pEquals = strchr(pArg, '=');
+        if (pEquals == nullptr || pEquals == pArg) {
+            Bug("Expected <name>=<path>, got '%s'", pArg);
+            printUsage(argv[0]);
+            return 1;
+        }
+        std::string name(pArg, pEquals);
+        const char* pPath = pEquals + 1;
+
+        FileView file;
+        if (!file.open(pPath, FileAccess::Sequential)) {
+            Bug("Unable to read '%s' for '%s'", pPath, name.c_str());
+            return 1;
+        }
+        Verbose("Packing %s <- %s", name.c_str(), pPath);
+        writer.add(std::move(name),
+                   std::vector<uint8_t>(file.begin(), file.end()),
+                   compress);
+    }
+
+    return writer.write(pOutput) ? 0 : 1;
+}